@@ -0,0 +1,215 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_arena.c
+//  Description    : This file contains the memory arena the block cache (and
+//                   anything else needing aligned I/O buffers) allocates
+//                   its slabs from.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Include Files
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_arena.h>
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : initSGArena
+// Description  : Map a zero filled arena.  Memory is only committed as it
+//                is touched, so an arena can be sized for the most it may
+//                ever need.  With hugePages the mapping is
+//                rounded to whole huge pages and taken from the huge page
+//                pool, falling back to normal pages (with a transparent huge
+//                page hint) when the pool is empty.
+//
+// Inputs       : arena - the arena to set up
+//                size - bytes needed
+//                hugePages - try to back the arena with huge pages
+// Outputs      : 0 if successful, -1 if failure
+
+int initSGArena( SG_Arena *arena, size_t size, bool hugePages ) {
+    void * base = MAP_FAILED;
+
+    memset( arena, 0, sizeof(SG_Arena) );
+    if ( size == 0 ){
+        logMessage( LOG_ERROR_LEVEL, "initSGArena: invalid arena size." );
+        return( -1 );
+    }
+
+#ifdef MAP_HUGETLB
+    if ( hugePages ){
+        size_t hsize = (size + SG_ARENA_HUGE_PAGE_SIZE-1) & ~((size_t)SG_ARENA_HUGE_PAGE_SIZE-1);
+        base = mmap( NULL, hsize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_HUGETLB, -1, 0 );
+        if ( base != MAP_FAILED ){
+            arena->size = hsize;
+            arena->huge = true;
+        }
+    }
+#endif
+    if ( base == MAP_FAILED ){
+        size = (size + SG_ARENA_PAGE_SIZE-1) & ~((size_t)SG_ARENA_PAGE_SIZE-1);
+        base = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0 );
+        if ( base == MAP_FAILED ){
+            logMessage( LOG_ERROR_LEVEL, "initSGArena: unable to map [%lu] bytes.", size );
+            return( -1 );
+        }
+        arena->size = size;
+#ifdef MADV_HUGEPAGE
+        if ( hugePages ){
+            madvise( base, size, MADV_HUGEPAGE );
+        }
+#endif
+    }
+    arena->base = base;
+    arena->used = 0;
+
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocSGArena
+// Description  : Carve an aligned, zero filled block out of the arena
+//
+// Inputs       : arena - the arena
+//                size - bytes needed
+//                align - alignment, a power of two up to SG_ARENA_PAGE_SIZE
+// Outputs      : the block or NULL if the arena is full
+
+void *allocSGArena( SG_Arena *arena, size_t size, size_t align ) {
+    if ( arena->base == NULL || align == 0 || (align & (align-1)) || align > SG_ARENA_PAGE_SIZE ){
+        logMessage( LOG_ERROR_LEVEL, "allocSGArena: invalid arena or alignment [%lu].", align );
+        return( NULL );
+    }
+
+    size_t start = (arena->used + align-1) & ~(align-1);
+    if ( start > arena->size || size > arena->size-start ){
+        return( NULL );     // full, the caller decides whether that is an error
+    }
+    arena->used = start+size;
+    return( arena->base + start );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgArenaSpan
+// Description  : Worst case arena bytes taken by one allocation, including
+//                the padding its alignment can need
+//
+// Inputs       : size - bytes needed
+//                align - alignment of the allocation
+// Outputs      : bytes to reserve for it
+
+size_t sgArenaSpan( size_t size, size_t align ) {
+    return( size + align-1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseSGArena
+// Description  : Hand the whole pages of an allocation back to the system
+//                while keeping it mapped; they read as zero when next used
+//
+// Inputs       : arena - the arena
+//                ptr - start of the range
+//                size - bytes in the range
+// Outputs      : 0 if successful, -1 if failure
+
+int releaseSGArena( SG_Arena *arena, void *ptr, size_t size ) {
+    size_t page = arena->huge ? SG_ARENA_HUGE_PAGE_SIZE : SG_ARENA_PAGE_SIZE;
+    uintptr_t start = ((uintptr_t)ptr + page-1) & ~(uintptr_t)(page-1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(page-1);
+
+    if ( (char *)ptr < arena->base || (char *)ptr + size > arena->base + arena->size ){
+        logMessage( LOG_ERROR_LEVEL, "releaseSGArena: range outside the arena." );
+        return( -1 );
+    }
+    if ( end > start && madvise((void *)start, end-start, MADV_DONTNEED) ){
+        logMessage( LOG_ERROR_LEVEL, "releaseSGArena: unable to release [%lu] bytes.", end-start );
+        return( -1 );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSGArena
+// Description  : Unmap the arena, releasing everything allocated from it
+//
+// Inputs       : arena - the arena
+// Outputs      : 0 if successful, -1 if failure
+
+int closeSGArena( SG_Arena *arena ) {
+    if ( arena->base == NULL ){
+        return( 0 );
+    }
+    if ( munmap(arena->base, arena->size) ){
+        logMessage( LOG_ERROR_LEVEL, "closeSGArena: unable to unmap arena." );
+        return( -1 );
+    }
+    memset( arena, 0, sizeof(SG_Arena) );
+
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgArenaUnitTest
+// Description  : Check alignment, zero fill, release and the full arena case
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int sgArenaUnitTest( void ) {
+    SG_Arena arena;
+    char * a, * b, * c;
+
+    if ( initSGArena(&arena, 3*SG_ARENA_PAGE_SIZE, false) ){
+        return( -1 );
+    }
+    a = allocSGArena( &arena, 100, 64 );
+    b = allocSGArena( &arena, SG_ARENA_PAGE_SIZE, SG_ARENA_PAGE_SIZE );
+    c = allocSGArena( &arena, 1, 8 );
+    if ( a == NULL || b == NULL || c == NULL || ((uintptr_t)a & 63) || ((uintptr_t)b & (SG_ARENA_PAGE_SIZE-1)) ||
+         a[99] != 0 || b[SG_ARENA_PAGE_SIZE-1] != 0 || b < a+100 || c < b+SG_ARENA_PAGE_SIZE ){
+        logMessage( LOG_ERROR_LEVEL, "sgArenaUnitTest: misplaced or dirty allocation." );
+        closeSGArena( &arena );
+        return( -1 );
+    }
+    memset( b, 1, SG_ARENA_PAGE_SIZE );
+    if ( releaseSGArena(&arena, b, SG_ARENA_PAGE_SIZE) || b[0] != 0 ){
+        logMessage( LOG_ERROR_LEVEL, "sgArenaUnitTest: released page not cleared." );
+        closeSGArena( &arena );
+        return( -1 );
+    }
+    if ( allocSGArena(&arena, 2*SG_ARENA_PAGE_SIZE, 8) != NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgArenaUnitTest: allocation past the end of the arena." );
+        closeSGArena( &arena );
+        return( -1 );
+    }
+    if ( closeSGArena(&arena) ){
+        return( -1 );
+    }
+
+    // Huge pages are optional, the arena has to work either way
+    if ( initSGArena(&arena, 1, true) || (a = allocSGArena(&arena, SG_ARENA_PAGE_SIZE, 64)) == NULL ||
+         closeSGArena(&arena) ){
+        logMessage( LOG_ERROR_LEVEL, "sgArenaUnitTest: huge page arena failed." );
+        return( -1 );
+    }
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgArenaUnitTest: arena unit tests completed successfully." );
+    return( 0 );
+}
@@ -0,0 +1,55 @@
+#ifndef SG_ARENA_INCLUDED
+#define SG_ARENA_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_arena.h
+//  Description    : This is the declaration of the memory arena used for the
+//                   block slabs and index arrays of the scatter gather system.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Includes
+#include <stddef.h>
+#include <stdbool.h>
+
+//
+// Defines
+#define SG_ARENA_PAGE_SIZE 4096                     // base alignment of an arena
+#define SG_ARENA_HUGE_PAGE_SIZE (2*1024*1024)       // huge page size asked for
+
+// Type definitions
+
+// A region mapped once and carved up by a bump allocator, everything in it
+// is released together
+typedef struct {
+    char * base;    // start of the mapping (page aligned)
+    size_t size;    // bytes mapped
+    size_t used;    // bytes handed out
+    bool huge;      // backed by huge pages
+} SG_Arena;
+
+//
+// Arena functions
+
+int initSGArena( SG_Arena *arena, size_t size, bool hugePages );
+    // Map a zero filled arena, on huge pages if asked and available
+
+void *allocSGArena( SG_Arena *arena, size_t size, size_t align );
+    // Carve an aligned block out of the arena, NULL if it is full
+
+int releaseSGArena( SG_Arena *arena, void *ptr, size_t size );
+    // Give the pages under an allocation back to the system, keeping it usable
+
+size_t sgArenaSpan( size_t size, size_t align );
+    // Arena bytes an allocation of size bytes can take, for sizing arenas
+
+int closeSGArena( SG_Arena *arena );
+    // Unmap the arena and everything allocated from it
+
+int sgArenaUnitTest( void );
+    // Run the arena unit tests
+
+#endif
@@ -11,29 +11,269 @@
 
 // Include Files
 #include <stdlib.h>
+#include <unistd.h>
 #include <cmpsc311_log.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 // Project Includes
 #include <sg_cache.h>
+#include <sg_arena.h>
+#include <sg_mrc.h>
+#include <sg_l2.h>
+#include <sg_victim.h>
 #include <string.h>
 
 // Defines
-int latest_time = 1;
-uint16_t maxElementsRecord;
-uint16_t cacheElementsCount = 0;
-int total = 0;
-int hit = 0;
-
-typedef struct {    //cache line strcture
-    int time;
-    SG_Node_ID node_ID;
-    SG_Block_ID blk_ID;
-    char data [SG_BLOCK_SIZE];
-} SG_cache_line;
-
-SG_cache_line * cache;
+#define SG_CACHE_NIL (-1)   // end of a list or hash chain
+#define SG_CACHE_LISTS 4    // most lists any policy keeps
+#define SG_CACHE_NOLIST 0xff
+#define SG_CACHE_MAX_SHARDS 16          // shards are a power of two up to this
+#define SG_CACHE_MIN_SHARD_LINES 64     // ... as long as each keeps this many lines
+#define SG_CACHE_ACCESS_LOG 64          // hits buffered per shard (power of two)
+#define SG_CACHE_ACCESS_DRAIN 32        // buffered hits that trigger a drain
+#define SG_CACHE_READ_RETRIES 8         // lock-free read attempts before locking
+#define SG_CACHE_MAX_WRITEBACKS 2       // evictions a single insert can cause
+#define SG_CACHE_MAX_FLIGHTS 8          // blocks a shard may have on their way out
+#define SG_CACHE_MAX_LINES (1u << 28)   // most lines a cache may ever grow to
+#define SG_CACHE_SKETCH_ROWS 4          // admission: rows of the frequency sketch
+#define SG_CACHE_SKETCH_MAX 15          // ... its counters saturate here (4 bits)
+#define SG_CACHE_SKETCH_WINDOW 10       // ... and are halved every this many references per line
+
+// Policy list assignments
+#define LRU_LIST  0         // LRU, CLOCK: the one recency list (CLOCK ring)
+#define Q2_A1IN   0         // 2Q: first-touch FIFO
+#define Q2_AM     1         // 2Q: re-referenced LRU
+#define Q2_A1OUT  2         // 2Q: ghosts of blocks evicted from A1in
+#define ARC_T1    0         // ARC: seen once recently
+#define ARC_T2    1         // ARC: seen at least twice recently
+#define ARC_B1    2         // ARC: ghosts evicted from T1
+#define ARC_B2    3         // ARC: ghosts evicted from T2
+
+const char * sg_cache_policy_strings[SG_CACHE_MAXVAL_POLICY] = {
+    "lru", "clock", "2q", "arc"
+};
+
+// A cache entry (a resident line or a ghost) is split over two arrays
+// indexed alike: the key holds all a lookup reads, two to a CPU cache line,
+// the meta holds the policy state only touched under the lock.  The block
+// data itself lives in a page aligned slab of its own.  What lock-free
+// lookups read is atomic, writers may change it underneath them.
+typedef struct {    //cache entry key
+    _Atomic SG_Node_ID node_ID;
+    _Atomic SG_Block_ID blk_ID;
+    _Atomic int32_t hnext;      // next entry in the same hash bucket
+    _Atomic int32_t slot;       // data slot, SG_CACHE_NIL for a ghost
+    _Atomic uint32_t gen;       // bumped whenever the entry takes a new block
+    _Atomic uint8_t filling;    // reserved, data not there yet (off every list)
+    uint8_t part;               // partition the entry is charged to
+} SG_cache_key;
+
+typedef struct {    //cache entry policy state
+    int32_t prev;       // policy list, towards the head (most recent)
+    int32_t next;       // policy list, towards the tail (next victim)
+    uint8_t list;       // policy list the entry is on
+    uint8_t ref;        // reference bit (CLOCK)
+    uint8_t dirty;      // modified since it was last written back
+    uint8_t home;       // list a reserved entry joins when committed
+    uint8_t stashed;    // a newer block was stored while it was reserved
+} SG_cache_meta;
+
+_Static_assert( sizeof(SG_cache_key) == 32, "cache keys must pack two to a cache line" );
+_Static_assert( SG_BLOCK_SIZE % sizeof(uint64_t) == 0, "lines are copied a word at a time" );
+_Static_assert( SG_CACHE_MAX_WRITEBACKS == 2, "a change's victims are posted oldest first" );
+
+typedef struct {    //policy list
+    int32_t head;
+    int32_t tail;
+    uint32_t count;
+} SG_cache_list;
+
+// A block on its way out of a shard: an evicted victim waiting to be
+// written back or demoted, or a dirty line being flushed.  Write backs are
+// posted with the shard unlocked; until they end, a miss on the block is
+// served from here, and flights of the same block post in the order taken.
+typedef struct {
+    SG_Node_ID node;
+    SG_Block_ID blk;
+    uint32_t seq;       // when it was taken
+    uint8_t used;
+    uint8_t dirty;      // to be written back, otherwise only demoted
+    char data[SG_BLOCK_SIZE];
+} SG_cache_flight;
+
+// A block stored while its line is reserved.  The line still belongs to
+// the reader filling it, so the newer block waits here and replaces
+// whatever was received once the reservation ends.
+typedef struct {
+    SG_Node_ID node;
+    SG_Block_ID blk;
+    char data[SG_BLOCK_SIZE];
+} SG_cache_stash;
+
+// A partition's slice of a shard.  The policy runs over each slice on its
+// own; capacity is how far the slice may fill before it replaces its own
+// lines, worked out before every insert from its quota and the idle lines.
+typedef struct {
+    SG_cache_list lists[SG_CACHE_LISTS];
+    uint32_t capacity;              // lines the policy may fill
+    uint32_t used;                  // resident lines
+    uint32_t filling;               // ... of them reserved, off the lists until committed
+    uint32_t arcTarget;             // ARC: adaptive target size of T1
+    uint8_t id;                     // the partition
+} SG_cache_part;
+
+// A cache partition, quotas are over the whole cache
+typedef struct {
+    char name[SG_CACHE_PARTITION_NAME];
+    uint32_t minLines;              // lines kept for it however full the cache
+    uint32_t maxLines;              // most lines it may hold
+    atomic_ulong queries;
+    atomic_ulong hits;
+} SG_cache_partition;
+
+// Cache shard, one independently locked slice of the cache.  Writers hold
+// the lock and bump version to an odd value while they change the index or
+// the data; readers search without the lock, through relaxed atomic loads,
+// and retry if version moved.
+// Hits seen by readers are queued in accessLog and handed to the policy the
+// next time the lock is held, always before an eviction is chosen.
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    atomic_uint version;
+    SG_cache_key * keys;            // entry keys, what lookups scan
+    SG_cache_meta * meta;           // entry policy state
+    char (* data)[SG_BLOCK_SIZE];   // block slab, one slot per line
+    int32_t * freeSlots;            // stack of unused data slots
+    uint32_t freeSlotCount;
+    int32_t freeEntry;              // unused entries, linked through next
+    uint32_t entryCount;            // entries in use or on the free list
+    _Atomic int32_t * buckets;      // hash index, heads of the bucket chains
+    atomic_uint bucketMask;         // number of buckets - 1 (power of two)
+    uint32_t lineLimit;             // lines the slab has room for
+    uint32_t entryLimit;            // entries allocated
+    uint32_t bucketLimit;           // buckets allocated
+    SG_cache_part parts[SG_CACHE_MAX_PARTITIONS];
+    uint32_t capacity;              // lines this shard may hold
+    uint32_t used;                  // resident lines, all partitions
+    uint8_t * sketch;               // admission: block frequencies, SG_CACHE_SKETCH_ROWS rows
+    uint32_t sketchMask;            // counters per row - 1 (power of two)
+    uint32_t sketchAdds;            // references counted since the counters were halved
+    unsigned long contested;        // inserts that would have evicted a line
+    unsigned long rejected;         // ... and were turned away
+    atomic_ulong queries;
+    atomic_ulong hits;
+    uint32_t wbCount;               // victims of the current change
+    uint8_t wbFlight[SG_CACHE_MAX_WRITEBACKS];      // ... and their flights
+    uint32_t flightSeq;             // flights taken so far
+    pthread_cond_t flightDone;      // signalled when a flight ends
+    SG_cache_flight flights[SG_CACHE_MAX_FLIGHTS];
+    SG_cache_stash * stash;         // blocks stored into reserved lines
+    uint32_t stashCount;
+    uint32_t stashRoom;
+    _Alignas(64) atomic_uint accessTail;
+    atomic_uint accessHead;
+    _Atomic uint64_t accessLog[SG_CACHE_ACCESS_LOG];
+} SG_cache_shard;
+
+typedef struct {    //replacement policy interface
+    void (*hit)( SG_cache_shard *s, SG_cache_part *p, int32_t e );
+        // A resident entry was referenced
+    int32_t (*miss)( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost );
+        // Make room for and insert a block, ghost is its ghost entry or SG_CACHE_NIL
+    int (*shrink)( SG_cache_shard *s, SG_cache_part *p );
+        // Evict a line or drop a ghost towards a reduced capacity, 0 when done
+    int32_t (*peek)( SG_cache_shard *s, SG_cache_part *p );
+        // The line the next miss would evict (without changing anything)
+} SG_cache_policy_ops;
+
+uint32_t cacheLines;        // lines in the cache
+uint32_t cacheLineLimit;    // lines it may grow to
+SG_cache_shard * cacheShards;
+uint32_t cacheShardCount;
+uint32_t cacheShardShift;   // 64 - log2(cacheShardCount)
+SG_Cache_Policy cachePolicy;
+SG_Cache_WriteBack cacheWriteBack;  // write-back mode if set
+SG_Arena cacheArena;        // backs the shards, their index and their slabs
+bool cacheAdmission;        // TinyLFU admission filter on
+SG_cache_partition cachePartitions[SG_CACHE_MAX_PARTITIONS];
+uint32_t cachePartitionCount;       // partitions defined, 0 is the default
+_Thread_local uint8_t cacheThreadPartition;     // partition charged for this thread's misses
+
 // Functional Prototypes
+static uint64_t sgCacheHash( SG_Node_ID nde, SG_Block_ID blk );
+static SG_cache_shard * sgCacheShard( uint64_t h );
+static size_t sgCacheShardBytes( uint32_t lineLimit );
+static int sgCacheShardInit( SG_cache_shard *s, uint32_t capacity, uint32_t lineLimit );
+static void sgCacheShardFree( SG_cache_shard *s );
+static int sgCacheShardResize( SG_cache_shard *s, uint32_t capacity );
+static void sgCacheRehash( SG_cache_shard *s, uint32_t buckets );
+static uint32_t sgCacheCompactSlots( SG_cache_shard *s );
+static int32_t sgCacheLookup( SG_cache_shard *s, uint64_t h, SG_Node_ID nde, SG_Block_ID blk,
+        char *buf, size_t off, size_t len, char **ptr );
+static void sgCacheCopyOut( char *buf, const char *line, size_t off, size_t len );
+static void sgCacheCopyIn( char *line, const char *block );
+static void sgCacheRecordAccess( SG_cache_shard *s, int32_t e, uint32_t gen );
+static void sgCacheDrainAccesses( SG_cache_shard *s );
+static void sgCacheWriteBegin( SG_cache_shard *s );
+static void sgCacheWriteEnd( SG_cache_shard *s );
+static int sgCacheWriteBackPending( SG_cache_shard *s );
+static int sgCacheFlushLine( SG_cache_shard *s, int32_t e );
+static void sgCacheFlightRoom( SG_cache_shard *s, uint32_t n );
+static int sgCacheFlightTake( SG_cache_shard *s, SG_Node_ID nde, SG_Block_ID blk, bool dirty, const char *block );
+static int sgCacheFlightFind( SG_cache_shard *s, SG_Node_ID nde, SG_Block_ID blk, int before );
+static int sgCacheFlightPost( SG_cache_shard *s, int f );
+static bool sgCacheFlightRedirty( SG_cache_shard *s, int f );
+static void sgCacheFlightEnd( SG_cache_shard *s, int f );
+static int sgCacheStash( SG_cache_shard *s, int32_t e, const char *block );
+static void sgCacheUnstash( SG_cache_shard *s, int32_t e );
+static int sgCacheStore( SG_Node_ID nde, SG_Block_ID blk, char *block, bool dirty, bool fill, char **ptr );
+static int sgCachePromote( SG_Node_ID nde, SG_Block_ID blk, char *block, char **ptr );
+static bool sgCacheDemoting( void );
+static void sgCacheDemote( SG_Node_ID nde, SG_Block_ID blk, char *block );
+static int32_t sgCacheFind( SG_cache_shard *s, uint64_t h, SG_Node_ID nde, SG_Block_ID blk );
+static void sgCacheUnhash( SG_cache_shard *s, int32_t e );
+static void sgCacheListRemove( SG_cache_shard *s, int32_t e );
+static void sgCacheListPushFront( SG_cache_shard *s, uint8_t l, int32_t e );
+static void sgCacheEvict( SG_cache_shard *s, int32_t e, uint8_t ghostList );
+static void sgCacheDrop( SG_cache_shard *s, int32_t e );
+static int32_t sgCacheInsert( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost, uint8_t l );
+static int32_t sgCacheMiss( SG_cache_shard *s, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost );
+static uint32_t sgCacheShare( SG_cache_shard *s, uint32_t lines );
+static uint32_t sgCachePartAllowance( SG_cache_shard *s, SG_cache_part *p );
+static SG_cache_part * sgCacheVictimPart( SG_cache_shard *s, SG_cache_part *p );
+static int sgCacheShrinkStep( SG_cache_shard *s );
+static int sgCacheShardTrim( SG_cache_shard *s );
+static int sgCacheDropGhost( SG_cache_shard *s );
+static SG_cache_part * sgCacheThreadPart( SG_cache_shard *s );
+static void sgCacheSketchAdd( SG_cache_shard *s, uint64_t h );
+static uint32_t sgCacheSketchCount( SG_cache_shard *s, uint64_t h );
+static bool sgCacheAdmit( SG_cache_shard *s, uint64_t h, int32_t ghost );
+
+static void sgLruHit( SG_cache_shard *s, SG_cache_part *p, int32_t e );
+static int32_t sgLruMiss( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost );
+static int sgLruShrink( SG_cache_shard *s, SG_cache_part *p );
+static int32_t sgLruPeek( SG_cache_shard *s, SG_cache_part *p );
+static void sgClockHit( SG_cache_shard *s, SG_cache_part *p, int32_t e );
+static int32_t sgClockMiss( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost );
+static int sgClockShrink( SG_cache_shard *s, SG_cache_part *p );
+static int32_t sgClockPeek( SG_cache_shard *s, SG_cache_part *p );
+static void sg2QHit( SG_cache_shard *s, SG_cache_part *p, int32_t e );
+static int32_t sg2QMiss( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost );
+static int sg2QShrink( SG_cache_shard *s, SG_cache_part *p );
+static int32_t sg2QPeek( SG_cache_shard *s, SG_cache_part *p );
+static void sgArcHit( SG_cache_shard *s, SG_cache_part *p, int32_t e );
+static int32_t sgArcMiss( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost );
+static int sgArcShrink( SG_cache_shard *s, SG_cache_part *p );
+static int32_t sgArcPeek( SG_cache_shard *s, SG_cache_part *p );
+
+static const SG_cache_policy_ops sgCachePolicies[SG_CACHE_MAXVAL_POLICY] = {
+    { sgLruHit, sgLruMiss, sgLruShrink, sgLruPeek },            // SG_CACHE_LRU
+    { sgClockHit, sgClockMiss, sgClockShrink, sgClockPeek },    // SG_CACHE_CLOCK
+    { sg2QHit, sg2QMiss, sg2QShrink, sg2QPeek },                // SG_CACHE_2Q
+    { sgArcHit, sgArcMiss, sgArcShrink, sgArcPeek }             // SG_CACHE_ARC
+};
 
 //
 // Functions
@@ -43,23 +283,120 @@ SG_cache_line * cache;
 // Function     : initSGCache
 // Description  : Initialize the cache of block elements
 //
-// Inputs       : maxElements - maximum number of elements allowed
+// Inputs       : cacheBytes - memory budget for cached blocks
+//                maxBytes - most the cache may be resized to, 0 for
+//                           SG_CACHE_GROWTH times cacheBytes
+//                policy - the replacement policy to use
 // Outputs      : 0 if successful, -1 if failure
 
-int initSGCache( uint16_t maxElements ) {
-    maxElementsRecord = maxElements;
-    if ( maxElements <= 0 ){
-        logMessage( LOG_ERROR_LEVEL, "initSGCache: invalid cache size: [%d].", maxElements );
+int initSGCache( size_t cacheBytes, size_t maxBytes, SG_Cache_Policy policy ) {
+    size_t lines = cacheBytes/SG_BLOCK_SIZE;
+    size_t limit = (maxBytes ? maxBytes : cacheBytes*SG_CACHE_GROWTH)/SG_BLOCK_SIZE;
+    if ( lines == 0 || limit < lines || limit > SG_CACHE_MAX_LINES ){
+        logMessage( LOG_ERROR_LEVEL, "initSGCache: invalid cache size: [%lu] bytes, up to [%lu].", 
+                    cacheBytes, maxBytes );
         return (-1);
-    } else {
-        cache = (SG_cache_line *) calloc(maxElements, sizeof(SG_cache_line));   //allocating cache
-        if ( cache == NULL ){
+    }
+    if ( policy < 0 || policy >= SG_CACHE_MAXVAL_POLICY ){
+        logMessage( LOG_ERROR_LEVEL, "initSGCache: invalid cache policy: [%d].", policy );
+        return (-1);
+    }
+
+    // Split the lines over as many shards as keep a useful size each
+    uint32_t bits = 0;
+    while ( (1u << (bits+1)) <= SG_CACHE_MAX_SHARDS && 
+            lines/(1u << (bits+1)) >= SG_CACHE_MIN_SHARD_LINES ){
+        bits += 1;
+    }
+    cacheShardCount = 1u << bits;
+    cacheShardShift = 64 - bits;
+
+    // One arena holds everything, sized for the largest the cache may grow
+    // to; only the part in use is ever touched.  Big caches get huge pages.
+    uint32_t lineLimit = limit/cacheShardCount + 1;
+    size_t bytes = sgArenaSpan( sizeof(SG_cache_shard)*cacheShardCount, 64 ) + 
+                   sgCacheShardBytes( lineLimit )*cacheShardCount;
+    if ( initSGArena(&cacheArena, bytes, cacheBytes >= SG_ARENA_HUGE_PAGE_SIZE) ){
+        logMessage( LOG_ERROR_LEVEL, "initSGCache: memory allocation failed. " );
+        return (-1);
+    }
+    cacheShards = allocSGArena( &cacheArena, sizeof(SG_cache_shard)*cacheShardCount, 64 );
+
+    // Everything starts in the default partition, which may use it all
+    memset( cachePartitions, 0, sizeof(cachePartitions) );
+    strcpy( cachePartitions[0].name, "default" );
+    cachePartitions[0].maxLines = SG_CACHE_MAX_LINES;
+    cachePartitionCount = 1;
+    cacheThreadPartition = 0;
+
+    for ( uint32_t i=0; i<cacheShardCount; i++ ){
+        // The shard capacities add up to exactly the lines asked for
+        uint32_t capacity = lines/cacheShardCount + (i < lines%cacheShardCount ? 1 : 0);
+        if ( sgCacheShardInit(cacheShards + i, capacity, lineLimit) ){
             logMessage( LOG_ERROR_LEVEL, "initSGCache: memory allocation failed. " );
+            while ( i-- > 0 ){
+                sgCacheShardFree( cacheShards + i );
+            }
+            closeSGArena( &cacheArena );
+            cacheShards = NULL;
             return (-1);
         }
-        // Return successfully
-        return( 0 );
     }
+    cacheLines = lines;
+    cacheLineLimit = limit;
+    cachePolicy = policy;
+    initSGMrc( cacheLines );
+
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resizeSGCache
+// Description  : Grow or shrink the cache while it is in use.  Shrinking
+//                evicts down to the new size (writing dirty blocks back)
+//                and gives the memory of the dropped lines to the system.
+//
+// Inputs       : cacheBytes - the new memory budget for cached blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int resizeSGCache( size_t cacheBytes ) {
+    size_t lines = cacheBytes/SG_BLOCK_SIZE;
+    int ret = 0;
+
+    if ( cacheShards == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] resizeSGCache: cache not initialized." );
+        return( -1 );
+    }
+    if ( lines < cacheShardCount || lines > cacheLineLimit ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] resizeSGCache: invalid cache size: [%lu] bytes, limit [%lu].", 
+                    cacheBytes, (size_t)cacheLineLimit*SG_BLOCK_SIZE );
+        return( -1 );
+    }
+    size_t reserved = 0;
+    for ( uint32_t i=0; i<cachePartitionCount; i++ ){
+        reserved += cachePartitions[i].minLines;
+    }
+    if ( lines < reserved ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] resizeSGCache: [%lu] lines would not cover the [%lu] partitions are guaranteed.", 
+                    lines, reserved );
+        return( -1 );
+    }
+
+    for ( uint32_t i=0; i<cacheShardCount; i++ ){
+        SG_cache_shard * s = cacheShards + i;
+        uint32_t capacity = lines/cacheShardCount + (i < lines%cacheShardCount ? 1 : 0);
+        pthread_mutex_lock( &s->lock );
+        sgCacheDrainAccesses( s );
+        if ( sgCacheShardResize(s, capacity) ){
+            ret = -1;
+        }
+        pthread_mutex_unlock( &s->lock );
+    }
+    logMessage( LOG_INFO_LEVEL, "[Cache] resizeSGCache: [%u] lines resized to [%lu].", cacheLines, lines );
+    cacheLines = lines;
+    return( ret );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,10 +408,52 @@ int initSGCache( uint16_t maxElements ) {
 // Outputs      : 0 if successful, -1 if failure
 
 int closeSGCache( void ) {
-    free(cache);        // free allocated memory
-    cache = NULL;
-    float rate = ((float)hit/(float)total)*100;
-    logMessage( LOG_INFO_LEVEL, "[Cache] Total queries: %d, hit count: %d, hit rate: %f%%", total, hit, rate );
+    unsigned long total = 0, hit = 0, contested = 0, rejected = 0;
+
+    if ( cacheShards == NULL ){
+        return( 0 );
+    }
+    if ( flushSGCache() < 0 ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] closeSGCache: dirty blocks could not be written back." );
+    }
+    for ( uint32_t i=0; i<cacheShardCount && sgL2Active(); i++ ){
+        // Everything still cached goes to the second tier for the next run
+        SG_cache_shard * s = cacheShards + i;
+        pthread_mutex_lock( &s->lock );
+        for ( uint32_t e=0; e<s->entryCount; e++ ){
+            if ( (s->keys + e)->slot != SG_CACHE_NIL && !(s->keys + e)->filling && !(s->meta + e)->dirty ){
+                putSGL2Block( (s->keys + e)->node_ID, (s->keys + e)->blk_ID, s->data[(s->keys + e)->slot] );
+            }
+        }
+        pthread_mutex_unlock( &s->lock );
+    }
+    for ( uint32_t i=0; i<cacheShardCount; i++ ){
+        total += atomic_load( &cacheShards[i].queries );
+        hit += atomic_load( &cacheShards[i].hits );
+        contested += cacheShards[i].contested;
+        rejected += cacheShards[i].rejected;
+        sgCacheShardFree( cacheShards + i );
+    }
+    closeSGArena( &cacheArena );     // free allocated memory
+    cacheShards = NULL;
+    float rate = total ? ((float)hit/(float)total)*100 : 0;
+    logMessage( LOG_INFO_LEVEL, "[Cache] Policy: %s, lines: %d, shards: %d, total queries: %lu, hit count: %lu, hit rate: %f%%", 
+                sg_cache_policy_strings[cachePolicy], cacheLines, cacheShardCount, total, hit, rate );
+    if ( cacheAdmission ){
+        logMessage( LOG_INFO_LEVEL, "[Cache] Admission: %lu inserts contested a line, %lu turned away", 
+                    contested, rejected );
+    }
+    for ( uint32_t i=0; i<cachePartitionCount && cachePartitionCount > 1; i++ ){
+        SG_cache_partition * part = cachePartitions + i;
+        unsigned long pq = atomic_load( &part->queries ), ph = atomic_load( &part->hits );
+        logMessage( LOG_INFO_LEVEL, "[Cache] Partition %s: min %u, max %u lines, queries: %lu, hits: %lu, misses: %lu, hit rate: %f%%", 
+                    part->name, part->minLines, part->maxLines, pq, ph, pq-ph, pq ? ((float)ph/(float)pq)*100 : 0 );
+    }
+    cachePartitionCount = 0;
+    cacheAdmission = false;
+    closeSGVictimCache( total );
+    logSGMrc( cacheLines );
+    closeSGMrc();
     // Return successfully
     return( 0 );
 }
@@ -82,33 +461,203 @@ int closeSGCache( void ) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : getSGDataBlock
-// Description  : Get the data block from the block cache
+// Description  : Get the data block from the block cache (or a lower
+//                tier, which brings it back in).  The block stays valid
+//                until the next insertion into the cache, callers sharing
+//                the cache between threads use readSGDataBlock.
 //
 // Inputs       : nde - node ID to find
 //                blk - block ID to find
 // Outputs      : pointer to block or NULL if not found
 
 char * getSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
-    total += 1;             // count total queries
-    
+    char * block = NULL, tier[SG_BLOCK_SIZE];
+
     if ( nde==0 && blk==0 ){
         logMessage( LOG_ERROR_LEVEL, "[cache] getSGDataBlock: invalid node or blk ID. " );
         return (NULL);
     }
-    for ( int i=0; i<maxElementsRecord; i++ ){
-        if ( ((cache + i)->node_ID) == nde && ((cache + i)->blk_ID) == blk ){       //hit
-            (cache + i)->time = latest_time;
-            latest_time += 1;
-            logMessage( LOG_INFO_LEVEL, "[cache] getSGDataBlock: blk found in cache. cache index:[%d]", i);
-            hit += 1;
-            return ((cache + i) -> data); 
-        }
+    if ( cacheShards == NULL ){
+        return( NULL );
+    }
+
+    uint64_t h = sgCacheHash( nde, blk );
+    int32_t e = sgCacheLookup( sgCacheShard(h), h, nde, blk, NULL, 0, 0, &block );
+    if ( e != SG_CACHE_NIL ){       //hit
+        logMessage( LOG_INFO_LEVEL, "[cache] getSGDataBlock: blk found in cache. cache index:[%d]", e);
+        return( block ); 
+    }
+    if ( sgCachePromote(nde, blk, tier, &block) == 0 && block != NULL ){
+        logMessage( LOG_INFO_LEVEL, "[cache] getSGDataBlock: blk found in a lower tier." );
+        return( block );
     }
     
-    logMessage( LOG_INFO_LEVEL, "[cache] getSGDataBlock: blk not found in cache. cache status: [%d] lines used. ",cacheElementsCount );
+    logMessage( LOG_INFO_LEVEL, "[cache] getSGDataBlock: blk not found in cache." );
     return( NULL );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readSGDataBlock
+// Description  : Copy part of a block out of the block cache, without
+//                taking a lock when the block is cached; misses fall back
+//                to the lower tiers
+//
+// Inputs       : nde - node ID to find
+//                blk - block ID to find
+//                buf - place to put the data
+//                off - offset within the block
+//                len - number of bytes to copy
+// Outputs      : 0 if the block was cached and copied, -1 if not
+
+int readSGDataBlock( SG_Node_ID nde, SG_Block_ID blk, char *buf, size_t off, size_t len ) {
+    if ( (nde==0 && blk==0) || off+len > SG_BLOCK_SIZE ){
+        logMessage( LOG_ERROR_LEVEL, "[cache] readSGDataBlock: invalid block or range. " );
+        return (-1);
+    }
+    if ( cacheShards == NULL ){
+        return( -1 );
+    }
+
+    uint64_t h = sgCacheHash( nde, blk );
+    int32_t e = sgCacheLookup( sgCacheShard(h), h, nde, blk, buf, off, len, NULL );
+    if ( e == SG_CACHE_NIL ){
+        char tier[SG_BLOCK_SIZE];
+        if ( sgCachePromote(nde, blk, tier, NULL) == 0 ){
+            memcpy( buf, tier+off, len );
+            logMessage( LOG_INFO_LEVEL, "[cache] readSGDataBlock: blk [%lu] found in a lower tier.", blk );
+            return( 0 );
+        }
+    }
+    logMessage( LOG_INFO_LEVEL, "[cache] readSGDataBlock: blk [%lu] %s", blk, 
+                (e != SG_CACHE_NIL) ? "found in cache." : "not found in cache." );
+    return( (e != SG_CACHE_NIL) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserveSGDataBlock
+// Description  : Make room for a block that is about to be fetched and hand
+//                back its line, so the block can be received in place.  The
+//                line stays invisible (and cannot be evicted) until it is
+//                committed or cancelled.
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+// Outputs      : the line to fill, NULL if the block is already cached,
+//                not admitted or no line could be reserved
+
+char * reserveSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+    char * line = NULL;
+
+    if ( cacheShards == NULL ){
+        return( NULL );
+    }
+
+    uint64_t h = sgCacheHash( nde, blk );
+    SG_cache_shard * s = sgCacheShard( h );
+    pthread_mutex_lock( &s->lock );
+    sgCacheDrainAccesses( s );
+    sgCacheFlightRoom( s, SG_CACHE_MAX_WRITEBACKS );
+    sgCacheWriteBegin( s );
+
+    if ( cacheAdmission ){
+        sgCacheSketchAdd( s, h );
+    }
+    int32_t e = sgCacheFind( s, h, nde, blk );
+    if ( (e == SG_CACHE_NIL || (s->keys + e)->slot == SG_CACHE_NIL) && sgCacheAdmit(s, h, e) ){
+        if ( (e = sgCacheMiss(s, nde, blk, e)) != SG_CACHE_NIL ){
+            (s->meta + e)->home = (s->meta + e)->list;
+            sgCacheListRemove( s, e );
+            (s->keys + e)->filling = 1;
+            s->parts[(s->keys + e)->part].filling += 1;
+            line = s->data[(s->keys + e)->slot];
+        }
+    }
+
+    sgCacheWriteEnd( s );
+    sgCacheWriteBackPending( s );
+    pthread_mutex_unlock( &s->lock );
+    return( line );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : commitSGDataBlock
+// Description  : Publish a reserved line once its block has been received
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+// Outputs      : 0 if successful, -1 if the block was not reserved
+
+int commitSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+    int ret = -1;
+
+    if ( cacheShards == NULL ){
+        return( -1 );
+    }
+
+    uint64_t h = sgCacheHash( nde, blk );
+    SG_cache_shard * s = sgCacheShard( h );
+    pthread_mutex_lock( &s->lock );
+    sgCacheWriteBegin( s );
+    int32_t e = sgCacheFind( s, h, nde, blk );
+    if ( e != SG_CACHE_NIL && (s->keys + e)->filling ){
+        sgCacheUnstash( s, e );
+        (s->keys + e)->filling = 0;
+        s->parts[(s->keys + e)->part].filling -= 1;
+        sgCacheListPushFront( s, (s->meta + e)->home, e );
+        ret = 0;
+    }
+    sgCacheWriteEnd( s );
+    pthread_mutex_unlock( &s->lock );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cancelSGDataBlock
+// Description  : Give back a reserved line whose block could not be fetched.
+//                If a block was stored into it meanwhile, that is kept.
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+// Outputs      : 0 if successful, -1 if the block was not reserved
+
+int cancelSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+    int ret = -1;
+
+    if ( cacheShards == NULL ){
+        return( -1 );
+    }
+
+    uint64_t h = sgCacheHash( nde, blk );
+    SG_cache_shard * s = sgCacheShard( h );
+    pthread_mutex_lock( &s->lock );
+    sgCacheWriteBegin( s );
+    int32_t e = sgCacheFind( s, h, nde, blk );
+    if ( e != SG_CACHE_NIL && (s->keys + e)->filling && (s->meta + e)->stashed ){
+        sgCacheUnstash( s, e );
+        (s->keys + e)->filling = 0;
+        s->parts[(s->keys + e)->part].filling -= 1;
+        sgCacheListPushFront( s, (s->meta + e)->home, e );
+        ret = 0;
+    } else if ( e != SG_CACHE_NIL && (s->keys + e)->filling ){
+        SG_cache_key * key = s->keys + e;
+        key->filling = 0;
+        s->parts[key->part].filling -= 1;
+        s->freeSlots[s->freeSlotCount++] = key->slot;
+        key->slot = SG_CACHE_NIL;
+        s->used -= 1;
+        s->parts[key->part].used -= 1;
+        sgCacheDrop( s, e );
+        ret = 0;
+    }
+    sgCacheWriteEnd( s );
+    pthread_mutex_unlock( &s->lock );
+    return( ret );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : putSGDataBlock
@@ -120,49 +669,2196 @@ char * getSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
 // Outputs      : 0 if successful, -1 if failure
 
 int putSGDataBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
-    bool blk_found = 0;
-    SG_cache_line * temp_cache;
+    return( sgCacheStore(nde, blk, block, false, false, NULL) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeSGDataBlock
+// Description  : Put a modified block into the cache, to be written back
+//                when it is evicted or flushed (write-back mode only)
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+//                block - the new block contents
+// Outputs      : 0 if the cache took the write, -1 if the caller must
+//                write the block through itself
+
+int writeSGDataBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    if ( cacheWriteBack == NULL ){
+        return( -1 );
+    }
+    return( sgCacheStore(nde, blk, block, true, false, NULL) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushSGDataBlock
+// Description  : Write a block back if it is cached dirty
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+// Outputs      : 0 if successful (or nothing to do), -1 if failure
+
+int flushSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+    int ret = 0;
+
+    if ( cacheShards == NULL || cacheWriteBack == NULL ){
+        return( 0 );
+    }
 
-    for ( int i=0; i<maxElementsRecord; i++ ){ 
-        if ( ((cache + i)->node_ID) == nde && ((cache + i)->blk_ID) == blk ){
-            temp_cache = cache + i;
-            blk_found = 1;
+    uint64_t h = sgCacheHash( nde, blk );
+    SG_cache_shard * s = sgCacheShard( h );
+    pthread_mutex_lock( &s->lock );
+    sgCacheFlightRoom( s, 1 );
+    int32_t e = sgCacheFind( s, h, nde, blk );
+    if ( e != SG_CACHE_NIL && (s->keys + e)->slot != SG_CACHE_NIL && (s->meta + e)->dirty ){
+        ret = sgCacheFlushLine( s, e );
+    }
+    pthread_mutex_unlock( &s->lock );
+    return( ret ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropSGDataBlock
+// Description  : Forget a block that no longer exists: its line (dirty or
+//                not, it is never written back), its ghost and its copies
+//                in the lower tiers.  A line still being filled is left to
+//                its reader.
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+// Outputs      : 0 if successful (or nothing to do), -1 if it is being filled
+
+int dropSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+    int ret = 0;
+
+    if ( cacheShards == NULL ){
+        return( 0 );
+    }
+
+    uint64_t h = sgCacheHash( nde, blk );
+    SG_cache_shard * s = sgCacheShard( h );
+    pthread_mutex_lock( &s->lock );
+    while ( sgCacheFlightFind(s, nde, blk, -1) >= 0 ){
+        pthread_cond_wait( &s->flightDone, &s->lock );     // its write back must not land after it is gone
+    }
+    sgCacheDrainAccesses( s );
+    sgCacheWriteBegin( s );
+    int32_t e = sgCacheFind( s, h, nde, blk );
+    if ( e != SG_CACHE_NIL && (s->keys + e)->filling ){
+        ret = -1;
+    } else if ( e != SG_CACHE_NIL ){
+        SG_cache_key * key = s->keys + e;
+        if ( key->slot != SG_CACHE_NIL ){
+            (s->meta + e)->dirty = 0;
+            s->freeSlots[s->freeSlotCount++] = key->slot;
+            key->slot = SG_CACHE_NIL;
+            s->used -= 1;
+            s->parts[key->part].used -= 1;
         }
+        sgCacheDrop( s, e );
     }
-    
-    if ( blk_found == 1 ){
-        logMessage( LOG_INFO_LEVEL, "[Cache] putSGDataBlock: blk found and updating blk [%lu]", blk );  // updating blk
-        memcpy( temp_cache->data, block, SG_BLOCK_SIZE );
+    dropSGVictimBlock( nde, blk );
+    dropSGL2Block( nde, blk );
+    sgCacheWriteEnd( s );
+    pthread_mutex_unlock( &s->lock );
+    return( ret );
+}
 
-    } else {
-        if ( cacheElementsCount < maxElementsRecord ){
-        (cache + cacheElementsCount)->time = latest_time;
-        (cache + cacheElementsCount)->node_ID = nde;
-        (cache + cacheElementsCount)->blk_ID = blk;
-        latest_time += 1;
-        memcpy( (cache + cacheElementsCount)->data, block, SG_BLOCK_SIZE );
-
-        cacheElementsCount += 1;
-        logMessage( LOG_INFO_LEVEL, "[Cache] putSGDataBlock: inserting new blk [%lu] to cache, cache status: [%d] lines used. ", blk, cacheElementsCount );
-
-        } else if ( cacheElementsCount == maxElementsRecord ) {
-            SG_cache_line * cacheLine_earliest = cache;
-            for ( int i=0; i<maxElementsRecord; i++ ){  // finding earliest
-                if ( ((cache + i)->time) < (cacheLine_earliest->time) ){
-                    cacheLine_earliest = (cache + i);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushSGCache
+// Description  : Write back every dirty block in the cache
+//
+// Inputs       : none
+// Outputs      : number of blocks written back, -1 if any failed
+
+int flushSGCache( void ) {
+    int flushed = 0, failed = 0;
+
+    if ( cacheShards == NULL || cacheWriteBack == NULL ){
+        return( 0 );
+    }
+    for ( uint32_t i=0; i<cacheShardCount; i++ ){
+        SG_cache_shard * s = cacheShards + i;
+        pthread_mutex_lock( &s->lock );
+        for ( uint32_t e=0; e<s->entryCount; e++ ){
+            if ( (s->keys + e)->slot == SG_CACHE_NIL || !(s->meta + e)->dirty ){
+                continue;
+            }
+            sgCacheFlightRoom( s, 1 );
+            if ( (s->keys + e)->slot != SG_CACHE_NIL && (s->meta + e)->dirty ){
+                if ( sgCacheFlushLine(s, e) == 0 ){
+                    flushed += 1;
+                } else {
+                    failed += 1;
                 }
             }
+        }
+        pthread_mutex_unlock( &s->lock );
+    }
+    logMessage( LOG_INFO_LEVEL, "[Cache] flushSGCache: wrote back [%d] blocks, [%d] failed.", flushed, failed );
+    return( failed ? -1 : flushed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheWriteBack
+// Description  : Turn write-back mode on (or off with NULL); dirty blocks
+//                are handed to the function when they leave the cache
+//
+// Inputs       : fn - the function writing a block back to its node
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheWriteBack( SG_Cache_WriteBack fn ) {
+    if ( fn == NULL && cacheWriteBack != NULL && flushSGCache() < 0 ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] setSGCacheWriteBack: failed to flush dirty blocks." );
+        return( -1 );
+    }
+    cacheWriteBack = fn;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheAdmission
+// Description  : Turn the admission filter on or off.  When on, a block
+//                missed by a read while the cache is full only gets a line
+//                reserved if it has been referenced more often lately than
+//                the line it would evict (TinyLFU), so blocks read once do
+//                not push out hot ones.  Written blocks are always cached,
+//                they are usually read again soon.
+//
+// Inputs       : on - filter new blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheAdmission( bool on ) {
+    if ( cacheShards == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] setSGCacheAdmission: cache not initialized." );
+        return( -1 );
+    }
+    cacheAdmission = on;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheVictimTier
+// Description  : Keep blocks evicted from the cache compressed in memory
+//                until the cache is closed
+//
+// Inputs       : bytes - memory for the compressed blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheVictimTier( size_t bytes ) {
+    if ( cacheShards == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] setSGCacheVictimTier: cache not initialized." );
+        return( -1 );
+    }
+    return( openSGVictimCache(bytes) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : createSGCachePartition
+// Description  : Define a cache partition (or change the quotas of the one
+//                with that name).  A partition is always left minBytes of
+//                the cache, may borrow idle lines beyond that and never
+//                holds more than maxBytes.  Lines over a lowered maximum are
+//                evicted at once.
+//
+// Inputs       : name - the partition (or group) name
+//                minBytes - memory kept for it
+//                maxBytes - most memory it may use, 0 for no limit
+// Outputs      : the partition, -1 if failure
+
+int createSGCachePartition( const char *name, size_t minBytes, size_t maxBytes ) {
+    size_t minLines = minBytes/SG_BLOCK_SIZE, reserved = minLines;
+    size_t maxLines = maxBytes ? maxBytes/SG_BLOCK_SIZE : SG_CACHE_MAX_LINES;
+    uint32_t part;
+    int ret = 0;
+
+    if ( cacheShards == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] createSGCachePartition: cache not initialized." );
+        return( -1 );
+    }
+    if ( name == NULL || strlen(name) >= SG_CACHE_PARTITION_NAME || maxLines == 0 || maxLines < minLines ||
+         maxLines > SG_CACHE_MAX_LINES ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] createSGCachePartition: invalid partition [%s], [%lu] to [%lu] bytes.", 
+                    name ? name : "", minBytes, maxBytes );
+        return( -1 );
+    }
+    for ( part=0; part<cachePartitionCount && strcmp(cachePartitions[part].name, name); part++ );
+    if ( part == SG_CACHE_MAX_PARTITIONS ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] createSGCachePartition: no room for partition [%s].", name );
+        return( -1 );
+    }
+    for ( uint32_t i=0; i<cachePartitionCount; i++ ){
+        reserved += (i != part) ? cachePartitions[i].minLines : 0;
+    }
+    if ( reserved > cacheLines ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] createSGCachePartition: [%lu] guaranteed lines would not fit in [%u].", 
+                    reserved, cacheLines );
+        return( -1 );
+    }
 
-            logMessage( LOG_INFO_LEVEL, "[Cache] putSGDataBlock: update oldest blk [%lu] to new blk [%lu]", cacheLine_earliest->blk_ID, blk );  //replacement policy
-            cacheLine_earliest->time = latest_time;
-            latest_time += 1;
-            cacheLine_earliest->node_ID = nde;
-            cacheLine_earliest->blk_ID = blk;
-            memcpy( cacheLine_earliest->data, block, SG_BLOCK_SIZE );
-            
+    SG_cache_partition * p = cachePartitions + part;
+    if ( part == cachePartitionCount ){
+        strcpy( p->name, name );
+        atomic_store( &p->queries, 0 );
+        atomic_store( &p->hits, 0 );
+        cachePartitionCount += 1;
+    }
+    p->minLines = minLines;
+    p->maxLines = maxLines;
+    for ( uint32_t i=0; i<cacheShardCount; i++ ){
+        SG_cache_shard * s = cacheShards + i;
+        pthread_mutex_lock( &s->lock );
+        sgCacheDrainAccesses( s );
+        if ( sgCacheShardTrim(s) ){
+            ret = -1;
         }
+        pthread_mutex_unlock( &s->lock );
     }
+    logMessage( LOG_INFO_LEVEL, "[Cache] createSGCachePartition: partition [%s] holds [%lu] to [%lu] lines.", 
+                name, minLines, maxLines );
+    return( ret ? -1 : (int)part );
+}
 
-    // Return successfully
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCachePartition
+// Description  : Charge the blocks the calling thread brings into the cache
+//                (and its lookups) to a partition
+//
+// Inputs       : part - the partition
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCachePartition( int part ) {
+    if ( part < 0 || (part > 0 && (uint32_t)part >= cachePartitionCount) ){     // 0 is always there
+        logMessage( LOG_ERROR_LEVEL, "[Cache] setSGCachePartition: no partition [%d].", part );
+        return( -1 );
+    }
+    cacheThreadPartition = part;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getSGCachePartitionStats
+// Description  : Report what a partition holds and how it has done
+//
+// Inputs       : part - the partition
+//                queries - where to put its lookups
+//                hits - where to put the ones that hit
+//                bytes - where to put the memory its lines take
+// Outputs      : 0 if successful, -1 if failure
+
+int getSGCachePartitionStats( int part, unsigned long *queries, unsigned long *hits, size_t *bytes ) {
+    size_t lines = 0;
+
+    if ( cacheShards == NULL || part < 0 || (uint32_t)part >= cachePartitionCount ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] getSGCachePartitionStats: no partition [%d].", part );
+        return( -1 );
+    }
+    for ( uint32_t i=0; i<cacheShardCount; i++ ){
+        pthread_mutex_lock( &cacheShards[i].lock );
+        lines += cacheShards[i].parts[part].used;
+        pthread_mutex_unlock( &cacheShards[i].lock );
+    }
+    *queries = atomic_load( &cachePartitions[part].queries );
+    *hits = atomic_load( &cachePartitions[part].hits );
+    *bytes = lines*SG_BLOCK_SIZE;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheUnitTest
+// Description  : Run each replacement policy over a random block trace on a
+//                small cache, checking contents and occupancy as it goes,
+//                then hammer a sharded cache from several threads
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static void * sgCacheUnitTestThread( void *arg );
+static int unitWriteBacks;
+
+static int sgCacheUnitTestWriteBack( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    unitWriteBacks += (block[0] == (char)blk && block[SG_BLOCK_SIZE-1] == (char)blk);
     return( 0 );
 }
+
+int sgCacheUnitTest( void ) {
+    char block[SG_BLOCK_SIZE], *got;
+    int policy, i;
+
+    srand( 311 );
+    for ( policy=0; policy<SG_CACHE_MAXVAL_POLICY; policy++ ){
+        if ( initSGCache(16*SG_BLOCK_SIZE, 0, (SG_Cache_Policy)policy) ){
+            return( -1 );
+        }
+        for ( i=0; i<20000; i++ ){
+            // Skewed trace: a hot set of 8 blocks and a cold set of 64
+            SG_Block_ID blk = (rand()%3) ? 1+rand()%8 : 100+rand()%64;
+            SG_Node_ID nde = 1+blk%3;
+            if ( (got = getSGDataBlock(nde, blk)) != NULL ){
+                if ( *(SG_Block_ID *)got != blk ){
+                    logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: %s returned wrong data for blk [%lu]",
+                                sg_cache_policy_strings[policy], blk );
+                    closeSGCache();
+                    return( -1 );
+                }
+                continue;
+            }
+            memset( block, 0, SG_BLOCK_SIZE );
+            memcpy( block, &blk, sizeof(blk) );
+            if ( putSGDataBlock(nde, blk, block) || getSGDataBlock(nde, blk) == NULL ||
+                 cacheShards->used > cacheShards->capacity ){
+                logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: %s failed inserting blk [%lu]",
+                            sg_cache_policy_strings[policy], blk );
+                closeSGCache();
+                return( -1 );
+            }
+        }
+
+        // Dropped blocks (resident or ghosts) are gone, and then refilled
+        for ( i=0; i<172; i++ ){
+            SG_Block_ID blk = (i < 8) ? 1+i : 100+i-8;
+            uint32_t used = cacheShards->used;
+            bool held = ( getSGDataBlock(1+blk%3, blk) != NULL );
+            if ( dropSGDataBlock(1+blk%3, blk) || getSGDataBlock(1+blk%3, blk) != NULL ||
+                 cacheShards->used != used - held ){
+                logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: %s failed dropping blk [%lu]",
+                            sg_cache_policy_strings[policy], blk );
+                closeSGCache();
+                return( -1 );
+            }
+        }
+        for ( i=0; i<64; i++ ){
+            SG_Block_ID blk = 1+i%8;
+            memset( block, 0, SG_BLOCK_SIZE );
+            memcpy( block, &blk, sizeof(blk) );
+            if ( putSGDataBlock(1+blk%3, blk, block) || getSGDataBlock(1+blk%3, blk) == NULL ){
+                logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: %s failed refilling blk [%lu]",
+                            sg_cache_policy_strings[policy], blk );
+                closeSGCache();
+                return( -1 );
+            }
+        }
+        closeSGCache();
+    }
+
+    // Admission: a scan of blocks read once leaves the hot set alone, and a
+    // block that keeps being read gets in
+    for ( policy=0; policy<SG_CACHE_MAXVAL_POLICY; policy++ ){
+        int lost = 0;
+        if ( initSGCache(16*SG_BLOCK_SIZE, 0, (SG_Cache_Policy)policy) || setSGCacheAdmission(true) ){
+            return( -1 );
+        }
+        for ( i=0; i<440; i++ ){
+            // Warm up the hot set, then scan with hot reads in between
+            SG_Block_ID blk = (i >= 40 && i%2) ? 100+i : 1+(i/2)%8;
+            if ( readSGDataBlock(1, blk, block, 0, 1) && (got = reserveSGDataBlock(1, blk)) != NULL ){
+                memset( got, (char)blk, SG_BLOCK_SIZE );
+                commitSGDataBlock( 1, blk );
+            }
+        }
+        for ( i=1; i<=8; i++ ){
+            lost += ( readSGDataBlock(1, i, block, 0, SG_BLOCK_SIZE) || block[SG_BLOCK_SIZE-1] != (char)i );
+        }
+        for ( i=0; i<200 && readSGDataBlock(1, 500, block, 0, 1); i++ ){
+            if ( (got = reserveSGDataBlock(1, 500)) != NULL ){
+                commitSGDataBlock( 1, 500 );
+            }
+        }
+        if ( lost || getSGDataBlock(1, 500) == NULL ){
+            logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: %s admission lost [%d] hot blocks (or kept out a warm one)",
+                        sg_cache_policy_strings[policy], lost );
+            closeSGCache();
+            return( -1 );
+        }
+        closeSGCache();
+    }
+
+    // ... and cold blocks read back from a lower tier leave it alone too
+    unsigned long queries, hits, hitsBefore;
+    size_t bytes;
+    int cold = 0;
+    if ( initSGCache(16*SG_BLOCK_SIZE, 0, SG_CACHE_LRU) || setSGCacheAdmission(true) ||
+         setSGCacheVictimTier(16*SG_BLOCK_SIZE) ){
+        return( -1 );
+    }
+    for ( i=1; i<=32; i++ ){    // 1-16 are demoted
+        memset( block, (char)i, SG_BLOCK_SIZE );
+        putSGDataBlock( 1, i, block );
+    }
+    for ( i=0; i<64; i++ ){
+        readSGDataBlock( 1, 17+i%16, block, 0, 1 );
+    }
+    for ( i=1; i<=16; i++ ){
+        cold += ( readSGDataBlock(1, i, block, 0, SG_BLOCK_SIZE) || block[SG_BLOCK_SIZE-1] != (char)i );
+    }
+    getSGCachePartitionStats( 0, &queries, &hitsBefore, &bytes );
+    for ( i=17; i<=32; i++ ){
+        readSGDataBlock( 1, i, block, 0, 1 );
+    }
+    getSGCachePartitionStats( 0, &queries, &hits, &bytes );
+    closeSGCache();
+    if ( cold || hits-hitsBefore != 16 ){
+        logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: [%d] cold blocks lost, [%lu] of 16 hot blocks kept after a lower tier refill",
+                    cold, hits-hitsBefore );
+        return( -1 );
+    }
+
+    // Partitions: a capped scan cannot take the guaranteed lines, a partition
+    // below its minimum takes lines back, and idle lines can be borrowed
+    for ( policy=0; policy<SG_CACHE_MAXVAL_POLICY; policy++ ){
+        unsigned long queries, hits;
+        size_t hot, batch, other;
+        int hp, bp, missing = 0;
+        if ( initSGCache(64*SG_BLOCK_SIZE, 0, (SG_Cache_Policy)policy) ||
+             (hp = createSGCachePartition("hot", 16*SG_BLOCK_SIZE, 32*SG_BLOCK_SIZE)) < 0 ||
+             (bp = createSGCachePartition("batch", 0, 60*SG_BLOCK_SIZE)) < 0 ){
+            return( -1 );
+        }
+        memset( block, 0, SG_BLOCK_SIZE );
+        setSGCachePartition( bp );
+        for ( i=1; i<=200; i++ ){
+            putSGDataBlock( 2, i, block );
+        }
+        getSGCachePartitionStats( bp, &queries, &hits, &batch );
+        setSGCachePartition( hp );
+        for ( i=1; i<=16; i++ ){
+            putSGDataBlock( 1, i, block );
+        }
+        setSGCachePartition( bp );
+        for ( i=201; i<=400; i++ ){
+            putSGDataBlock( 2, i, block );
+        }
+        setSGCachePartition( hp );
+        for ( i=1; i<=16; i++ ){
+            missing += readSGDataBlock( 1, i, block, 0, 1 ) ? 1 : 0;
+        }
+        getSGCachePartitionStats( hp, &queries, &hits, &hot );
+        int ok = ( batch == 60*SG_BLOCK_SIZE && !missing && hot == 16*SG_BLOCK_SIZE && queries == 16 && hits == 16 );
+        getSGCachePartitionStats( bp, &queries, &hits, &batch );
+        ok = ok && ( batch == 48*SG_BLOCK_SIZE );
+
+        // A lowered maximum applies at once, and the default partition
+        // fills what is left
+        createSGCachePartition( "batch", 0, 8*SG_BLOCK_SIZE );
+        setSGCachePartition( 0 );
+        for ( i=1; i<=100; i++ ){
+            putSGDataBlock( 3, i, block );
+        }
+        getSGCachePartitionStats( bp, &queries, &hits, &batch );
+        getSGCachePartitionStats( 0, &queries, &hits, &other );
+        ok = ok && batch == 8*SG_BLOCK_SIZE && other == 40*SG_BLOCK_SIZE &&
+             createSGCachePartition("greedy", 60*SG_BLOCK_SIZE, 0) == -1 && setSGCachePartition(3) == -1;
+        if ( !ok ){
+            logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: %s partitions held [%lu] hot (%d missing), [%lu] batch and [%lu] other bytes",
+                        sg_cache_policy_strings[policy], hot, missing, batch, other );
+            closeSGCache();
+            return( -1 );
+        }
+        closeSGCache();
+    }
+
+    // Write-back: dirty victims and flushes reach the write back function
+    if ( initSGCache(16*SG_BLOCK_SIZE, 0, SG_CACHE_LRU) || setSGCacheWriteBack(sgCacheUnitTestWriteBack) ){
+        return( -1 );
+    }
+    for ( i=1; i<=32; i++ ){
+        memset( block, (char)i, SG_BLOCK_SIZE );
+        if ( writeSGDataBlock(1, i, block) ){
+            closeSGCache();
+            return( -1 );
+        }
+    }
+    if ( unitWriteBacks != 16 || flushSGCache() != 16 || unitWriteBacks != 32 || flushSGCache() != 0 ){
+        logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: write back saw [%d] blocks, expected 32", unitWriteBacks );
+        closeSGCache();
+        return( -1 );
+    }
+    setSGCacheWriteBack( NULL );
+    closeSGCache();
+
+    // Reserved lines stay hidden until committed, and vanish when cancelled
+    char * line;
+    if ( initSGCache(16*SG_BLOCK_SIZE, 0, SG_CACHE_ARC) || (line = reserveSGDataBlock(1, 1)) == NULL ){
+        return( -1 );
+    }
+    memset( line, 1, SG_BLOCK_SIZE );
+    if ( ((uintptr_t)line & (SG_BLOCK_SIZE-1)) || readSGDataBlock(1, 1, block, 0, SG_BLOCK_SIZE) == 0 || reserveSGDataBlock(1, 1) != NULL ||
+         commitSGDataBlock(1, 1) || readSGDataBlock(1, 1, block, 0, SG_BLOCK_SIZE) || block[SG_BLOCK_SIZE-1] != 1 ||
+         reserveSGDataBlock(1, 2) == NULL || cancelSGDataBlock(1, 2) || readSGDataBlock(1, 2, block, 0, 1) == 0 ||
+         cacheShards->used != 1 ){
+        logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: line reservation failed (or line misaligned)" );
+        closeSGCache();
+        return( -1 );
+    }
+    // More reservations than lines: the extra ones are refused, not waited for
+    int held = 0;
+    for ( i=100; i<140; i++ ){
+        held += ( reserveSGDataBlock(1, i) != NULL );
+    }
+    for ( i=100; i<140; i++ ){
+        cancelSGDataBlock( 1, i );
+    }
+    if ( held == 0 || held > 16 || cacheShards->used > 1 ){
+        logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: [%d] lines reserved in a 16 line cache", held );
+        closeSGCache();
+        return( -1 );
+    }
+    // A block stored into a reserved line outlives the older copy the
+    // reader receives, whether the reservation is committed or cancelled
+    char newer[SG_BLOCK_SIZE];
+    memset( newer, 9, SG_BLOCK_SIZE );
+    setSGCacheWriteBack( sgCacheUnitTestWriteBack );
+    unitWriteBacks = 0;
+    int stored = ( (line = reserveSGDataBlock(7, 9)) != NULL && writeSGDataBlock(7, 9, newer) == 0 );
+    if ( stored ){
+        memset( line, 'O', SG_BLOCK_SIZE );
+        stored = ( commitSGDataBlock(7, 9) == 0 && readSGDataBlock(7, 9, block, 0, SG_BLOCK_SIZE) == 0 &&
+                   memcmp(block, newer, SG_BLOCK_SIZE) == 0 && flushSGDataBlock(7, 9) == 0 && unitWriteBacks == 1 );
+    }
+    memset( newer, 10, SG_BLOCK_SIZE );
+    if ( stored && (stored = ((line = reserveSGDataBlock(7, 10)) != NULL && putSGDataBlock(7, 10, newer) == 0)) ){
+        memset( line, 'O', SG_BLOCK_SIZE );
+        stored = ( cancelSGDataBlock(7, 10) == 0 && readSGDataBlock(7, 10, block, 0, SG_BLOCK_SIZE) == 0 &&
+                   memcmp(block, newer, SG_BLOCK_SIZE) == 0 );
+    }
+    setSGCacheWriteBack( NULL );
+    if ( !stored ){
+        logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: a block stored into a reserved line was lost" );
+        closeSGCache();
+        return( -1 );
+    }
+    closeSGCache();
+
+    // Evicted blocks come back from the second tier (then from the victim
+    // tier), changed ones current
+    char path[] = "/tmp/sg_l2_cache_XXXXXX";
+    int fd = mkstemp( path ), stale = 0, tier;
+    if ( fd < 0 ){
+        return( -1 );
+    }
+    close( fd );
+    for ( tier=0; tier<2; tier++ ){
+        if ( (tier == 0 && openSGL2Cache(path, 64)) || initSGCache(16*SG_BLOCK_SIZE, 0, SG_CACHE_LRU) ||
+             (tier == 1 && setSGCacheVictimTier(16*SG_BLOCK_SIZE)) ){
+            unlink( path );
+            return( -1 );
+        }
+        for ( i=1; i<=48; i++ ){
+            memset( block, (char)i, SG_BLOCK_SIZE );
+            putSGDataBlock( 1, i, block );
+            if ( i == 32 ){     // block 2 changes after it was demoted
+                memset( block, 100, SG_BLOCK_SIZE );
+                putSGDataBlock( 1, 2, block );
+            }
+        }
+        for ( i=1; i<=48; i++ ){
+            char want = (i == 2) ? 100 : (char)i;
+            if ( readSGDataBlock(1, i, block, 0, SG_BLOCK_SIZE) || block[0] != want || block[SG_BLOCK_SIZE-1] != want ){
+                stale += 1;
+            }
+        }
+        closeSGCache();
+        closeSGL2Cache();
+    }
+    unlink( path );
+    if ( stale ){
+        logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: [%d] blocks missing or stale from the lower tiers", stale );
+        return( -1 );
+    }
+
+    // Resizing keeps the most recent blocks and writes back the rest
+    for ( policy=0; policy<SG_CACHE_MAXVAL_POLICY; policy++ ){
+        if ( initSGCache(64*SG_BLOCK_SIZE, 256*SG_BLOCK_SIZE, (SG_Cache_Policy)policy) || 
+             setSGCacheWriteBack(sgCacheUnitTestWriteBack) ){
+            return( -1 );
+        }
+        unitWriteBacks = 0;
+        for ( i=1; i<=64; i++ ){
+            memset( block, (char)i, SG_BLOCK_SIZE );
+            writeSGDataBlock( 1, i, block );
+        }
+        int shrunk = resizeSGCache( 16*SG_BLOCK_SIZE ) || unitWriteBacks != 48 || cacheShards->used != 16 ||
+                     resizeSGCache( 256*SG_BLOCK_SIZE );
+        for ( i=1; i<=256; i++ ){
+            memset( block, (char)i, SG_BLOCK_SIZE );
+            putSGDataBlock( 2, i, block );
+        }
+        int grown = (cacheShards->used == 256);
+        for ( i=1; i<=256 && grown; i++ ){
+            grown = (readSGDataBlock(2, i, block, 0, SG_BLOCK_SIZE) == 0 && block[0] == (char)i && 
+                     block[SG_BLOCK_SIZE-1] == (char)i);
+        }
+        int kept = 0;
+        resizeSGCache( 16*SG_BLOCK_SIZE );
+        for ( i=1; i<=256; i++ ){
+            if ( readSGDataBlock(2, i, block, 0, SG_BLOCK_SIZE) == 0 ){
+                kept += (block[0] == (char)i && block[SG_BLOCK_SIZE-1] == (char)i) ? 1 : 1000;
+            }
+        }
+        if ( shrunk || !grown || kept != 16 || resizeSGCache(257*SG_BLOCK_SIZE) == 0 ){
+            logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: %s resize failed, [%d] written back, [%d] kept",
+                        sg_cache_policy_strings[policy], unitWriteBacks, kept );
+            closeSGCache();
+            return( -1 );
+        }
+        setSGCacheWriteBack( NULL );
+        closeSGCache();
+    }
+
+    // Concurrent readers and writers over a sharded cache
+    pthread_t threads[4];
+    long failures = 0;
+    void * result;
+    if ( initSGCache(1024*SG_BLOCK_SIZE, 0, SG_CACHE_LRU) ){
+        return( -1 );
+    }
+    for ( i=0; i<4; i++ ){
+        pthread_create( &threads[i], NULL, sgCacheUnitTestThread, (void *)(long)i );
+    }
+    for ( i=0; i<4; i++ ){
+        pthread_join( threads[i], &result );
+        failures += (long)result;
+    }
+    closeSGCache();
+    if ( failures ){
+        logMessage( LOG_ERROR_LEVEL, "sgCacheUnitTest: [%ld] torn or wrong blocks read concurrently", failures );
+        return( -1 );
+    }
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgCacheUnitTest: cache unit tests completed successfully." );
+    return( 0 );
+}
+
+static void * sgCacheUnitTestThread( void *arg ) {
+    char block[SG_BLOCK_SIZE], out[SG_BLOCK_SIZE];
+    unsigned int seed = 311 + (unsigned int)(long)arg;
+    long failures = 0;
+
+    for ( int i=0; i<50000; i++ ){
+        SG_Block_ID blk = 1 + rand_r(&seed)%2048;
+        if ( readSGDataBlock(1, blk, out, 0, SG_BLOCK_SIZE) == 0 ){
+            // Every byte of a block is its ID, a torn copy would mix two
+            for ( int j=0; j<SG_BLOCK_SIZE; j++ ){
+                if ( out[j] != (char)blk ){
+                    failures += 1;
+                    break;
+                }
+            }
+        } else {
+            memset( block, (char)blk, SG_BLOCK_SIZE );
+            putSGDataBlock( 1, blk, block );
+        }
+    }
+    return( (void *)failures );
+}
+
+//
+// Replacement policies
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgLruHit / sgLruMiss / sgLruShrink / sgLruPeek
+// Description  : Least recently used replacement
+//
+// Inputs       : s - the shard, p - the partition replacing its lines
+//                e - the entry referenced (hit)
+//                nde, blk - block to insert, ghost - unused (miss)
+// Outputs      : the inserted entry (miss), 0 when within capacity (shrink),
+//                the next victim (peek)
+
+static void sgLruHit( SG_cache_shard *s, SG_cache_part *p, int32_t e ) {
+    sgCacheListRemove( s, e );
+    sgCacheListPushFront( s, LRU_LIST, e );
+}
+
+static int32_t sgLruMiss( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost ) {
+    if ( p->used == p->capacity ){
+        sgCacheEvict( s, p->lists[LRU_LIST].tail, SG_CACHE_NOLIST );
+    }
+    return( sgCacheInsert(s, p, nde, blk, SG_CACHE_NIL, LRU_LIST) );
+}
+
+static int sgLruShrink( SG_cache_shard *s, SG_cache_part *p ) {
+    if ( p->used <= p->capacity || p->lists[LRU_LIST].tail == SG_CACHE_NIL ){
+        return( 0 );
+    }
+    sgCacheEvict( s, p->lists[LRU_LIST].tail, SG_CACHE_NOLIST );
+    return( 1 );
+}
+
+static int32_t sgLruPeek( SG_cache_shard *s, SG_cache_part *p ) {
+    return( p->lists[LRU_LIST].tail );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgClockHit / sgClockMiss / sgClockShrink / sgClockVictim /
+//                sgClockPeek
+// Description  : CLOCK (second chance) replacement, the hand is the list tail
+//
+// Inputs       : s - the shard, p - the partition replacing its lines
+//                e - the entry referenced (hit)
+//                nde, blk - block to insert, ghost - unused (miss)
+// Outputs      : the inserted entry (miss), 0 when within capacity (shrink),
+//                the next line without its reference bit (victim, peek;
+//                peek leaves the bits and the hand alone)
+
+static void sgClockHit( SG_cache_shard *s, SG_cache_part *p, int32_t e ) {
+    (s->meta + e)->ref = 1;
+}
+
+static int32_t sgClockVictim( SG_cache_shard *s, SG_cache_part *p ) {
+    int32_t hand = p->lists[LRU_LIST].tail;
+    while ( (s->meta + hand)->ref ){      // referenced lines get a second pass
+        (s->meta + hand)->ref = 0;
+        sgCacheListRemove( s, hand );
+        sgCacheListPushFront( s, LRU_LIST, hand );
+        hand = p->lists[LRU_LIST].tail;
+    }
+    return( hand );
+}
+
+static int32_t sgClockMiss( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost ) {
+    if ( p->used == p->capacity ){
+        sgCacheEvict( s, sgClockVictim(s, p), SG_CACHE_NOLIST );
+    }
+    return( sgCacheInsert(s, p, nde, blk, SG_CACHE_NIL, LRU_LIST) );
+}
+
+static int sgClockShrink( SG_cache_shard *s, SG_cache_part *p ) {
+    if ( p->used <= p->capacity || p->lists[LRU_LIST].tail == SG_CACHE_NIL ){
+        return( 0 );
+    }
+    sgCacheEvict( s, sgClockVictim(s, p), SG_CACHE_NOLIST );
+    return( 1 );
+}
+
+static int32_t sgClockPeek( SG_cache_shard *s, SG_cache_part *p ) {
+    int32_t hand = p->lists[LRU_LIST].tail;
+    while ( hand != SG_CACHE_NIL && (s->meta + hand)->ref ){
+        hand = (s->meta + hand)->prev;
+    }
+    // Every line referenced: the hand clears them all and comes back round
+    return( (hand != SG_CACHE_NIL) ? hand : p->lists[LRU_LIST].tail );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sg2QHit / sg2QMiss / sg2QShrink / sg2QReplace / sg2QPeek
+// Description  : 2Q replacement (Johnson and Shasha, full version): first
+//                references go to the A1in FIFO, blocks referenced again
+//                after leaving it (found in A1out) go to the Am LRU
+//
+// Inputs       : s - the shard, p - the partition replacing its lines
+//                e - the entry referenced (hit)
+//                nde, blk - block to insert, ghost - its A1out entry (miss)
+// Outputs      : the inserted entry (miss), 0 when within capacity (shrink),
+//                the next victim (peek)
+
+static void sg2QHit( SG_cache_shard *s, SG_cache_part *p, int32_t e ) {
+    if ( (s->meta + e)->list == Q2_AM ){      // A1in hits are not promoted
+        sgCacheListRemove( s, e );
+        sgCacheListPushFront( s, Q2_AM, e );
+    }
+}
+
+static void sg2QReplace( SG_cache_shard *s, SG_cache_part *p ) {
+    uint32_t kin = p->capacity/4 ? p->capacity/4 : 1;
+    uint32_t kout = p->capacity/2 ? p->capacity/2 : 1;
+
+    if ( p->lists[Q2_A1IN].count > kin || p->lists[Q2_AM].count == 0 ){
+        sgCacheEvict( s, p->lists[Q2_A1IN].tail, Q2_A1OUT );
+        if ( p->lists[Q2_A1OUT].count > kout ){
+            sgCacheDrop( s, p->lists[Q2_A1OUT].tail );
+        }
+    } else {
+        sgCacheEvict( s, p->lists[Q2_AM].tail, SG_CACHE_NOLIST );
+    }
+}
+
+static int32_t sg2QMiss( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost ) {
+    if ( ghost != SG_CACHE_NIL ){       // take it off A1out before trimming it
+        sgCacheListRemove( s, ghost );
+    }
+    if ( p->used == p->capacity ){
+        sg2QReplace( s, p );
+    }
+    return( sgCacheInsert(s, p, nde, blk, ghost, (ghost != SG_CACHE_NIL) ? Q2_AM : Q2_A1IN) );
+}
+
+static int sg2QShrink( SG_cache_shard *s, SG_cache_part *p ) {
+    uint32_t kout = p->capacity/2 ? p->capacity/2 : 1;
+
+    if ( p->used > p->capacity && p->lists[Q2_A1IN].count+p->lists[Q2_AM].count > 0 ){
+        sg2QReplace( s, p );
+        return( 1 );
+    }
+    if ( p->lists[Q2_A1OUT].count > kout ){
+        sgCacheDrop( s, p->lists[Q2_A1OUT].tail );
+        return( 1 );
+    }
+    return( 0 );
+}
+
+static int32_t sg2QPeek( SG_cache_shard *s, SG_cache_part *p ) {
+    uint32_t kin = p->capacity/4 ? p->capacity/4 : 1;
+
+    if ( p->lists[Q2_A1IN].count > kin || p->lists[Q2_AM].count == 0 ){
+        return( p->lists[Q2_A1IN].tail );
+    }
+    return( p->lists[Q2_AM].tail );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgArcReplace
+// Description  : ARC REPLACE, evict from T1 or T2 depending on the target
+//
+// Inputs       : s - the shard, p - the partition replacing its lines
+//                inB2 - the request was a hit in the B2 ghost list
+// Outputs      : none
+
+static void sgArcReplace( SG_cache_shard *s, SG_cache_part *p, bool inB2 ) {
+    uint32_t t1 = p->lists[ARC_T1].count;
+
+    if ( p->used < p->capacity ){
+        return;
+    }
+    if ( t1 >= 1 && ((inB2 && t1 == p->arcTarget) || t1 > p->arcTarget || p->lists[ARC_T2].count == 0) ){
+        sgCacheEvict( s, p->lists[ARC_T1].tail, ARC_B1 );
+    } else {
+        sgCacheEvict( s, p->lists[ARC_T2].tail, ARC_B2 );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgArcHit / sgArcMiss / sgArcShrink / sgArcPeek
+// Description  : Adaptive replacement cache (Megiddo and Modha)
+//
+// Inputs       : s - the shard, p - the partition replacing its lines
+//                e - the entry referenced (hit)
+//                nde, blk - block to insert, ghost - its B1/B2 entry (miss)
+// Outputs      : the inserted entry (miss), 0 when within capacity (shrink),
+//                the next victim of a miss outside the ghost lists (peek)
+
+static void sgArcHit( SG_cache_shard *s, SG_cache_part *p, int32_t e ) {
+    sgCacheListRemove( s, e );
+    sgCacheListPushFront( s, ARC_T2, e );
+}
+
+static int32_t sgArcMiss( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost ) {
+    uint32_t c = p->capacity;
+    uint32_t b1 = p->lists[ARC_B1].count, b2 = p->lists[ARC_B2].count;
+
+    if ( ghost != SG_CACHE_NIL ){       // adapt the target, then refetch into T2
+        bool inB2 = ((s->meta + ghost)->list == ARC_B2);
+        if ( inB2 ){
+            uint32_t delta = (b1 > b2) ? b1/b2 : 1;
+            p->arcTarget = (p->arcTarget > delta) ? p->arcTarget-delta : 0;
+        } else {
+            uint32_t delta = (b2 > b1) ? b2/b1 : 1;
+            p->arcTarget = (p->arcTarget+delta < c) ? p->arcTarget+delta : c;
+        }
+        sgCacheListRemove( s, ghost );
+        sgArcReplace( s, p, inB2 );
+        return( sgCacheInsert(s, p, nde, blk, ghost, ARC_T2) );
+    }
+
+    uint32_t t1 = p->lists[ARC_T1].count, t2 = p->lists[ARC_T2].count;
+    if ( t1+b1 >= c ){       // more than c only after a partition's capacity fell
+        if ( t1 < c ){
+            sgCacheDrop( s, p->lists[ARC_B1].tail );
+            sgArcReplace( s, p, false );
+        } else {
+            sgCacheEvict( s, p->lists[ARC_T1].tail, SG_CACHE_NOLIST );
+        }
+    } else if ( t1+b1+t2+b2 >= c ){
+        if ( t1+b1+t2+b2 >= 2*c && b2 > 0 ){
+            sgCacheDrop( s, p->lists[ARC_B2].tail );
+        }
+        sgArcReplace( s, p, false );
+    }
+    return( sgCacheInsert(s, p, nde, blk, SG_CACHE_NIL, ARC_T1) );
+}
+
+static int sgArcShrink( SG_cache_shard *s, SG_cache_part *p ) {
+    uint32_t c = p->capacity;
+    uint32_t t1 = p->lists[ARC_T1].count, t2 = p->lists[ARC_T2].count;
+    uint32_t b1 = p->lists[ARC_B1].count, b2 = p->lists[ARC_B2].count;
+
+    if ( p->arcTarget > c ){
+        p->arcTarget = c;
+    }
+    if ( p->used > c && t1+t2 > 0 ){
+        sgArcReplace( s, p, false );
+    } else if ( t1+b1 > c && b1 > 0 ){      // ARC keeps T1+B1 within c ...
+        sgCacheDrop( s, p->lists[ARC_B1].tail );
+    } else if ( t1+t2+b1+b2 > 2*c && b2 > 0 ){  // ... and everything within 2c
+        sgCacheDrop( s, p->lists[ARC_B2].tail );
+    } else {
+        return( 0 );
+    }
+    return( 1 );
+}
+
+static int32_t sgArcPeek( SG_cache_shard *s, SG_cache_part *p ) {
+    uint32_t t1 = p->lists[ARC_T1].count;
+
+    if ( t1 >= 1 && (t1 > p->arcTarget || p->lists[ARC_T2].count == 0) ){
+        return( p->lists[ARC_T1].tail );
+    }
+    return( p->lists[ARC_T2].tail );
+}
+
+//
+// Cache support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheStore
+// Description  : Insert or update a block, writing back (or demoting) any
+//                victim before the shard is unlocked.  A changed block's
+//                lower tier copies are dropped.  A block stored into a
+//                reserved line is stashed until the reservation ends.  A
+//                fill only takes a line if admitted, as a read miss would.
+//
+// Inputs       : nde - node ID
+//                blk - block ID
+//                block - block to insert into cache
+//                dirty - the block is newer than its remote copy
+//                fill - only insert, never replace a cached copy
+//                ptr - where to return the line, may be NULL (left alone
+//                      if the fill was not admitted)
+// Outputs      : 0 if successful (or not admitted), -1 if failure
+
+static int sgCacheStore( SG_Node_ID nde, SG_Block_ID blk, char *block, bool dirty, bool fill, char **ptr ) {
+    if ( cacheShards == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] putSGDataBlock: cache not initialized." );
+        return( -1 );
+    }
+
+    uint64_t h = sgCacheHash( nde, blk );
+    SG_cache_shard * s = sgCacheShard( h );
+    pthread_mutex_lock( &s->lock );
+    sgCacheDrainAccesses( s );
+    sgCacheFlightRoom( s, SG_CACHE_MAX_WRITEBACKS );
+    sgCacheWriteBegin( s );
+
+    if ( cacheAdmission ){
+        sgCacheSketchAdd( s, h );
+    }
+    int32_t e = sgCacheFind( s, h, nde, blk );
+    bool reserved = ( e != SG_CACHE_NIL && (s->keys + e)->filling ), rejected = false;
+    if ( reserved ){
+        if ( !fill && sgCacheStash(s, e, block) ){
+            e = SG_CACHE_NIL;
+        }
+    } else if ( e != SG_CACHE_NIL && (s->keys + e)->slot != SG_CACHE_NIL ){
+        if ( !fill ){
+            logMessage( LOG_INFO_LEVEL, "[Cache] putSGDataBlock: blk found and updating blk [%lu]", blk );  // updating blk
+            sgCacheCopyIn( s->data[(s->keys + e)->slot], block );
+        }
+    } else if ( fill && !sgCacheAdmit(s, h, e) ){
+        e = SG_CACHE_NIL;
+        rejected = true;
+    } else if ( (e = sgCacheMiss(s, nde, blk, e)) != SG_CACHE_NIL ){
+        sgCacheCopyIn( s->data[(s->keys + e)->slot], block );
+        logMessage( LOG_INFO_LEVEL, "[Cache] putSGDataBlock: inserting new blk [%lu] to cache, shard status: [%d] lines used. ", blk, s->used );
+    }
+    if ( e != SG_CACHE_NIL && dirty ){
+        (s->meta + e)->dirty = 1;
+    }
+    if ( e != SG_CACHE_NIL && ptr != NULL && !reserved ){
+        *ptr = s->data[(s->keys + e)->slot];
+    }
+    if ( !fill ){
+        dropSGVictimBlock( nde, blk );
+        dropSGL2Block( nde, blk );
+    }
+
+    sgCacheWriteEnd( s );
+    int wbret = sgCacheWriteBackPending( s );
+    pthread_mutex_unlock( &s->lock );
+    if ( e == SG_CACHE_NIL && !rejected ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] putSGDataBlock: no cache entry available for blk [%lu]", blk );
+        return( -1 );
+    }
+
+    // Return successfully
+    return( wbret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCachePromote
+// Description  : Bring a block back after a miss, from its write back if
+//                it is on its way out, otherwise from the victim or second
+//                tier; it is cached again only if admitted
+//
+// Inputs       : nde - node ID
+//                blk - block ID
+//                block - buffer to read the block into
+//                ptr - where to return its line, may be NULL
+// Outputs      : 0 if a tier had the block, -1 if not
+
+static int sgCachePromote( SG_Node_ID nde, SG_Block_ID blk, char *block, char **ptr ) {
+    SG_cache_shard * s = sgCacheShard( sgCacheHash(nde, blk) );
+    pthread_mutex_lock( &s->lock );
+    int f = sgCacheFlightFind( s, nde, blk, -1 );
+    if ( f >= 0 ){
+        memcpy( block, s->flights[f].data, SG_BLOCK_SIZE );
+    }
+    pthread_mutex_unlock( &s->lock );
+    if ( f < 0 && getSGVictimBlock(nde, blk, block) && getSGL2Block(nde, blk, block) ){
+        return( -1 );
+    }
+    sgCacheStore( nde, blk, block, false, true, ptr );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheWriteBackPending
+// Description  : Demote the clean blocks evicted by the last change to the
+//                lower tiers and write back the dirty ones (lock held, but
+//                released while they are posted)
+//
+// Inputs       : s - the shard
+// Outputs      : 0 if successful, -1 if any write back failed
+
+static int sgCacheWriteBackPending( SG_cache_shard *s ) {
+    uint8_t pending[SG_CACHE_MAX_WRITEBACKS];
+    uint32_t count = s->wbCount;
+    int ret = 0;
+
+    memcpy( pending, s->wbFlight, count );
+    s->wbCount = 0;
+    if ( count == 2 && (int32_t)(s->flights[pending[0]].seq - s->flights[pending[1]].seq) > 0 ){
+        pending[0] = s->wbFlight[1];    // oldest first, as every thread posts them
+        pending[1] = s->wbFlight[0];
+    }
+    for ( uint32_t i=0; i<count; i++ ){
+        SG_cache_flight * f = s->flights + pending[i];
+        if ( f->dirty && sgCacheFlightPost(s, pending[i]) ){
+            logMessage( LOG_ERROR_LEVEL, "[Cache] write back of evicted blk [%lu] failed.", f->blk );
+            sgCacheFlightRedirty( s, pending[i] );
+            ret = -1;
+        } else if ( sgCacheDemoting() ){
+            sgCacheDemote( f->node, f->blk, f->data );
+        }
+        sgCacheFlightEnd( s, pending[i] );
+    }
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheFlushLine
+// Description  : Write back a dirty line (lock held, but released while it
+//                is posted).  The line is clean while its write back is out
+//                and marked dirty again if the write back fails.
+//
+// Inputs       : s - the shard, with room for a flight
+//                e - the line
+// Outputs      : 0 if successful, -1 if failure
+
+static int sgCacheFlushLine( SG_cache_shard *s, int32_t e ) {
+    SG_cache_key * key = s->keys + e;
+    int ret = 0;
+
+    int f = sgCacheFlightTake( s, key->node_ID, key->blk_ID, true, s->data[key->slot] );
+    if ( f < 0 ){
+        return( -1 );
+    }
+    (s->meta + e)->dirty = 0;
+    if ( (ret = sgCacheFlightPost(s, f)) && !sgCacheFlightRedirty(s, f) ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] blk [%lu] evicted while its write back failed.", s->flights[f].blk );
+    }
+    sgCacheFlightEnd( s, f );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheFlightRoom / sgCacheFlightTake / sgCacheFlightFind
+// Description  : Wait until a shard has room for n more flights, take one
+//                for a block, find the latest one of a block (lock held)
+//
+// Inputs       : s - the shard
+//                n - flights needed (room)
+//                nde, blk - the block (take, find)
+//                dirty - it is to be written back, not demoted (take)
+//                block - its data (take)
+//                before - only flights taken before this one, -1 for any (find)
+// Outputs      : the flight, -1 if there is none free (take) or none of
+//                the block (find)
+
+static void sgCacheFlightRoom( SG_cache_shard *s, uint32_t n ) {
+    for (;;){
+        uint32_t free = 0;
+        for ( int f=0; f<SG_CACHE_MAX_FLIGHTS; f++ ){
+            free += !s->flights[f].used;
+        }
+        if ( free >= n ){
+            return;
+        }
+        pthread_cond_wait( &s->flightDone, &s->lock );
+    }
+}
+
+static int sgCacheFlightTake( SG_cache_shard *s, SG_Node_ID nde, SG_Block_ID blk, bool dirty, const char *block ) {
+    for ( int f=0; f<SG_CACHE_MAX_FLIGHTS; f++ ){
+        SG_cache_flight * fl = s->flights + f;
+        if ( !fl->used ){
+            fl->node = nde;
+            fl->blk = blk;
+            fl->seq = s->flightSeq++;
+            fl->used = 1;
+            fl->dirty = dirty;
+            memcpy( fl->data, block, SG_BLOCK_SIZE );
+            return( f );
+        }
+    }
+    return( -1 );
+}
+
+static int sgCacheFlightFind( SG_cache_shard *s, SG_Node_ID nde, SG_Block_ID blk, int before ) {
+    int found = -1;
+    for ( int f=0; f<SG_CACHE_MAX_FLIGHTS; f++ ){
+        SG_cache_flight * fl = s->flights + f;
+        if ( !fl->used || fl->node != nde || fl->blk != blk ||
+             (before >= 0 && (int32_t)(fl->seq - s->flights[before].seq) >= 0) ){
+            continue;
+        }
+        if ( found < 0 || (int32_t)(fl->seq - s->flights[found].seq) > 0 ){
+            found = f;
+        }
+    }
+    return( found );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheFlightPost / sgCacheFlightRedirty / sgCacheFlightEnd
+// Description  : Write a flight's block back once the ones of the same
+//                block taken before it have ended, with the shard unlocked
+//                (lock held on entry and return); mark its block dirty
+//                again after a failed write back, if it is (back) in the
+//                cache; end a flight
+//
+// Inputs       : s - the shard
+//                f - the flight
+// Outputs      : 0 if successful, -1 if the write back failed (post),
+//                whether the block was cached (redirty)
+
+static int sgCacheFlightPost( SG_cache_shard *s, int f ) {
+    SG_cache_flight * fl = s->flights + f;
+
+    while ( sgCacheFlightFind(s, fl->node, fl->blk, f) >= 0 ){
+        pthread_cond_wait( &s->flightDone, &s->lock );
+    }
+    pthread_mutex_unlock( &s->lock );
+    int ret = cacheWriteBack( fl->node, fl->blk, fl->data );
+    pthread_mutex_lock( &s->lock );
+    return( ret ? -1 : 0 );
+}
+
+static bool sgCacheFlightRedirty( SG_cache_shard *s, int f ) {
+    SG_cache_flight * fl = s->flights + f;
+    int32_t e = sgCacheFind( s, sgCacheHash(fl->node, fl->blk), fl->node, fl->blk );
+    if ( e == SG_CACHE_NIL || (s->keys + e)->slot == SG_CACHE_NIL || (s->keys + e)->filling ){
+        return( false );
+    }
+    (s->meta + e)->dirty = 1;
+    return( true );
+}
+
+static void sgCacheFlightEnd( SG_cache_shard *s, int f ) {
+    s->flights[f].used = 0;
+    pthread_cond_broadcast( &s->flightDone );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheStash / sgCacheUnstash
+// Description  : Hold a block stored into a reserved line, and put it in
+//                the line once the reservation ends (lock held)
+//
+// Inputs       : s - the shard
+//                e - the reserved entry
+//                block - the block stored (stash)
+// Outputs      : 0 if successful, -1 if failure (stash)
+
+static int sgCacheStash( SG_cache_shard *s, int32_t e, const char *block ) {
+    SG_cache_key * key = s->keys + e;
+    uint32_t i;
+
+    for ( i=0; i<s->stashCount && (s->stash[i].node != key->node_ID || s->stash[i].blk != key->blk_ID); i++ );
+    if ( i == s->stashRoom ){
+        uint32_t room = s->stashRoom ? s->stashRoom*2 : 4;
+        SG_cache_stash * grown = realloc( s->stash, sizeof(SG_cache_stash)*room );
+        if ( grown == NULL ){
+            logMessage( LOG_ERROR_LEVEL, "[Cache] failed to stash blk [%lu] stored while it was reserved.", key->blk_ID );
+            return( -1 );
+        }
+        s->stash = grown;
+        s->stashRoom = room;
+    }
+    if ( i == s->stashCount ){
+        s->stash[i].node = key->node_ID;
+        s->stash[i].blk = key->blk_ID;
+        s->stashCount += 1;
+    }
+    memcpy( s->stash[i].data, block, SG_BLOCK_SIZE );
+    (s->meta + e)->stashed = 1;
+    logMessage( LOG_INFO_LEVEL, "[Cache] putSGDataBlock: blk [%lu] is being filled, stashing it", key->blk_ID );
+    return( 0 );
+}
+
+static void sgCacheUnstash( SG_cache_shard *s, int32_t e ) {
+    SG_cache_key * key = s->keys + e;
+
+    if ( !(s->meta + e)->stashed ){
+        return;
+    }
+    for ( uint32_t i=0; i<s->stashCount; i++ ){
+        if ( s->stash[i].node == key->node_ID && s->stash[i].blk == key->blk_ID ){
+            sgCacheCopyIn( s->data[key->slot], s->stash[i].data );
+            s->stash[i] = s->stash[--s->stashCount];
+            break;
+        }
+    }
+    (s->meta + e)->stashed = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheDemoting / sgCacheDemote
+// Description  : Whether evicted clean blocks go anywhere, and send one
+//                there: the victim tier if it keeps the block, otherwise
+//                the second tier
+//
+// Inputs       : nde - node ID (demote)
+//                blk - block ID (demote)
+//                block - the evicted block (demote)
+// Outputs      : true if there is a lower tier (demoting)
+
+static bool sgCacheDemoting( void ) {
+    return( sgVictimActive() || sgL2Active() );
+}
+
+static void sgCacheDemote( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    if ( putSGVictimBlock(nde, blk, block) ){
+        putSGL2Block( nde, blk, block );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheSketchAdd / sgCacheSketchCount
+// Description  : TinyLFU frequency sketch (lock held): a count-min sketch
+//                of small saturating counters, all halved once the shard
+//                has seen SG_CACHE_SKETCH_WINDOW references per line so old
+//                popularity fades
+//
+// Inputs       : s - the shard
+//                h - hash of the block
+// Outputs      : the estimated recent references to the block (count)
+
+static void sgCacheSketchAdd( SG_cache_shard *s, uint64_t h ) {
+    uint64_t x = h ^ (h >> 29);
+    for ( uint32_t r=0; r<SG_CACHE_SKETCH_ROWS; r++ ){
+        x *= 0xbf58476d1ce4e5b9ULL;
+        uint8_t * c = s->sketch + (size_t)r*(s->sketchMask+1) + ((x >> 32) & s->sketchMask);
+        if ( *c < SG_CACHE_SKETCH_MAX ){
+            *c += 1;
+        }
+    }
+    if ( ++s->sketchAdds >= SG_CACHE_SKETCH_WINDOW*s->capacity ){
+        for ( size_t i=0; i<(size_t)SG_CACHE_SKETCH_ROWS*(s->sketchMask+1); i++ ){
+            s->sketch[i] >>= 1;
+        }
+        s->sketchAdds /= 2;
+    }
+}
+
+static uint32_t sgCacheSketchCount( SG_cache_shard *s, uint64_t h ) {
+    uint64_t x = h ^ (h >> 29);
+    uint32_t count = SG_CACHE_SKETCH_MAX;
+    for ( uint32_t r=0; r<SG_CACHE_SKETCH_ROWS; r++ ){
+        x *= 0xbf58476d1ce4e5b9ULL;
+        uint8_t c = s->sketch[(size_t)r*(s->sketchMask+1) + ((x >> 32) & s->sketchMask)];
+        count = ( c < count ) ? c : count;
+    }
+    return( count );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheAdmit
+// Description  : Decide whether a missed block may take a line (lock held):
+//                always while the shard has room or when the policy still
+//                remembers the block (a ghost), otherwise only if the
+//                sketch says it is hotter than the line it would evict
+//
+// Inputs       : s - the shard
+//                h - hash of the block
+//                ghost - its ghost entry, or SG_CACHE_NIL
+// Outputs      : true if it should be cached
+
+static bool sgCacheAdmit( SG_cache_shard *s, uint64_t h, int32_t ghost ) {
+    if ( !cacheAdmission || ghost != SG_CACHE_NIL || s->used < s->capacity ){
+        return( true );
+    }
+    SG_cache_part * q = sgCacheVictimPart( s, sgCacheThreadPart(s) );
+    if ( q == NULL ){
+        return( true );
+    }
+    q->capacity = sgCachePartAllowance( s, q );
+    int32_t victim = sgCachePolicies[cachePolicy].peek( s, q );
+    if ( victim == SG_CACHE_NIL ){
+        return( true );
+    }
+    s->contested += 1;
+    SG_cache_key * key = s->keys + victim;
+    if ( sgCacheSketchCount(s, h) > sgCacheSketchCount(s, sgCacheHash(key->node_ID, key->blk_ID)) ){
+        return( true );
+    }
+    s->rejected += 1;
+    return( false );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheMiss
+// Description  : Insert a missed block for the calling thread's partition
+//                (lock held).  A partition may fill the shard's idle lines
+//                up to its maximum; once the shard is full it replaces its
+//                own lines, unless it is below its guaranteed minimum, when
+//                it takes a line back from the partition furthest over its
+//                own minimum.
+//
+// Inputs       : s - the shard
+//                nde - node ID
+//                blk - block ID
+//                ghost - the block's ghost entry, or SG_CACHE_NIL
+// Outputs      : the entry or SG_CACHE_NIL if none is available
+
+static int32_t sgCacheMiss( SG_cache_shard *s, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost ) {
+    SG_cache_part * p = sgCacheThreadPart( s );
+
+    if ( ghost != SG_CACHE_NIL && (s->keys + ghost)->part != p->id ){
+        sgCacheDrop( s, ghost );    // another partition's history of the block
+        ghost = SG_CACHE_NIL;
+    }
+    if ( s->used >= s->capacity ){
+        SG_cache_part * q = sgCacheVictimPart( s, p );
+        if ( q != NULL && q != p && q->used > q->filling ){
+            q->capacity = q->used-1;
+            sgCachePolicies[cachePolicy].shrink( s, q );
+        }
+    }
+    p->capacity = sgCachePartAllowance( s, p );
+    if ( p->capacity < p->used ){       // never more than one eviction here
+        p->capacity = p->used;
+    }
+    if ( p->capacity == 0 || (p->used == p->capacity && p->used == p->filling) ){
+        return( SG_CACHE_NIL );     // nothing it could replace, every line is being filled
+    }
+    while ( ghost == SG_CACHE_NIL && s->freeEntry == SG_CACHE_NIL && sgCacheDropGhost(s) );
+    return( sgCachePolicies[cachePolicy].miss(s, p, nde, blk, ghost) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheShare / sgCachePartAllowance / sgCacheThreadPart
+// Description  : A shard's share of some number of lines, how many lines a
+//                partition may hold in a shard right now (its own and the
+//                idle ones, within its maximum) and the partition charged
+//                for the calling thread's misses
+//
+// Inputs       : s - the shard
+//                lines - lines over the whole cache (share)
+//                p - the partition (allowance)
+// Outputs      : the lines, the partition
+
+static uint32_t sgCacheShare( SG_cache_shard *s, uint32_t lines ) {
+    uint32_t i = s - cacheShards;
+    return( lines/cacheShardCount + (i < lines%cacheShardCount ? 1 : 0) );
+}
+
+static uint32_t sgCachePartAllowance( SG_cache_shard *s, SG_cache_part *p ) {
+    uint32_t others = s->used - p->used;
+    uint32_t allow = (s->capacity > others) ? s->capacity-others : 0;
+    uint32_t max = sgCacheShare( s, cachePartitions[p->id].maxLines );
+    max = max ? max : 1;
+    return( (allow < max) ? allow : max );
+}
+
+static SG_cache_part * sgCacheThreadPart( SG_cache_shard *s ) {
+    return( s->parts + ((cacheThreadPartition < cachePartitionCount) ? cacheThreadPartition : 0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheVictimPart
+// Description  : Pick the partition to give up a line of a full shard (lock
+//                held): the one asking, if it holds at least its minimum,
+//                otherwise the one furthest over its minimum
+//
+// Inputs       : s - the shard
+//                p - the partition needing a line, NULL when shrinking
+// Outputs      : the partition, NULL if the shard holds no lines
+
+static SG_cache_part * sgCacheVictimPart( SG_cache_shard *s, SG_cache_part *p ) {
+    SG_cache_part * victim = NULL;
+    long most = 0;
+
+    if ( p != NULL && p->used > 0 && p->used >= sgCacheShare(s, cachePartitions[p->id].minLines) ){
+        return( p );
+    }
+    for ( uint32_t i=0; i<cachePartitionCount; i++ ){
+        SG_cache_part * q = s->parts + i;
+        long over = (long)q->used - (long)sgCacheShare( s, cachePartitions[i].minLines );
+        if ( q->used > 0 && (victim == NULL || over > most) ){
+            victim = q;
+            most = over;
+        }
+    }
+    return( victim );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheShardTrim / sgCacheShrinkStep
+// Description  : Evict down to the shard capacity and the partition
+//                maximums, then trim the ghosts to match (lock held),
+//                writing back as it goes; a step evicts or drops one entry
+//
+// Inputs       : s - the shard
+// Outputs      : 0 if successful, -1 if a write back failed (trim),
+//                0 when there is nothing left to do (step)
+
+static int sgCacheShardTrim( SG_cache_shard *s ) {
+    int ret = 0;
+
+    for ( int more=1; more; ){
+        sgCacheFlightRoom( s, SG_CACHE_MAX_WRITEBACKS );
+        sgCacheWriteBegin( s );
+        more = sgCacheShrinkStep( s );
+        sgCacheWriteEnd( s );
+        if ( sgCacheWriteBackPending(s) ){
+            ret = -1;
+        }
+    }
+    return( ret );
+}
+
+static int sgCacheShrinkStep( SG_cache_shard *s ) {
+    if ( s->used > s->capacity ){
+        SG_cache_part * q = sgCacheVictimPart( s, NULL );
+        uint32_t over = s->used - s->capacity;
+        q->capacity = q->used - ((over < q->used) ? over : q->used);
+        if ( sgCachePolicies[cachePolicy].shrink(s, q) ){
+            return( 1 );
+        }
+    }
+    for ( uint32_t i=0; i<cachePartitionCount; i++ ){
+        SG_cache_part * p = s->parts + i;
+        p->capacity = sgCachePartAllowance( s, p );
+        if ( sgCachePolicies[cachePolicy].shrink(s, p) ){
+            return( 1 );
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheDropGhost
+// Description  : Forget the oldest ghost of the longest ghost list (lock
+//                held).  Partitions size their ghost lists by what they
+//                may hold, which together can run past the entries a shard
+//                has; this makes room.
+//
+// Inputs       : s - the shard
+// Outputs      : 1 if a ghost was dropped, 0 if there were none
+
+static int sgCacheDropGhost( SG_cache_shard *s ) {
+    int32_t victim = SG_CACHE_NIL;
+    uint32_t longest = 0;
+
+    for ( uint32_t i=0; i<cachePartitionCount; i++ ){
+        for ( int l=0; l<SG_CACHE_LISTS; l++ ){
+            SG_cache_list * list = &s->parts[i].lists[l];
+            if ( list->tail != SG_CACHE_NIL && (s->keys + list->tail)->slot == SG_CACHE_NIL && list->count > longest ){
+                victim = list->tail;
+                longest = list->count;
+            }
+        }
+    }
+    if ( victim == SG_CACHE_NIL ){
+        return( 0 );
+    }
+    sgCacheDrop( s, victim );
+    return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheHash / sgCacheShard
+// Description  : Hash a (node, block) pair; the top bits pick the shard and
+//                the low bits the bucket within it
+//
+// Inputs       : nde - node ID, blk - block ID (hash)
+//                h - the hash (shard)
+// Outputs      : the hash, the shard
+
+static uint64_t sgCacheHash( SG_Node_ID nde, SG_Block_ID blk ) {
+    uint64_t h = nde * 0x9e3779b97f4a7c15ULL ^ blk;     // 64-bit finalizer (splitmix)
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return( h );
+}
+
+static SG_cache_shard * sgCacheShard( uint64_t h ) {
+    return( (cacheShardCount > 1) ? cacheShards + (h >> cacheShardShift) : cacheShards );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheShardBytes / sgCacheShardInit / sgCacheShardFree
+// Description  : Allocate (release) the lines and index of one shard from
+//                the cache arena, with room to grow to lineLimit lines;
+//                sgCacheShardBytes is what that can take
+//
+// Inputs       : s - the shard
+//                capacity - lines the shard holds
+//                lineLimit - lines the shard may grow to
+// Outputs      : 0 if successful, -1 if failure (init), bytes (bytes)
+
+static size_t sgCacheShardBytes( uint32_t lineLimit ) {
+    // Ghost entries (2Q, ARC) remember up to one more shard worth of blocks
+    uint32_t entries = lineLimit*2;
+    uint32_t buckets = 1;
+    while ( buckets < entries ){     // size the index so the chains stay short
+        buckets <<= 1;
+    }
+    return( sgArenaSpan(sizeof(SG_cache_key)*entries, 64) + sgArenaSpan(sizeof(SG_cache_meta)*entries, 64) +
+            sgArenaSpan(sizeof(int32_t)*buckets, 64) + sgArenaSpan(sizeof(int32_t)*lineLimit, 64) +
+            sgArenaSpan((size_t)SG_BLOCK_SIZE*lineLimit, SG_ARENA_PAGE_SIZE) + 
+            sgArenaSpan((size_t)SG_CACHE_SKETCH_ROWS*buckets/2, 64) );
+}
+
+static int sgCacheShardInit( SG_cache_shard *s, uint32_t capacity, uint32_t lineLimit ) {
+    uint32_t entries = lineLimit*2;
+    uint32_t buckets = 1;
+    while ( buckets < entries ){
+        buckets <<= 1;
+    }
+    s->keys = allocSGArena( &cacheArena, sizeof(SG_cache_key)*entries, 64 );
+    s->meta = allocSGArena( &cacheArena, sizeof(SG_cache_meta)*entries, 64 );
+    s->buckets = allocSGArena( &cacheArena, sizeof(int32_t)*buckets, 64 );
+    s->freeSlots = allocSGArena( &cacheArena, sizeof(int32_t)*lineLimit, 64 );
+    s->data = allocSGArena( &cacheArena, (size_t)SG_BLOCK_SIZE*lineLimit, SG_ARENA_PAGE_SIZE );
+    s->sketch = allocSGArena( &cacheArena, (size_t)SG_CACHE_SKETCH_ROWS*buckets/2, 64 );
+    if ( s->keys == NULL || s->meta == NULL || s->data == NULL || s->freeSlots == NULL || s->buckets == NULL ||
+         s->sketch == NULL ){
+        return( -1 );
+    }
+    s->sketchMask = buckets/2 - 1;      // a counter per line in each row
+    s->sketchAdds = 0;
+    s->contested = s->rejected = 0;
+    s->lineLimit = lineLimit;
+    s->entryLimit = entries;
+    s->bucketLimit = buckets;
+
+    // Only set up what the current capacity needs, resizing adds the rest
+    s->entryCount = 0;
+    s->freeEntry = SG_CACHE_NIL;
+    s->freeSlotCount = 0;
+    s->capacity = 0;
+    s->bucketMask = 0;
+    for ( int p=0; p<SG_CACHE_MAX_PARTITIONS; p++ ){
+        SG_cache_part * part = s->parts + p;
+        for ( int l=0; l<SG_CACHE_LISTS; l++ ){
+            part->lists[l].head = part->lists[l].tail = SG_CACHE_NIL;
+            part->lists[l].count = 0;
+        }
+        part->capacity = part->used = part->filling = part->arcTarget = 0;
+        part->id = p;
+    }
+    s->used = 0;
+    s->wbCount = 0;
+    for ( int f=0; f<SG_CACHE_MAX_FLIGHTS; f++ ){
+        s->flights[f].used = 0;
+    }
+    s->stash = NULL;
+    s->stashCount = s->stashRoom = 0;
+    pthread_mutex_init( &s->lock, NULL );
+    pthread_cond_init( &s->flightDone, NULL );
+    return( sgCacheShardResize(s, capacity) );
+}
+
+static void sgCacheShardFree( SG_cache_shard *s ) {
+    // The memory goes back with the arena
+    s->keys = NULL;
+    s->meta = NULL;
+    s->data = NULL;
+    s->freeSlots = NULL;
+    s->buckets = NULL;
+    free( s->stash );
+    s->stash = NULL;
+    s->stashCount = s->stashRoom = 0;
+    pthread_cond_destroy( &s->flightDone );
+    pthread_mutex_destroy( &s->lock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheShardResize
+// Description  : Change the capacity of a shard (lock held).  Growing adds
+//                the slots, entries and buckets the new lines need; shrinking
+//                has the policy evict and trim its ghosts, writing back as it
+//                goes, then packs the remaining lines into the front of the
+//                slab and releases the rest.
+//
+// Inputs       : s - the shard
+//                capacity - the new capacity, at most lineLimit
+// Outputs      : 0 if successful, -1 if a write back failed
+
+static int sgCacheShardResize( SG_cache_shard *s, uint32_t capacity ) {
+    int ret = 0;
+
+    if ( capacity >= s->capacity ){
+        sgCacheWriteBegin( s );
+        for ( uint32_t e=s->entryCount; e<capacity*2; e++ ){
+            (s->meta + e)->list = SG_CACHE_NOLIST;
+            (s->meta + e)->next = s->freeEntry;
+            (s->keys + e)->slot = SG_CACHE_NIL;
+            s->freeEntry = e;
+        }
+        if ( s->entryCount < capacity*2 ){
+            s->entryCount = capacity*2;
+        }
+        uint32_t buckets = s->bucketMask+1;
+        while ( buckets < s->entryCount ){
+            buckets <<= 1;
+        }
+        if ( buckets != s->bucketMask+1 || s->capacity == 0 ){
+            sgCacheRehash( s, buckets );
+        }
+        s->capacity = capacity;
+        sgCacheCompactSlots( s );
+        sgCacheWriteEnd( s );
+        return( 0 );
+    }
+
+    s->capacity = capacity;
+    ret = sgCacheShardTrim( s );
+    sgCacheWriteBegin( s );
+    uint32_t inUse = sgCacheCompactSlots( s );
+    sgCacheWriteEnd( s );
+    releaseSGArena( &cacheArena, s->data[inUse], (size_t)(s->lineLimit-inUse)*SG_BLOCK_SIZE );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheRehash
+// Description  : Rebuild the hash index over a new number of buckets
+//                (lock held, inside a write)
+//
+// Inputs       : s - the shard
+//                buckets - the new number of buckets, a power of two
+// Outputs      : none
+
+static void sgCacheRehash( SG_cache_shard *s, uint32_t buckets ) {
+    for ( uint32_t i=0; i<buckets; i++ ){
+        s->buckets[i] = SG_CACHE_NIL;
+    }
+    s->bucketMask = buckets-1;
+    for ( uint32_t e=0; e<s->entryCount; e++ ){
+        // Hashed entries are on a policy list or being filled
+        if ( (s->meta + e)->list != SG_CACHE_NOLIST || (s->keys + e)->filling ){
+            uint64_t h = sgCacheHash( (s->keys + e)->node_ID, (s->keys + e)->blk_ID );
+            (s->keys + e)->hnext = s->buckets[h & s->bucketMask];
+            s->buckets[h & s->bucketMask] = e;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheCompactSlots
+// Description  : Move lines sitting past the capacity into free slots below
+//                it and rebuild the free slot stack (lock held, inside a
+//                write).  Lines being filled keep their slot, the caller
+//                is writing into it.
+//
+// Inputs       : s - the shard
+// Outputs      : slots from the start of the slab that may still be in use
+
+static uint32_t sgCacheCompactSlots( SG_cache_shard *s ) {
+    int32_t * inUse = s->freeSlots;     // reused as a map of the slots in use
+    uint32_t low = 0, high = s->capacity;
+
+    memset( inUse, 0, sizeof(int32_t)*s->lineLimit );
+    for ( uint32_t e=0; e<s->entryCount; e++ ){
+        if ( (s->keys + e)->slot != SG_CACHE_NIL ){
+            inUse[(s->keys + e)->slot] = 1;
+        }
+    }
+    for ( uint32_t e=0; e<s->entryCount; e++ ){
+        int32_t slot = (s->keys + e)->slot;
+        if ( slot == SG_CACHE_NIL || (uint32_t)slot < s->capacity ){
+            continue;
+        }
+        while ( low < s->capacity && inUse[low] ){
+            low += 1;
+        }
+        if ( (s->keys + e)->filling || low == s->capacity ){
+            high = ((uint32_t)slot+1 > high) ? (uint32_t)slot+1 : high;
+            continue;
+        }
+        sgCacheCopyIn( s->data[low], s->data[slot] );
+        inUse[slot] = 0;
+        inUse[low] = 1;
+        (s->keys + e)->slot = low;
+    }
+
+    // Rebuilding in place is safe, the stack never gets ahead of the scan
+    s->freeSlotCount = 0;
+    for ( uint32_t i=0; i<s->capacity; i++ ){
+        if ( !inUse[i] ){
+            s->freeSlots[s->freeSlotCount++] = i;
+        }
+    }
+    return( high );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheLookup
+// Description  : Find a resident block without the shard lock, copying the
+//                requested bytes out (or returning the block pointer) and
+//                queueing the hit for the policy
+//
+// Inputs       : s - the shard
+//                h - hash of the block
+//                nde - node ID to find
+//                blk - block ID to find
+//                buf, off, len - where and what to copy, buf may be NULL
+//                ptr - where to return a pointer to the block, may be NULL
+// Outputs      : entry index or SG_CACHE_NIL if not cached
+
+static int32_t sgCacheLookup( SG_cache_shard *s, uint64_t h, SG_Node_ID nde, SG_Block_ID blk,
+        char *buf, size_t off, size_t len, char **ptr ) {
+    int32_t e = SG_CACHE_NIL;
+    uint32_t gen = 0;
+
+    atomic_fetch_add_explicit( &s->queries, 1, memory_order_relaxed );
+    atomic_fetch_add_explicit( &cachePartitions[cacheThreadPartition].queries, 1, memory_order_relaxed );
+    recordSGMrc( h );
+    for ( int attempt=0; attempt<SG_CACHE_READ_RETRIES; attempt++ ){
+        unsigned int v = atomic_load_explicit( &s->version, memory_order_acquire );
+        if ( v & 1 ){
+            continue;       // a writer is in the middle of a change
+        }
+
+        // Walk the chain defensively, it may be changing underneath us
+        uint32_t mask = atomic_load_explicit( &s->bucketMask, memory_order_relaxed );
+        e = atomic_load_explicit( &s->buckets[h & mask], memory_order_relaxed );
+        for ( uint32_t steps=0; e != SG_CACHE_NIL; steps++ ){
+            if ( e < 0 || (uint32_t)e >= s->entryLimit || steps >= s->entryLimit ){
+                e = SG_CACHE_NIL;
+                break;
+            }
+            SG_cache_key * key = s->keys + e;
+            if ( atomic_load_explicit(&key->node_ID, memory_order_relaxed) == nde &&
+                 atomic_load_explicit(&key->blk_ID, memory_order_relaxed) == blk ){
+                break;
+            }
+            e = atomic_load_explicit( &key->hnext, memory_order_relaxed );
+        }
+        int32_t slot = SG_CACHE_NIL;
+        if ( e != SG_CACHE_NIL && !atomic_load_explicit(&(s->keys + e)->filling, memory_order_relaxed) ){
+            slot = atomic_load_explicit( &(s->keys + e)->slot, memory_order_relaxed );
+        }
+        if ( slot >= 0 && (uint32_t)slot < s->lineLimit ){
+            gen = atomic_load_explicit( &(s->keys + e)->gen, memory_order_relaxed );
+            if ( buf != NULL ){
+                sgCacheCopyOut( buf, s->data[slot], off, len );
+            }
+            if ( ptr != NULL ){
+                *ptr = s->data[slot];
+            }
+        } else {
+            e = SG_CACHE_NIL;
+        }
+
+        // Nothing read above may be used unless no writer got in meanwhile
+        atomic_thread_fence( memory_order_acquire );
+        if ( atomic_load_explicit(&s->version, memory_order_relaxed) == v ){
+            if ( e != SG_CACHE_NIL ){
+                atomic_fetch_add_explicit( &s->hits, 1, memory_order_relaxed );
+                atomic_fetch_add_explicit( &cachePartitions[cacheThreadPartition].hits, 1, memory_order_relaxed );
+                sgCacheRecordAccess( s, e, gen );
+            }
+            return( e );
+        }
+    }
+
+    // Writers kept getting in the way, take the lock
+    pthread_mutex_lock( &s->lock );
+    sgCacheDrainAccesses( s );
+    e = sgCacheFind( s, h, nde, blk );
+    if ( e != SG_CACHE_NIL && (s->keys + e)->slot != SG_CACHE_NIL && !(s->keys + e)->filling ){
+        if ( buf != NULL ){
+            memcpy( buf, s->data[(s->keys + e)->slot]+off, len );
+        }
+        if ( ptr != NULL ){
+            *ptr = s->data[(s->keys + e)->slot];
+        }
+        sgCachePolicies[cachePolicy].hit( s, s->parts + (s->keys + e)->part, e );
+        if ( cacheAdmission ){
+            sgCacheSketchAdd( s, h );
+        }
+        atomic_fetch_add_explicit( &s->hits, 1, memory_order_relaxed );
+        atomic_fetch_add_explicit( &cachePartitions[cacheThreadPartition].hits, 1, memory_order_relaxed );
+    } else {
+        e = SG_CACHE_NIL;
+    }
+    pthread_mutex_unlock( &s->lock );
+    return( e );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheCopyOut / sgCacheCopyIn
+// Description  : Copy bytes out of a line without the lock, and a block into
+//                a line under it.  Both go a word at a time through relaxed
+//                atomics, a writer may be changing a line a reader is in
+//                (the reader then throws the copy away).
+//
+// Inputs       : buf - where to put the bytes
+//                line - the line
+//                off, len - what to copy out of it
+//                block - the block to copy in
+// Outputs      : none
+
+static void sgCacheCopyOut( char *buf, const char *line, size_t off, size_t len ) {
+    const _Atomic uint64_t * words = (const _Atomic uint64_t *)line;
+
+    for ( size_t w=off/sizeof(uint64_t); w*sizeof(uint64_t) < off+len; w++ ){
+        uint64_t v = atomic_load_explicit( words+w, memory_order_relaxed );
+        size_t lo = w*sizeof(uint64_t), hi = lo+sizeof(uint64_t);
+        if ( lo >= off && hi <= off+len ){
+            memcpy( buf+lo-off, &v, sizeof(uint64_t) );
+        } else {
+            size_t from = (lo > off) ? lo : off, to = (hi < off+len) ? hi : off+len;
+            memcpy( buf+from-off, (char *)&v + (from-lo), to-from );
+        }
+    }
+}
+
+static void sgCacheCopyIn( char *line, const char *block ) {
+    _Atomic uint64_t * words = (_Atomic uint64_t *)line;
+
+    for ( size_t w=0; w<SG_BLOCK_SIZE/sizeof(uint64_t); w++ ){
+        uint64_t v;
+        memcpy( &v, block + w*sizeof(uint64_t), sizeof(uint64_t) );
+        atomic_store_explicit( words+w, v, memory_order_relaxed );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheRecordAccess
+// Description  : Queue a lock-free hit for the policy, draining the queue
+//                if it is filling up and the lock is free
+//
+// Inputs       : s - the shard
+//                e - the entry hit
+//                gen - its generation when it was read
+// Outputs      : none
+
+static void sgCacheRecordAccess( SG_cache_shard *s, int32_t e, uint32_t gen ) {
+    uint32_t pos = atomic_fetch_add_explicit( &s->accessTail, 1, memory_order_relaxed );
+    atomic_store_explicit( &s->accessLog[pos & (SG_CACHE_ACCESS_LOG-1)], 
+                           ((uint64_t)gen << 32) | (uint32_t)e, memory_order_release );
+    if ( pos - atomic_load_explicit(&s->accessHead, memory_order_relaxed) >= SG_CACHE_ACCESS_DRAIN &&
+         pthread_mutex_trylock(&s->lock) == 0 ){
+        sgCacheDrainAccesses( s );
+        pthread_mutex_unlock( &s->lock );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheDrainAccesses
+// Description  : Replay queued hits into the policy, in order (lock held).
+//                Hits on entries that have since changed block are dropped,
+//                as are hits overwritten when the queue wrapped.
+//
+// Inputs       : s - the shard
+// Outputs      : none
+
+static void sgCacheDrainAccesses( SG_cache_shard *s ) {
+    uint32_t tail = atomic_load_explicit( &s->accessTail, memory_order_acquire );
+    uint32_t head = atomic_load_explicit( &s->accessHead, memory_order_relaxed );
+
+    if ( tail-head > SG_CACHE_ACCESS_LOG ){
+        head = tail-SG_CACHE_ACCESS_LOG;
+    }
+    for ( ; head != tail; head++ ){
+        uint64_t rec = atomic_exchange_explicit( &s->accessLog[head & (SG_CACHE_ACCESS_LOG-1)], 0, 
+                                                 memory_order_acquire );
+        int32_t e = (int32_t)(uint32_t)rec;
+        if ( rec != 0 && (uint32_t)e < s->entryCount && (s->keys + e)->gen == (uint32_t)(rec >> 32) &&
+             (s->keys + e)->slot != SG_CACHE_NIL ){
+            sgCachePolicies[cachePolicy].hit( s, s->parts + (s->keys + e)->part, e );
+            if ( cacheAdmission ){
+                sgCacheSketchAdd( s, sgCacheHash((s->keys + e)->node_ID, (s->keys + e)->blk_ID) );
+            }
+        }
+    }
+    atomic_store_explicit( &s->accessHead, tail, memory_order_relaxed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheWriteBegin / sgCacheWriteEnd
+// Description  : Bracket a change to the index or data (lock held)
+//
+// Inputs       : s - the shard
+// Outputs      : none
+
+static void sgCacheWriteBegin( SG_cache_shard *s ) {
+    atomic_fetch_add_explicit( &s->version, 1, memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+}
+
+static void sgCacheWriteEnd( SG_cache_shard *s ) {
+    atomic_fetch_add_explicit( &s->version, 1, memory_order_release );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheFind
+// Description  : Look a (node, block) pair up in the shard index (lock held)
+//
+// Inputs       : s - the shard
+//                h - hash of the block
+//                nde - node ID to find
+//                blk - block ID to find
+// Outputs      : entry index (resident or ghost) or SG_CACHE_NIL
+
+static int32_t sgCacheFind( SG_cache_shard *s, uint64_t h, SG_Node_ID nde, SG_Block_ID blk ) {
+    for ( int32_t i=s->buckets[h & s->bucketMask]; i!=SG_CACHE_NIL; i=(s->keys + i)->hnext ){
+        if ( (s->keys + i)->node_ID == nde && (s->keys + i)->blk_ID == blk ){
+            return( i );
+        }
+    }
+    return( SG_CACHE_NIL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheUnhash
+// Description  : Remove an entry from its hash chain
+//
+// Inputs       : s - the shard
+//                e - the entry to remove
+// Outputs      : none
+
+static void sgCacheUnhash( SG_cache_shard *s, int32_t e ) {
+    uint64_t h = sgCacheHash( (s->keys + e)->node_ID, (s->keys + e)->blk_ID );
+    _Atomic int32_t * link = &s->buckets[h & s->bucketMask];
+    while ( *link != e ){
+        link = &(s->keys + *link)->hnext;
+    }
+    *link = (s->keys + e)->hnext;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheListRemove
+// Description  : Take an entry off its policy list
+//
+// Inputs       : s - the shard
+//                e - the entry to unlink
+// Outputs      : none
+
+static void sgCacheListRemove( SG_cache_shard *s, int32_t e ) {
+    SG_cache_meta * ent = s->meta + e;
+    SG_cache_list * l = &s->parts[(s->keys + e)->part].lists[ent->list];
+    if ( ent->prev != SG_CACHE_NIL ){
+        (s->meta + ent->prev)->next = ent->next;
+    } else {
+        l->head = ent->next;
+    }
+    if ( ent->next != SG_CACHE_NIL ){
+        (s->meta + ent->next)->prev = ent->prev;
+    } else {
+        l->tail = ent->prev;
+    }
+    l->count -= 1;
+    ent->list = SG_CACHE_NOLIST;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheListPushFront
+// Description  : Put an entry at the head of one of its partition's policy
+//                lists
+//
+// Inputs       : s - the shard
+//                l - the list
+//                e - the entry to insert
+// Outputs      : none
+
+static void sgCacheListPushFront( SG_cache_shard *s, uint8_t l, int32_t e ) {
+    SG_cache_meta * ent = s->meta + e;
+    SG_cache_list * list = &s->parts[(s->keys + e)->part].lists[l];
+    ent->list = l;
+    ent->prev = SG_CACHE_NIL;
+    ent->next = list->head;
+    if ( list->head != SG_CACHE_NIL ){
+        (s->meta + list->head)->prev = e;
+    } else {
+        list->tail = e;
+    }
+    list->head = e;
+    list->count += 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheEvict
+// Description  : Evict a resident entry, releasing its data slot
+//
+// Inputs       : s - the shard
+//                e - the entry to evict
+//                ghostList - list to keep it on as a ghost, or SG_CACHE_NOLIST
+// Outputs      : none
+
+static void sgCacheEvict( SG_cache_shard *s, int32_t e, uint8_t ghostList ) {
+    SG_cache_key * key = s->keys + e;
+    logMessage( LOG_INFO_LEVEL, "[Cache] evicting blk [%lu]", key->blk_ID );
+    bool dirty = (s->meta + e)->dirty;
+    if ( (dirty && cacheWriteBack != NULL) || (!dirty && sgCacheDemoting()) ){
+        // Keep the data in a flight until the shard is consistent again;
+        // a dirty block may take the place of a queued demotion
+        uint32_t q = s->wbCount;
+        if ( q == SG_CACHE_MAX_WRITEBACKS && dirty ){
+            for ( q=0; q<SG_CACHE_MAX_WRITEBACKS && s->flights[s->wbFlight[q]].dirty; q++ );
+            if ( q < SG_CACHE_MAX_WRITEBACKS ){
+                sgCacheFlightEnd( s, s->wbFlight[q] );
+            }
+        }
+        int f = (q < SG_CACHE_MAX_WRITEBACKS) ? sgCacheFlightTake(s, key->node_ID, key->blk_ID, dirty, s->data[key->slot]) : -1;
+        if ( f >= 0 ){
+            s->wbFlight[q] = f;
+            if ( q == s->wbCount ){
+                s->wbCount += 1;
+            }
+            dirty = false;
+        }
+    }
+    if ( dirty ){
+        logMessage( LOG_ERROR_LEVEL, "[Cache] dirty blk [%lu] evicted without write back.", key->blk_ID );
+    }
+    (s->meta + e)->dirty = 0;
+    s->freeSlots[s->freeSlotCount++] = key->slot;
+    key->slot = SG_CACHE_NIL;
+    s->used -= 1;
+    s->parts[key->part].used -= 1;
+    if ( ghostList == SG_CACHE_NOLIST ){
+        sgCacheDrop( s, e );
+    } else {
+        sgCacheListRemove( s, e );
+        sgCacheListPushFront( s, ghostList, e );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheDrop
+// Description  : Forget a ghost (or evicted) entry and free it
+//
+// Inputs       : s - the shard
+//                e - the entry to drop
+// Outputs      : none
+
+static void sgCacheDrop( SG_cache_shard *s, int32_t e ) {
+    if ( (s->meta + e)->list != SG_CACHE_NOLIST ){
+        sgCacheListRemove( s, e );
+    }
+    sgCacheUnhash( s, e );
+    (s->meta + e)->next = s->freeEntry;
+    s->freeEntry = e;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheInsert
+// Description  : Make a block resident on a policy list (room must exist)
+//
+// Inputs       : s - the shard
+//                p - the partition it is charged to
+//                nde - node ID
+//                blk - block ID
+//                ghost - ghost entry to reuse (already unlinked) or SG_CACHE_NIL
+//                l - the list to insert into
+// Outputs      : the entry or SG_CACHE_NIL if none is available
+
+static int32_t sgCacheInsert( SG_cache_shard *s, SG_cache_part *p, SG_Node_ID nde, SG_Block_ID blk, int32_t ghost, uint8_t l ) {
+    int32_t e = ghost;
+
+    if ( s->freeSlotCount == 0 ){
+        return( SG_CACHE_NIL );
+    }
+    if ( e == SG_CACHE_NIL ){
+        if ( (e = s->freeEntry) == SG_CACHE_NIL ){
+            return( SG_CACHE_NIL );
+        }
+        s->freeEntry = (s->meta + e)->next;
+        uint64_t h = sgCacheHash( nde, blk );
+        (s->keys + e)->node_ID = nde;
+        (s->keys + e)->blk_ID = blk;
+        (s->keys + e)->hnext = s->buckets[h & s->bucketMask];
+        s->buckets[h & s->bucketMask] = e;
+    } else if ( (s->meta + e)->list != SG_CACHE_NOLIST ){
+        sgCacheListRemove( s, e );
+    }
+    (s->keys + e)->slot = s->freeSlots[--s->freeSlotCount];
+    (s->meta + e)->ref = 0;
+    (s->meta + e)->dirty = 0;
+    (s->meta + e)->stashed = 0;
+    (s->keys + e)->filling = 0;
+    (s->keys + e)->part = p->id;
+    if ( ++(s->keys + e)->gen == 0 ){     // zero marks an empty access record
+        (s->keys + e)->gen = 1;
+    }
+    s->used += 1;
+    p->used += 1;
+    sgCacheListPushFront( s, l, e );
+    return( e );
+}
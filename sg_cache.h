@@ -12,17 +12,40 @@
 //
 
 // Includes
+#include <stdbool.h>
 #include <sg_defs.h>
 
 //
 // Defines
 #define SG_MAX_CACHE_ELEMENTS 128
+#define SG_CACHE_DEFAULT_BYTES (SG_MAX_CACHE_ELEMENTS*SG_BLOCK_SIZE)
+#define SG_CACHE_GROWTH 8   // default resize limit, times the initial size
+#define SG_CACHE_MAX_PARTITIONS 8       // partitions, the default one included
+#define SG_CACHE_PARTITION_NAME 32      // longest partition name, with its terminator
+
+// Type definitions
+
+// Cache replacement policies
+typedef enum {
+    SG_CACHE_LRU           = 0,   // Least recently used
+    SG_CACHE_CLOCK         = 1,   // CLOCK (second chance)
+    SG_CACHE_2Q            = 2,   // 2Q, FIFO for first touch, LRU for reuse
+    SG_CACHE_ARC           = 3,   // Adaptive replacement cache
+    SG_CACHE_MAXVAL_POLICY = 4    // Maximum value of the policy
+} SG_Cache_Policy;
+extern const char * sg_cache_policy_strings[SG_CACHE_MAXVAL_POLICY];
+
+// Writes a dirty block back to its node, 0 if successful
+typedef int (*SG_Cache_WriteBack)( SG_Node_ID nde, SG_Block_ID blk, char *block );
 
 // 
 // Cache functions
 
-int initSGCache( uint16_t maxElements );
-    // Initialize the cache of block elements
+int initSGCache( size_t cacheBytes, size_t maxBytes, SG_Cache_Policy policy );
+    // Initialize the cache with a memory budget, resizable up to maxBytes
+
+int resizeSGCache( size_t cacheBytes );
+    // Grow or shrink the cache while it is in use
 
 int closeSGCache( void );
     // Close the cache of block elements, clean up remaining data
@@ -30,7 +53,54 @@ int closeSGCache( void );
 char *getSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
     // Get the data block from the block cache
 
+int readSGDataBlock( SG_Node_ID nde, SG_Block_ID blk, char *buf, size_t off, size_t len );
+    // Copy part of a data block out of the block cache (thread safe)
+
+char *reserveSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Reserve a line for a block about to be fetched, returns its storage
+
+int commitSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Publish a reserved line once the block is in it (a block stored
+    // into the line meanwhile replaces what was received)
+
+int cancelSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Release a reserved line whose block could not be fetched (a block
+    // stored into the line meanwhile is kept)
+
 int putSGDataBlock( SG_Node_ID nde, SG_Block_ID blk, char *block );
     // Get the data block from the block cache
 
+int writeSGDataBlock( SG_Node_ID nde, SG_Block_ID blk, char *block );
+    // Put a modified block into the cache, written back later (write-back mode)
+
+int flushSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Write a block back if it is dirty
+
+int dropSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Forget a block that no longer exists, dirty or not
+
+int flushSGCache( void );
+    // Write back every dirty block
+
+int setSGCacheWriteBack( SG_Cache_WriteBack fn );
+    // Turn write-back mode on (or off, with NULL)
+
+int setSGCacheAdmission( bool on );
+    // Only cache blocks read hotter than the ones they would evict
+
+int setSGCacheVictimTier( size_t bytes );
+    // Keep evicted blocks compressed in bytes of memory
+
+int createSGCachePartition( const char *name, size_t minBytes, size_t maxBytes );
+    // Define a partition guaranteed minBytes and limited to maxBytes, its number
+
+int setSGCachePartition( int part );
+    // Charge the calling thread's cache use to a partition
+
+int getSGCachePartitionStats( int part, unsigned long *queries, unsigned long *hits, size_t *bytes );
+    // Get a partition's lookups, hits and the memory it holds
+
+int sgCacheUnitTest( void );
+    // Run the block cache unit tests
+
 #endif
\ No newline at end of file
@@ -14,45 +14,153 @@
 // Project Includes
 #include <sg_driver.h>
 #include <sg_service.h>
+#include <sg_post.h>
+#include <sg_node.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <limits.h>
 #include <sg_cache.h>
 #include <stdlib.h>
 
 // Defines
+#define SG_FILE_BUCKETS_MIN 64                      // name index buckets to start with
+#define SG_MAP_LEAF 32                              // blocks per block map leaf (512 bytes of IDs)
+#define SG_STREAM_BYPASS_BYTES (16*SG_BLOCK_SIZE)  // in-order bytes after which a file bypasses the cache
+#define SG_READAHEAD_MIN 2                          // blocks read ahead once a file is read in order
+#define SG_UNIT_FILE_MAX (64*SG_BLOCK_SIZE)         // largest file the driver unit tests grow
 
 //
 // Global Data
 
-// Driver file entry
+// Where a block of a file is kept
 typedef struct {
+    SG_Node_ID nde;
+    SG_Block_ID blk;
+    } SG_Block_Ref;
+
+// Driver file entry, kept (in the name index) while the file exists
+typedef struct SG_File {
     char * name;
-    int length;
+    struct SG_File * hnext;     // next file in the name index bucket
+    uint64_t length;
     bool open;
-    int position;
-    SG_Node_ID node_ID[500];
-    SG_Block_ID blk_ID[500];
-    uint16_t blk_num;
-    SgFHandle file_handle;
+    uint64_t position;
+    SG_Block_Ref ** map;        // block map, leaves of SG_MAP_LEAF blocks
+    uint64_t mapRoom;           // ... leaf pointers it has room for
+    uint64_t mapLeaves;         // ... leaves allocated
+    uint64_t blk_num;           // blocks in the file
+    SgFHandle file_handle;      // while open
+    uint64_t seqNext;   // where an in-order access would start
+    uint64_t seqRun;    // bytes accessed in order up to seqNext
+    int cachePart;      // cache partition its blocks are charged to
+    uint64_t raStart;   // read-ahead: first block read ahead the reader has not reached
+    uint64_t raEnd;     // ... blocks before this have been read ahead
+    int raWindow;       // ... blocks to keep ahead of the reader, 0 when off
+    int raLost;         // ... blocks evicted before the reader got to them
+    char * tail;        // partly filled last block, not created yet
+    bool tailHeld;      // ... the tail holds block blk_num
     } SG_File;
 
-// seq structure
-typedef struct  {
-    SG_Node_ID id;
-    SG_SeqNum resentSeq;
-    } SG_remSeq;
+// Async operation, as submitted and then as completed
+typedef struct {
+    bool write;         // sgwrite rather than sgread
+    SgFHandle fh;
+    char * buf;
+    size_t len;
+    SgCompletion done;  // cookie, and the result once run
+    } SG_Async_Op;
+
+// Driver unit test operation, and what it should come to
+typedef struct {
+    bool write;
+    size_t len;
+    int expect;                     // result it should complete with
+    char buf[2*SG_BLOCK_SIZE];      // data written, or read
+    char want[2*SG_BLOCK_SIZE];     // ... data the read should see
+    } SG_Unit_Op;
 
 // Global data
 int sgDriverInitialized = 0;    // The flag indicating the driver initialized
 SG_Node_ID sgLocalNodeId;   // The local node identifier
 SG_SeqNum sgLocalSeqno = SG_INITIAL_SEQNO; // The local sequence number
 int file_count;   // count of total files
-SG_File * file_list; //global pointer to file entry
-int remSeq_count;
-SG_remSeq * remSeq_list; //global pointer to remSeq entry
+SG_File ** file_buckets; // name index, chained through hnext
+size_t file_bucket_count;
+SG_File ** file_handles; // the open file of each handle, NULL if the handle is free
+int file_handle_count; // handles handed out so far
+int file_handle_room;
+SgFHandle * file_free; // closed handles, reused first
+int file_free_count;
+SG_Cache_Policy sgCachePolicy = SG_CACHE_LRU; // Block cache replacement policy
+bool sgCacheWriteBack = 0; // Defer block updates to cache eviction/flush
+size_t sgCacheBytes = SG_CACHE_DEFAULT_BYTES; // Block cache memory budget
+const char * sgCacheL2Path = NULL; // Second tier cache file, if any
+size_t sgCacheVictimBytes = 0; // Compressed victim tier memory, 0 for none
+bool sgCacheAdmission = 0; // Filter cache inserts, bypass the cache for streams
+int sgReadAheadMax = SG_READAHEAD_MAX; // Most blocks read ahead of an in-order reader, 0 for none
+unsigned long sgStreamBypassed; // blocks streamed around the cache
+unsigned long sgReadAheadFetched; // blocks read ahead into the cache
+unsigned long sgReadAheadUsed; // ... that the reader went on to read
+unsigned long sgReadAheadLost; // ... that were evicted before it did
+SG_Async_Op asyncSubmitted[SG_ASYNC_DEPTH]; // submission ring, run by the async thread
+SG_Async_Op asyncCompleted[SG_ASYNC_DEPTH]; // completion ring, reaped by sgpoll/sgwait
+unsigned asyncSubHead, asyncSubTail; // next to run, next free
+unsigned asyncCompHead, asyncCompTail; // next to reap, next free
+int asyncOutstanding; // submitted and not reaped
+bool asyncRunning; // the async thread has started ... 
+bool asyncBusy; // ... is running a batch of operations
+bool asyncStop; // ... should exit once the submissions run out
+pthread_t asyncThread;
+pthread_mutex_t asyncLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t asyncWork = PTHREAD_COND_INITIALIZER; // submitted, or stopping
+pthread_cond_t asyncDone = PTHREAD_COND_INITIALIZER; // completed, or idle
+bool asyncDeferring; // the async thread holds back its block updates for one post ...
+int asyncDeferCount; // ... has this many held
+bool asyncDeferFailed; // ... some of which could not be sent
+SG_Node_ID asyncDeferNde[SG_POST_BATCH_MAX];
+SG_Block_ID asyncDeferBlk[SG_POST_BATCH_MAX];
+uint16_t asyncDeferOff[SG_POST_BATCH_MAX], asyncDeferLen[SG_POST_BATCH_MAX];
+char asyncDeferData[SG_POST_BATCH_MAX][SG_BLOCK_SIZE];
 
 // Driver support functions
 int sgInitEndpoint( void ); // Initialize the endpoint
+int sgUpdateRemoteBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ); // Send a block update
+int sgObtainRemoteBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ); // Fetch a block
+int sgObtainRemoteBlocks( int count, SG_Node_ID *nde, SG_Block_ID *blk, char **blocks ); // Fetch blocks in batches
+int sgUpdateRemoteBlocks( int count, SG_Node_ID *nde, SG_Block_ID *blk, char **blocks ); // Send block updates in batches
+int sgUpdateRemoteRanges( int count, SG_Node_ID *nde, SG_Block_ID *blk, char **blocks, uint16_t *off, uint16_t *len ); // Send block updates, ranged where partial
+int sgCreateRemoteBlocks( int count, char **blocks, SG_Node_ID *nde, SG_Block_ID *blk ); // Create blocks in batches
+int sgDeleteRemoteBlocks( int count, SG_Node_ID *nde, SG_Block_ID *blk, int *deleted ); // Delete blocks in batches
+int sgPacketPieces( char *packet, char *block, struct iovec *iov ); // Lay a packet out in pieces around its block
+bool sgFileStreaming( SG_File *file, uint64_t pos, size_t len ); // Track in-order access to a file
+SG_File * sgFileForIo( SgFHandle fh, const struct iovec *iov, int iovcnt ); // Check a read or write
+SG_File * sgFileOfHandle( SgFHandle fh ); // The open file of a handle
+SG_File * sgFindFile( const char *path ); // Look a file up by name
+SG_File * sgAddFile( const char *path ); // Enter a new file in the name index
+SgFHandle sgNewHandle( SG_File *file ); // Hand out a handle for a file
+uint64_t sgFileNameHash( const char *path ); // Hash a file name
+int sgFileRead( SG_File *target_file, const struct iovec *iov, int iovcnt, uint64_t pos ); // Read at an offset
+int sgFileWrite( SG_File *target_file, const struct iovec *iov, int iovcnt, uint64_t pos ); // Write at an offset
+size_t sgIovLength( const struct iovec *iov, int iovcnt ); // Bytes in a buffer list
+char * sgIovRange( const struct iovec *iov, int iovcnt, size_t at, size_t len ); // Find a range of a buffer list
+void sgIovCopy( const struct iovec *iov, int iovcnt, size_t at, char *block, size_t len, bool in ); // Copy a range of a buffer list
+void sgFileReadAhead( SG_File *file, uint64_t last, bool inOrder ); // Keep blocks cached ahead of a reader
+SG_Block_Ref * sgFileBlock( SG_File *file, uint64_t i ); // Where a block of a file is kept
+int sgFileMapGrow( SG_File *file, uint64_t blocks ); // Make room in a block map
+void sgFileMapFree( SG_File *file ); // Free a block map
+int sgFileFlushTail( SG_File *file ); // Create a file's held tail block
+int sgFileSync( SG_File *file ); // Get a file's writes out to its nodes
+int sgFileTruncate( SG_File *file, uint64_t length ); // Cut a file short, deleting its blocks past the end
+int sgFileWriteBlocks( SG_File *target_file, const struct iovec *iov, int iovcnt, size_t at, uint64_t pos, size_t len, bool stream ); // Write a run of blocks
+int sgAsyncSubmit( bool write, SgFHandle fh, char *buf, size_t len, uint64_t cookie ); // Queue an async operation
+int sgAsyncQueue( bool write, SgFHandle fh, char *buf, size_t len, uint64_t cookie ); // Queue an async operation (lock held)
+void sgAsyncDrain( void ); // Wait for the async operations submitted so far
+void * sgAsyncWorker( void *arg ); // The async thread
+void sgAsyncPrefetch( SG_Async_Op *ops, int count ); // Fetch the blocks a batch of operations will need in one post
+void sgAsyncSettle( SG_Async_Op *ops, int from, int to ); // Send the held updates and queue the completions
+int sgAsyncUpdate( int count, SG_Node_ID *nde, SG_Block_ID *blk, char **blocks, uint16_t *off, uint16_t *len ); // Send block updates, or hold them for the batch
+int sgAsyncFlushUpdates( void ); // Send the held block updates
 //
 // Functions
 //
@@ -67,8 +175,8 @@ int sgInitEndpoint( void ); // Initialize the endpoint
 // Outputs      : file handle if successful test, -1 if failure
 
 SgFHandle sgopen(const char *path) {
-    
-    bool n = 0;
+
+    sgAsyncDrain();
 
     // First check to see if we have been initialized
     if (!sgDriverInitialized) {
@@ -81,43 +189,20 @@ SgFHandle sgopen(const char *path) {
         // Set to initialized
         sgDriverInitialized = 1; 
     }
-                                                                                        
-    if (file_count == 0 ){
-        file_list = (SG_File*) malloc(sizeof(SG_File));  //dynamic allocation
-        n=1;
-    }
-   
-    for ( SgFHandle i = 0; i<file_count; i++){
-        SG_File * temp_file = file_list + i;
-        if ( strcmp(temp_file->name, path) == 0 ){
-            if ( temp_file->open == 0){ // if not opened, open it 
-                temp_file->open = 1;
-                temp_file->position = 0;
-                return i;
-            } else {
-                return i;
-            }
-        }
-    }
 
-    if (n==0){
-        file_list = (SG_File *) realloc(file_list, sizeof(SG_File)*(file_count+1));   //creating the first file and using realloc() to achieve dynamic allocation
-        if (file_list==NULL){
-            logMessage( LOG_ERROR_LEVEL, "sgopen: Scatter/Gather file pointer null." );
-            return (-1);
-        }
+    SG_File * file = sgFindFile( path );
+    if ( file != NULL && file->open ){      // already open, same handle
+        return( file->file_handle );
     }
-    
-    SG_File * new_file = file_list + (file_count);
-    new_file->name = (char*) realloc(new_file->name, strlen(path));
-    strcpy(new_file->name, path);
-    new_file->open = 1;
-    new_file->length = 0;
-    new_file->position = 0;
-    new_file->blk_num = 0;
-    new_file->file_handle = file_count;
-    file_count += 1;
-    return new_file->file_handle;
+    if ( file == NULL && (file = sgAddFile( path )) == NULL ){
+        return( -1 );
+    }
+    if ( sgNewHandle( file ) == -1 ){
+        return( -1 );
+    }
+    file->open = 1;
+    file->position = 0;
+    return( file->file_handle );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -131,597 +216,982 @@ SgFHandle sgopen(const char *path) {
 // Outputs      : number of bytes read, -1 if failure
 
 int sgread(SgFHandle fh, char *buf, size_t len) {
+    struct iovec iov = { buf, len };
+    return( sgreadv(fh, &iov, 1) );
+}
 
-    // Local variables
-    char sendPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_BASE_PACKET_SIZE];
-    char data[SG_BLOCK_SIZE];
-    size_t pktlen, rpktlen;
-    SG_Node_ID loc_ID, rem_ID;
-    SG_Block_ID blk_ID;
-    SG_SeqNum sloc, srem;
-    SG_System_OP op;
-    SG_Packet_Status ret;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgreadv
+// Description  : Read data from the file into several buffers, filling
+//                each in turn
+//
+// Inputs       : fh - file handle for the file to read from
+//                iov - the buffers
+//                iovcnt - how many
+// Outputs      : number of bytes read, -1 if failure
 
-    if (fh < 0 || fh > file_count-1 || ((file_list + fh)->open) == 0 ){
-        logMessage( LOG_ERROR_LEVEL, "Bad file handle or not opened. File handle:[%d]", fh );
-        return (-1);
-    } else {
-        SG_File * target_file = file_list + fh;
-        if ( (target_file->position) >= ((target_file->length)) ){
-            logMessage( LOG_ERROR_LEVEL, "Bad file position. File position[%d]", target_file->position );
-            return (-1);
-        }
+int sgreadv(SgFHandle fh, const struct iovec *iov, int iovcnt) {
+    SG_File * target_file = sgFileForIo( fh, iov, iovcnt );
 
-        if (len > ((target_file->length)-(target_file->position))){     // read length larger than file length
-            uint16_t ori_pos = target_file->position;
-            uint16_t read_pos = 0;
-            uint8_t start_blk = (target_file->position)/SG_BLOCK_SIZE;
-            uint8_t stop_blk = (target_file->blk_num)-1;
-
-            for ( uint8_t i=start_blk; i<=stop_blk; i++ ){
-
-                //setup the packet
-                pktlen = SG_BASE_PACKET_SIZE;
-                if ( (ret = serialize_sg_packet( sgLocalNodeId,
-                                                *((target_file->node_ID)+i),
-                                                *((target_file->blk_ID)+i),
-                                                SG_OBTAIN_BLOCK,
-                                                sgLocalSeqno++,
-                                                SG_SEQNO_UNKNOWN,
-                                                NULL, sendPacket, &pktlen)) != SG_PACKT_OK ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgread: failed serialization of packet [%d].", ret );
-                    return(-1);
-                }
+    if ( target_file == NULL ){
+        return (-1);
+    }
+    int len = sgFileRead( target_file, iov, iovcnt, target_file->position );
+    if ( len > 0 ){
+        target_file->position += len;
+    }
+    return( len );
+}
 
-                //send packet
-                rpktlen = SG_DATA_PACKET_SIZE;
-                if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgread: failed packet post" );
-                    return(-1);
-                }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgpread
+// Description  : Read data from a given offset, the file position is not
+//                used or moved
+//
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data
+//                len - the length of the read
+//                off - where in the file to read from
+// Outputs      : number of bytes read, -1 if failure
 
-                //unpack
-                if ( (ret = deserialize_sg_packet(&loc_ID, &rem_ID, &blk_ID, 
-                                                &op, &sloc, &srem, data, recvPacket, rpktlen)) != SG_PACKT_OK ){
-                    logMessage( LOG_ERROR_LEVEL, "sgread: failed deserialization of packet [%d].", ret );
-                    
-                    return(-1);
-                }
+int sgpread(SgFHandle fh, char *buf, size_t len, uint64_t off) {
+    struct iovec iov = { buf, len };
+    SG_File * target_file = sgFileForIo( fh, &iov, 1 );
 
-                if ( start_blk == stop_blk ){
-                    uint16_t blk_pos = (target_file->position)-(i*SG_BLOCK_SIZE);
-                    memcpy ( buf, data+blk_pos, target_file->length );
-                    target_file->position += target_file->length;
-
-                } else {
-                    if ( i == start_blk ){
-                        uint16_t first_blk_pos = (target_file->position)-(i*SG_BLOCK_SIZE);
-                        memcpy ( buf, data+first_blk_pos, SG_BLOCK_SIZE-first_blk_pos );
-                        target_file->position += (SG_BLOCK_SIZE-first_blk_pos);
-                        read_pos += (SG_BLOCK_SIZE-first_blk_pos);
-                    } else if ( i == stop_blk ) {
-                        memcpy ( buf+read_pos , data, ((target_file->length)-(i*SG_BLOCK_SIZE)));
-                        target_file->position += ((target_file->length)-(i*SG_BLOCK_SIZE));
-                        read_pos += ((target_file->length)-(i*SG_BLOCK_SIZE));
-                    } else {
-                        memcpy ( buf+read_pos , data, SG_BLOCK_SIZE );
-                        target_file->position += SG_BLOCK_SIZE;
-                        read_pos += SG_BLOCK_SIZE;
-                    }
-                }
-            }
-            
-            return (target_file->length)-ori_pos;
-        }
+    if ( target_file == NULL ){
+        return (-1);
+    }
+    return( sgFileRead(target_file, &iov, 1, off) );
+}
 
-        if (len <= ((target_file->length)-(target_file->position))){       // read length not larger than file length
-            uint16_t read_pos_s = 0;
-            uint8_t start_blk_s = (target_file->position)/SG_BLOCK_SIZE;
-            uint8_t stop_blk_s = (((target_file->position) + len)-1)/SG_BLOCK_SIZE;
-            //logMessage( LOG_ERROR_LEVEL, "<start blk: [%d], stop blk[%d]", start_blk_s, stop_blk_s );
-            SG_remSeq * current_seq;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgwrite
+// Description  : write data to the file
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - pointer to data to write
+//                len - the length of the write
+// Outputs      : number of bytes written if successful test, -1 if failure
 
-            for ( uint8_t i=start_blk_s; i<=stop_blk_s; i++ ){
-                //logMessage( LOG_ERROR_LEVEL, "<sgread: blk ID [%d], rem node ID [%d]", *((target_file->blk_ID)+i), *((target_file->node_ID)+i));
-                //setup the packet
+int sgwrite(SgFHandle fh, char *buf, size_t len) {
+    struct iovec iov = { buf, len };
+    return( sgwritev(fh, &iov, 1) );
+}
 
-                char * cache_data = getSGDataBlock( *((target_file->node_ID)+i), *((target_file->blk_ID)+i) );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgwritev
+// Description  : write the contents of several buffers to the file, one
+//                after another
+//
+// Inputs       : fh - file handle for the file to write to
+//                iov - the buffers
+//                iovcnt - how many
+// Outputs      : number of bytes written if successful test, -1 if failure
 
-                for ( int x=0; x<remSeq_count; x++){
-                    if ((remSeq_list+x)->id == *((target_file->node_ID)+i ) ){
-                        current_seq = remSeq_list+x;
-                    }
-                }
+int sgwritev(SgFHandle fh, const struct iovec *iov, int iovcnt) {
+    SG_File * target_file = sgFileForIo( fh, iov, iovcnt );
 
-                if ( cache_data == NULL ){
-                    pktlen = SG_BASE_PACKET_SIZE;
-                    if ( (ret = serialize_sg_packet( sgLocalNodeId,
-                                                    *((target_file->node_ID)+i),
-                                                    *((target_file->blk_ID)+i),
-                                                    SG_OBTAIN_BLOCK,
-                                                    sgLocalSeqno++,
-                                                    (current_seq->resentSeq)+=1,
-                                                    NULL, sendPacket, &pktlen)) != SG_PACKT_OK ) {
-                        logMessage( LOG_ERROR_LEVEL, "sgread: failed serialization of packet [%d].", ret );
-                        return(-1);
-                    }
-
-                    //send packet
-                    rpktlen = SG_DATA_PACKET_SIZE;
-                    if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
-                        logMessage( LOG_ERROR_LEVEL, "sgread: failed packet post" );
-                        return(-1);
-                    }
-
-                    //unpack
-                    if ( (ret = deserialize_sg_packet(&loc_ID, &rem_ID, &blk_ID, 
-                                                    &op, &sloc, &srem, data, recvPacket, rpktlen)) != SG_PACKT_OK ){
-                        logMessage( LOG_ERROR_LEVEL, "sgread: failed deserialization of packet [%d].", ret );
-                        return(-1);
-                    }
-
-                    if ( start_blk_s == stop_blk_s ){
-                        uint16_t blk_pos = (target_file->position)-(i*SG_BLOCK_SIZE);
-                        memcpy ( buf, data+blk_pos, len );
-                        target_file->position += len;
-
-                    } else {
-                        if ( i == start_blk_s ){
-                            uint16_t first_blk_poss = (target_file->position)-(i*SG_BLOCK_SIZE);
-                            memcpy ( buf, data+first_blk_poss, SG_BLOCK_SIZE-first_blk_poss );
-                            target_file->position += (SG_BLOCK_SIZE-first_blk_poss);
-                            read_pos_s += (SG_BLOCK_SIZE-first_blk_poss);
-                        } else if ( i == stop_blk_s ) {
-                            memcpy ( buf+read_pos_s , data, ((target_file->position)-(i*SG_BLOCK_SIZE))+len );
-                            target_file->position += (((target_file->position)-(i*SG_BLOCK_SIZE))+len);
-                            read_pos_s += (((target_file->position)-(i*SG_BLOCK_SIZE))+len);
-                        } else {
-                            memcpy ( buf+read_pos_s , data, SG_BLOCK_SIZE );
-                            target_file->position += SG_BLOCK_SIZE;
-                            read_pos_s += SG_BLOCK_SIZE;
-                        }
-                    }
-                    putSGDataBlock( *((target_file->node_ID)+i), *((target_file->blk_ID)+i), data );
-                } else {
-
-                    uint16_t blk_pos = (target_file->position)-(i*SG_BLOCK_SIZE);
-                    memcpy ( buf, cache_data+blk_pos, len );
-                    target_file->position += len;
-                }
-            }
-            return (len);
-        }
-    } 
+    if ( target_file == NULL ){
+        return (-1);
+    }
+    int len = sgFileWrite( target_file, iov, iovcnt, target_file->position );
+    if ( len > 0 ){
+        target_file->position += len;
+    }
+    return( len );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sgwrite
-// Description  : write data to the file
+// Function     : sgpwrite
+// Description  : write data at a given offset (at most the file length),
+//                the file position is not used or moved
 //
 // Inputs       : fh - file handle for the file to write to
 //                buf - pointer to data to write
 //                len - the length of the write
+//                off - where in the file to write
 // Outputs      : number of bytes written if successful test, -1 if failure
 
-int sgwrite(SgFHandle fh, char *buf, size_t len) {
-    // Local variables
-    char sendPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_BASE_PACKET_SIZE];
-    size_t pktlen, rpktlen;
-    SG_Node_ID new_rem_ID, loc_ID;
-    SG_Block_ID new_blk_ID;
-    SG_SeqNum sloc, srem;
-    SG_System_OP op;
-    SG_Packet_Status ret;
-    uint16_t buf_offset = 0;
-    char data[SG_BLOCK_SIZE];
-    char temp_buf [SG_BLOCK_SIZE];
-    bool f =0;
+int sgpwrite(SgFHandle fh, char *buf, size_t len, uint64_t off) {
+    struct iovec iov = { buf, len };
+    SG_File * target_file = sgFileForIo( fh, &iov, 1 );
 
-    if (fh < 0 || fh > file_count-1){
-        logMessage( LOG_ERROR_LEVEL, "Bad file handle. File handle:[%d]", fh );
+    if ( target_file == NULL ){
         return (-1);
     }
+    return( sgFileWrite(target_file, &iov, 1, off) );
+}
 
-    SG_File * target_file = file_list + fh;
-    
-    if (target_file->open == 0){
-        logMessage( LOG_ERROR_LEVEL, "sgwrite: The file is not opened. File handle:[%d]", fh );
-        return (-1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileForIo
+// Description  : Check the arguments of a read or write, once the async
+//                operations before it are done
+//
+// Inputs       : fh - the file handle
+//                iov - the buffers
+//                iovcnt - how many
+// Outputs      : the open file, NULL if failure
+
+SG_File * sgFileForIo( SgFHandle fh, const struct iovec *iov, int iovcnt ) {
+    sgAsyncDrain();
+    SG_File * target_file = sgFileOfHandle( fh );
+    if ( target_file == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "Bad file handle or not opened. File handle:[%d]", fh );
+        return (NULL);
     }
+    if ( iovcnt < 0 || (iovcnt > 0 && iov == NULL) || sgIovLength(iov, iovcnt) > INT_MAX ){
+        logMessage( LOG_ERROR_LEVEL, "Bad buffer list of [%d] buffers. File handle:[%d]", iovcnt, fh );
+        return (NULL);
+    }
+    return( target_file );
+}
 
-    if ((target_file->position) == ((target_file->length))){    // writing at the end of the file
-        //create blocks
-        int remainder = len%SG_BLOCK_SIZE;
-        int blk_num = len/SG_BLOCK_SIZE;
-        
-        if ( remainder > 0 ){           // writing at the end of the file, write half of the block (assign4)
-            uint8_t target_blk = (target_file->position)/SG_BLOCK_SIZE;
-            uint16_t rel_position = (target_file->position) - (target_blk*SG_BLOCK_SIZE);
-
-            if (rel_position == 0){     //need to create new block
-                //setup the packet
-                pktlen = SG_DATA_PACKET_SIZE;
-                if ( (ret = serialize_sg_packet( sgLocalNodeId,
-                                                SG_NODE_UNKNOWN,
-                                                SG_BLOCK_UNKNOWN,
-                                                SG_CREATE_BLOCK,
-                                                sgLocalSeqno++,
-                                                SG_SEQNO_UNKNOWN,
-                                                buf, sendPacket, &pktlen)) != SG_PACKT_OK ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed serialization of packet [%d].", ret );
-                    return(-1);
-                }
-                //send packet
-                rpktlen = SG_BASE_PACKET_SIZE;
-                if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed packet post" );
-                    return(-1);
-                }
-                //unpack
-                if ( (ret = deserialize_sg_packet(&loc_ID, &new_rem_ID, &new_blk_ID, 
-                                                &op, &sloc, &srem, NULL, recvPacket, rpktlen)) != SG_PACKT_OK ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed deserialization of packet [%d].", ret );
-                    return(-1);
-                }
-                //Check assigned block and node ID
-                if ( new_blk_ID == SG_BLOCK_UNKNOWN ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: bad new remote block ID [%d].", new_blk_ID );
-                    return(-1);
-                }
-                if ( new_rem_ID == SG_NODE_UNKNOWN ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: bad new remote node ID [%d].", new_rem_ID );
-                    return(-1);
-                } else {
-                    if ( remSeq_count == 0 ){
-                        remSeq_list = (SG_remSeq *) malloc( sizeof(SG_remSeq) );
-                        (remSeq_list+remSeq_count)->id = new_rem_ID;
-                        (remSeq_list+remSeq_count)->resentSeq = srem;
-                        remSeq_count += 1;
-                    } else {
-                        for ( int i=0; i<remSeq_count; i++){
-                            if ((remSeq_list+i)->id == new_rem_ID ){
-                                (remSeq_list+i)->resentSeq = srem;
-                                f=1;
-                            }
-                        }
-                        if ( f==0 ){
-                            remSeq_list = (SG_remSeq *) realloc( remSeq_list, sizeof(SG_remSeq)*(remSeq_count+1) );
-                            (remSeq_list+remSeq_count)->id = new_rem_ID;
-                            (remSeq_list+remSeq_count)->resentSeq = srem;
-                            remSeq_count += 1;
-                        }
-                    }
-                }
-                 
-                putSGDataBlock( new_rem_ID, new_blk_ID, buf );      
-
-                SG_Block_ID * blk_ID_ptr = (file_list+fh)->blk_ID;
-                SG_Node_ID * node_ID_ptr = (file_list+fh)->node_ID;
-                uint16_t temp_blk_num = (file_list+fh)->blk_num;
-                *(blk_ID_ptr+temp_blk_num) = new_blk_ID;
-                *(node_ID_ptr+temp_blk_num) = new_rem_ID;
-                (file_list+fh)-> length +=len;
-                (file_list+fh)-> position = (file_list+fh)->length;
-                (file_list+fh)->blk_num = (file_list+fh)->blk_num+1;
-
-            } else if ( rel_position != 0 ) {     //  writing at the end of the file, updating the blk
-                char * temp_g = getSGDataBlock( *((target_file->node_ID)+target_blk), *((target_file->blk_ID)+target_blk) );
-                SG_remSeq * current_seq;
-
-                for ( int i=0; i<remSeq_count; i++){;
-
-                        if ( (remSeq_list+i)->id == (*((target_file->node_ID)+target_blk )) ){
-                            current_seq = remSeq_list+i;
-                          \
-                        }
-                    }
-
-                if ( temp_g != NULL ){
-                    memcpy( data, temp_g, SG_BLOCK_SIZE );
-                } else {
-                    
-                    pktlen = SG_BASE_PACKET_SIZE;
-                    if ( (ret = serialize_sg_packet( sgLocalNodeId,
-                                                    *((target_file->node_ID)+target_blk),
-                                                    *((target_file->blk_ID)+target_blk),
-                                                    SG_OBTAIN_BLOCK,
-                                                    sgLocalSeqno++,
-                                                    (current_seq->resentSeq)+=1,
-                                                    NULL, sendPacket, &pktlen)) != SG_PACKT_OK ) {
-                        logMessage( LOG_ERROR_LEVEL, "sgwrite: failed serialization of packet [%d].", ret );
-                        return(-1);
-                    }
-                    //send packet
-                    rpktlen = SG_DATA_PACKET_SIZE;
-                    if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
-                        logMessage( LOG_ERROR_LEVEL, "sgwrite: failed packet post" );
-                        return(-1);
-                    }
-                    //unpack
-                    if ( (ret = deserialize_sg_packet(&loc_ID, &new_rem_ID, &new_blk_ID, 
-                                                    &op, &sloc, &srem, data, recvPacket, rpktlen)) != SG_PACKT_OK ){
-                        logMessage( LOG_ERROR_LEVEL, "sgwrite: failed deserialization of packet [%d].", ret );
-                        return(-1);
-                    }
-                    putSGDataBlock( *((target_file->node_ID)+target_blk), *((target_file->blk_ID)+target_blk), data );
-                }
-                
-                if ( rel_position == 256 ){
-                    memcpy(temp_buf, data, 256);
-                    memcpy(temp_buf+256, buf, 256);
-                } else if ( rel_position == 512 ){
-                    memcpy(temp_buf, data, 512);
-                    memcpy(temp_buf+512, buf, 256);
-                } else if ( rel_position == 768 ) {
-                    memcpy(temp_buf, data, 768);
-                    memcpy(temp_buf+768, buf, 256);
-                }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileOfHandle
+// Description  : Find the open file a handle refers to
+//
+// Inputs       : fh - the file handle
+// Outputs      : the file, NULL if the handle is not open
 
-                pktlen = SG_DATA_PACKET_SIZE;
-                if ( (ret = serialize_sg_packet( sgLocalNodeId,
-                                                *((target_file->node_ID)+target_blk),
-                                                *((target_file->blk_ID)+target_blk),
-                                                SG_UPDATE_BLOCK,
-                                                sgLocalSeqno++,
-                                                (current_seq->resentSeq)+=1,
-                                                temp_buf, sendPacket, &pktlen)) != SG_PACKT_OK ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed serialization of packet [%d].", ret );
-                    return(-1);
-                }
-                //send packet
-                rpktlen = SG_BASE_PACKET_SIZE;
-                if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed packet post" );
-                    return(-1);
-                }
-                //unpack
-                if ( (ret = deserialize_sg_packet(&loc_ID, &new_rem_ID, &new_blk_ID, 
-                                                &op, &sloc, &srem, NULL, recvPacket, rpktlen)) != SG_PACKT_OK ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed deserialization of packet [%d].", ret );
-                    return(-1);
-                }
-                //Check assigned block and node ID
-                if ( new_blk_ID == SG_BLOCK_UNKNOWN ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: bad new remote block ID [%d].", new_blk_ID );
-                    return(-1);
-                }
-                if ( new_rem_ID == SG_NODE_UNKNOWN ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: bad new remote node ID [%d].", new_rem_ID );
-                    return(-1);
-                }
+SG_File * sgFileOfHandle( SgFHandle fh ) {
+    if ( fh < 0 || fh >= file_handle_count ){
+        return( NULL );
+    }
+    return( file_handles[fh] );
+}
 
-                if ( getSGDataBlock( *((target_file->node_ID)+target_blk), *((target_file->blk_ID)+target_blk) ) != NULL ){
-                    putSGDataBlock( *((target_file->node_ID)+target_blk), *((target_file->blk_ID)+target_blk), temp_buf );
-                }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFindFile
+// Description  : Look a file up in the name index
+//
+// Inputs       : path - the file name
+// Outputs      : the file, NULL if there is none by that name
+
+SG_File * sgFindFile( const char *path ) {
+    if ( file_bucket_count == 0 ){
+        return( NULL );
+    }
+    SG_File * file = file_buckets[sgFileNameHash(path) & (file_bucket_count-1)];
+    while ( file != NULL && strcmp(file->name, path) ){
+        file = file->hnext;
+    }
+    return( file );
+}
 
-                (file_list+fh)-> length +=len;
-                (file_list+fh)-> position = (file_list+fh)->length;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAddFile
+// Description  : Create an empty file and enter it in the name index,
+//                doubling the buckets once there is a file per bucket
+//
+// Inputs       : path - the file name
+// Outputs      : the file, NULL if failure
+
+SG_File * sgAddFile( const char *path ) {
+    if ( (size_t)file_count >= file_bucket_count ){
+        size_t count = file_bucket_count ? file_bucket_count*2 : SG_FILE_BUCKETS_MIN;
+        SG_File ** buckets = (SG_File **) calloc( count, sizeof(SG_File *) );
+        if ( buckets == NULL ){
+            logMessage( LOG_ERROR_LEVEL, "sgopen: failed to grow the name index to [%lu] buckets.", count );
+            return( NULL );
+        }
+        for ( size_t b=0; b<file_bucket_count; b++ ){
+            for ( SG_File * file = file_buckets[b], * next; file != NULL; file = next ){
+                next = file->hnext;
+                file->hnext = buckets[sgFileNameHash(file->name) & (count-1)];
+                buckets[sgFileNameHash(file->name) & (count-1)] = file;
             }
-                
-        } else {     
-            for (int i=0; i<blk_num; i++){  // wirte the whole block (assign3) and assuming writing multiple blocks a time
-                //setup the packet
-                pktlen = SG_DATA_PACKET_SIZE;
-                if ( (ret = serialize_sg_packet( sgLocalNodeId,
-                                                SG_NODE_UNKNOWN,
-                                                SG_BLOCK_UNKNOWN,
-                                                SG_CREATE_BLOCK,
-                                                sgLocalSeqno++,
-                                                SG_SEQNO_UNKNOWN,
-                                                buf+buf_offset, sendPacket, &pktlen)) != SG_PACKT_OK ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed serialization of packet [%d].", ret );
-                    return(-1);
-                }
-                //send packet
-                rpktlen = SG_BASE_PACKET_SIZE;
-                if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed packet post" );
-                    return(-1);
-                }
-                //unpack
-                if ( (ret = deserialize_sg_packet(&loc_ID, &new_rem_ID, &new_blk_ID, 
-                                                &op, &sloc, &srem, NULL, recvPacket, rpktlen)) != SG_PACKT_OK ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed deserialization of packet [%d].", ret );
-                    return(-1);
-                }
-                //Check assigned block and node ID
-                if ( new_blk_ID == SG_BLOCK_UNKNOWN ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: bad new remote block ID [%d].", new_blk_ID );
-                    return(-1);
-                }
-                if ( new_rem_ID == SG_NODE_UNKNOWN ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: bad new remote node ID [%d].", new_rem_ID );
-                    return(-1);
-                }
+        }
+        free( file_buckets );
+        file_buckets = buckets;
+        file_bucket_count = count;
+    }
 
-                SG_Block_ID * blk_ID_ptr_s = (file_list+fh)->blk_ID;
-                SG_Node_ID * node_ID_ptr_s = (file_list+fh)->node_ID;
+    SG_File * new_file = (SG_File *) calloc( 1, sizeof(SG_File) );
+    if ( new_file == NULL || (new_file->name = strdup(path)) == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgopen: Scatter/Gather file name allocation failed." );
+        free( new_file );
+        return( NULL );
+    }
+    new_file->file_handle = -1;
+    SG_File ** bucket = file_buckets + (sgFileNameHash(path) & (file_bucket_count-1));
+    new_file->hnext = *bucket;
+    *bucket = new_file;
+    file_count += 1;
+    return( new_file );
+}
 
-                uint16_t temp_blk_num_s = (file_list+fh)->blk_num;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNewHandle
+// Description  : Give a file a handle, a closed one if there is any,
+//                otherwise the next, doubling the handle table if needed
+//
+// Inputs       : file - the file being opened
+// Outputs      : the handle, -1 if failure
 
-                *(blk_ID_ptr_s+temp_blk_num_s) = new_blk_ID;
-                *(node_ID_ptr_s+temp_blk_num_s) = new_rem_ID;
-                //logMessage ( LOG_ERROR_LEVEL, "sgwrite: new blk_num is: [%d], number is [%d], new rem ID is [%d] ", (file_list+fh)->blk_num, *(blk_ID_ptr_s+temp_blk_num_s), new_rem_ID);
-                (file_list+fh)->length +=len;
-                (file_list+fh)->position = (file_list+fh)->length;
-                (file_list+fh)->blk_num +=1;
+SgFHandle sgNewHandle( SG_File *file ) {
+    SgFHandle fh;
 
-                buf_offset += SG_BLOCK_SIZE;
+    if ( file_free_count > 0 ){
+        fh = file_free[--file_free_count];
+    } else {
+        if ( file_handle_count == file_handle_room ){
+            int room = file_handle_room ? file_handle_room*2 : SG_FILE_BUCKETS_MIN;
+            SG_File ** handles = (SG_File **) realloc( file_handles, room*sizeof(SG_File *) );
+            SgFHandle * free_list = handles ? (SgFHandle *) realloc( file_free, room*sizeof(SgFHandle) ) : NULL;
+            if ( handles != NULL ){
+                file_handles = handles;
+            }
+            if ( free_list == NULL ){
+                logMessage( LOG_ERROR_LEVEL, "sgopen: failed to grow the handle table to [%d] handles.", room );
+                return( -1 );
             }
+            file_free = free_list;
+            file_handle_room = room;
         }
-    } else if ((target_file->position) < (target_file->length)) {   // writing to the middle of the file at 0 or 256 or 512 or 768
-        uint8_t target_blk_m = (target_file->position)/SG_BLOCK_SIZE;
-        uint16_t rel_position = (target_file->position) - (target_blk_m*SG_BLOCK_SIZE);
-        SG_remSeq * current_seq_m;
+        fh = file_handle_count++;
+    }
+    file_handles[fh] = file;
+    file->file_handle = fh;
+    return( fh );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileNameHash
+// Description  : Hash a file name (FNV-1a)
+//
+// Inputs       : path - the file name
+// Outputs      : the hash
 
-        char * temp_m = getSGDataBlock( *((target_file->node_ID)+target_blk_m), *((target_file->blk_ID)+target_blk_m) );
+uint64_t sgFileNameHash( const char *path ) {
+    uint64_t h = 14695981039346656037ULL;
 
-             for ( int i=0; i<remSeq_count; i++){
-                    if ((remSeq_list+i)->id == *((target_file->node_ID)+target_blk_m ) ){
-                        current_seq_m = remSeq_list+i;
-                    }
-                }
+    for ( ; *path; path++ ){
+        h = (h ^ (uint8_t)*path) * 1099511628211ULL;
+    }
+    return( h );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileRead
+// Description  : Read from a file offset into a list of buffers.  Blocks
+//                missed in the cache are fetched in batches, each straight
+//                into a reserved cache line or the caller's buffer where it
+//                can be, through a bounce block otherwise.
+//
+// Inputs       : target_file - the file
+//                iov - the buffers
+//                iovcnt - how many
+//                pos - the file offset to read from
+// Outputs      : number of bytes read, -1 if failure
 
-            if ( temp_m != NULL ){
-                memcpy( data, temp_m, SG_BLOCK_SIZE );
+int sgFileRead( SG_File *target_file, const struct iovec *iov, int iovcnt, uint64_t pos ) {
 
-            } else {
-                
-                pktlen = SG_BASE_PACKET_SIZE;
-                if ( (ret = serialize_sg_packet( sgLocalNodeId,
-                                                *((target_file->node_ID)+target_blk_m),
-                                                *((target_file->blk_ID)+target_blk_m),
-                                                SG_OBTAIN_BLOCK,
-                                                sgLocalSeqno++,
-                                                (current_seq_m->resentSeq)+=1,
-                                                NULL, sendPacket, &pktlen)) != SG_PACKT_OK ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed serialization of packet [%d].", ret );
-                    return(-1);
-                }
-                //send packet
-                rpktlen = SG_DATA_PACKET_SIZE;
-                if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed packet post" );
-                    return(-1);
+    // Local variables
+    char bounce[SG_POST_BATCH_MAX][SG_BLOCK_SIZE];
+    size_t read_pos = 0, len = sgIovLength( iov, iovcnt );
+    SG_Node_ID mNde[SG_POST_BATCH_MAX];
+    SG_Block_ID mBlk[SG_POST_BATCH_MAX];
+    char * mBlock[SG_POST_BATCH_MAX], * mLine[SG_POST_BATCH_MAX], * mDst[SG_POST_BATCH_MAX];
+    size_t mOff[SG_POST_BATCH_MAX], mSpan[SG_POST_BATCH_MAX], mAt[SG_POST_BATCH_MAX];
+    int missed = 0;
+
+    setSGCachePartition( target_file->cachePart );
+    if ( pos >= target_file->length ){
+        logMessage( LOG_ERROR_LEVEL, "Bad file position. File position[%lu]", pos );
+        return (-1);
+    }
+    if (len > target_file->length-pos){     // read length larger than file length
+        len = target_file->length-pos;
+    }
+    bool stream = sgFileStreaming( target_file, pos, len );
+    bool inOrder = ( target_file->seqRun > len );     // carries on where the last access ended
+
+    while ( read_pos < len ){
+        uint64_t i = (pos+read_pos)/SG_BLOCK_SIZE;
+        size_t blk_pos = (pos+read_pos)%SG_BLOCK_SIZE;
+        size_t span = ( len-read_pos < SG_BLOCK_SIZE-blk_pos ) ? len-read_pos : SG_BLOCK_SIZE-blk_pos;
+        bool held = ( i == target_file->blk_num );     // the held tail, only kept here
+        SG_Node_ID nde = held ? SG_NODE_UNKNOWN : sgFileBlock( target_file, i )->nde;
+        SG_Block_ID blk = held ? SG_BLOCK_UNKNOWN : sgFileBlock( target_file, i )->blk;
+        char * dst = sgIovRange( iov, iovcnt, read_pos, span );    // NULL if the span is split
+
+        if ( held ){
+            sgIovCopy( iov, iovcnt, read_pos, target_file->tail+blk_pos, span, false );
+        } else if ( readSGDataBlock( nde, blk, dst ? dst : bounce[missed], blk_pos, span ) ){
+            // Cache miss, the block will be received straight into a
+            // reserved cache line (unless streaming), or into the caller's
+            // buffer if it wants all of it in one piece
+            if ( i >= target_file->raStart && i < target_file->raEnd ){
+                target_file->raLost += 1;
+                sgReadAheadLost += 1;
+            }
+            mLine[missed] = stream ? NULL : reserveSGDataBlock( nde, blk );
+            sgStreamBypassed += stream;
+            mBlock[missed] = mLine[missed];
+            if ( mBlock[missed] == NULL ){
+                mBlock[missed] = ( span == SG_BLOCK_SIZE && dst ) ? dst : bounce[missed];
+            }
+            mNde[missed] = nde;
+            mBlk[missed] = blk;
+            mDst[missed] = dst;
+            mAt[missed] = read_pos;
+            mOff[missed] = blk_pos;
+            mSpan[missed] = span;
+            missed += 1;
+        } else if ( dst == NULL ){
+            sgIovCopy( iov, iovcnt, read_pos, bounce[missed], span, false );
+        }
+        read_pos += span;
+
+        // Fetch the blocks missed so far in one batch
+        if ( missed == SG_POST_BATCH_MAX || (read_pos == len && missed > 0) ){
+            int failed = sgObtainRemoteBlocks( missed, mNde, mBlk, mBlock );
+            for ( int m=0; m<missed; m++ ){
+                if ( !failed && mDst[m] == NULL ){
+                    sgIovCopy( iov, iovcnt, mAt[m], mBlock[m]+mOff[m], mSpan[m], false );
+                } else if ( !failed && mBlock[m] != mDst[m] ){
+                    memcpy( mDst[m], mBlock[m]+mOff[m], mSpan[m] );
                 }
-                //unpack
-                if ( (ret = deserialize_sg_packet(&loc_ID, &new_rem_ID, &new_blk_ID, 
-                                                &op, &sloc, &srem, data, recvPacket, rpktlen)) != SG_PACKT_OK ){
-                    logMessage( LOG_ERROR_LEVEL, "sgwrite: failed deserialization of packet [%d].", ret );
-                    return(-1);
+                if ( mLine[m] != NULL && failed ){
+                    cancelSGDataBlock( mNde[m], mBlk[m] );
+                } else if ( mLine[m] != NULL ){
+                    commitSGDataBlock( mNde[m], mBlk[m] );
                 }
-               putSGDataBlock( *((target_file->node_ID)+target_blk_m), *((target_file->blk_ID)+target_blk_m), data );
             }
+            if ( failed ){
+                logMessage( LOG_ERROR_LEVEL, "sgread: failed to obtain [%d] blocks", missed );
+                return(-1);
+            }
+            missed = 0;
+        }
+    }
+    if ( len > 0 && !stream ){
+        sgFileReadAhead( target_file, (pos+len-1)/SG_BLOCK_SIZE, inOrder );
+    }
+    return (len);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileWrite
+// Description  : Write a list of buffers at a file offset (the file grows
+//                if it runs past the end), SG_POST_BATCH_MAX blocks at a
+//                time
+//
+// Inputs       : target_file - the file
+//                iov - the buffers
+//                iovcnt - how many
+//                pos - the file offset to write at
+// Outputs      : number of bytes written, -1 if failure
+
+int sgFileWrite( SG_File *target_file, const struct iovec *iov, int iovcnt, uint64_t pos ) {
+    size_t len = sgIovLength( iov, iovcnt ), done = 0;
+
+    setSGCachePartition( target_file->cachePart );
+    if ( pos > target_file->length ){
+        logMessage( LOG_ERROR_LEVEL, "sgwrite: Bad file position [%lu], length [%lu]", pos, target_file->length );
+        return (-1);
+    }
+    if ( len == 0 ){
+        return( 0 );
+    }
+    bool stream = sgFileStreaming( target_file, pos, len );
+    if ( sgFileMapGrow( target_file, (pos+len+SG_BLOCK_SIZE-1)/SG_BLOCK_SIZE ) ){
+        return (-1);
+    }
 
-        if ( rel_position == 0 ){
-            memcpy(temp_buf, buf, 256);
-            memcpy(temp_buf+256, data+256, 768);
-
-        } else if ( rel_position == 256 ){
-            memcpy(temp_buf, data, 256);
-            memcpy(temp_buf+256, buf, 256);
-            memcpy(temp_buf+512, data+512, 512);
+    while ( done < len ){
+        size_t run = SG_POST_BATCH_MAX*SG_BLOCK_SIZE - (pos+done)%SG_BLOCK_SIZE;
+        run = ( len-done < run ) ? len-done : run;
+        if ( sgFileWriteBlocks( target_file, iov, iovcnt, done, pos+done, run, stream ) ){
+            return (-1);
+        }
+        done += run;
+    }
+    return( len );
+}
 
-        } else if ( rel_position == 512 ) {
-            memcpy(temp_buf, data, 512);
-            memcpy(temp_buf+512, buf, 256);
-            memcpy(temp_buf+768, data+768, 256);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileWriteBlocks
+// Description  : Write a run of at most SG_POST_BATCH_MAX blocks.  Blocks
+//                the write covers entirely are simply replaced; only the
+//                partly covered blocks at either edge that already exist
+//                are read, modified and written.
+//
+// Inputs       : target_file - the file (its block map has room)
+//                iov - the buffers
+//                iovcnt - how many
+//                at - where in the buffers the run starts
+//                pos - the file offset of the run
+//                len - the length of the run
+//                stream - the write bypasses the cache
+// Outputs      : 0 if successful, -1 if failure
+
+int sgFileWriteBlocks( SG_File *target_file, const struct iovec *iov, int iovcnt, size_t at, uint64_t pos, size_t len, bool stream ) {
+    // Local variables
+    char data[2][SG_BLOCK_SIZE];        // the partly written blocks at either edge
+    char gathered[SG_POST_BATCH_MAX][SG_BLOCK_SIZE];    // whole blocks split across buffers
+    SG_Node_ID nde[SG_POST_BATCH_MAX];
+    SG_Block_ID blk[SG_POST_BATCH_MAX];
+    char * blocks[SG_POST_BATCH_MAX], * updates[SG_POST_BATCH_MAX];
+    uint16_t offs[SG_POST_BATCH_MAX], lens[SG_POST_BATCH_MAX];
+    bool known[SG_POST_BATCH_MAX];
+    bool unknown[2] = { false, false }; // an edge block is only known where written
+    int count = 0;
+
+    // Without write back, a partial write to an existing block can go as a
+    // ranged update and needs nothing else of the block (envelopes only)
+    bool ranged = sgPostEnvelopes && ( stream || !sgCacheWriteBack );
+
+    uint64_t end = pos + len;
+    uint64_t first = pos/SG_BLOCK_SIZE, last = (end-1)/SG_BLOCK_SIZE;
+    uint64_t existing = target_file->blk_num;
+    uint64_t have = existing + target_file->tailHeld;    // blocks with contents
+
+    // Bring in the existing blocks written in part, one batch for both
+    for ( uint64_t i=first; i<=last && i<have; i++ ){
+        size_t off = ( i == first ) ? pos%SG_BLOCK_SIZE : 0;
+        size_t to = ( i == last ) ? end-i*SG_BLOCK_SIZE : SG_BLOCK_SIZE;
+        if ( off == 0 && to == SG_BLOCK_SIZE ){
+            continue;
+        }
+        char * block = data[i != first];
+        SG_Block_Ref * ref = sgFileBlock( target_file, i );
+        if ( i == existing ){
+            memcpy( block, target_file->tail, SG_BLOCK_SIZE );
+        } else if ( readSGDataBlock( ref->nde, ref->blk, block, 0, SG_BLOCK_SIZE ) ){
+            if ( ranged ){
+                unknown[i != first] = true;
+                continue;
+            }
+            nde[count] = ref->nde;
+            blk[count] = ref->blk;
+            blocks[count++] = block;
+        }
+    }
+    if ( count > 0 && sgObtainRemoteBlocks( count, nde, blk, blocks ) ){
+        logMessage( LOG_ERROR_LEVEL, "sgwrite: failed to obtain block" );
+        return(-1);
+    }
 
-        } else if ( rel_position == 768 ) {
-            memcpy(temp_buf, data, 768);
-            memcpy(temp_buf+768, buf, 256);
+    // Lay out each block's new contents, whole blocks straight from the
+    // caller's buffers unless they are split across two
+    for ( uint64_t i=first; i<=last; i++ ){
+        size_t off = ( i == first ) ? pos%SG_BLOCK_SIZE : 0;
+        size_t to = ( i == last ) ? end-i*SG_BLOCK_SIZE : SG_BLOCK_SIZE;
+        size_t from = at + (i*SG_BLOCK_SIZE + off - pos);
+        if ( off == 0 && to == SG_BLOCK_SIZE && (blocks[i-first] = sgIovRange(iov, iovcnt, from, SG_BLOCK_SIZE)) != NULL ){
+            continue;
         }
+        if ( off == 0 && to == SG_BLOCK_SIZE ){
+            blocks[i-first] = gathered[i-first];
+        } else {
+            blocks[i-first] = data[i != first];
+            if ( i >= have ){           // new block, only the caller has anything for it
+                memset( blocks[i-first]+to, 0, SG_BLOCK_SIZE-to );
+            }
+        }
+        sgIovCopy( iov, iovcnt, from, blocks[i-first]+off, to-off, true );
+    }
 
-        pktlen = SG_DATA_PACKET_SIZE;
-        if ( (ret = serialize_sg_packet( sgLocalNodeId,
-                                        *((target_file->node_ID)+target_blk_m),
-                                        *((target_file->blk_ID)+target_blk_m),
-                                        SG_UPDATE_BLOCK,
-                                        sgLocalSeqno++,
-                                        (current_seq_m->resentSeq)+=1,
-                                        temp_buf, sendPacket, &pktlen)) != SG_PACKT_OK ) {
-            logMessage( LOG_ERROR_LEVEL, "sgwrite: failed serialization of packet [%d].", ret );
-            return(-1);
+    // Existing blocks are cached for write back or written through
+    count = 0;
+    for ( uint64_t i=first; i<=last && i<existing; i++ ){
+        SG_Block_Ref * ref = sgFileBlock( target_file, i );
+        size_t off = ( i == first ) ? pos%SG_BLOCK_SIZE : 0;
+        size_t to = ( i == last ) ? end-i*SG_BLOCK_SIZE : SG_BLOCK_SIZE;
+        known[count] = ( off == 0 && to == SG_BLOCK_SIZE ) || !unknown[i != first];
+        if ( stream || !known[count] || writeSGDataBlock( ref->nde, ref->blk, blocks[i-first] ) ){
+            nde[count] = ref->nde;
+            blk[count] = ref->blk;
+            offs[count] = ranged ? off : 0;
+            lens[count] = ranged ? to-off : SG_BLOCK_SIZE;
+            updates[count++] = blocks[i-first];
         }
-        //send packet
-        rpktlen = SG_BASE_PACKET_SIZE;
-        if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
-            logMessage( LOG_ERROR_LEVEL, "sgwrite: failed packet post" );
-            return(-1);
+    }
+    if ( count > 0 && sgAsyncUpdate( count, nde, blk, updates, offs, lens ) ){
+        logMessage( LOG_ERROR_LEVEL, "sgwrite: failed block update" );
+        return(-1);
+    }
+    for ( int k=0; k<count; k++ ){
+        if ( known[k] && (!stream || getSGDataBlock( nde[k], blk[k] ) != NULL) ){
+            putSGDataBlock( nde[k], blk[k], updates[k] );
         }
-        //unpack
-        if ( (ret = deserialize_sg_packet(&loc_ID, &new_rem_ID, &new_blk_ID, 
-                                        &op, &sloc, &srem, NULL, recvPacket, rpktlen)) != SG_PACKT_OK ){
-            logMessage( LOG_ERROR_LEVEL, "sgwrite: failed deserialization of packet [%d].", ret );
-            return(-1);
+    }
+    sgStreamBypassed += stream ? count : 0;
+
+    // Blocks past the end of the file are created, one batch for all, but
+    // a partly filled last block is held back until it fills or the file
+    // is flushed, so appends do not create and then rewrite it
+    uint64_t length = ( end > target_file->length ) ? end : target_file->length;
+    if ( last >= existing ){
+        uint64_t from = ( first > existing ) ? first : existing;
+        bool hold = ( length%SG_BLOCK_SIZE != 0 && last == length/SG_BLOCK_SIZE );
+        int n = last-from+1 - hold;
+        if ( hold ){
+            if ( target_file->tail == NULL && (target_file->tail = malloc( SG_BLOCK_SIZE )) == NULL ){
+                logMessage( LOG_ERROR_LEVEL, "sgwrite: out of memory for the tail block" );
+                return(-1);
+            }
+            memcpy( target_file->tail, blocks[last-first], SG_BLOCK_SIZE );
         }
-        //Check assigned block and node ID
-        if ( new_blk_ID == SG_BLOCK_UNKNOWN ){
-            logMessage( LOG_ERROR_LEVEL, "sgwrite: bad new remote block ID [%d].", new_blk_ID );
+        if ( n > 0 && sgCreateRemoteBlocks( n, blocks+(from-first), nde, blk ) ){
+            logMessage( LOG_ERROR_LEVEL, "sgwrite: failed to create [%d] blocks", n );
             return(-1);
         }
-        if ( new_rem_ID == SG_NODE_UNKNOWN ){
-            logMessage( LOG_ERROR_LEVEL, "sgwrite: bad new remote node ID [%d].", new_rem_ID );
-            return(-1);
+        for ( int k=0; k<n; k++ ){
+            SG_Block_Ref * ref = sgFileBlock( target_file, from+k );
+            ref->nde = nde[k];
+            ref->blk = blk[k];
+            if ( stream ){
+                sgStreamBypassed += 1;
+            } else {
+                putSGDataBlock( nde[k], blk[k], blocks[from-first+k] );
+            }
         }
-        (target_file->position) += len;
+        target_file->blk_num = from+n;
+        target_file->tailHeld = hold;
+    }
+    target_file->length = length;
+    return( 0 );
+}
 
-        if ( getSGDataBlock( *((target_file->node_ID)+target_blk_m), *((target_file->blk_ID)+target_blk_m) ) != NULL ){
-            putSGDataBlock( *((target_file->node_ID)+target_blk_m), *((target_file->blk_ID)+target_blk_m), temp_buf );
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileBlock
+// Description  : Find where a block of a file is kept in its block map
+//
+// Inputs       : file - the file
+//                i - the block (within the map's room)
+// Outputs      : the block's node and block ID
 
-    }
-    // Log the write, return bytes written
-    return( len );
+SG_Block_Ref * sgFileBlock( SG_File *file, uint64_t i ) {
+    return( file->map[i/SG_MAP_LEAF] + i%SG_MAP_LEAF );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sgseek
-// Description  : Seek to a specific place in the file
+// Function     : sgFileMapGrow
+// Description  : Make room in a file's block map for a number of blocks,
+//                adding leaves (and doubling the leaf pointers) as needed,
+//                so the map costs memory in step with the file
 //
-// Inputs       : fh - the file handle of the file to seek in
-//                off - offset within the file to seek to
-// Outputs      : new position if successful, -1 if failure
+// Inputs       : file - the file
+//                blocks - blocks the map must hold
+// Outputs      : 0 if successful, -1 if failure
 
-int sgseek(SgFHandle fh, size_t off) {
+int sgFileMapGrow( SG_File *file, uint64_t blocks ) {
+    uint64_t leaves = (blocks+SG_MAP_LEAF-1)/SG_MAP_LEAF;
 
-    if (fh < 0 || fh > file_count-1){
-        logMessage( LOG_ERROR_LEVEL, "sgseek: Bad file handle. File handle:[%d]", fh );
-        return (-1);
+    if ( leaves > file->mapRoom ){
+        uint64_t room = file->mapRoom ? file->mapRoom : 1;
+        while ( room < leaves ){
+            room *= 2;
+        }
+        SG_Block_Ref ** map = (SG_Block_Ref **) realloc( file->map, room*sizeof(SG_Block_Ref *) );
+        if ( map == NULL ){
+            logMessage( LOG_ERROR_LEVEL, "sgFileMapGrow: no memory for a map of [%lu] blocks", blocks );
+            return( -1 );
+        }
+        file->map = map;
+        file->mapRoom = room;
     }
-
-    if ( off > (file_list+fh)->length ){
-        logMessage( LOG_ERROR_LEVEL, "sgseek: Bad offset. Length: [%d], offset: [%d]", (file_list+fh)->length, off );
-        return(-1);
+    for ( ; file->mapLeaves < leaves; file->mapLeaves++ ){
+        if ( (file->map[file->mapLeaves] = (SG_Block_Ref *) malloc( SG_MAP_LEAF*sizeof(SG_Block_Ref) )) == NULL ){
+            logMessage( LOG_ERROR_LEVEL, "sgFileMapGrow: no memory for a map of [%lu] blocks", blocks );
+            return( -1 );
+        }
     }
+    return( 0 );
+}
 
-    SG_File * target_file = file_list + fh;
-    target_file->position = off;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileMapFree
+// Description  : Free a file's block map
+//
+// Inputs       : file - the file
+// Outputs      : none
 
-    //logMessage( LOG_ERROR_LEVEL, "seeked to:[%d], File handle:[%d]", off, fh );
-    // Return new position
-    return( off );
+void sgFileMapFree( SG_File *file ) {
+    for ( uint64_t l=0; l<file->mapLeaves; l++ ){
+        free( file->map[l] );
+    }
+    free( file->map );
+    file->map = NULL;
+    file->mapRoom = file->mapLeaves = 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sgclose
-// Description  : Close the file
+// Function     : sgFileFlushTail
+// Description  : Create the partly filled last block a file has been
+//                holding back, if it has one
 //
-// Inputs       : fh - the file handle of the file to close
-// Outputs      : 0 if successful test, -1 if failure
+// Inputs       : file - the file
+// Outputs      : 0 if successful, -1 if failure
 
-int sgclose(SgFHandle fh) {
-
-    if (fh < 0 || fh > file_count-1){
-        logMessage( LOG_ERROR_LEVEL, "sgclose: Bad file handle. File handle:[%d]", fh );
-        return (-1);
+int sgFileFlushTail( SG_File *file ) {
+    if ( !file->tailHeld ){
+        return( 0 );
     }
-
-    if ( (file_list+fh)->open == 0 ){
-        logMessage( LOG_ERROR_LEVEL, "sgclose: Bad file handle, file [%d] was not opened", fh);
-        return(-1);
+    SG_Block_Ref * ref = sgFileBlock( file, file->blk_num );
+    setSGCachePartition( file->cachePart );
+    if ( sgCreateRemoteBlocks( 1, &file->tail, &ref->nde, &ref->blk ) ){
+        logMessage( LOG_ERROR_LEVEL, "sgFileFlushTail: failed to create block [%lu]", file->blk_num );
+        return( -1 );
     }
-
-    (file_list+fh)->open = 0;
-    // Return successfully
+    putSGDataBlock( ref->nde, ref->blk, file->tail );
+    file->blk_num += 1;
+    file->tailHeld = 0;
     return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sgshutdown
-// Description  : Shut down the filesystem
+// Function     : sgFileSync
+// Description  : Create a file's held tail and write back the blocks it
+//                has dirty in the cache
 //
-// Inputs       : none
+// Inputs       : file - the file
+// Outputs      : 0 if successful, -1 if failure
+
+int sgFileSync( SG_File *file ) {
+    if ( sgFileFlushTail( file ) ){
+        return( -1 );
+    }
+    for ( uint64_t i=0; i<file->blk_num; i++ ){
+        SG_Block_Ref * ref = sgFileBlock( file, i );
+        if ( flushSGDataBlock( ref->nde, ref->blk ) ){
+            logMessage( LOG_ERROR_LEVEL, "sgFileSync: failed to write back block [%lu]", ref->blk );
+            return( -1 );
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileTruncate
+// Description  : Cut a file short.  The blocks wholly past the new end are
+//                deleted from their nodes, last first and a batch at a
+//                time, each batch dropped from the map and the cache once
+//                it is gone; the map leaves left empty are freed.  If a
+//                delete fails, the file is left cut short of the blocks
+//                after it, its length no more than the blocks it keeps
+//                hold (blocks before it whose deletes went through in
+//                the same batch are lost).  The bytes past the end in the
+//                new last block are left as they are: nothing reads past
+//                the end, and a write reaching past it covers them.
+//
+// Inputs       : file - the file
+//                length - the new length (no more than the current one)
+// Outputs      : 0 if successful, -1 if failure
+
+int sgFileTruncate( SG_File *file, uint64_t length ) {
+    SG_Node_ID nde[SG_POST_BATCH_MAX];
+    SG_Block_ID blk[SG_POST_BATCH_MAX];
+    uint64_t keep = (length+SG_BLOCK_SIZE-1)/SG_BLOCK_SIZE;
+    int ret = 0;
+
+    if ( file->tailHeld && file->blk_num >= keep ){
+        file->tailHeld = 0;
+    }
+    while ( file->blk_num > keep ){
+        int n = ( file->blk_num-keep < SG_POST_BATCH_MAX ) ? file->blk_num-keep : SG_POST_BATCH_MAX;
+        int deleted;
+        for ( int k=0; k<n; k++ ){
+            SG_Block_Ref * ref = sgFileBlock( file, file->blk_num-1-k );
+            nde[k] = ref->nde;
+            blk[k] = ref->blk;
+        }
+        if ( sgDeleteRemoteBlocks(n, nde, blk, &deleted) ){
+            logMessage( LOG_ERROR_LEVEL, "sgFileTruncate: failed to delete blocks of file [%s]", file->name );
+            ret = -1;
+        }
+        file->blk_num -= deleted;
+        for ( int k=0; k<deleted; k++ ){
+            if ( dropSGDataBlock( nde[k], blk[k] ) ){
+                logMessage( LOG_ERROR_LEVEL, "sgFileTruncate: deleted block [%lu] is still being read into the cache", blk[k] );
+                ret = -1;
+            }
+        }
+        if ( deleted < n ){
+            break;
+        }
+    }
+    if ( ret == 0 ){
+        file->length = length;
+    } else if ( file->length > (file->blk_num+file->tailHeld)*SG_BLOCK_SIZE ){
+        file->length = (file->blk_num+file->tailHeld)*SG_BLOCK_SIZE;
+    }
+    file->position = ( file->position > file->length ) ? file->length : file->position;
+    file->seqNext = file->seqRun = 0;
+    file->raStart = file->raEnd = 0;
+
+    // Free the leaves nothing is mapped into any more (the held tail's
+    // block needs one)
+    uint64_t leaves = (file->blk_num+file->tailHeld+SG_MAP_LEAF-1)/SG_MAP_LEAF;
+    for ( ; file->mapLeaves > leaves; file->mapLeaves-- ){
+        free( file->map[file->mapLeaves-1] );
+    }
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgIovLength / sgIovRange / sgIovCopy
+// Description  : Treat a list of buffers as one run of bytes: its length,
+//                where a range of it lies if that is all in one buffer,
+//                and copying a range in or out of it
+//
+// Inputs       : iov - the buffers
+//                iovcnt - how many
+//                at - offset of the range in the run
+//                len - length of the range
+//                block - where to copy the range to (in) or from
+//                in - copy out of the buffers into block
+// Outputs      : the length, the range (NULL if split), none
+
+size_t sgIovLength( const struct iovec *iov, int iovcnt ) {
+    size_t len = 0;
+
+    for ( int i=0; i<iovcnt; i++ ){
+        len += iov[i].iov_len;
+    }
+    return( len );
+}
+
+char * sgIovRange( const struct iovec *iov, int iovcnt, size_t at, size_t len ) {
+    for ( int i=0; i<iovcnt; i++ ){
+        if ( at < iov[i].iov_len ){
+            return( (at+len <= iov[i].iov_len) ? (char *)iov[i].iov_base + at : NULL );
+        }
+        at -= iov[i].iov_len;
+    }
+    return( NULL );
+}
+
+void sgIovCopy( const struct iovec *iov, int iovcnt, size_t at, char *block, size_t len, bool in ) {
+    for ( int i=0; i<iovcnt && len > 0; i++ ){
+        if ( at >= iov[i].iov_len ){
+            at -= iov[i].iov_len;
+            continue;
+        }
+        size_t n = ( iov[i].iov_len-at < len ) ? iov[i].iov_len-at : len;
+        if ( in ){
+            memcpy( block, (char *)iov[i].iov_base + at, n );
+        } else {
+            memcpy( (char *)iov[i].iov_base + at, block, n );
+        }
+        block += n;
+        len -= n;
+        at = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgseek
+// Description  : Seek to a specific place in the file
+//
+// Inputs       : fh - the file handle of the file to seek in
+//                off - offset within the file to seek to
+// Outputs      : new position if successful, -1 if failure
+
+int64_t sgseek(SgFHandle fh, uint64_t off) {
+
+    sgAsyncDrain();
+    SG_File * target_file = sgFileOfHandle( fh );
+    if ( target_file == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgseek: Bad file handle. File handle:[%d]", fh );
+        return (-1);
+    }
+
+    if ( off > target_file->length ){
+        logMessage( LOG_ERROR_LEVEL, "sgseek: Bad offset. Length: [%lu], offset: [%lu]", target_file->length, off );
+        return(-1);
+    }
+
+    target_file->position = off;
+
+    //logMessage( LOG_ERROR_LEVEL, "seeked to:[%d], File handle:[%d]", off, fh );
+    // Return new position
+    return( off );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgfsync
+// Description  : Get everything written to the file out to its nodes
+//
+// Inputs       : fh - the file handle of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int sgfsync(SgFHandle fh) {
+
+    sgAsyncDrain();
+    SG_File * target_file = sgFileOfHandle( fh );
+    if ( target_file == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgfsync: Bad file handle, file [%d] was not opened", fh);
+        return(-1);
+    }
+    return( sgFileSync(target_file) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgtruncate
+// Description  : Cut the file down to a length, the blocks past it are
+//                deleted from their nodes
+//
+// Inputs       : fh - the file handle of the file
+//                len - the new length, no more than the current one
+// Outputs      : 0 if successful, -1 if failure
+
+int sgtruncate(SgFHandle fh, uint64_t len) {
+
+    sgAsyncDrain();
+    SG_File * target_file = sgFileOfHandle( fh );
+    if ( target_file == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgtruncate: Bad file handle, file [%d] was not opened", fh);
+        return(-1);
+    }
+    if ( len > target_file->length ){
+        logMessage( LOG_ERROR_LEVEL, "sgtruncate: can not grow file from [%lu] to [%lu] bytes", target_file->length, len );
+        return(-1);
+    }
+    return( sgFileTruncate(target_file, len) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgunlink
+// Description  : Remove a (closed) file, deleting all of its blocks
+//
+// Inputs       : path - the file name
+// Outputs      : 0 if successful, -1 if failure
+
+int sgunlink(const char *path) {
+
+    sgAsyncDrain();
+    SG_File * target_file = sgFindFile( path );
+    if ( target_file == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgunlink: no file [%s]", path );
+        return(-1);
+    }
+    if ( target_file->open ){
+        logMessage( LOG_ERROR_LEVEL, "sgunlink: file [%s] is open", path );
+        return(-1);
+    }
+    if ( sgFileTruncate(target_file, 0) ){
+        return(-1);
+    }
+
+    // Take it out of the name index
+    SG_File ** link = file_buckets + (sgFileNameHash(path) & (file_bucket_count-1));
+    while ( *link != target_file ){
+        link = &(*link)->hnext;
+    }
+    *link = target_file->hnext;
+    file_count -= 1;
+    free( target_file->name );
+    free( target_file->tail );
+    sgFileMapFree( target_file );
+    free( target_file );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgclose
+// Description  : Close the file
+//
+// Inputs       : fh - the file handle of the file to close
+// Outputs      : 0 if successful test, -1 if failure
+
+int sgclose(SgFHandle fh) {
+
+    sgAsyncDrain();
+    SG_File * target_file = sgFileOfHandle( fh );
+    if ( target_file == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgclose: Bad file handle, file [%d] was not opened", fh);
+        return(-1);
+    }
+
+    // Create the held tail, write back whatever is dirty in the cache
+    if ( sgFileSync( target_file ) ){
+        logMessage( LOG_ERROR_LEVEL, "sgclose: failed to write back file [%s]", target_file->name );
+        return(-1);
+    }
+
+    // The file stays in the name index, its handle goes back for reuse
+    free( target_file->tail );
+    target_file->tail = NULL;
+    target_file->open = 0;
+    target_file->file_handle = -1;
+    file_handles[fh] = NULL;
+    file_free[file_free_count++] = fh;
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgcachegroup
+// Description  : Put a file in a cache partition of its own or shared with
+//                the other files of a named group, so its blocks keep at
+//                least minBytes of the cache and never take more than
+//                maxBytes
+//
+// Inputs       : fh - the file handle
+//                group - the group name, NULL for a partition of its own
+//                minBytes - cache memory kept for the group
+//                maxBytes - most cache memory the group may use, 0 for no limit
+// Outputs      : 0 if successful, -1 if failure
+
+int sgcachegroup(SgFHandle fh, const char *group, size_t minBytes, size_t maxBytes) {
+
+    sgAsyncDrain();
+    SG_File * target_file = sgFileOfHandle( fh );
+    if ( target_file == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgcachegroup: Bad file handle. File handle:[%d]", fh );
+        return (-1);
+    }
+
+    int part = createSGCachePartition( group ? group : target_file->name, minBytes, maxBytes );
+    if ( part < 0 ){
+        logMessage( LOG_ERROR_LEVEL, "sgcachegroup: failed to set up a cache partition for file [%d]", fh );
+        return (-1);
+    }
+    target_file->cachePart = part;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgshutdown
+// Description  : Shut down the filesystem
+//
+// Inputs       : none
 // Outputs      : 0 if successful test, -1 if failure
 
 int sgshutdown(void) {
     // Local variables
-    char sendPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_BASE_PACKET_SIZE];
+    char sendPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_DATA_PACKET_SIZE];
     size_t pktlen, rpktlen;
     SG_Node_ID rem_ID, loc_ID;
     SG_Block_ID blk_ID;
@@ -729,6 +1199,39 @@ int sgshutdown(void) {
     SG_System_OP op;
     SG_Packet_Status ret;
 
+    // Stop the async thread once it has run everything submitted
+    pthread_mutex_lock( &asyncLock );
+    bool running = asyncRunning;
+    asyncStop = running;
+    pthread_cond_signal( &asyncWork );
+    pthread_mutex_unlock( &asyncLock );
+    if ( running ){
+        pthread_join( asyncThread, NULL );
+        pthread_mutex_lock( &asyncLock );
+        asyncRunning = asyncStop = 0;
+        if ( asyncOutstanding ){
+            logMessage( LOG_WARNING_LEVEL, "sgshutdown: [%d] async completions were never reaped.", asyncOutstanding );
+        }
+        asyncSubHead = asyncSubTail = asyncCompHead = asyncCompTail = 0;
+        asyncOutstanding = 0;
+        pthread_mutex_unlock( &asyncLock );
+    }
+
+    // Held tails and dirty blocks must reach their nodes before the
+    // endpoint stops
+    for ( size_t b=0; b<file_bucket_count; b++ ){
+        for ( SG_File * file = file_buckets[b]; file != NULL; file = file->hnext ){
+            if ( sgFileFlushTail( file ) ){
+                logMessage( LOG_ERROR_LEVEL, "sgshutdown: failed to create the tail of file [%s].", file->name );
+                return(-1);
+            }
+        }
+    }
+    if ( flushSGCache() < 0 ){
+        logMessage( LOG_ERROR_LEVEL, "sgshutdown: failed to write back cached blocks." );
+        return(-1);
+    }
+
     //packing
     pktlen = SG_DATA_PACKET_SIZE;
     if ( (ret = serialize_sg_packet( sgLocalNodeId,
@@ -744,7 +1247,7 @@ int sgshutdown(void) {
 
     //send packet
     rpktlen = SG_DATA_PACKET_SIZE;
-    if ( sgServicePost(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
+    if ( sgServicePostOne(sendPacket, &pktlen, recvPacket, &rpktlen) ) {
         logMessage( LOG_ERROR_LEVEL, "sgshutdown: failed packet post" );
         return(-1);
     }
@@ -756,218 +1259,432 @@ int sgshutdown(void) {
         return(-1);
     }
 
+    if ( sgCacheAdmission ){
+        logMessage( LOG_INFO_LEVEL, "[Cache] Streaming bypass: %lu blocks read or written around the cache.",
+                    sgStreamBypassed );
+    }
+    if ( sgReadAheadFetched ){
+        logMessage( LOG_INFO_LEVEL, "[Cache] Read-ahead: %lu blocks fetched ahead, %lu reached by the reader, %lu evicted first.",
+                    sgReadAheadFetched, sgReadAheadUsed, sgReadAheadLost );
+    }
+    sgNodeLogStats();
+    logMessage( LOG_INFO_LEVEL, "[Post] %lu requests in %lu service exchanges%s.", sgPostRequests, sgPostExchanges,
+                sgPostEnvelopes ? " (batches in envelopes)" : "" );
     if ( closeSGCache() == 0 ){
         logMessage( LOG_INFO_LEVEL, "Shut down SG cache." );
     }
+    closeSGL2Cache();
 
     // Log, return successfully
     logMessage( LOG_INFO_LEVEL, "Shut down Scatter/Gather driver." );
     logMessage( LOG_INFO_LEVEL, "Freeing pointers..." );
-    free(file_list);
-    free(remSeq_list);
-    file_list = NULL;
-    remSeq_list = NULL;
+    for ( size_t b=0; b<file_bucket_count; b++ ){
+        for ( SG_File * file = file_buckets[b], * next; file != NULL; file = next ){
+            next = file->hnext;
+            free( file->name );
+            free( file->tail );
+            sgFileMapFree( file );
+            free( file );
+        }
+    }
+    free(file_buckets);
+    free(file_handles);
+    free(file_free);
+    sgNodeClear();
+    sgServiceReset();
+    file_buckets = file_handles = NULL;
+    file_free = NULL;
+    file_bucket_count = 0;
+    file_count = file_handle_count = file_handle_room = file_free_count = 0;
+    sgDriverInitialized = 0;
     
     return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : serialize_sg_packet
-// Description  : Serialize a ScatterGather packet (create packet)
+// Function     : sgread_async
+// Description  : Queue a read from the file position; it runs, in order
+//                with the other operations queued, on the async thread,
+//                its blocks fetched together with theirs
 //
-// Inputs       : loc - the local node identifier
-//                rem - the remote node identifier
-//                blk - the block identifier
-//                op - the operation performed/to be performed on block
-//                sseq - the sender sequence number
-//                rseq - the receiver sequence number
-//                data - the data block (of size SG_BLOCK_SIZE) or NULL
-//                packet - the buffer to place the data
-//                plen - the packet length (int bytes)
-// Outputs      : 0 if successfully created, -1 if failure
-
-SG_Packet_Status serialize_sg_packet(SG_Node_ID loc, SG_Node_ID rem, SG_Block_ID blk,
-                                     SG_System_OP op, SG_SeqNum sseq, SG_SeqNum rseq, char *data,
-                                     char *packet, size_t *plen) {
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data (left alone until completion)
+//                len - the length of the read
+//                cookie - tag returned with the completion
+// Outputs      : 0 if queued, -1 if SG_ASYNC_DEPTH operations are outstanding
 
-            uint32_t magic_copy = SG_MAGIC_VALUE;
-            SG_Node_ID loc_copy = loc;
-            SG_Node_ID rem_copy = rem;
-            SG_Block_ID blk_copy = blk;
-            SG_System_OP op_copy = op;
-            SG_SeqNum sseq_copy = sseq;
-            SG_SeqNum rseq_copy = rseq;
-            uint8_t data_indicator;
+int sgread_async(SgFHandle fh, char *buf, size_t len, uint64_t cookie) {
+    return( sgAsyncSubmit(0, fh, buf, len, cookie) );
+}
 
-            if ( packet == NULL){
-                return ( SG_PACKT_PDATA_BAD );
-            }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgwrite_async
+// Description  : Queue a write at the file position; it runs, in order
+//                with the other operations queued, on the async thread,
+//                its block updates sent together with theirs
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - the data (left alone until completion)
+//                len - the length of the write
+//                cookie - tag returned with the completion
+// Outputs      : 0 if queued, -1 if SG_ASYNC_DEPTH operations are outstanding
 
-            if ( loc == 0 ){
-                return ( SG_PACKT_LOCID_BAD );
-            }
-            if ( rem == 0 ){
-                return ( SG_PACKT_REMID_BAD );
-            }
-            if ( sseq == 0 ){
-                return ( SG_PACKT_SNDSQ_BAD );
-            }
-            if ( rseq == 0 ){
-                return ( SG_PACKT_RCVSQ_BAD );
-            }
-            if ( blk == 0 ) {
-                return ( SG_PACKT_BLKID_BAD );
-            }
-            if ( op > 6 || op < 0) {
-                return ( SG_PACKT_OPERN_BAD );
-            }
+int sgwrite_async(SgFHandle fh, char *buf, size_t len, uint64_t cookie) {
+    return( sgAsyncSubmit(1, fh, buf, len, cookie) );
+}
 
-            if ( data == NULL ){
-                *plen = SG_BASE_PACKET_SIZE;
-                data_indicator = 0;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgpoll
+// Description  : Reap the completions that are in, without waiting
+//
+// Inputs       : cqe - where to put the completions
+//                max - room at cqe
+// Outputs      : the number of completions reaped
 
-            } else {
-                *plen = SG_DATA_PACKET_SIZE;
-                data_indicator = 1;
-            }
+int sgpoll(SgCompletion *cqe, int max) {
+    return( sgwait(cqe, 0, max) );
+}
 
-            memcpy(packet, &magic_copy, sizeof(uint32_t));
-            memcpy(packet+4, &loc_copy, sizeof(SG_Node_ID));
-            memcpy(packet+12, &rem_copy, sizeof(SG_Node_ID));
-            memcpy(packet+20, &blk_copy, sizeof(SG_Block_ID));
-            memcpy(packet+28, &op_copy, sizeof(SG_System_OP));
-            memcpy(packet+32, &sseq_copy, sizeof(SG_SeqNum));
-            memcpy(packet+34, &rseq_copy, sizeof(SG_SeqNum));
-            memcpy(packet+36, &data_indicator, 1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgwait
+// Description  : Wait until at least min completions are in (or all the
+//                outstanding operations, if fewer), then reap up to max
+//
+// Inputs       : cqe - where to put the completions
+//                min - completions to wait for
+//                max - room at cqe
+// Outputs      : the number of completions reaped, -1 if failure
 
-            if ( data != NULL ){
-                memcpy(packet+37, data, SG_BLOCK_SIZE);
-                memcpy(packet+1061, &magic_copy, sizeof(uint32_t));
+int sgwait(SgCompletion *cqe, int min, int max) {
+    int n = 0;
 
-            } else {
-                memcpy(packet+37, &magic_copy, sizeof(uint32_t));
-            }
+    if ( cqe == NULL || min < 0 || max < min ){
+        logMessage( LOG_ERROR_LEVEL, "sgwait: bad completion request, min [%d], max [%d]", min, max );
+        return( -1 );
+    }
 
-    // Return the system function return value
-    return (SG_PACKT_OK);
-    
+    pthread_mutex_lock( &asyncLock );
+    min = ( min < asyncOutstanding ) ? min : asyncOutstanding;
+    while ( (int)(asyncCompTail - asyncCompHead) < min ){
+        pthread_cond_wait( &asyncDone, &asyncLock );
+    }
+    while ( n < max && asyncCompHead != asyncCompTail ){
+        cqe[n++] = asyncCompleted[asyncCompHead++ % SG_ASYNC_DEPTH].done;
+        asyncOutstanding -= 1;
+    }
+    pthread_mutex_unlock( &asyncLock );
+    return( n );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : deserialize_sg_packet
-// Description  : De-serialize a ScatterGather packet (unpack packet)
+// Function     : sgAsyncSubmit / sgAsyncQueue
+// Description  : Queue an operation for the async thread, starting it the
+//                first time.  Outstanding operations (submitted or
+//                completed but not reaped) are held to SG_ASYNC_DEPTH so
+//                the completion ring never overflows.  sgAsyncQueue is
+//                called with asyncLock held, so several operations can be
+//                queued for the thread to take as one batch.
 //
-// Inputs       : loc - the local node identifier
-//                rem - the remote node identifier
-//                blk - the block identifier
-//                op - the operation performed/to be performed on block
-//                sseq - the sender sequence number
-//                rseq - the receiver sequence number
-//                data - the data block (of size SG_BLOCK_SIZE) or NULL
-//                packet - the buffer to place the data
-//                plen - the packet length (int bytes)
-// Outputs      : 0 if successfully created, -1 if failure
-
-SG_Packet_Status deserialize_sg_packet(SG_Node_ID *loc, SG_Node_ID *rem, SG_Block_ID *blk,
-                                       SG_System_OP *op, SG_SeqNum *sseq, SG_SeqNum *rseq, char *data,
-                                       char *packet, size_t plen) {
-
-            SG_Node_ID loc_value =0;
-            SG_Node_ID *loc_ptr = &loc_value;
-            memcpy( loc_ptr, packet+4, sizeof(SG_Node_ID));
-
-            SG_Node_ID rem_value =0;
-            SG_Node_ID *rem_ptr = &rem_value;
-            memcpy( rem_ptr, packet+12, sizeof(SG_Node_ID));
+// Inputs       : write - a write rather than a read
+//                fh, buf, len - the operation
+//                cookie - tag returned with the completion
+// Outputs      : 0 if queued, -1 if failure
+
+int sgAsyncSubmit( bool write, SgFHandle fh, char *buf, size_t len, uint64_t cookie ) {
+    pthread_mutex_lock( &asyncLock );
+    int ret = sgAsyncQueue( write, fh, buf, len, cookie );
+    pthread_mutex_unlock( &asyncLock );
+    return( ret );
+}
 
-            SG_Block_ID blk_value =0;
-            SG_Block_ID *blk_ptr = &blk_value;
-            memcpy( blk_ptr, packet+20, sizeof(SG_Block_ID));
+int sgAsyncQueue( bool write, SgFHandle fh, char *buf, size_t len, uint64_t cookie ) {
+    if ( asyncOutstanding == SG_ASYNC_DEPTH ){
+        return( -1 );
+    }
+    if ( !asyncRunning ){
+        if ( pthread_create(&asyncThread, NULL, sgAsyncWorker, NULL) ){
+            logMessage( LOG_ERROR_LEVEL, "sgAsyncSubmit: failed to start the async thread." );
+            return( -1 );
+        }
+        asyncRunning = 1;
+    }
+    SG_Async_Op * op = asyncSubmitted + (asyncSubTail++ % SG_ASYNC_DEPTH);
+    op->write = write;
+    op->fh = fh;
+    op->buf = buf;
+    op->len = len;
+    op->done.cookie = cookie;
+    op->done.result = -1;
+    asyncOutstanding += 1;
+    pthread_cond_signal( &asyncWork );
+    return( 0 );
+}
 
-            SG_System_OP op_value =0;
-            SG_System_OP *op_ptr = &op_value;
-            memcpy( op_ptr, packet+28, sizeof(SG_System_OP));
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncDrain
+// Description  : Wait until the async thread has run every operation
+//                submitted, so a synchronous call sees the file positions
+//                and contents they leave (the async thread itself does not
+//                wait, it is running them)
+//
+// Inputs       : none
+// Outputs      : none
 
-            SG_SeqNum sseq_value =0;
-            SG_SeqNum *sseq_ptr = &sseq_value;
-            memcpy( sseq_ptr, packet+32, sizeof(SG_SeqNum));
+void sgAsyncDrain( void ) {
+    pthread_mutex_lock( &asyncLock );
+    if ( asyncRunning && !pthread_equal(pthread_self(), asyncThread) ){
+        while ( asyncSubHead != asyncSubTail || asyncBusy ){
+            pthread_cond_wait( &asyncDone, &asyncLock );
+        }
+    }
+    pthread_mutex_unlock( &asyncLock );
+}
 
-            SG_SeqNum rseq_value =0;
-            SG_SeqNum *rseq_ptr = &rseq_value;
-            memcpy( rseq_ptr, packet+34, sizeof(SG_SeqNum));
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncWorker
+// Description  : The async thread.  It takes every operation submitted as
+//                one batch: the blocks the batch will read are fetched in
+//                one post, then the operations run in order through
+//                sgread/sgwrite with the block updates of each run of
+//                writes held back and sent in one post.  Completions are
+//                queued as they become final, until shutdown.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
 
-            if ( packet == NULL){
-                return ( SG_PACKT_PDATA_BAD );
-            }
+void * sgAsyncWorker( void *arg ) {
+    SG_Async_Op ops[SG_ASYNC_DEPTH];
 
-            if ( loc_value == 0 ){
-                return ( SG_PACKT_LOCID_BAD );
-            }
-            if ( rem_value == 0 ){
-                return ( SG_PACKT_REMID_BAD );
-            }
-            if ( blk_value == 0 ){
-                return ( SG_PACKT_BLKID_BAD );
-            }
-            if ( op_value > 6 || op_value < 0 ){
-                return ( SG_PACKT_OPERN_BAD );
-            }
-            if ( sseq_value == 0 ) {
-                return ( SG_PACKT_SNDSQ_BAD );
+    pthread_mutex_lock( &asyncLock );
+    for ( ;; ){
+        while ( asyncSubHead == asyncSubTail && !asyncStop ){
+            pthread_cond_wait( &asyncWork, &asyncLock );
+        }
+        if ( asyncSubHead == asyncSubTail ){
+            break;
+        }
+        int count = 0;
+        while ( asyncSubHead != asyncSubTail ){
+            ops[count++] = asyncSubmitted[asyncSubHead++ % SG_ASYNC_DEPTH];
+        }
+        asyncBusy = 1;
+        pthread_mutex_unlock( &asyncLock );
+
+        asyncDeferring = 1;
+        sgAsyncPrefetch( ops, count );
+        int settled = 0;
+        for ( int i=0; i<count; i++ ){
+            if ( !ops[i].write ){
+                sgAsyncSettle( ops, settled, i );   // a read sees the writes before it
+                settled = i;
             }
-            if ( rseq_value == 0 ) {
-                return ( SG_PACKT_RCVSQ_BAD );
+            ops[i].done.result = ops[i].write ? sgwrite(ops[i].fh, ops[i].buf, ops[i].len) : 
+                                                sgread(ops[i].fh, ops[i].buf, ops[i].len);
+            if ( !ops[i].write ){
+                sgAsyncSettle( ops, settled, i+1 );
+                settled = i+1;
             }
+        }
+        sgAsyncSettle( ops, settled, count );
+        asyncDeferring = 0;
 
-            if ( plen == SG_BASE_PACKET_SIZE ){
-                memcpy( loc, packet+4, sizeof(SG_Node_ID));
-                memcpy( rem, packet+12, sizeof(SG_Node_ID));
-                memcpy( blk, packet+20, sizeof(SG_Block_ID));
-                memcpy( op, packet+28, sizeof(SG_System_OP));
-                memcpy( sseq, packet+32, sizeof(SG_SeqNum));
-                memcpy( rseq, packet+34, sizeof(SG_SeqNum));
-            } else {
-                if ( data == NULL){
-                    return ( SG_PACKT_BLKDT_BAD );
-                }
-                memcpy( loc, packet+4, sizeof(SG_Node_ID));
-                memcpy( rem, packet+12, sizeof(SG_Node_ID));
-                memcpy( blk, packet+20, sizeof(SG_Block_ID));
-                memcpy( op, packet+28, sizeof(SG_System_OP));
-                memcpy( sseq, packet+32, sizeof(SG_SeqNum));
-                memcpy( rseq, packet+34, sizeof(SG_SeqNum));
-                memcpy( data, packet+37, SG_BLOCK_SIZE);
-            }
-            
-             // Return the system function return value
-        return (SG_PACKT_OK);
+        pthread_mutex_lock( &asyncLock );
+        asyncBusy = 0;
+        pthread_cond_broadcast( &asyncDone );
     }
+    pthread_mutex_unlock( &asyncLock );
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Driver support functions
+// Function     : sgAsyncPrefetch
+// Description  : Fetch the uncached blocks a batch of async operations will
+//                read (and those its writes will read, modify and write)
+//                straight into reserved cache lines, SG_POST_BATCH_MAX of
+//                them in one post.  File positions are followed through
+//                the batch; only blocks that already exist are fetched, each
+//                into its file's cache partition.
+//
+// Inputs       : ops - the operations, in order
+//                count - how many
+// Outputs      : none
+
+void sgAsyncPrefetch( SG_Async_Op *ops, int count ) {
+    SgFHandle fhs[SG_ASYNC_DEPTH];
+    uint64_t pos[SG_ASYNC_DEPTH], length[SG_ASYNC_DEPTH];
+    SG_Node_ID nde[SG_POST_BATCH_MAX];
+    SG_Block_ID blk[SG_POST_BATCH_MAX];
+    char * lines[SG_POST_BATCH_MAX];
+    int files = 0, n = 0;
+
+    // Partial writes only read their edge blocks when not sent as ranges
+    bool edges = !sgPostEnvelopes || sgCacheWriteBack;
+
+    for ( int i=0; i<count && n<SG_POST_BATCH_MAX; i++ ){
+        SG_File * file = sgFileOfHandle( ops[i].fh );
+        int f;
+        if ( file == NULL || ops[i].len == 0 ){
+            continue;
+        }
+        for ( f=0; f<files && fhs[f] != ops[i].fh; f++ );
+        if ( f == files ){
+            fhs[f] = ops[i].fh;
+            pos[f] = file->position;
+            length[f] = file->length;
+            files += 1;
+        }
+        uint64_t start = pos[f], end = pos[f] + ops[i].len;
+        if ( ops[i].write ){
+            pos[f] = end;
+            length[f] = ( end > length[f] ) ? end : length[f];
+        } else if ( start < length[f] ){
+            end = ( end < length[f] ) ? end : length[f];
+            pos[f] = end;
+        } else {
+            continue;
+        }
+        setSGCachePartition( file->cachePart );     // its lines are charged to its partition
+        for ( uint64_t b=start/SG_BLOCK_SIZE; b<=(end-1)/SG_BLOCK_SIZE && b<file->blk_num && n<SG_POST_BATCH_MAX; b++ ){
+            bool edge = ( b == start/SG_BLOCK_SIZE && start%SG_BLOCK_SIZE ) || ( b == (end-1)/SG_BLOCK_SIZE && end%SG_BLOCK_SIZE );
+            if ( ops[i].write && !(edges && edge) ){
+                continue;
+            }
+            SG_Block_Ref * ref = sgFileBlock( file, b );
+            if ( (lines[n] = reserveSGDataBlock(ref->nde, ref->blk)) != NULL ){
+                nde[n] = ref->nde;
+                blk[n] = ref->blk;
+                n += 1;
+            }
+        }
+    }
+    int failed = ( n > 0 ) ? sgObtainRemoteBlocks( n, nde, blk, lines ) : 0;
+    for ( int i=0; i<n; i++ ){
+        if ( failed ){
+            cancelSGDataBlock( nde[i], blk[i] );
+        } else {
+            commitSGDataBlock( nde[i], blk[i] );
+        }
+    }
+    if ( failed ){
+        logMessage( LOG_ERROR_LEVEL, "sgAsyncPrefetch: failed to obtain [%d] blocks", n );
+    }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sgInitEndpoint
-// Description  : Initialize the endpoint
+// Function     : sgAsyncSettle
+// Description  : Send the block updates held back for a run of async
+//                operations and queue their completions; if any update
+//                could not be sent, every write of the run fails
 //
-// Inputs       : none
-// Outputs      : 0 if successfull, -1 if failure
+// Inputs       : ops - the operations
+//                from, to - the run, [from, to)
+// Outputs      : none
 
-int sgInitEndpoint( void ) {
+void sgAsyncSettle( SG_Async_Op *ops, int from, int to ) {
+    if ( asyncDeferCount > 0 ){
+        sgAsyncFlushUpdates();
+    }
+    for ( int i=from; i<to && asyncDeferFailed; i++ ){
+        if ( ops[i].write ){
+            ops[i].done.result = -1;
+        }
+    }
+    asyncDeferFailed = 0;
+    if ( from == to ){
+        return;
+    }
+    pthread_mutex_lock( &asyncLock );
+    for ( int i=from; i<to; i++ ){
+        asyncCompleted[asyncCompTail++ % SG_ASYNC_DEPTH] = ops[i];
+    }
+    pthread_cond_broadcast( &asyncDone );
+    pthread_mutex_unlock( &asyncLock );
+}
 
-    // Local variables
-    char initPacket[SG_BASE_PACKET_SIZE], recvPacket[SG_BASE_PACKET_SIZE];
-    size_t pktlen, rpktlen;
-    SG_Node_ID loc, rem;
-    SG_Block_ID blkid;
-    SG_SeqNum sloc, srem;
-    SG_System_OP op;
-    SG_Packet_Status ret;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncUpdate / sgAsyncFlushUpdates
+// Description  : Send block updates, or on the async thread hold a copy of
+//                them back to go in one post with the updates of the writes
+//                around them; send the ones held back.  The held updates go
+//                out before any other block is fetched or updated, so
+//                nothing reads a block behind a held update.  Blocks whose
+//                update could not be sent are dropped from the cache.
+//
+// Inputs       : count - how many blocks (update)
+//                nde, blk, blocks, off, len - as sgUpdateRemoteRanges (update)
+// Outputs      : 0 if successful (or held), -1 if failure
 
-    // Local and do some initial setup
-    logMessage( LOG_INFO_LEVEL, "Initializing local endpoint ..." );
+int sgAsyncUpdate( int count, SG_Node_ID *nde, SG_Block_ID *blk, char **blocks, uint16_t *off, uint16_t *len ) {
+    if ( !asyncDeferring ){
+        return( sgUpdateRemoteRanges(count, nde, blk, blocks, off, len) );
+    }
+    for ( int i=0; i<count; i++ ){
+        if ( asyncDeferCount == SG_POST_BATCH_MAX ){
+            sgAsyncFlushUpdates();
+        }
+        int k = asyncDeferCount++;
+        asyncDeferNde[k] = nde[i];
+        asyncDeferBlk[k] = blk[i];
+        asyncDeferOff[k] = ( off != NULL ) ? off[i] : 0;
+        asyncDeferLen[k] = ( off != NULL ) ? len[i] : SG_BLOCK_SIZE;
+        memcpy( asyncDeferData[k], blocks[i], SG_BLOCK_SIZE );
+    }
+    return( 0 );
+}
+
+int sgAsyncFlushUpdates( void ) {
+    char * blocks[SG_POST_BATCH_MAX];
+    int count = asyncDeferCount;
+
+    asyncDeferCount = 0;
+    for ( int i=0; i<count; i++ ){
+        blocks[i] = asyncDeferData[i];
+    }
+    if ( count > 0 && sgUpdateRemoteRanges( count, asyncDeferNde, asyncDeferBlk, blocks, asyncDeferOff, asyncDeferLen ) ){
+        logMessage( LOG_ERROR_LEVEL, "sgAsyncFlushUpdates: failed to send [%d] held block updates", count );
+        for ( int i=0; i<count; i++ ){
+            dropSGDataBlock( asyncDeferNde[i], asyncDeferBlk[i] );
+        }
+        asyncDeferFailed = 1;
+        return( -1 );
+    }
+    return( 0 );
+}
+
+//
+// Driver support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgInitEndpoint
+// Description  : Initialize the endpoint
+//
+// Inputs       : none
+// Outputs      : 0 if successfull, -1 if failure
+
+int sgInitEndpoint( void ) {
+
+    // Local variables
+    char initPacket[SG_BASE_PACKET_SIZE], recvPacket[SG_BASE_PACKET_SIZE];
+    size_t pktlen, rpktlen;
+    SG_Node_ID loc, rem;
+    SG_Block_ID blkid;
+    SG_SeqNum sloc, srem;
+    SG_System_OP op;
+    SG_Packet_Status ret;
+
+    // Local and do some initial setup
+    logMessage( LOG_INFO_LEVEL, "Initializing local endpoint ..." );
     sgLocalSeqno = SG_INITIAL_SEQNO;
 
     // Setup the packet
@@ -985,7 +1702,7 @@ int sgInitEndpoint( void ) {
 
     // Send the packet
     rpktlen = SG_BASE_PACKET_SIZE;
-    if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
+    if ( sgServicePostOne(initPacket, &pktlen, recvPacket, &rpktlen) ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
         return( -1 );
     }
@@ -1008,8 +1725,1013 @@ int sgInitEndpoint( void ) {
 
     logMessage( LOG_INFO_LEVEL, "Completed initialization of node (local node ID %lu", sgLocalNodeId );
 
-    if ( initSGCache( SG_MAX_CACHE_ELEMENTS ) == 0 ){
+    if ( initSGCache( sgCacheBytes, 0, sgCachePolicy ) == 0 ){
         logMessage( LOG_INFO_LEVEL, "Completed initialization of cache" );
+        if ( sgCacheWriteBack ){
+            setSGCacheWriteBack( sgUpdateRemoteBlock );
+        }
+        if ( sgCacheAdmission ){
+            setSGCacheAdmission( true );
+        }
+        if ( sgCacheVictimBytes > 0 && setSGCacheVictimTier( sgCacheVictimBytes ) ){
+            logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: victim tier unavailable, continuing without it." );
+        }
+        if ( sgCacheL2Path != NULL && openSGL2Cache( sgCacheL2Path, SG_L2_DEFAULT_BLOCKS ) ){
+            logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: second tier cache unavailable, continuing without it." );
+        }
     }
     return( 0 );
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgUpdateRemoteBlock
+// Description  : Send a block update to the node holding the block (also
+//                the cache's write back function)
+//
+// Inputs       : nde - the remote node
+//                blk - the block to update
+//                block - the new block contents
+// Outputs      : 0 if successful, -1 if failure
+
+int sgUpdateRemoteBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    return( sgUpdateRemoteBlocks(1, &nde, &blk, &block) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgUpdateRemoteBlocks
+// Description  : Send several block updates, SG_POST_BATCH_MAX requests to
+//                a batch post
+//
+// Inputs       : count - how many blocks
+//                nde - the remote node of each block
+//                blk - the blocks to update
+//                blocks - the new contents of each block
+// Outputs      : 0 if successful, -1 if any update failed
+
+int sgUpdateRemoteBlocks( int count, SG_Node_ID *nde, SG_Block_ID *blk, char **blocks ) {
+    return( sgUpdateRemoteRanges(count, nde, blk, blocks, NULL, NULL) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgUpdateRemoteRanges
+// Description  : Send several block updates, SG_POST_BATCH_MAX requests to
+//                a batch post; an update of part of a block sends only the
+//                bytes changed, as a ranged update
+//
+// Inputs       : count - how many blocks
+//                nde - the remote node of each block
+//                blk - the blocks to update
+//                blocks - the new contents of each block (only the range
+//                         need be right for a ranged update)
+//                off - where each update starts in its block (NULL for
+//                      whole blocks)
+//                len - bytes each updates, SG_BLOCK_SIZE for the whole block
+// Outputs      : 0 if successful, -1 if any update failed
+
+int sgUpdateRemoteRanges( int count, SG_Node_ID *nde, SG_Block_ID *blk, char **blocks, uint16_t *off, uint16_t *len ) {
+
+    // Local variables
+    char sendPacket[SG_POST_BATCH_MAX][SG_BASE_PACKET_SIZE], recvPacket[SG_POST_BATCH_MAX][SG_BASE_PACKET_SIZE];
+    SG_Post posts[SG_POST_BATCH_MAX];
+    SG_Node_State * node[SG_POST_BATCH_MAX];
+    char * rpackets[SG_POST_BATCH_MAX];
+    size_t rlens[SG_POST_BATCH_MAX];
+    SG_Packet_Info info[SG_POST_BATCH_MAX];
+    SG_Packet_Status ret;
+
+    if ( asyncDeferCount > 0 ){
+        sgAsyncFlushUpdates();      // updates held back go first
+    }
+    for ( int done=0; done<count; done+=SG_POST_BATCH_MAX ){
+        int n = ( count-done < SG_POST_BATCH_MAX ) ? count-done : SG_POST_BATCH_MAX;
+
+        for ( int i=0; i<n; i++ ){
+            if ( (node[i] = sgNodeFind( nde[done+i] )) == NULL ){
+                logMessage( LOG_ERROR_LEVEL, "sgUpdateRemoteRanges: unknown remote node [%lu].", nde[done+i] );
+                return(-1);
+            }
+            size_t pktlen = SG_BASE_PACKET_SIZE;
+            if ( (ret = serialize_sg_packet( sgLocalNodeId,
+                                            nde[done+i],
+                                            blk[done+i],
+                                            SG_UPDATE_BLOCK,
+                                            sgLocalSeqno++,
+                                            (node[i]->resentSeq)+=1,
+                                            NULL, sendPacket[i], &pktlen)) != SG_PACKT_OK ) {
+                logMessage( LOG_ERROR_LEVEL, "sgUpdateRemoteRanges: failed serialization of packet [%d].", ret );
+                return(-1);
+            }
+            posts[i].riovcnt = sgPacketPieces( recvPacket[i], NULL, posts[i].riov );
+            posts[i].range = NULL;
+            if ( off == NULL || len[done+i] == SG_BLOCK_SIZE ){
+                posts[i].iovcnt = sgPacketPieces( sendPacket[i], blocks[done+i], posts[i].iov );
+                continue;
+            }
+
+            posts[i].iovcnt = sgPacketPieces( sendPacket[i], NULL, posts[i].iov );
+            posts[i].range = blocks[done+i] + off[done+i];
+            posts[i].rangeOff = off[done+i];
+            posts[i].rangeLen = len[done+i];
+        }
+        //send packets
+        int failed = sgServicePostBatch( posts, n );
+        for ( int i=0; i<n; i++ ){
+            sgNodeDone( node[i], posts+i, (posts[i].range != NULL) ? posts[i].rangeLen : SG_BLOCK_SIZE );
+        }
+        if ( failed ) {
+            logMessage( LOG_ERROR_LEVEL, "sgUpdateRemoteRanges: failed packet post" );
+            return(-1);
+        }
+        //unpack
+        for ( int i=0; i<n; i++ ){
+            rpackets[i] = recvPacket[i];
+            rlens[i] = ( posts[i].rlen == SG_BASE_PACKET_SIZE ) ? SG_BASE_PACKET_SIZE : 0;
+        }
+        if ( sgPacketDecodeBatch(rpackets, rlens, n, info, &ret) < n ){
+            logMessage( LOG_ERROR_LEVEL, "sgUpdateRemoteRanges: failed deserialization of packet [%d].", ret );
+            return(-1);
+        }
+        for ( int i=0; i<n; i++ ){
+            //Check assigned block and node ID
+            if ( info[i].blockID == SG_BLOCK_UNKNOWN ){
+                logMessage( LOG_ERROR_LEVEL, "sgUpdateRemoteRanges: bad remote block ID [%lu].", info[i].blockID );
+                return(-1);
+            }
+            if ( info[i].remNodeId == SG_NODE_UNKNOWN ){
+                logMessage( LOG_ERROR_LEVEL, "sgUpdateRemoteRanges: bad remote node ID [%lu].", info[i].remNodeId );
+                return(-1);
+            }
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgObtainRemoteBlock
+// Description  : Fetch a block from the node holding it, the payload is
+//                unpacked directly into the destination
+//
+// Inputs       : nde - the remote node
+//                blk - the block to fetch
+//                block - where to put the block contents
+// Outputs      : 0 if successful, -1 if failure
+
+int sgObtainRemoteBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    return( sgObtainRemoteBlocks(1, &nde, &blk, &block) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgObtainRemoteBlocks
+// Description  : Fetch several blocks, SG_POST_BATCH_MAX requests to a
+//                batch post; each payload is unpacked directly into its
+//                destination
+//
+// Inputs       : count - how many blocks
+//                nde - the remote node of each block
+//                blk - the blocks to fetch
+//                blocks - where to put each block's contents
+// Outputs      : 0 if successful, -1 if any block could not be fetched
+
+int sgObtainRemoteBlocks( int count, SG_Node_ID *nde, SG_Block_ID *blk, char **blocks ) {
+
+    // Local variables
+    char sendPacket[SG_POST_BATCH_MAX][SG_BASE_PACKET_SIZE], recvPacket[SG_POST_BATCH_MAX][SG_BASE_PACKET_SIZE];
+    SG_Post posts[SG_POST_BATCH_MAX];
+    SG_Node_State * node[SG_POST_BATCH_MAX];
+    char * rpackets[SG_POST_BATCH_MAX];
+    size_t rlens[SG_POST_BATCH_MAX];
+    SG_Packet_Info info[SG_POST_BATCH_MAX];
+    SG_Packet_Status ret;
+
+    if ( asyncDeferCount > 0 ){
+        sgAsyncFlushUpdates();      // nothing is fetched from behind a held update
+    }
+    for ( int done=0; done<count; done+=SG_POST_BATCH_MAX ){
+        int n = ( count-done < SG_POST_BATCH_MAX ) ? count-done : SG_POST_BATCH_MAX;
+
+        for ( int i=0; i<n; i++ ){
+            if ( (node[i] = sgNodeFind( nde[done+i] )) == NULL ){
+                logMessage( LOG_ERROR_LEVEL, "sgObtainRemoteBlocks: unknown remote node [%lu].", nde[done+i] );
+                return(-1);
+            }
+            size_t pktlen = SG_BASE_PACKET_SIZE;
+            if ( (ret = serialize_sg_packet( sgLocalNodeId,
+                                            nde[done+i],
+                                            blk[done+i],
+                                            SG_OBTAIN_BLOCK,
+                                            sgLocalSeqno++,
+                                            (node[i]->resentSeq)+=1,
+                                            NULL, sendPacket[i], &pktlen)) != SG_PACKT_OK ) {
+                logMessage( LOG_ERROR_LEVEL, "sgObtainRemoteBlocks: failed serialization of packet [%d].", ret );
+                return(-1);
+            }
+            posts[i].iovcnt = sgPacketPieces( sendPacket[i], NULL, posts[i].iov );
+            posts[i].riovcnt = sgPacketPieces( recvPacket[i], blocks[done+i], posts[i].riov );
+            posts[i].range = NULL;
+        }
+        //send packets
+        int failed = sgServicePostBatch( posts, n );
+        for ( int i=0; i<n; i++ ){
+            sgNodeDone( node[i], posts+i, SG_BLOCK_SIZE );
+        }
+        if ( failed ) {
+            logMessage( LOG_ERROR_LEVEL, "sgObtainRemoteBlocks: failed packet post" );
+            return(-1);
+        }
+        //unpack, each block was received in place, between header and trailer
+        for ( int i=0; i<n; i++ ){
+            rpackets[i] = recvPacket[i];
+            rlens[i] = ( posts[i].rlen == SG_DATA_PACKET_SIZE ) ? SG_BASE_PACKET_SIZE : 0;
+        }
+        if ( sgPacketDecodeBatch(rpackets, rlens, n, info, &ret) < n ){
+            logMessage( LOG_ERROR_LEVEL, "sgObtainRemoteBlocks: failed deserialization of packet [%d].", ret );
+            return(-1);
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCreateRemoteBlocks
+// Description  : Create several blocks, SG_POST_BATCH_MAX requests to a
+//                batch post, and note the nodes they were placed on
+//
+// Inputs       : count - how many blocks
+//                blocks - the contents of each block
+//                nde - where to put the node of each new block
+//                blk - where to put each new block ID
+// Outputs      : 0 if successful, -1 if any block could not be created
+
+int sgCreateRemoteBlocks( int count, char **blocks, SG_Node_ID *nde, SG_Block_ID *blk ) {
+
+    // Local variables
+    char sendPacket[SG_POST_BATCH_MAX][SG_BASE_PACKET_SIZE], recvPacket[SG_POST_BATCH_MAX][SG_BASE_PACKET_SIZE];
+    SG_Post posts[SG_POST_BATCH_MAX];
+    char * rpackets[SG_POST_BATCH_MAX];
+    size_t rlens[SG_POST_BATCH_MAX];
+    SG_Packet_Info info[SG_POST_BATCH_MAX];
+    SG_Packet_Status ret;
+
+    for ( int done=0; done<count; done+=SG_POST_BATCH_MAX ){
+        int n = ( count-done < SG_POST_BATCH_MAX ) ? count-done : SG_POST_BATCH_MAX;
+
+        for ( int i=0; i<n; i++ ){
+            size_t pktlen = SG_BASE_PACKET_SIZE;
+            if ( (ret = serialize_sg_packet( sgLocalNodeId,
+                                            SG_NODE_UNKNOWN,
+                                            SG_BLOCK_UNKNOWN,
+                                            SG_CREATE_BLOCK,
+                                            sgLocalSeqno++,
+                                            SG_SEQNO_UNKNOWN,
+                                            NULL, sendPacket[i], &pktlen)) != SG_PACKT_OK ) {
+                logMessage( LOG_ERROR_LEVEL, "sgCreateRemoteBlocks: failed serialization of packet [%d].", ret );
+                return(-1);
+            }
+            posts[i].iovcnt = sgPacketPieces( sendPacket[i], blocks[done+i], posts[i].iov );
+            posts[i].riovcnt = sgPacketPieces( recvPacket[i], NULL, posts[i].riov );
+            posts[i].range = NULL;
+        }
+        //send packets
+        if ( sgServicePostBatch(posts, n) ) {
+            logMessage( LOG_ERROR_LEVEL, "sgCreateRemoteBlocks: failed packet post" );
+            return(-1);
+        }
+        //unpack
+        for ( int i=0; i<n; i++ ){
+            rpackets[i] = recvPacket[i];
+            rlens[i] = ( posts[i].rlen == SG_BASE_PACKET_SIZE ) ? SG_BASE_PACKET_SIZE : 0;
+        }
+        if ( sgPacketDecodeBatch(rpackets, rlens, n, info, &ret) < n ){
+            logMessage( LOG_ERROR_LEVEL, "sgCreateRemoteBlocks: failed deserialization of packet [%d].", ret );
+            return(-1);
+        }
+        for ( int i=0; i<n; i++ ){
+            nde[done+i] = info[i].remNodeId;
+            blk[done+i] = info[i].blockID;
+            //Check assigned block and node ID
+            if ( blk[done+i] == SG_BLOCK_UNKNOWN ){
+                logMessage( LOG_ERROR_LEVEL, "sgCreateRemoteBlocks: bad new remote block ID [%lu].", blk[done+i] );
+                return(-1);
+            }
+            if ( nde[done+i] == SG_NODE_UNKNOWN ){
+                logMessage( LOG_ERROR_LEVEL, "sgCreateRemoteBlocks: bad new remote node ID [%lu].", nde[done+i] );
+                return(-1);
+            }
+            SG_Node_State * node = sgNodeAdd( nde[done+i] );
+            if ( node == NULL ){
+                return(-1);
+            }
+            node->resentSeq = info[i].recvSeqNo;
+            sgNodeDone( node, posts+i, SG_BLOCK_SIZE );
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDeleteRemoteBlocks
+// Description  : Delete several blocks from the nodes holding them,
+//                SG_POST_BATCH_MAX requests to a batch post
+//
+// Inputs       : count - how many blocks
+//                nde - the remote node of each block
+//                blk - the blocks to delete
+//                deleted - where to put how many, from the first, were
+//                          deleted before one failed
+// Outputs      : 0 if successful, -1 if any delete failed
+
+int sgDeleteRemoteBlocks( int count, SG_Node_ID *nde, SG_Block_ID *blk, int *deleted ) {
+
+    // Local variables
+    char sendPacket[SG_POST_BATCH_MAX][SG_BASE_PACKET_SIZE], recvPacket[SG_POST_BATCH_MAX][SG_BASE_PACKET_SIZE];
+    SG_Post posts[SG_POST_BATCH_MAX];
+    SG_Node_State * node[SG_POST_BATCH_MAX];
+    char * rpackets[SG_POST_BATCH_MAX];
+    size_t rlens[SG_POST_BATCH_MAX];
+    SG_Packet_Info info[SG_POST_BATCH_MAX];
+    SG_Packet_Status ret;
+
+    *deleted = 0;
+    for ( int done=0; done<count; done+=SG_POST_BATCH_MAX ){
+        int n = ( count-done < SG_POST_BATCH_MAX ) ? count-done : SG_POST_BATCH_MAX;
+
+        for ( int i=0; i<n; i++ ){
+            if ( (node[i] = sgNodeFind( nde[done+i] )) == NULL ){
+                logMessage( LOG_ERROR_LEVEL, "sgDeleteRemoteBlocks: unknown remote node [%lu].", nde[done+i] );
+                return(-1);
+            }
+            size_t pktlen = SG_BASE_PACKET_SIZE;
+            if ( (ret = serialize_sg_packet( sgLocalNodeId,
+                                            nde[done+i],
+                                            blk[done+i],
+                                            SG_DELETE_BLOCK,
+                                            sgLocalSeqno++,
+                                            (node[i]->resentSeq)+=1,
+                                            NULL, sendPacket[i], &pktlen)) != SG_PACKT_OK ) {
+                logMessage( LOG_ERROR_LEVEL, "sgDeleteRemoteBlocks: failed serialization of packet [%d].", ret );
+                return(-1);
+            }
+            posts[i].iovcnt = sgPacketPieces( sendPacket[i], NULL, posts[i].iov );
+            posts[i].riovcnt = sgPacketPieces( recvPacket[i], NULL, posts[i].riov );
+            posts[i].range = NULL;
+        }
+        //send packets
+        int failed = sgServicePostBatch( posts, n );
+        for ( int i=0; i<n; i++ ){
+            sgNodeDone( node[i], posts+i, 0 );
+        }
+        for ( int i=0; i<n && *deleted == done+i && posts[i].status == 0; i++ ){
+            *deleted += 1;
+        }
+        if ( failed ) {
+            logMessage( LOG_ERROR_LEVEL, "sgDeleteRemoteBlocks: failed packet post" );
+            return(-1);
+        }
+        //unpack
+        for ( int i=0; i<n; i++ ){
+            rpackets[i] = recvPacket[i];
+            rlens[i] = ( posts[i].rlen == SG_BASE_PACKET_SIZE ) ? SG_BASE_PACKET_SIZE : 0;
+        }
+        if ( sgPacketDecodeBatch(rpackets, rlens, n, info, &ret) < n ){
+            logMessage( LOG_ERROR_LEVEL, "sgDeleteRemoteBlocks: failed deserialization of packet [%d].", ret );
+            return(-1);
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketPieces
+// Description  : Lay a packet out in pieces for a post: the header and
+//                trailer stay together in one SG_BASE_PACKET_SIZE buffer,
+//                laid out as a packet without a block would be, and the
+//                block (if any) is sent from or received into its own
+//                place in between
+//
+// Inputs       : packet - the header and trailer
+//                block - the block, NULL for none
+//                iov - where to put the pieces (SG_POST_IOV_MAX)
+// Outputs      : how many pieces
+
+int sgPacketPieces( char *packet, char *block, struct iovec *iov ) {
+    if ( block == NULL ){
+        iov[0] = (struct iovec) { packet, SG_BASE_PACKET_SIZE };
+        return( 1 );
+    }
+    packet[SG_PKT_FLAG_OFF] = 1;
+    iov[0] = (struct iovec) { packet, SG_PKT_HEADER_SIZE };
+    iov[1] = (struct iovec) { block, SG_BLOCK_SIZE };
+    iov[2] = (struct iovec) { packet+SG_PKT_HEADER_SIZE, sizeof(uint32_t) };
+    return( 3 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileStreaming
+// Description  : Follow how a file is being accessed.  Once a file has been
+//                read or written strictly in order for SG_STREAM_BYPASS_BYTES
+//                (and admission control is on) it is treated as a stream:
+//                blocks it misses on are not cached, so a one pass scan does
+//                not push out hot blocks.  Any jump starts the count over.
+//
+// Inputs       : file - the file being accessed
+//                pos - where in the file
+//                len - bytes being accessed
+// Outputs      : true if the access should bypass the cache
+
+bool sgFileStreaming( SG_File *file, uint64_t pos, size_t len ) {
+    if ( pos == file->seqNext ){
+        file->seqRun += len;
+    } else {
+        file->seqRun = len;
+    }
+    file->seqNext = pos + len;
+    return( sgCacheAdmission && file->seqRun > SG_STREAM_BYPASS_BYTES );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFileReadAhead
+// Description  : Keep the blocks after an in-order reader cached.  Once the
+//                reader is past the middle of the blocks read ahead, the
+//                next window is fetched; the window doubles (up to
+//                sgReadAheadMax or a quarter of the cache) while everything
+//                read ahead survives until the reader gets to it and halves
+//                when blocks are evicted first or the reader jumps elsewhere.
+//
+// Inputs       : file - the file just read
+//                last - the last block the read touched
+//                inOrder - the read carried on from the last access
+// Outputs      : none
+
+void sgFileReadAhead( SG_File *file, uint64_t last, bool inOrder ) {
+    uint64_t next = last+1;
+
+    if ( !inOrder ){
+        if ( file->raEnd > file->raStart ){     // read ahead for nothing
+            file->raWindow /= 2;
+        }
+        file->raStart = file->raEnd = 0;
+        file->raLost = 0;
+        return;
+    }
+
+    // The reader has reached these
+    if ( next > file->raStart && file->raEnd > file->raStart ){
+        uint64_t reached = ((next < file->raEnd) ? next : file->raEnd) - file->raStart;
+        sgReadAheadUsed += reached;
+        file->raStart += reached;
+    }
+    if ( (file->raEnd > next && file->raEnd-next > (uint64_t)file->raWindow/2) || sgReadAheadMax == 0 ){
+        return;
+    }
+    if ( file->raWindow == 0 ){
+        file->raWindow = SG_READAHEAD_MIN;
+    } else if ( file->raLost ){
+        file->raWindow = (file->raWindow/2 > SG_READAHEAD_MIN) ? file->raWindow/2 : SG_READAHEAD_MIN;
+    } else {
+        // A window never takes more than a quarter of the cache
+        int max = ( (int)(sgCacheBytes/SG_BLOCK_SIZE/4) < sgReadAheadMax ) ? (int)(sgCacheBytes/SG_BLOCK_SIZE/4) : sgReadAheadMax;
+        file->raWindow = (file->raWindow*2 < max) ? file->raWindow*2 : max;
+        file->raWindow = (file->raWindow > SG_READAHEAD_MIN) ? file->raWindow : SG_READAHEAD_MIN;
+    }
+    file->raLost = 0;
+
+    uint64_t from = (file->raEnd > next) ? file->raEnd : next;
+    uint64_t to = (next+file->raWindow < file->blk_num) ? next+file->raWindow : file->blk_num;
+    if ( file->raStart >= file->raEnd ){
+        file->raStart = from;
+    }
+
+    // Fetch the window's uncached blocks straight into reserved lines
+    SG_Node_ID nde[SG_READAHEAD_MAX];
+    SG_Block_ID blk[SG_READAHEAD_MAX];
+    char * lines[SG_READAHEAD_MAX];
+    int n = 0;
+    to = ( to > from && to-from > SG_READAHEAD_MAX ) ? from+SG_READAHEAD_MAX : to;
+    for ( uint64_t i=from; i<to; i++ ){
+        SG_Block_Ref * ref = sgFileBlock( file, i );
+        if ( (lines[n] = reserveSGDataBlock(ref->nde, ref->blk)) != NULL ){
+            nde[n] = ref->nde;
+            blk[n] = ref->blk;
+            n += 1;
+        }
+    }
+    int failed = ( n > 0 ) ? sgObtainRemoteBlocks( n, nde, blk, lines ) : 0;
+    for ( int i=0; i<n; i++ ){
+        if ( failed ){
+            cancelSGDataBlock( nde[i], blk[i] );
+        } else {
+            commitSGDataBlock( nde[i], blk[i] );
+        }
+    }
+    if ( failed ){
+        logMessage( LOG_ERROR_LEVEL, "sgFileReadAhead: failed to obtain [%d] blocks", n );
+        return;
+    }
+    sgReadAheadFetched += n;
+    file->raEnd = (to > file->raEnd) ? to : file->raEnd;
+}
+
+//
+// Driver unit tests
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTest
+// Description  : Run the driver against the in-process service, with
+//                envelopes off and then on: async reads and writes queued
+//                many deep, truncates and unlinks, and reads and writes of
+//                several buffers, each checked against a model of the file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int sgDriverUnitTestAsync( void );
+static int sgDriverUnitTestTruncate( void );
+static int sgDriverUnitTestVectored( void );
+static int sgDriverUnitTestVector( SgFHandle fh, bool write, const size_t *sizes, int count, char *model, uint64_t *length, uint64_t *pos );
+static void sgDriverUnitTestPlan( SG_Unit_Op *op, bool write, size_t len, char *model, uint64_t *length, uint64_t *pos );
+static int sgDriverUnitTestBatch( SgFHandle fh, SG_Unit_Op *ops, int count );
+static int sgDriverUnitTestCheck( SgFHandle fh, const char *model, uint64_t length );
+static void sgDriverUnitTestUncache( SgFHandle fh );
+
+int sgDriverUnitTest( void ) {
+    bool envelopes = sgPostEnvelopes, writeBack = sgCacheWriteBack, admission = sgCacheAdmission;
+    int readAhead = sgReadAheadMax, failed = 0;
+
+    // Write-through and no read-ahead, so every block moved is one asked for
+    sgCacheWriteBack = sgCacheAdmission = 0;
+    sgReadAheadMax = 0;
+    srand( 311 );
+    for ( int env=0; env<2 && !failed; env++ ){
+        sgPostEnvelopes = env;
+        failed = sgDriverUnitTestAsync() || sgDriverUnitTestTruncate() || sgDriverUnitTestVectored();
+    }
+    if ( sgDriverInitialized && sgshutdown() ){
+        failed = -1;
+    }
+    sgPostEnvelopes = envelopes;
+    sgCacheWriteBack = writeBack;
+    sgCacheAdmission = admission;
+    sgReadAheadMax = readAhead;
+    if ( failed ){
+        return( -1 );
+    }
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgDriverUnitTest: driver unit tests completed successfully." );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTestAsync
+// Description  : Queue async batches over a file: reads of uncached blocks
+//                (fetched together), runs of writes (their updates held and
+//                sent together), random mixes of both, and a run of writes
+//                one of whose updates fails
+//
+// Inputs       : none
+// Outputs      : the number of wrong results
+
+static int sgDriverUnitTestAsync( void ) {
+    static SG_Unit_Op ops[SG_ASYNC_DEPTH];
+    static char model[SG_UNIT_FILE_MAX], before[4*SG_BLOCK_SIZE], got[SG_BLOCK_SIZE];
+    char path[] = "unit-async-0";
+    uint64_t length = 0, pos = 0;
+    unsigned long requests, exchanges;
+    int i, wrong = 0;
+
+    // Twelve blocks written in order, then dropped from the cache
+    path[sizeof(path)-2] += sgPostEnvelopes;
+    SgFHandle fh = sgopen( path );
+    for ( i=0; i<12*SG_BLOCK_SIZE; i++ ){
+        model[i] = (char)rand();
+    }
+    length = 12*SG_BLOCK_SIZE;
+    if ( fh < 0 || sgwrite(fh, model, length) != (int)length || sgfsync(fh) || sgseek(fh, 0) ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: failed to set up file [%s]", path );
+        return( 1 );
+    }
+    sgDriverUnitTestUncache( fh );
+
+    // Reads across the file: each block is fetched once, all in one post
+    for ( i=0; i<8; i++ ){
+        sgDriverUnitTestPlan( ops+i, 0, SG_BLOCK_SIZE*3/2, model, &length, &pos );
+    }
+    requests = sgPostRequests;
+    exchanges = sgPostExchanges;
+    wrong += sgDriverUnitTestBatch( fh, ops, 8 );
+    if ( sgPostRequests-requests != 12 || (sgPostEnvelopes && sgPostExchanges-exchanges != 1) ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: reading 12 blocks took [%lu] requests in [%lu] exchanges",
+                    sgPostRequests-requests, sgPostExchanges-exchanges );
+        wrong += 1;
+    }
+
+    // Overwrites of whole and part blocks: their updates go in one post
+    sgseek( fh, 0 );
+    pos = 0;
+    for ( i=0; i<8; i++ ){
+        sgDriverUnitTestPlan( ops+i, 1, (i%2) ? SG_BLOCK_SIZE : 300, model, &length, &pos );
+    }
+    exchanges = sgPostExchanges;
+    wrong += sgDriverUnitTestBatch( fh, ops, 8 );
+    if ( sgPostEnvelopes && sgPostExchanges-exchanges != 1 ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: a run of 8 writes took [%lu] exchanges",
+                    sgPostExchanges-exchanges );
+        wrong += 1;
+    }
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+
+    // Random mixes of reads and writes, from a random place, growing the file
+    for ( int round=0; round<4; round++ ){
+        sgDriverUnitTestUncache( fh );
+        pos = rand() % length;
+        sgseek( fh, pos );
+        for ( i=0; i<40; i++ ){
+            size_t len = 1 + rand() % (2*SG_BLOCK_SIZE);
+            sgDriverUnitTestPlan( ops+i, (rand() % 2) && pos+len <= SG_UNIT_FILE_MAX, len, model, &length, &pos );
+        }
+        wrong += sgDriverUnitTestBatch( fh, ops, 40 );
+        wrong += sgDriverUnitTestCheck( fh, model, length );
+    }
+    sgclose( fh );
+
+    // A run of writes one of whose updates fails: every write of the run
+    // fails, the reads either side of it do not
+    path[sizeof(path)-2] += 2;
+    fh = sgopen( path );
+    length = 4*SG_BLOCK_SIZE;
+    for ( i=0; i<(int)length; i++ ){
+        model[i] = (char)rand();
+    }
+    if ( fh < 0 || sgwrite(fh, model, length) != (int)length || sgfsync(fh) || sgseek(fh, 0) ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: failed to set up file [%s]", path );
+        return( wrong+1 );
+    }
+    SG_Block_Ref * ref = sgFileBlock( sgFileOfHandle(fh), 2 );
+    SG_Block_ID blk = ref->blk;
+    memcpy( before, model, length );
+    pos = 0;
+    for ( i=0; i<4; i++ ){
+        sgDriverUnitTestPlan( ops+i, i == 1 || i == 2, SG_BLOCK_SIZE, model, &length, &pos );
+    }
+    ops[1].expect = ops[2].expect = -1;
+    memcpy( model+2*SG_BLOCK_SIZE, before+2*SG_BLOCK_SIZE, SG_BLOCK_SIZE );
+    ref->blk = blk ^ 0x5a5a5a5a5a5a5a5aULL;    // no such block
+    wrong += sgDriverUnitTestBatch( fh, ops, 4 );
+    ref->blk = blk;
+
+    // The other block of the run may or may not have been updated
+    if ( sgseek(fh, SG_BLOCK_SIZE) != SG_BLOCK_SIZE || sgread(fh, got, SG_BLOCK_SIZE) != SG_BLOCK_SIZE ||
+         (memcmp(got, before+SG_BLOCK_SIZE, SG_BLOCK_SIZE) && memcmp(got, model+SG_BLOCK_SIZE, SG_BLOCK_SIZE)) ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: a block of a failed run of writes is neither old nor new" );
+        wrong += 1;
+    }
+    memcpy( model+SG_BLOCK_SIZE, got, SG_BLOCK_SIZE );
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+
+    // ... and the file still takes writes
+    for ( i=SG_BLOCK_SIZE; i<3*SG_BLOCK_SIZE; i++ ){
+        model[i] = (char)rand();
+    }
+    if ( sgseek(fh, SG_BLOCK_SIZE) != SG_BLOCK_SIZE || sgwrite(fh, model+SG_BLOCK_SIZE, 2*SG_BLOCK_SIZE) != 2*SG_BLOCK_SIZE ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: writes failed after a failed run of writes" );
+        wrong += 1;
+    }
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+    sgclose( fh );
+    return( wrong );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTestTruncate
+// Description  : Cut a file mid-block and to nothing, unlink a file open
+//                and closed and reuse its name, and cut a file short with
+//                one of its deletes failing
+//
+// Inputs       : none
+// Outputs      : the number of wrong results
+
+static int sgDriverUnitTestTruncate( void ) {
+    static char model[SG_UNIT_FILE_MAX], got[SG_BLOCK_SIZE];
+    char path[] = "unit-truncate-0";
+    uint64_t length;
+    int i, wrong = 0;
+
+    // Ten and a half blocks, the last half held back, cut mid-block
+    path[sizeof(path)-2] += sgPostEnvelopes;
+    SgFHandle fh = sgopen( path );
+    length = 10*SG_BLOCK_SIZE + 500;
+    for ( i=0; i<(int)length; i++ ){
+        model[i] = (char)rand();
+    }
+    if ( fh < 0 || sgwrite(fh, model, length) != (int)length ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: failed to set up file [%s]", path );
+        return( 1 );
+    }
+    length = 6*SG_BLOCK_SIZE + 300;
+    SG_File * file = sgFileOfHandle( fh );
+    if ( sgtruncate(fh, length) || file->length != length || file->position != length || file->blk_num != 7 ||
+         sgread(fh, got, 1) != -1 ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: file cut to [%lu] bytes is [%lu] bytes in [%lu] blocks, at [%lu]",
+                    length, file->length, file->blk_num, file->position );
+        wrong += 1;
+    }
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+
+    // ... a write past the new end covers the bytes left in its last block
+    for ( i=0; i<1000; i++ ){
+        model[length+i] = (char)rand();
+    }
+    if ( sgwrite(fh, model+length, 1000) != 1000 ){
+        wrong += 1;
+    }
+    wrong += sgDriverUnitTestCheck( fh, model, length+1000 );
+
+    // Cut to nothing, then written again
+    if ( sgtruncate(fh, 0) || file->length != 0 || file->blk_num != 0 || file->position != 0 ||
+         sgread(fh, got, 1) != -1 ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: file cut to nothing is [%lu] bytes in [%lu] blocks",
+                    file->length, file->blk_num );
+        wrong += 1;
+    }
+    length = 2*SG_BLOCK_SIZE;
+    if ( sgwrite(fh, model, length) != (int)length ){
+        wrong += 1;
+    }
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+
+    // An open file can not be unlinked, a closed one can, and its name
+    // then opens a new, empty file
+    if ( sgunlink(path) != -1 || sgclose(fh) || sgunlink(path) || sgunlink(path) != -1 ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: unlinking file [%s] open and closed went wrong", path );
+        wrong += 1;
+    }
+    fh = sgopen( path );
+    file = sgFileOfHandle( fh );
+    if ( fh < 0 || file->length != 0 || file->blk_num != 0 || sgread(fh, got, 1) != -1 ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: file [%s] reopened after unlinking is not empty", path );
+        wrong += 1;
+    }
+    length = SG_BLOCK_SIZE + 10;
+    if ( sgwrite(fh, model, length) != (int)length ){
+        wrong += 1;
+    }
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+    sgclose( fh );
+
+    // Forty blocks cut to two, the delete of the last block of the first
+    // batch failing: the file keeps that block and those before it
+    path[sizeof(path)-2] += 2;
+    fh = sgopen( path );
+    file = sgFileOfHandle( fh );
+    length = 40*SG_BLOCK_SIZE;
+    for ( i=0; i<(int)length; i++ ){
+        model[i] = (char)rand();
+    }
+    if ( fh < 0 || sgwrite(fh, model, length) != (int)length ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: failed to set up file [%s]", path );
+        return( wrong+1 );
+    }
+    uint64_t fail = 40-SG_POST_BATCH_MAX;
+    SG_Block_Ref * ref = sgFileBlock( file, fail );
+    SG_Node_ID nde = ref->nde;
+    ref->nde = nde ^ 0x5a5a5a5a5a5a5a5aULL;    // no such node
+    sgNodeAdd( ref->nde );
+    int ret = sgtruncate( fh, 2*SG_BLOCK_SIZE );
+    ref->nde = nde;
+    if ( ret != -1 || file->blk_num != fail+1 || file->length != (fail+1)*SG_BLOCK_SIZE || file->position != file->length ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: failed cut left [%lu] bytes in [%lu] blocks, at [%lu]",
+                    file->length, file->blk_num, file->position );
+        wrong += 1;
+    }
+    wrong += sgDriverUnitTestCheck( fh, model, file->length );
+    if ( sgtruncate(fh, 2*SG_BLOCK_SIZE) || file->blk_num != 2 ){
+        wrong += 1;
+    }
+    wrong += sgDriverUnitTestCheck( fh, model, 2*SG_BLOCK_SIZE );
+    sgclose( fh );
+    return( wrong );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTestVectored
+// Description  : Write and read a file through several buffers at a time,
+//                with blocks split between buffers: whole blocks gathered
+//                for a write, missed and cached blocks read through a
+//                bounce block, partial blocks at either edge
+//
+// Inputs       : none
+// Outputs      : the number of wrong results
+
+static int sgDriverUnitTestVectored( void ) {
+    static char model[SG_UNIT_FILE_MAX];
+    static const size_t create[] = { 700, 2*SG_BLOCK_SIZE+100, 0, 6*SG_BLOCK_SIZE-800 },
+                        spans[] = { 100, 1500, 0, 3000, 8*SG_BLOCK_SIZE },     // runs past the end
+                        edges[] = { 10, SG_BLOCK_SIZE+20, 2 },
+                        grow[] = { 300, 700, 1 };
+    char path[] = "unit-vector-0";
+    uint64_t length = 0, pos = 0;
+    int wrong = 0;
+
+    path[sizeof(path)-2] += sgPostEnvelopes;
+    SgFHandle fh = sgopen( path );
+    if ( fh < 0 ){
+        return( 1 );
+    }
+
+    // Eight blocks written from four buffers, then read back missed and
+    // cached from five, at two alignments
+    wrong += sgDriverUnitTestVector( fh, 1, create, 4, model, &length, &pos );
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+    sgDriverUnitTestUncache( fh );
+    for ( pos=0; pos<100; pos+=50 ){
+        sgseek( fh, pos );
+        wrong += sgDriverUnitTestVector( fh, 0, spans, 5, model, &length, &pos );
+    }
+
+    // Parts of blocks at both edges of a write, then the file grown from
+    // inside its last block
+    pos = 1500;
+    sgseek( fh, pos );
+    wrong += sgDriverUnitTestVector( fh, 1, edges, 3, model, &length, &pos );
+    pos = length-200;
+    sgseek( fh, pos );
+    wrong += sgDriverUnitTestVector( fh, 1, grow, 3, model, &length, &pos );
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+    sgfsync( fh );
+    sgDriverUnitTestUncache( fh );
+    wrong += sgDriverUnitTestCheck( fh, model, length );
+    sgclose( fh );
+    return( wrong );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTestVector
+// Description  : Read or write at the file position through buffers of the
+//                given sizes, laid out apart from each other, and check the
+//                result against the model (a write is applied to it)
+//
+// Inputs       : fh - the file
+//                write - a write rather than a read
+//                sizes, count - the buffers
+//                model, length, pos - the file as it should be
+// Outputs      : the number of wrong results
+
+static int sgDriverUnitTestVector( SgFHandle fh, bool write, const size_t *sizes, int count, char *model, uint64_t *length, uint64_t *pos ) {
+    static char buf[SG_UNIT_FILE_MAX+16*8];
+    struct iovec iov[8];
+    size_t total = 0, done = 0;
+    int wrong = 0;
+
+    for ( int i=0; i<count; i++ ){
+        iov[i].iov_base = buf + total + 16*i;
+        iov[i].iov_len = sizes[i];
+        for ( size_t k=0; k<sizes[i]; k++ ){
+            ((char *)iov[i].iov_base)[k] = write ? (model[*pos+total+k] = (char)rand()) : 0;
+        }
+        total += sizes[i];
+    }
+    if ( !write ){
+        total = ( total < *length-*pos ) ? total : *length-*pos;
+    }
+    int ret = write ? sgwritev( fh, iov, count ) : sgreadv( fh, iov, count );
+    for ( int i=0; i<count && !write; i++ ){
+        size_t n = ( sizes[i] < total-done ) ? sizes[i] : total-done;
+        wrong += ( memcmp(iov[i].iov_base, model+*pos+done, n) != 0 );
+        done += n;
+    }
+    if ( ret != (int)total || wrong ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: %s of [%d] buffers at [%lu] returned [%d] (expected [%lu]) or wrong data",
+                    write ? "write" : "read", count, *pos, ret, total );
+        wrong += 1;
+    }
+    *pos += total;
+    *length = ( *pos > *length ) ? *pos : *length;
+    return( wrong );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTestPlan
+// Description  : Make up an operation at the model's file position and
+//                work out what it should come to, applying a write to the
+//                model
+//
+// Inputs       : op - the operation to fill in
+//                write - a write rather than a read
+//                len - its length (at most 2 blocks)
+//                model, length, pos - the file as it should be
+// Outputs      : none
+
+static void sgDriverUnitTestPlan( SG_Unit_Op *op, bool write, size_t len, char *model, uint64_t *length, uint64_t *pos ) {
+    op->write = write;
+    op->len = len;
+    if ( write ){
+        for ( size_t i=0; i<len; i++ ){
+            op->buf[i] = (char)rand();
+        }
+        memcpy( model + *pos, op->buf, len );
+        *pos += len;
+        *length = ( *pos > *length ) ? *pos : *length;
+        op->expect = (int)len;
+    } else if ( *pos >= *length ){
+        op->expect = -1;
+    } else {
+        op->expect = (int)(( *pos+len > *length ) ? *length - *pos : len);
+        memcpy( op->want, model + *pos, op->expect );
+        memset( op->buf, 0, len );
+        *pos += op->expect;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTestBatch
+// Description  : Queue operations together, so the async thread takes them
+//                as one batch, and check what each completes with
+//
+// Inputs       : fh - the file
+//                ops - the operations
+//                count - how many (at most SG_ASYNC_DEPTH)
+// Outputs      : the number of wrong results
+
+static int sgDriverUnitTestBatch( SgFHandle fh, SG_Unit_Op *ops, int count ) {
+    SgCompletion cqe[SG_ASYNC_DEPTH];
+    int queued = 0, done = 0, wrong = 0;
+
+    pthread_mutex_lock( &asyncLock );
+    while ( queued < count && sgAsyncQueue(ops[queued].write, fh, ops[queued].buf, ops[queued].len, queued) == 0 ){
+        queued += 1;
+    }
+    pthread_mutex_unlock( &asyncLock );
+    if ( queued < count ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: queued only [%d] of [%d] operations", queued, count );
+        wrong += count-queued;
+    }
+    while ( done < queued ){
+        int n = sgwait( cqe, 1, SG_ASYNC_DEPTH );
+        if ( n <= 0 ){
+            return( wrong+queued-done );
+        }
+        for ( int k=0; k<n; k++ ){
+            SG_Unit_Op * op = ops + cqe[k].cookie;
+            if ( cqe[k].result != op->expect || (!op->write && op->expect > 0 && memcmp(op->buf, op->want, op->expect)) ){
+                logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: async %s [%lu] of [%lu] bytes returned [%d] (expected [%d]) or wrong data",
+                            op->write ? "write" : "read", cqe[k].cookie, op->len, cqe[k].result, op->expect );
+                wrong += 1;
+            }
+        }
+        done += n;
+    }
+    return( wrong );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTestCheck
+// Description  : Read the whole file back and compare it to the model
+//
+// Inputs       : fh - the file
+//                model, length - what it should hold
+// Outputs      : 0 if it matches, 1 if not
+
+static int sgDriverUnitTestCheck( SgFHandle fh, const char *model, uint64_t length ) {
+    static char got[SG_UNIT_FILE_MAX];
+
+    if ( sgseek(fh, 0) != 0 || sgread(fh, got, length) != (int)length || memcmp(got, model, length) ){
+        logMessage( LOG_ERROR_LEVEL, "sgDriverUnitTest: file of [%lu] bytes does not read back as written", length );
+        return( 1 );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgDriverUnitTestUncache
+// Description  : Drop the blocks of a file from the cache
+//
+// Inputs       : fh - the file
+// Outputs      : none
+
+static void sgDriverUnitTestUncache( SgFHandle fh ) {
+    SG_File * file = sgFileOfHandle( fh );
+
+    for ( uint64_t i=0; i<file->blk_num; i++ ){
+        SG_Block_Ref * ref = sgFileBlock( file, i );
+        dropSGDataBlock( ref->nde, ref->blk );
+    }
+}
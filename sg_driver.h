@@ -12,13 +12,33 @@
 //
 
 // Includes
+#include <stdbool.h>
+#include <sys/uio.h>
 #include <sg_defs.h>
+#include <sg_packet.h>
+#include <sg_cache.h>
+#include <sg_l2.h>
 
 // Defines 
+#define SG_READAHEAD_MAX 32 // Most blocks read ahead of a file read in order
+#define SG_ASYNC_DEPTH 64 // Most async operations submitted and not yet reaped
 
 // Type definitions
 
+// Completion of an async read or write
+typedef struct {
+    uint64_t cookie;    // the tag the operation was submitted with
+    int result;         // what sgread/sgwrite would have returned
+} SgCompletion;
+
 // Global interface definitions
+extern SG_Cache_Policy sgCachePolicy; // Block cache replacement policy
+extern bool sgCacheWriteBack; // Defer block updates to cache eviction/flush
+extern size_t sgCacheBytes; // Block cache memory budget
+extern const char * sgCacheL2Path; // Second tier cache file, if any
+extern size_t sgCacheVictimBytes; // Compressed victim tier memory, 0 for none
+extern bool sgCacheAdmission; // Filter cache inserts, bypass the cache for streams
+extern int sgReadAheadMax; // Most blocks read ahead of an in-order reader, 0 for none
 
 // Type definitions
 
@@ -33,26 +53,56 @@ int sgread( SgFHandle fh, char *buf, size_t len );
 int sgwrite( SgFHandle fh, char *buf, size_t len );
     // Write data to the file
 
-int sgseek( SgFHandle fh, size_t off );
+int sgpread( SgFHandle fh, char *buf, size_t len, uint64_t off );
+    // Read data from an offset, leaving the file position alone
+
+int sgpwrite( SgFHandle fh, char *buf, size_t len, uint64_t off );
+    // Write data at an offset, leaving the file position alone
+
+int sgreadv( SgFHandle fh, const struct iovec *iov, int iovcnt );
+    // Read data from the file into several buffers
+
+int sgwritev( SgFHandle fh, const struct iovec *iov, int iovcnt );
+    // Write the data of several buffers to the file
+
+int64_t sgseek( SgFHandle fh, uint64_t off );
     // Seek to a specific place in the file
 
+int sgfsync( SgFHandle fh );
+    // Get everything written to the file out to its nodes
+
+int sgtruncate( SgFHandle fh, uint64_t len );
+    // Cut the file down to a length, deleting the blocks past it
+
+int sgunlink( const char *path );
+    // Remove a closed file and delete its blocks
+
 int sgclose( SgFHandle fh );
     // Close the file
 
+int sgcachegroup( SgFHandle fh, const char *group, size_t minBytes, size_t maxBytes );
+    // Give the file (or its group) a cache partition with quotas
+
 int sgshutdown( void );
     // Shut down the filesystem
 
 //
-// Helper Functions
+// Asynchronous interface, operations run in submission order by a driver
+// thread; any synchronous call waits for those submitted before it
+
+int sgread_async( SgFHandle fh, char *buf, size_t len, uint64_t cookie );
+    // Queue a read from the file position, -1 if the queue is full
+
+int sgwrite_async( SgFHandle fh, char *buf, size_t len, uint64_t cookie );
+    // Queue a write at the file position, -1 if the queue is full
+
+int sgpoll( SgCompletion *cqe, int max );
+    // Reap up to max completions without waiting
 
-SG_Packet_Status serialize_sg_packet( SG_Node_ID loc, SG_Node_ID rem, SG_Block_ID blk, 
-        SG_System_OP op, SG_SeqNum sseq, SG_SeqNum rseq, char *data, 
-        char *packet, size_t *plen );
-    // Serialize a ScatterGather packet (create packet)
+int sgwait( SgCompletion *cqe, int min, int max );
+    // Wait for at least min completions, reap up to max
 
-SG_Packet_Status deserialize_sg_packet( SG_Node_ID *loc, SG_Node_ID *rem, SG_Block_ID *blk, 
-        SG_System_OP *op, SG_SeqNum *sseq, SG_SeqNum *rseq, char *data, 
-        char *packet, size_t plen );
-    // De-serialize a ScatterGather packet (unpack packet)
+int sgDriverUnitTest( void );
+    // Run the driver unit tests (starts and shuts down the driver)
 
 #endif
\ No newline at end of file
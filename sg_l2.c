@@ -0,0 +1,464 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_l2.c
+//  Description    : This file contains the second tier block cache.  Clean
+//                   blocks evicted from memory are demoted to a local file
+//                   and read back with pread before going to the network.
+//                   The file is a header, the index (one node/block pair per
+//                   slot) and the slots themselves; the index is saved when
+//                   the tier is closed, so the next run starts warm.  A file
+//                   that was not closed cleanly starts empty.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_l2.h>
+
+// Defines
+#define SG_L2_MAGIC 0x324c4753      // "SGL2"
+#define SG_L2_VERSION 1
+#define SG_L2_HEADER_SIZE 4096
+#define SG_L2_NIL (-1)
+
+typedef struct {    //tier file header
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t blocks;        // slots in the file
+    uint32_t clean;         // the saved index matches the slots
+    uint32_t count;         // slots in use
+} SG_l2_header;
+
+typedef struct {    //index entry, node 0 and block 0 for a free slot
+    SG_Node_ID node_ID;
+    SG_Block_ID blk_ID;
+} SG_l2_slot;
+
+int l2File = -1;
+pthread_mutex_t l2Lock = PTHREAD_MUTEX_INITIALIZER;
+SG_l2_slot * l2Slots;       // index, slot i holds data block i
+int32_t * l2Next;           // hash chains through the slots, the free list through the free ones
+int32_t l2Free;             // free slots, taken before the CLOCK hand replaces any
+int32_t * l2Buckets;
+uint32_t l2BucketMask;
+uint8_t * l2Ref;            // CLOCK reference bits
+uint32_t l2Blocks;
+uint32_t l2Count;
+uint32_t l2Hand;            // CLOCK hand
+off_t l2DataOffset;         // where slot 0 starts
+unsigned long l2Queries, l2Hits, l2Demotions;
+
+// Functional Prototypes
+static uint32_t sgL2Bucket( SG_Node_ID nde, SG_Block_ID blk );
+static int32_t sgL2Find( SG_Node_ID nde, SG_Block_ID blk );
+static void sgL2Hash( int32_t i );
+static void sgL2Unhash( int32_t i );
+static int sgL2WriteHeader( uint32_t clean );
+static void sgL2Free( void );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openSGL2Cache
+// Description  : Open the tier file, reloading its index if it was closed
+//                cleanly, or set up a new (sparse) one.  The file is marked
+//                in use until it is closed again.
+//
+// Inputs       : path - the tier file
+//                blocks - slots for a new file (an existing one keeps its own)
+// Outputs      : 0 if successful, -1 if failure
+
+int openSGL2Cache( const char *path, uint32_t blocks ) {
+    SG_l2_header hdr;
+    bool warm;
+
+    if ( l2File != -1 || blocks == 0 ){
+        logMessage( LOG_ERROR_LEVEL, "openSGL2Cache: tier already open or invalid size [%u].", blocks );
+        return( -1 );
+    }
+    if ( (l2File = open(path, O_RDWR|O_CREAT, 0644)) < 0 ){
+        logMessage( LOG_ERROR_LEVEL, "openSGL2Cache: unable to open tier file [%s].", path );
+        return( -1 );
+    }
+
+    warm = ( pread(l2File, &hdr, sizeof(hdr), 0) == sizeof(hdr) && hdr.magic == SG_L2_MAGIC &&
+             hdr.version == SG_L2_VERSION && hdr.blockSize == SG_BLOCK_SIZE && hdr.blocks > 0 && hdr.clean );
+    l2Blocks = warm ? hdr.blocks : blocks;
+    size_t indexBytes = (sizeof(SG_l2_slot)*l2Blocks + SG_L2_HEADER_SIZE-1) & ~(size_t)(SG_L2_HEADER_SIZE-1);
+    l2DataOffset = SG_L2_HEADER_SIZE + indexBytes;
+
+    uint32_t buckets = 1;
+    while ( buckets < l2Blocks ){
+        buckets <<= 1;
+    }
+    l2BucketMask = buckets-1;
+    l2Slots = (SG_l2_slot *) calloc(l2Blocks, sizeof(SG_l2_slot));
+    l2Next = (int32_t *) malloc(sizeof(int32_t)*l2Blocks);
+    l2Buckets = (int32_t *) malloc(sizeof(int32_t)*buckets);
+    l2Ref = (uint8_t *) calloc(l2Blocks, 1);
+    if ( l2Slots == NULL || l2Next == NULL || l2Buckets == NULL || l2Ref == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "openSGL2Cache: memory allocation failed." );
+        sgL2Free();
+        return( -1 );
+    }
+    for ( uint32_t i=0; i<buckets; i++ ){
+        l2Buckets[i] = SG_L2_NIL;
+    }
+    l2Count = l2Hand = 0;
+    l2Queries = l2Hits = l2Demotions = 0;
+
+    if ( warm && pread(l2File, l2Slots, sizeof(SG_l2_slot)*l2Blocks, SG_L2_HEADER_SIZE) !=
+                 (ssize_t)(sizeof(SG_l2_slot)*l2Blocks) ){
+        logMessage( LOG_ERROR_LEVEL, "openSGL2Cache: unable to read the index, starting empty." );
+        memset( l2Slots, 0, sizeof(SG_l2_slot)*l2Blocks );
+        warm = false;
+    }
+    l2Free = SG_L2_NIL;
+    for ( uint32_t i=l2Blocks; i-- > 0; ){
+        if ( l2Slots[i].node_ID != 0 || l2Slots[i].blk_ID != 0 ){
+            sgL2Hash( i );
+            l2Count += 1;
+        } else {
+            l2Next[i] = l2Free;
+            l2Free = i;
+        }
+    }
+
+    // Size the file and mark it in use, a crash now leaves it cold
+    if ( (!warm && ftruncate(l2File, l2DataOffset + (off_t)l2Blocks*SG_BLOCK_SIZE)) || sgL2WriteHeader(0) ){
+        logMessage( LOG_ERROR_LEVEL, "openSGL2Cache: unable to set up tier file [%s].", path );
+        sgL2Free();
+        return( -1 );
+    }
+    logMessage( LOG_INFO_LEVEL, "[Cache] L2: opened [%s], %u slots, %u blocks %s.", path, l2Blocks, l2Count,
+                warm ? "reloaded" : "(new)" );
+
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSGL2Cache
+// Description  : Save the index, mark the file clean and close it
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int closeSGL2Cache( void ) {
+    int ret = 0;
+
+    if ( l2File == -1 ){
+        return( 0 );
+    }
+    pthread_mutex_lock( &l2Lock );
+    if ( pwrite(l2File, l2Slots, sizeof(SG_l2_slot)*l2Blocks, SG_L2_HEADER_SIZE) !=
+         (ssize_t)(sizeof(SG_l2_slot)*l2Blocks) || fsync(l2File) || sgL2WriteHeader(1) || fsync(l2File) ){
+        logMessage( LOG_ERROR_LEVEL, "closeSGL2Cache: unable to save the index." );
+        ret = -1;
+    }
+    logMessage( LOG_INFO_LEVEL, "[Cache] L2: %u of %u slots used, queries: %lu, hits: %lu, demotions: %lu",
+                l2Count, l2Blocks, l2Queries, l2Hits, l2Demotions );
+    sgL2Free();
+    pthread_mutex_unlock( &l2Lock );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgL2Active
+// Description  : Check whether a tier file is open
+//
+// Inputs       : none
+// Outputs      : true if open
+
+bool sgL2Active( void ) {
+    return( l2File != -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getSGL2Block
+// Description  : Read a block from the tier
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+//                block - where to put it
+// Outputs      : 0 if found, -1 if not
+
+int getSGL2Block( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    int ret = -1;
+
+    if ( l2File == -1 ){
+        return( -1 );
+    }
+    pthread_mutex_lock( &l2Lock );
+    l2Queries += 1;
+    int32_t i = sgL2Find( nde, blk );
+    if ( i != SG_L2_NIL ){
+        if ( pread(l2File, block, SG_BLOCK_SIZE, l2DataOffset + (off_t)i*SG_BLOCK_SIZE) == SG_BLOCK_SIZE ){
+            l2Ref[i] = 1;
+            l2Hits += 1;
+            ret = 0;
+        } else {
+            logMessage( LOG_ERROR_LEVEL, "getSGL2Block: read of blk [%lu] failed, dropping it.", blk );
+            sgL2Unhash( i );
+        }
+    }
+    pthread_mutex_unlock( &l2Lock );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : putSGL2Block
+// Description  : Demote a clean block into a free slot, or once there are
+//                none replacing the slot the CLOCK hand lands on (so blocks
+//                reloaded warm are not replaced while slots are free).  A
+//                block already there is only marked referenced, its copy
+//                is current (changed blocks are dropped).
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+//                block - the block
+// Outputs      : 0 if successful, -1 if failure
+
+int putSGL2Block( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    int ret = 0;
+
+    if ( l2File == -1 ){
+        return( -1 );
+    }
+    pthread_mutex_lock( &l2Lock );
+    int32_t i = sgL2Find( nde, blk );
+    if ( i != SG_L2_NIL ){
+        l2Ref[i] = 1;
+        pthread_mutex_unlock( &l2Lock );
+        return( 0 );
+    }
+
+    if ( l2Free == SG_L2_NIL ){
+        for ( ;; l2Hand = (l2Hand+1) % l2Blocks ){
+            if ( !l2Ref[l2Hand] ){
+                sgL2Unhash( l2Hand );
+                break;
+            }
+            l2Ref[l2Hand] = 0;
+        }
+        l2Hand = (l2Hand+1) % l2Blocks;
+    }
+    i = l2Free;
+    l2Free = l2Next[i];
+    if ( pwrite(l2File, block, SG_BLOCK_SIZE, l2DataOffset + (off_t)i*SG_BLOCK_SIZE) == SG_BLOCK_SIZE ){
+        l2Slots[i].node_ID = nde;
+        l2Slots[i].blk_ID = blk;
+        l2Ref[i] = 0;
+        sgL2Hash( i );
+        l2Count += 1;
+        l2Demotions += 1;
+    } else {
+        logMessage( LOG_ERROR_LEVEL, "putSGL2Block: write of blk [%lu] failed.", blk );
+        l2Next[i] = l2Free;
+        l2Free = i;
+        ret = -1;
+    }
+    pthread_mutex_unlock( &l2Lock );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropSGL2Block
+// Description  : Forget the tier copy of a block
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+// Outputs      : 0 if successful (or not there), -1 if failure
+
+int dropSGL2Block( SG_Node_ID nde, SG_Block_ID blk ) {
+    if ( l2File == -1 ){
+        return( 0 );
+    }
+    pthread_mutex_lock( &l2Lock );
+    int32_t i = sgL2Find( nde, blk );
+    if ( i != SG_L2_NIL ){
+        sgL2Unhash( i );
+    }
+    pthread_mutex_unlock( &l2Lock );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgL2UnitTest
+// Description  : Fill a small tier past capacity, drop a block, then close
+//                and reopen it and check the survivors came back; reopen
+//                it again and check new blocks fill freed slots rather
+//                than replacing those reloaded
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int sgL2UnitTest( void ) {
+    char path[] = "/tmp/sg_l2_unit_XXXXXX";
+    char block[SG_BLOCK_SIZE];
+    int fd, found = 0, wrong = 0, i;
+
+    if ( (fd = mkstemp(path)) < 0 ){
+        return( -1 );
+    }
+    close( fd );
+    if ( openSGL2Cache(path, 64) ){
+        unlink( path );
+        return( -1 );
+    }
+    for ( i=1; i<=100; i++ ){
+        memset( block, (char)i, SG_BLOCK_SIZE );
+        putSGL2Block( 1, i, block );
+    }
+    dropSGL2Block( 1, 100 );
+    if ( closeSGL2Cache() || openSGL2Cache(path, 16) ){
+        unlink( path );
+        return( -1 );
+    }
+    for ( i=1; i<=100; i++ ){
+        if ( getSGL2Block(1, i, block) == 0 ){
+            found += 1;
+            wrong += ( block[0] != (char)i || block[SG_BLOCK_SIZE-1] != (char)i || i == 100 );
+        }
+    }
+    if ( found != 63 || wrong ){
+        logMessage( LOG_ERROR_LEVEL, "sgL2UnitTest: [%d] blocks survived reopening, [%d] wrong, expected 63.",
+                    found, wrong );
+        closeSGL2Cache();
+        unlink( path );
+        return( -1 );
+    }
+
+    // Eight blocks dropped after a warm reload make room for eight more
+    int dropped = 0;
+    if ( closeSGL2Cache() || openSGL2Cache(path, 16) ){
+        unlink( path );
+        return( -1 );
+    }
+    for ( i=1; dropped<8; i++ ){
+        if ( getSGL2Block(1, i, block) == 0 ){
+            dropSGL2Block( 1, i );
+            dropped += 1;
+        }
+    }
+    for ( i=101; i<=108; i++ ){
+        memset( block, (char)i, SG_BLOCK_SIZE );
+        putSGL2Block( 1, i, block );
+    }
+    for ( found=0, i=1; i<=108; i++ ){
+        found += ( getSGL2Block(1, i, block) == 0 );
+    }
+    closeSGL2Cache();
+    unlink( path );
+    if ( found != 63 ){
+        logMessage( LOG_ERROR_LEVEL, "sgL2UnitTest: [%d] blocks held after refilling freed slots, expected 63.", found );
+        return( -1 );
+    }
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgL2UnitTest: second tier unit tests completed successfully." );
+    return( 0 );
+}
+
+//
+// Support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgL2Bucket / sgL2Find / sgL2Hash / sgL2Unhash
+// Description  : Index of the tier slots by (node, block) (lock held);
+//                unhashing also frees the slot, onto the free list
+//
+// Inputs       : nde, blk - the block (bucket, find)
+//                i - the slot (hash, unhash)
+// Outputs      : the bucket, the slot or SG_L2_NIL (find)
+
+static uint32_t sgL2Bucket( SG_Node_ID nde, SG_Block_ID blk ) {
+    uint64_t h = nde * 0x9e3779b97f4a7c15ULL ^ blk;
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return( (uint32_t)h & l2BucketMask );
+}
+
+static int32_t sgL2Find( SG_Node_ID nde, SG_Block_ID blk ) {
+    for ( int32_t i=l2Buckets[sgL2Bucket(nde, blk)]; i!=SG_L2_NIL; i=l2Next[i] ){
+        if ( l2Slots[i].node_ID == nde && l2Slots[i].blk_ID == blk ){
+            return( i );
+        }
+    }
+    return( SG_L2_NIL );
+}
+
+static void sgL2Hash( int32_t i ) {
+    uint32_t b = sgL2Bucket( l2Slots[i].node_ID, l2Slots[i].blk_ID );
+    l2Next[i] = l2Buckets[b];
+    l2Buckets[b] = i;
+}
+
+static void sgL2Unhash( int32_t i ) {
+    int32_t * link = &l2Buckets[sgL2Bucket(l2Slots[i].node_ID, l2Slots[i].blk_ID)];
+    while ( *link != i ){
+        link = &l2Next[*link];
+    }
+    *link = l2Next[i];
+    l2Next[i] = l2Free;
+    l2Free = i;
+    l2Slots[i].node_ID = 0;
+    l2Slots[i].blk_ID = 0;
+    l2Ref[i] = 0;
+    l2Count -= 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgL2WriteHeader
+// Description  : Write the file header
+//
+// Inputs       : clean - whether the saved index matches the slots
+// Outputs      : 0 if successful, -1 if failure
+
+static int sgL2WriteHeader( uint32_t clean ) {
+    SG_l2_header hdr = { SG_L2_MAGIC, SG_L2_VERSION, SG_BLOCK_SIZE, l2Blocks, clean, l2Count };
+    return( pwrite(l2File, &hdr, sizeof(hdr), 0) == sizeof(hdr) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgL2Free
+// Description  : Release the index and close the file
+//
+// Inputs       : none
+// Outputs      : none
+
+static void sgL2Free( void ) {
+    free( l2Slots );
+    free( l2Next );
+    free( l2Buckets );
+    free( l2Ref );
+    l2Slots = NULL;
+    l2Next = l2Buckets = NULL;
+    l2Ref = NULL;
+    if ( l2File != -1 ){
+        close( l2File );
+        l2File = -1;
+    }
+}
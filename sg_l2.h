@@ -0,0 +1,46 @@
+#ifndef SG_L2_INCLUDED
+#define SG_L2_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_l2.h
+//  Description    : This is the declaration of the second tier block cache,
+//                   kept in a local file beneath the in-memory cache.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Includes
+#include <stdbool.h>
+#include <sg_defs.h>
+
+//
+// Defines
+#define SG_L2_DEFAULT_BLOCKS 8192   // blocks in a new tier file (8 MB)
+
+//
+// Second tier cache functions
+
+int openSGL2Cache( const char *path, uint32_t blocks );
+    // Open (or create with room for blocks) the tier file, keeping its contents
+
+int closeSGL2Cache( void );
+    // Save the index and close the tier file
+
+bool sgL2Active( void );
+    // Is a tier file open
+
+int getSGL2Block( SG_Node_ID nde, SG_Block_ID blk, char *block );
+    // Read a block from the tier, 0 if found
+
+int putSGL2Block( SG_Node_ID nde, SG_Block_ID blk, char *block );
+    // Demote a clean block into the tier
+
+int dropSGL2Block( SG_Node_ID nde, SG_Block_ID blk );
+    // Forget the tier copy of a block that changed
+
+int sgL2UnitTest( void );
+    // Run the second tier unit tests
+
+#endif
@@ -0,0 +1,323 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_lz.c
+//  Description    : This file contains a small LZ77 style compressor for
+//                   cache blocks.  A compressed buffer is a flags byte and
+//                   a run of sequences, each a token (literal count and
+//                   match length, four bits apiece, 15 meaning more length
+//                   bytes follow), the literals and then a two byte match
+//                   offset; the last sequence stops after its literals.
+//                   Blocks holding only 7 bit (ASCII) bytes get their
+//                   literals packed seven bits to the byte.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_lz.h>
+
+// Defines
+#define SG_LZ_PACKED 0x01           // flags: literals are packed 7 bit bytes
+#define SG_LZ_MIN_MATCH 4           // shortest match worth a sequence
+#define SG_LZ_HASH_BITS 10          // match finder table (one candidate per slot)
+
+// Functional Prototypes
+static int sgLzEmit( uint8_t **out, uint8_t *end, const uint8_t *lit, size_t litLen,
+                     size_t offset, size_t matchLen, bool packed );
+static uint8_t * sgLzPutLength( uint8_t *out, size_t len );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgLzCompress
+// Description  : Compress a buffer, greedily taking the match (if any) the
+//                hash of the next four bytes points at
+//
+// Inputs       : src - the bytes to compress
+//                len - how many (at most SG_LZ_MAX_INPUT)
+//                dst - where to put the compressed bytes
+//                cap - room at dst
+// Outputs      : the compressed size, -1 if it does not fit in cap
+
+int sgLzCompress( const char *src, size_t len, char *dst, size_t cap ) {
+    const uint8_t * in = (const uint8_t *) src;
+    uint8_t * out = (uint8_t *) dst, * end = out + cap;
+    uint32_t table[1 << SG_LZ_HASH_BITS];    // position+1 of the last four bytes hashed there
+    size_t anchor = 0, i = 0;
+    bool packed = true;
+
+    if ( len > SG_LZ_MAX_INPUT || cap < 1 ){
+        return( -1 );
+    }
+    for ( size_t k=0; k<len && packed; k++ ){
+        packed = ( in[k] < 0x80 );
+    }
+    memset( table, 0, sizeof(table) );
+    *out++ = packed ? SG_LZ_PACKED : 0;
+
+    while ( i+SG_LZ_MIN_MATCH <= len ){
+        uint32_t v;
+        memcpy( &v, in+i, sizeof(v) );
+        uint32_t h = (v * 2654435761u) >> (32-SG_LZ_HASH_BITS);
+        size_t cand = table[h];
+        table[h] = i+1;
+        if ( cand == 0 || memcmp(in+cand-1, in+i, SG_LZ_MIN_MATCH) ){
+            i += 1;
+            continue;
+        }
+        cand -= 1;
+        size_t m = SG_LZ_MIN_MATCH;
+        while ( i+m < len && in[cand+m] == in[i+m] ){
+            m += 1;
+        }
+        if ( sgLzEmit(&out, end, in+anchor, i-anchor, i-cand, m, packed) ){
+            return( -1 );
+        }
+        i += m;
+        anchor = i;
+    }
+    if ( sgLzEmit(&out, end, in+anchor, len-anchor, 0, 0, packed) ){
+        return( -1 );
+    }
+    return( (int)(out - (uint8_t *)dst) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgLzDecompress
+// Description  : Expand a compressed buffer, checking every length and
+//                offset against both buffers
+//
+// Inputs       : src - the compressed bytes
+//                len - how many
+//                dst - where to put the expanded bytes
+//                cap - room at dst
+// Outputs      : the expanded size, -1 if the input is malformed or too big
+
+int sgLzDecompress( const char *src, size_t len, char *dst, size_t cap ) {
+    const uint8_t * in = (const uint8_t *) src, * inEnd = in + len;
+    uint8_t * out = (uint8_t *) dst, * outEnd = out + cap;
+    uint8_t b;
+
+    if ( len < 1 ){
+        return( -1 );
+    }
+    bool packed = ( *in++ & SG_LZ_PACKED );
+
+    for ( ;; ){
+        if ( in >= inEnd ){
+            return( -1 );
+        }
+        uint8_t token = *in++;
+        size_t lit = token >> 4;
+        if ( lit == 15 ){
+            do {
+                if ( in >= inEnd ){
+                    return( -1 );
+                }
+                b = *in++;
+                lit += b;
+            } while ( b == 255 );
+        }
+        if ( lit > (size_t)(outEnd - out) ){
+            return( -1 );
+        }
+        if ( packed ){
+            uint32_t acc = 0;
+            int bits = 0;
+            if ( (lit*7+7)/8 > (size_t)(inEnd - in) ){
+                return( -1 );
+            }
+            for ( size_t k=0; k<lit; k++ ){
+                if ( bits < 7 ){
+                    acc |= (uint32_t)(*in++) << bits;
+                    bits += 8;
+                }
+                *out++ = acc & 0x7f;
+                acc >>= 7;
+                bits -= 7;
+            }
+        } else {
+            if ( lit > (size_t)(inEnd - in) ){
+                return( -1 );
+            }
+            memcpy( out, in, lit );
+            out += lit;
+            in += lit;
+        }
+        if ( in == inEnd ){
+            break;
+        }
+
+        if ( inEnd - in < 2 ){
+            return( -1 );
+        }
+        size_t offset = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        size_t match = token & 0x0f;
+        if ( match == 15 ){
+            do {
+                if ( in >= inEnd ){
+                    return( -1 );
+                }
+                b = *in++;
+                match += b;
+            } while ( b == 255 );
+        }
+        match += SG_LZ_MIN_MATCH;
+        if ( offset == 0 || offset > (size_t)(out - (uint8_t *)dst) || match > (size_t)(outEnd - out) ){
+            return( -1 );
+        }
+        for ( size_t k=0; k<match; k++ ){     // may overlap itself
+            out[k] = out[k-offset];
+        }
+        out += match;
+    }
+    return( (int)(out - (uint8_t *)dst) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgLzUnitTest
+// Description  : Round trip empty, zero, text, ASCII and binary blocks,
+//                check the sizes the block kinds compress to, and feed the
+//                decompressor truncated and corrupted input
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int sgLzUnitTest( void ) {
+    char in[4096], packed[4096+4096/8+64], out[4096];
+    int kind, n, m, i;
+
+    srand( 311 );
+    for ( kind=0; kind<5; kind++ ){
+        size_t len = (kind == 0) ? 0 : 1024 * (1 + kind%4);
+        for ( i=0; i<(int)len; i++ ){
+            switch ( kind ){
+                case 1: in[i] = 0; break;                                   // zero
+                case 2: in[i] = "the scatter gather block "[i%25]; break;    // repetitive text
+                case 3: in[i] = (i < 768) ? ' '+rand()%95 : 0; break;       // ASCII, zero tail
+                default: in[i] = (char)rand(); break;                       // binary
+            }
+        }
+        n = sgLzCompress( in, len, packed, sizeof(packed) );
+        m = ( n < 0 ) ? -1 : sgLzDecompress( packed, n, out, sizeof(out) );
+        bool small = ( kind == 1 || kind == 2 ) ? (n < 64) : ( kind == 3 ) ? (n < 700) : true;
+        if ( n < 0 || m != (int)len || memcmp(in, out, len) || !small ){
+            logMessage( LOG_ERROR_LEVEL, "sgLzUnitTest: block kind [%d] of [%lu] bytes compressed to [%d], "
+                        "expanded to [%d]", kind, len, n, m );
+            return( -1 );
+        }
+        if ( len > 0 && sgLzCompress(in, len, packed, (kind == 4) ? len/2 : 8) != -1 ){
+            logMessage( LOG_ERROR_LEVEL, "sgLzUnitTest: block kind [%d] overran a short output", kind );
+            return( -1 );
+        }
+
+        // Damaged input must be refused or stay inside the output
+        for ( i=0; i<n; i++ ){
+            if ( sgLzDecompress(packed, i, out, sizeof(out)) > (int)sizeof(out) ){
+                return( -1 );
+            }
+            char saved = packed[i];
+            packed[i] ^= 1 << (rand()%8);
+            if ( sgLzDecompress(packed, n, out, len) > (int)len ){
+                return( -1 );
+            }
+            packed[i] = saved;
+        }
+    }
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgLzUnitTest: compressor unit tests completed successfully." );
+    return( 0 );
+}
+
+//
+// Support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgLzEmit
+// Description  : Write one sequence, literals and (unless matchLen is 0,
+//                the final sequence) a match
+//
+// Inputs       : out - the output position, advanced
+//                end - end of the output
+//                lit - the literals, litLen - how many
+//                offset - distance back to the match
+//                matchLen - match length, 0 for none
+//                packed - pack the literals 7 bits to the byte
+// Outputs      : 0 if successful, -1 if the output is full
+
+static int sgLzEmit( uint8_t **out, uint8_t *end, const uint8_t *lit, size_t litLen,
+                     size_t offset, size_t matchLen, bool packed ) {
+    size_t extra = matchLen ? matchLen-SG_LZ_MIN_MATCH : 0;
+    size_t litBytes = packed ? (litLen*7+7)/8 : litLen;
+    uint8_t * o = *out;
+
+    // Token, length bytes, literals and the match, at their longest
+    if ( (size_t)(end - o) < 1 + (litLen/255+1) + litBytes + 2 + (extra/255+1) ){
+        return( -1 );
+    }
+    *o++ = (uint8_t)( ((litLen < 15 ? litLen : 15) << 4) | (extra < 15 ? extra : 15) );
+    if ( litLen >= 15 ){
+        o = sgLzPutLength( o, litLen-15 );
+    }
+    if ( packed ){
+        uint32_t acc = 0;
+        int bits = 0;
+        for ( size_t k=0; k<litLen; k++ ){
+            acc |= (uint32_t)lit[k] << bits;
+            bits += 7;
+            if ( bits >= 8 ){
+                *o++ = acc & 0xff;
+                acc >>= 8;
+                bits -= 8;
+            }
+        }
+        if ( bits > 0 ){
+            *o++ = acc & 0xff;
+        }
+    } else {
+        memcpy( o, lit, litLen );
+        o += litLen;
+    }
+    if ( matchLen ){
+        *o++ = offset & 0xff;
+        *o++ = (offset >> 8) & 0xff;
+        if ( extra >= 15 ){
+            o = sgLzPutLength( o, extra-15 );
+        }
+    }
+    *out = o;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgLzPutLength
+// Description  : Write the rest of a length as 255s and a final byte
+//
+// Inputs       : out - where to write
+//                len - the length left over after the token
+// Outputs      : the position after it
+
+static uint8_t * sgLzPutLength( uint8_t *out, size_t len ) {
+    while ( len >= 255 ){
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = (uint8_t)len;
+    return( out );
+}
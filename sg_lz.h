@@ -0,0 +1,33 @@
+#ifndef SG_LZ_INCLUDED
+#define SG_LZ_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_lz.h
+//  Description    : This is the declaration of the small block compressor
+//                   used by the compressed victim tier of the cache.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Includes
+#include <stddef.h>
+
+//
+// Defines
+#define SG_LZ_MAX_INPUT 65536       // offsets are 16 bits, inputs may not be longer
+
+//
+// Compressor functions
+
+int sgLzCompress( const char *src, size_t len, char *dst, size_t cap );
+    // Compress len bytes into at most cap bytes, the compressed size or -1
+
+int sgLzDecompress( const char *src, size_t len, char *dst, size_t cap );
+    // Expand a compressed buffer into at most cap bytes, the size or -1 if malformed
+
+int sgLzUnitTest( void );
+    // Run the compressor unit tests
+
+#endif
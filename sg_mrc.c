@@ -0,0 +1,441 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_mrc.c
+//  Description    : This file contains the miss ratio curve estimator run
+//                   alongside the block cache.  It follows SHARDS (Waldspurger
+//                   et al., FAST '15): only blocks whose hash falls under a
+//                   threshold are tracked, their LRU reuse distances are
+//                   scaled back up by the sampling rate, and the threshold is
+//                   lowered whenever more than SG_MRC_MAX_KEYS blocks would
+//                   be tracked, so the cost stays fixed however large the
+//                   working set grows.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_defs.h>
+#include <sg_mrc.h>
+
+// Defines
+#define SG_MRC_NIL (-1)
+#define SG_MRC_WINDOW (4*SG_MRC_MAX_KEYS)       // timestamps handed out before renumbering
+#define SG_MRC_BUCKETS (2*SG_MRC_MAX_KEYS)      // index buckets (power of two)
+#define SG_MRC_FULL_RATE (1u << SG_MRC_SAMPLE_BITS)
+
+typedef struct {    //a tracked (sampled) block
+    uint64_t h;         // block hash
+    uint32_t when;      // time of its last reference, 0 if the record is free
+    int32_t hnext;      // next record in the bucket, or on the free list
+} SG_mrc_key;
+
+pthread_mutex_t mrcLock = PTHREAD_MUTEX_INITIALIZER;
+atomic_uint mrcThreshold;                   // blocks sampling below this are tracked, 0 if off
+SG_mrc_key mrcKeys[SG_MRC_MAX_KEYS];
+int32_t mrcBuckets[SG_MRC_BUCKETS];
+int32_t mrcFree;                            // unused records
+uint32_t mrcCount;                          // tracked blocks
+int32_t mrcOwner[SG_MRC_WINDOW];            // block last referenced at each time
+uint32_t mrcTree[SG_MRC_WINDOW];            // Fenwick tree marking the times in use
+uint32_t mrcNow;                            // next timestamp
+uint32_t mrcScratch[SG_MRC_MAX_KEYS];
+double mrcHist[SG_MRC_BINS];                // weight of references by reuse distance
+double mrcBeyond;                           // ... past the last bin
+double mrcCold;                             // ... never seen before
+double mrcTotal;                            // weight of all references
+uint32_t mrcBinLines;                       // reuse distances per bin
+
+// Functional Prototypes
+static uint32_t sgMrcSample( uint64_t h );
+static int32_t sgMrcFind( uint64_t h );
+static void sgMrcForget( int32_t k );
+static void sgMrcLowerThreshold( void );
+static void sgMrcRenumber( void );
+static void sgMrcTreeAdd( uint32_t t, int32_t v );
+static uint32_t sgMrcTreeSum( uint32_t t );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : initSGMrc
+// Description  : Start (or restart) estimating, with the reuse distance
+//                histogram covering SG_MRC_RANGE times the given cache size
+//
+// Inputs       : lines - blocks in the cache being modelled
+// Outputs      : 0 if successful, -1 if failure
+
+int initSGMrc( uint32_t lines ) {
+    if ( lines == 0 ){
+        logMessage( LOG_ERROR_LEVEL, "initSGMrc: invalid cache size [%u].", lines );
+        return( -1 );
+    }
+
+    pthread_mutex_lock( &mrcLock );
+    for ( uint32_t i=0; i<SG_MRC_BUCKETS; i++ ){
+        mrcBuckets[i] = SG_MRC_NIL;
+    }
+    for ( uint32_t i=0; i<SG_MRC_MAX_KEYS; i++ ){
+        mrcKeys[i].when = 0;
+        mrcKeys[i].hnext = (i+1 < SG_MRC_MAX_KEYS) ? (int32_t)i+1 : SG_MRC_NIL;
+    }
+    for ( uint32_t i=0; i<SG_MRC_WINDOW; i++ ){
+        mrcOwner[i] = SG_MRC_NIL;
+    }
+    memset( mrcTree, 0, sizeof(mrcTree) );
+    memset( mrcHist, 0, sizeof(mrcHist) );
+    mrcFree = 0;
+    mrcCount = 0;
+    mrcNow = 1;
+    mrcBeyond = mrcCold = mrcTotal = 0;
+    mrcBinLines = ((uint64_t)lines*SG_MRC_RANGE + SG_MRC_BINS-1) / SG_MRC_BINS;
+    atomic_store( &mrcThreshold, SG_MRC_FULL_RATE );
+    pthread_mutex_unlock( &mrcLock );
+
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : recordSGMrc
+// Description  : Record a reference.  Unsampled blocks return without
+//                taking the lock; a sampled one adds its scaled reuse
+//                distance (or a cold miss) to the histogram.
+//
+// Inputs       : h - hash of the block referenced (well mixed)
+// Outputs      : none
+
+void recordSGMrc( uint64_t h ) {
+    uint32_t sample = sgMrcSample( h );
+
+    if ( sample >= atomic_load_explicit(&mrcThreshold, memory_order_relaxed) ){
+        return;
+    }
+    pthread_mutex_lock( &mrcLock );
+    uint32_t threshold = atomic_load_explicit( &mrcThreshold, memory_order_relaxed );
+    if ( sample >= threshold ){     // lowered while we waited
+        pthread_mutex_unlock( &mrcLock );
+        return;
+    }
+
+    // Each sampled reference stands for 1/rate references
+    double weight = (double)SG_MRC_FULL_RATE / threshold;
+    mrcTotal += weight;
+    int32_t k = sgMrcFind( h );
+    if ( k != SG_MRC_NIL ){
+        uint32_t when = mrcKeys[k].when;
+        double distance = (double)(sgMrcTreeSum(mrcNow-1) - sgMrcTreeSum(when)) * weight;
+        uint32_t bin = (uint32_t)(distance / mrcBinLines);
+        if ( distance < (double)mrcBinLines*SG_MRC_BINS ){
+            mrcHist[bin] += weight;
+        } else {
+            mrcBeyond += weight;
+        }
+        sgMrcTreeAdd( when, -1 );
+        mrcOwner[when] = SG_MRC_NIL;
+    } else {
+        mrcCold += weight;
+        if ( mrcCount == SG_MRC_MAX_KEYS ){
+            sgMrcLowerThreshold();
+            if ( sample >= atomic_load_explicit(&mrcThreshold, memory_order_relaxed) ){
+                pthread_mutex_unlock( &mrcLock );
+                return;
+            }
+        }
+        k = mrcFree;
+        mrcFree = mrcKeys[k].hnext;
+        mrcKeys[k].h = h;
+        mrcKeys[k].hnext = mrcBuckets[h & (SG_MRC_BUCKETS-1)];
+        mrcBuckets[h & (SG_MRC_BUCKETS-1)] = k;
+        mrcCount += 1;
+    }
+
+    if ( mrcNow == SG_MRC_WINDOW ){
+        sgMrcRenumber();
+    }
+    mrcKeys[k].when = mrcNow;
+    mrcOwner[mrcNow] = k;
+    sgMrcTreeAdd( mrcNow, 1 );
+    mrcNow += 1;
+    pthread_mutex_unlock( &mrcLock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgMrcHitRate
+// Description  : Estimate the hit rate of an LRU cache: a reference hits if
+//                fewer than lines other blocks were used since its last one
+//
+// Inputs       : lines - blocks in the cache
+// Outputs      : hit rate between 0 and 1, -1 if nothing was recorded
+
+double sgMrcHitRate( uint32_t lines ) {
+    double hits = 0, total;
+
+    pthread_mutex_lock( &mrcLock );
+    total = mrcTotal;
+    for ( uint32_t b=0; b<SG_MRC_BINS && total > 0; b++ ){
+        double lo = (double)b*mrcBinLines, hi = lo+mrcBinLines;
+        if ( hi <= lines ){
+            hits += mrcHist[b];
+        } else {
+            if ( lo < lines ){      // the bin straddles the size, take its share
+                hits += mrcHist[b] * (lines-lo) / mrcBinLines;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock( &mrcLock );
+    return( (total > 0) ? hits/total : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logSGMrc
+// Description  : Log the estimated hit rate from a quarter to eight times
+//                the given cache size
+//
+// Inputs       : lines - blocks in the cache
+// Outputs      : none
+
+void logSGMrc( uint32_t lines ) {
+    static const uint32_t scale[][2] = { {1,4}, {1,2}, {1,1}, {2,1}, {4,1}, {8,1} };
+
+    logMessage( LOG_INFO_LEVEL, "[Cache] MRC: sampling rate %f, %u blocks tracked, %f%% cold misses",
+                (double)atomic_load(&mrcThreshold) / SG_MRC_FULL_RATE, mrcCount,
+                mrcTotal > 0 ? mrcCold/mrcTotal*100 : 0 );
+    for ( int i=0; i<(int)(sizeof(scale)/sizeof(scale[0])); i++ ){
+        uint32_t c = lines*scale[i][0]/scale[i][1];
+        double rate = sgMrcHitRate( c );
+        if ( c > 0 && rate >= 0 ){
+            logMessage( LOG_INFO_LEVEL, "[Cache] MRC: estimated hit rate at %u lines (%u KB): %f%%",
+                        c, (uint32_t)((uint64_t)c*SG_BLOCK_SIZE/1024), rate*100 );
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSGMrc
+// Description  : Stop estimating, later references are ignored
+//
+// Inputs       : none
+// Outputs      : none
+
+void closeSGMrc( void ) {
+    atomic_store( &mrcThreshold, 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgMrcUnitTest
+// Description  : Cyclic scans have a known curve: a loop over N blocks hits
+//                every time once the cache holds N of them, never before.
+//                Check it exactly (everything tracked) and sampled.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static uint64_t sgMrcUnitTestHash( uint64_t i ) {
+    i += 0x9e3779b97f4a7c15ULL;
+    i = (i ^ (i >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    i = (i ^ (i >> 27)) * 0x94d049bb133111ebULL;
+    return( i ^ (i >> 31) );
+}
+
+int sgMrcUnitTest( void ) {
+    double above, below;
+
+    // 600 blocks 10 times, small enough to track them all
+    if ( initSGMrc(1000) ){
+        return( -1 );
+    }
+    for ( int pass=0; pass<10; pass++ ){
+        for ( int i=0; i<600; i++ ){
+            recordSGMrc( sgMrcUnitTestHash(i) );
+        }
+    }
+    above = sgMrcHitRate( 1000 );
+    below = sgMrcHitRate( 300 );
+    if ( above < 0.89 || above > 0.91 || below > 0.01 ){
+        logMessage( LOG_ERROR_LEVEL, "sgMrcUnitTest: exact curve off, [%f] above and [%f] below the loop.",
+                    above, below );
+        closeSGMrc();
+        return( -1 );
+    }
+
+    // 50000 blocks 4 times, only a sample fits
+    if ( initSGMrc(8192) ){
+        return( -1 );
+    }
+    for ( int pass=0; pass<4; pass++ ){
+        for ( int i=0; i<50000; i++ ){
+            recordSGMrc( sgMrcUnitTestHash(i) );
+        }
+    }
+    above = sgMrcHitRate( 60000 );
+    below = sgMrcHitRate( 40000 );
+    if ( atomic_load(&mrcThreshold) == SG_MRC_FULL_RATE || above < 0.70 || above > 0.80 || below > 0.05 ){
+        logMessage( LOG_ERROR_LEVEL, "sgMrcUnitTest: sampled curve off, [%f] above and [%f] below the loop.",
+                    above, below );
+        closeSGMrc();
+        return( -1 );
+    }
+    closeSGMrc();
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgMrcUnitTest: miss ratio curve unit tests completed successfully." );
+    return( 0 );
+}
+
+//
+// Support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgMrcSample
+// Description  : The sampling value of a block, hash bits the cache does
+//                not use to pick shards or buckets
+//
+// Inputs       : h - block hash
+// Outputs      : value below SG_MRC_FULL_RATE
+
+static uint32_t sgMrcSample( uint64_t h ) {
+    return( (uint32_t)(h >> 20) & (SG_MRC_FULL_RATE-1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgMrcFind
+// Description  : Look up a tracked block (lock held)
+//
+// Inputs       : h - block hash
+// Outputs      : record index or SG_MRC_NIL
+
+static int32_t sgMrcFind( uint64_t h ) {
+    for ( int32_t k=mrcBuckets[h & (SG_MRC_BUCKETS-1)]; k!=SG_MRC_NIL; k=mrcKeys[k].hnext ){
+        if ( mrcKeys[k].h == h ){
+            return( k );
+        }
+    }
+    return( SG_MRC_NIL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgMrcForget
+// Description  : Stop tracking a block (lock held)
+//
+// Inputs       : k - its record
+// Outputs      : none
+
+static void sgMrcForget( int32_t k ) {
+    int32_t * link = &mrcBuckets[mrcKeys[k].h & (SG_MRC_BUCKETS-1)];
+    while ( *link != k ){
+        link = &mrcKeys[*link].hnext;
+    }
+    *link = mrcKeys[k].hnext;
+    sgMrcTreeAdd( mrcKeys[k].when, -1 );
+    mrcOwner[mrcKeys[k].when] = SG_MRC_NIL;
+    mrcKeys[k].when = 0;
+    mrcKeys[k].hnext = mrcFree;
+    mrcFree = k;
+    mrcCount -= 1;
+}
+
+static int sgMrcCompare( const void *a, const void *b ) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return( (x > y) - (x < y) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgMrcLowerThreshold
+// Description  : Make room by lowering the threshold so the eighth of the
+//                tracked blocks with the highest values drop out (lock held)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void sgMrcLowerThreshold( void ) {
+    uint32_t n = 0;
+
+    for ( uint32_t k=0; k<SG_MRC_MAX_KEYS; k++ ){
+        if ( mrcKeys[k].when != 0 ){
+            mrcScratch[n++] = sgMrcSample( mrcKeys[k].h );
+        }
+    }
+    qsort( mrcScratch, n, sizeof(uint32_t), sgMrcCompare );
+    uint32_t threshold = mrcScratch[n - n/8 - 1] + 1;
+    atomic_store_explicit( &mrcThreshold, threshold, memory_order_relaxed );
+    for ( uint32_t k=0; k<SG_MRC_MAX_KEYS; k++ ){
+        if ( mrcKeys[k].when != 0 && sgMrcSample(mrcKeys[k].h) >= threshold ){
+            sgMrcForget( k );
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgMrcRenumber
+// Description  : Timestamps ran out: give the tracked blocks the times
+//                1..n in their current order and rebuild the tree (lock held)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void sgMrcRenumber( void ) {
+    uint32_t t = 0;
+
+    for ( uint32_t i=1; i<mrcNow; i++ ){
+        if ( mrcOwner[i] != SG_MRC_NIL ){
+            mrcOwner[++t] = mrcOwner[i];
+            mrcKeys[mrcOwner[t]].when = t;
+        }
+    }
+    for ( uint32_t i=t+1; i<SG_MRC_WINDOW; i++ ){
+        mrcOwner[i] = SG_MRC_NIL;
+    }
+    memset( mrcTree, 0, sizeof(mrcTree) );
+    for ( uint32_t i=1; i<SG_MRC_WINDOW; i++ ){      // linear time build
+        mrcTree[i] += (i <= t);
+        uint32_t j = i + (i & -i);
+        if ( j < SG_MRC_WINDOW ){
+            mrcTree[j] += mrcTree[i];
+        }
+    }
+    mrcNow = t+1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgMrcTreeAdd / sgMrcTreeSum
+// Description  : Mark (unmark) a time, count the marked times up to one
+//
+// Inputs       : t - the time, from 1
+//                v - +1 to mark, -1 to unmark (add)
+// Outputs      : marked times in 1..t (sum)
+
+static void sgMrcTreeAdd( uint32_t t, int32_t v ) {
+    for ( ; t < SG_MRC_WINDOW; t += t & -t ){
+        mrcTree[t] += v;
+    }
+}
+
+static uint32_t sgMrcTreeSum( uint32_t t ) {
+    uint32_t sum = 0;
+    for ( ; t > 0; t -= t & -t ){
+        sum += mrcTree[t];
+    }
+    return( sum );
+}
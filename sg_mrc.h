@@ -0,0 +1,45 @@
+#ifndef SG_MRC_INCLUDED
+#define SG_MRC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_mrc.h
+//  Description    : This is the declaration of the online miss ratio curve
+//                   estimator run alongside the block cache.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Includes
+#include <stdint.h>
+
+//
+// Defines
+#define SG_MRC_MAX_KEYS 8192        // sampled blocks tracked at once
+#define SG_MRC_BINS 1024            // reuse distance histogram bins
+#define SG_MRC_RANGE 16             // the histogram covers this times the cache size
+#define SG_MRC_SAMPLE_BITS 24       // resolution of the sampling threshold
+
+//
+// Miss ratio curve functions
+
+int initSGMrc( uint32_t lines );
+    // Start estimating, sized around a cache of lines blocks
+
+void recordSGMrc( uint64_t h );
+    // Record a reference to the block with hash h (thread safe)
+
+double sgMrcHitRate( uint32_t lines );
+    // Estimated LRU hit rate (0 to 1) of a cache of lines blocks, -1 if unknown
+
+void logSGMrc( uint32_t lines );
+    // Log the estimated hit rates around a cache of lines blocks
+
+void closeSGMrc( void );
+    // Stop estimating
+
+int sgMrcUnitTest( void );
+    // Run the miss ratio curve unit tests
+
+#endif
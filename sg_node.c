@@ -0,0 +1,258 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_node.c
+//  Description    : This file contains the remote node table.  Nodes are
+//                   kept in an open addressed hash table (linear probing,
+//                   doubled when three quarters full) keyed by node ID, so
+//                   finding the sequence number for each block's node costs
+//                   the same however many nodes the blocks are spread over.
+//                   Alongside the sequence numbers it counts the requests,
+//                   bytes and response times of each node.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Include Files
+#include <stdlib.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_node.h>
+
+// Global data
+SG_Node_State * nodeTable;  // the slots, free ones have id SG_NODE_UNKNOWN
+size_t nodeTableSize;       // slots, a power of two
+size_t nodeCount;           // nodes in the table
+
+// Functional Prototypes
+static size_t sgNodeSlot( SG_Node_State *table, size_t size, SG_Node_ID nde );
+static int sgNodeGrow( void );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNodeFind
+// Description  : Look up a remote node
+//
+// Inputs       : nde - the node
+// Outputs      : the node's entry, NULL if the node is not known
+
+SG_Node_State * sgNodeFind( SG_Node_ID nde ) {
+    if ( nodeTableSize == 0 || nde == SG_NODE_UNKNOWN ){
+        return( NULL );
+    }
+    SG_Node_State * node = nodeTable + sgNodeSlot( nodeTable, nodeTableSize, nde );
+    return( (node->id == nde) ? node : NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNodeAdd
+// Description  : Look up a remote node, adding a zeroed entry if it is new
+//
+// Inputs       : nde - the node
+// Outputs      : the node's entry, NULL if failure
+
+SG_Node_State * sgNodeAdd( SG_Node_ID nde ) {
+    SG_Node_State * node = sgNodeFind( nde );
+
+    if ( node != NULL ){
+        return( node );
+    }
+    if ( nde == SG_NODE_UNKNOWN ){
+        logMessage( LOG_ERROR_LEVEL, "sgNodeAdd: bad node ID [%lu].", nde );
+        return( NULL );
+    }
+    if ( (nodeCount+1)*4 > nodeTableSize*3 && sgNodeGrow() ){
+        return( NULL );
+    }
+    node = nodeTable + sgNodeSlot( nodeTable, nodeTableSize, nde );
+    node->id = nde;
+    nodeCount += 1;
+    return( node );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNodeDone
+// Description  : Count the end of a request to a node, folding its response
+//                time into the node's average if it was answered; a
+//                request that failed gives back its sequence number, as
+//                the node never took it
+//
+// Inputs       : node - the node
+//                post - the request, as posted
+//                bytes - block bytes it moved
+// Outputs      : none
+
+void sgNodeDone( SG_Node_State *node, const SG_Post *post, size_t bytes ) {
+    if ( post->status ){
+        node->errors += 1;
+        node->resentSeq -= 1;
+        return;
+    }
+    if ( node->ops == 0 ){
+        node->latency = post->nsecs;
+    } else {
+        node->latency += ( (int64_t)post->nsecs - (int64_t)node->latency ) >> SG_NODE_EWMA_SHIFT;
+    }
+    node->ops += 1;
+    node->bytes += bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNodeLogStats
+// Description  : Log how much went to the nodes and which was slowest
+//
+// Inputs       : none
+// Outputs      : none
+
+void sgNodeLogStats( void ) {
+    uint64_t ops = 0, errors = 0, bytes = 0;
+    SG_Node_State * slowest = NULL;
+
+    for ( size_t i=0; i<nodeTableSize; i++ ){
+        SG_Node_State * node = nodeTable + i;
+        if ( node->id == SG_NODE_UNKNOWN ){
+            continue;
+        }
+        ops += node->ops;
+        errors += node->errors;
+        bytes += node->bytes;
+        if ( slowest == NULL || node->latency > slowest->latency ){
+            slowest = node;
+        }
+    }
+    if ( slowest == NULL ){
+        return;
+    }
+    logMessage( LOG_INFO_LEVEL, "[Nodes] %lu nodes, %lu requests (%lu failed), %lu block bytes; slowest node [%lu] "
+                "averages %lu ns a request.", nodeCount, ops, errors, bytes, slowest->id, slowest->latency );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNodeClear
+// Description  : Forget every node
+//
+// Inputs       : none
+// Outputs      : none
+
+void sgNodeClear( void ) {
+    free( nodeTable );
+    nodeTable = NULL;
+    nodeTableSize = nodeCount = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNodeUnitTest
+// Description  : Add enough nodes to grow the table several times, check
+//                every one is still found with its state, that unknown
+//                nodes are not, and that the averages follow the posts
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int sgNodeUnitTest( void ) {
+    SG_Post post = { 0 };
+    int i;
+
+    sgNodeClear();
+    srand( 311 );
+    for ( i=0; i<1000; i++ ){
+        SG_Node_State * node = sgNodeAdd( (SG_Node_ID)i*7919 + 1 );
+        if ( node == NULL || node->ops != 0 || sgNodeAdd((SG_Node_ID)i*7919 + 1) != node ){
+            logMessage( LOG_ERROR_LEVEL, "sgNodeUnitTest: adding node [%d] failed.", i );
+            return( -1 );
+        }
+        node->resentSeq = i;
+    }
+    for ( i=0; i<1000; i++ ){
+        SG_Node_State * node = sgNodeFind( (SG_Node_ID)i*7919 + 1 );
+        if ( node == NULL || node->resentSeq != i || sgNodeFind((SG_Node_ID)i*7919 + 2) != NULL ){
+            logMessage( LOG_ERROR_LEVEL, "sgNodeUnitTest: node [%d] lost after the table grew.", i );
+            return( -1 );
+        }
+    }
+    if ( nodeCount != 1000 || nodeCount*4 > nodeTableSize*3 || sgNodeFind(SG_NODE_UNKNOWN) != NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgNodeUnitTest: [%lu] nodes in [%lu] slots.", nodeCount, nodeTableSize );
+        return( -1 );
+    }
+
+    // A steady response time is converged on, failures are only counted
+    SG_Node_State * node = sgNodeFind( 1 );
+    for ( i=0; i<100; i++ ){
+        post.nsecs = ( i == 0 ) ? 100000 : 2000;
+        post.status = ( i == 50 ) ? -1 : 0;
+        sgNodeDone( node, &post, SG_BLOCK_SIZE );
+    }
+    if ( node->ops != 99 || node->errors != 1 || node->bytes != 99*SG_BLOCK_SIZE ||
+         node->latency < 1900 || node->latency > 2100 ){
+        logMessage( LOG_ERROR_LEVEL, "sgNodeUnitTest: node stats off, [%lu] ops [%lu] errors [%lu] ns.",
+                    node->ops, node->errors, node->latency );
+        return( -1 );
+    }
+    sgNodeClear();
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgNodeUnitTest: node table unit tests completed successfully." );
+    return( 0 );
+}
+
+//
+// Support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNodeSlot
+// Description  : Find the slot holding a node, or the free slot it would go
+//                in (there is always one)
+//
+// Inputs       : table - the slots
+//                size - how many, a power of two
+//                nde - the node
+// Outputs      : the slot
+
+static size_t sgNodeSlot( SG_Node_State *table, size_t size, SG_Node_ID nde ) {
+    size_t i = (size_t)( (nde * 0x9E3779B97F4A7C15ull) >> 32 ) & (size-1);
+
+    while ( table[i].id != nde && table[i].id != SG_NODE_UNKNOWN ){
+        i = (i+1) & (size-1);
+    }
+    return( i );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNodeGrow
+// Description  : Double the node table and rehash the nodes into it
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int sgNodeGrow( void ) {
+    size_t size = nodeTableSize ? nodeTableSize*2 : SG_NODE_TABLE_MIN;
+    SG_Node_State * table = (SG_Node_State *) malloc( size*sizeof(SG_Node_State) );
+
+    if ( table == NULL ){
+        logMessage( LOG_ERROR_LEVEL, "sgNodeGrow: out of memory for [%lu] nodes.", size );
+        return( -1 );
+    }
+    for ( size_t i=0; i<size; i++ ){
+        table[i] = (SG_Node_State) { .id = SG_NODE_UNKNOWN };
+    }
+    for ( size_t i=0; i<nodeTableSize; i++ ){
+        if ( nodeTable[i].id != SG_NODE_UNKNOWN ){
+            table[sgNodeSlot( table, size, nodeTable[i].id )] = nodeTable[i];
+        }
+    }
+    free( nodeTable );
+    nodeTable = table;
+    nodeTableSize = size;
+    return( 0 );
+}
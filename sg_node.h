@@ -0,0 +1,58 @@
+#ifndef SG_NODE_INCLUDED
+#define SG_NODE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_node.h
+//  Description    : This is the declaration of the remote node table, the
+//                   driver's per node sequence numbers and traffic stats.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Includes
+#include <stdint.h>
+#include <sg_defs.h>
+#include <sg_post.h>
+
+//
+// Defines
+#define SG_NODE_TABLE_MIN 16        // node table slots to start with
+#define SG_NODE_EWMA_SHIFT 3        // latency average weighs each response 1/8
+
+// Type definitions
+
+// What the driver knows about a remote node
+typedef struct {
+    SG_Node_ID id;          // the node, SG_NODE_UNKNOWN for a free slot
+    SG_SeqNum resentSeq;    // the receiver sequence number last used with it
+    SG_SeqNum taken;        // ... of them, those the envelope stand-in took itself
+    uint64_t ops;           // requests it answered
+    uint64_t errors;        // requests that failed
+    uint64_t bytes;         // block bytes moved to and from it
+    uint64_t latency;       // response time average (nanoseconds)
+} SG_Node_State;
+
+//
+// Node table functions
+
+SG_Node_State * sgNodeFind( SG_Node_ID nde );
+    // Look up a node, NULL if it is not known
+
+SG_Node_State * sgNodeAdd( SG_Node_ID nde );
+    // Look up a node, adding it if it is new, NULL if out of memory
+
+void sgNodeDone( SG_Node_State *node, const SG_Post *post, size_t bytes );
+    // Count the answer (or failure) of a request to a node
+
+void sgNodeLogStats( void );
+    // Log the traffic to the nodes
+
+void sgNodeClear( void );
+    // Forget every node and free the table
+
+int sgNodeUnitTest( void );
+    // Run the node table unit tests
+
+#endif
@@ -0,0 +1,900 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_packet.c
+//  Description    : This file contains the ScatterGather packet codec.  The
+//                   header fields are described once, in a table of where
+//                   each sits in the packet, where it goes in a packet info
+//                   and how it is checked; encoding and decoding both walk
+//                   the table, decoding checks each field as it unpacks it.
+//                   Both magic numbers are checked.  A packet of
+//                   SG_BASE_PACKET_SIZE may say it has a block: the block
+//                   was sent or received separately, as a piece between the
+//                   header and trailer (see sgPacketPieces).  An envelope
+//                   carries several operations as records laid out like
+//                   the packet header from the remote node on, so the same
+//                   table packs and checks them.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_packet.h>
+
+// The layout must add up to the packet sizes the service uses
+_Static_assert( SG_PKT_HEADER_SIZE + sizeof(uint32_t) == SG_BASE_PACKET_SIZE, "packet header layout" );
+_Static_assert( SG_BASE_PACKET_SIZE + SG_BLOCK_SIZE == SG_DATA_PACKET_SIZE, "packet block layout" );
+_Static_assert( sizeof(SG_System_OP) == sizeof(uint32_t), "packet operation size" );
+_Static_assert( SG_ENV_OPS_MAX <= UINT16_MAX, "envelope count size" );
+
+// Type definitions
+
+// A header field
+typedef struct {
+    size_t off;             // where it is in the packet
+    size_t len;             // its size (2, 4 or 8)
+    size_t info;            // where it goes in a SG_Packet_Info
+    uint64_t max;           // it must be below this, 0 if it must just not be 0
+    SG_Packet_Status bad;   // what a bad one is
+} SG_Packet_Field;
+
+// The header fields, in the order they are checked
+static const SG_Packet_Field sgPacketFields[] = {
+    { SG_PKT_LOC_OFF,  sizeof(SG_Node_ID),   offsetof(SG_Packet_Info, locNodeId), 0, SG_PACKT_LOCID_BAD },
+    { SG_PKT_REM_OFF,  sizeof(SG_Node_ID),   offsetof(SG_Packet_Info, remNodeId), 0, SG_PACKT_REMID_BAD },
+    { SG_PKT_BLK_OFF,  sizeof(SG_Block_ID),  offsetof(SG_Packet_Info, blockID),   0, SG_PACKT_BLKID_BAD },
+    { SG_PKT_OP_OFF,   sizeof(SG_System_OP), offsetof(SG_Packet_Info, operation), SG_MAXVAL_OP, SG_PACKT_OPERN_BAD },
+    { SG_PKT_SSEQ_OFF, sizeof(SG_SeqNum),    offsetof(SG_Packet_Info, sendSeqNo), 0, SG_PACKT_SNDSQ_BAD },
+    { SG_PKT_RSEQ_OFF, sizeof(SG_SeqNum),    offsetof(SG_Packet_Info, recvSeqNo), 0, SG_PACKT_RCVSQ_BAD },
+};
+#define SG_PACKET_FIELDS (sizeof(sgPacketFields)/sizeof(sgPacketFields[0]))
+
+// Functional Prototypes
+static inline uint64_t sgPacketLoad( const char *p, size_t len );
+static inline void sgPacketStore( char *p, size_t len, uint64_t v );
+static SG_Packet_Status sgPacketCheck( const SG_Packet_Field *f, uint64_t v );
+static SG_Packet_Status sgPacketPutFields( const SG_Packet_Info *info, char *at, size_t from );
+static SG_Packet_Status sgPacketGetFields( const char *at, SG_Packet_Info *info, size_t from );
+static bool sgEnvelopeRangeOk( const SG_Env_Op *op );
+static size_t sgEnvelopeOpSize( const SG_Env_Op *op );
+static double sgPacketRate( int which, char *packet, size_t plen );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketEncode
+// Description  : Check the fields of a packet and pack it, with the block
+//                if info has one
+//
+// Inputs       : info - the packet's fields (data NULL for no block)
+//                packet - where to pack it (SG_DATA_PACKET_SIZE with a block)
+//                plen - where to put its length
+// Outputs      : SG_PACKT_OK, or what was wrong with it
+
+SG_Packet_Status sgPacketEncode( const SG_Packet_Info *info, char *packet, size_t *plen ) {
+    SG_Packet_Status ret;
+
+    if ( packet == NULL || info == NULL || plen == NULL ){
+        return( SG_PACKT_PDATA_BAD );
+    }
+    if ( (ret = sgPacketPutFields(info, packet, SG_PKT_MAGIC_OFF)) != SG_PACKT_OK ){
+        return( ret );
+    }
+    sgPacketStore( packet + SG_PKT_MAGIC_OFF, sizeof(uint32_t), SG_MAGIC_VALUE );
+    packet[SG_PKT_FLAG_OFF] = ( info->data != NULL );
+    if ( info->data != NULL ){
+        memcpy( packet + SG_PKT_HEADER_SIZE, info->data, SG_BLOCK_SIZE );
+    }
+    *plen = ( info->data != NULL ) ? SG_DATA_PACKET_SIZE : SG_BASE_PACKET_SIZE;
+    sgPacketStore( packet + *plen - sizeof(uint32_t), sizeof(uint32_t), SG_MAGIC_VALUE );
+    return( SG_PACKT_OK );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketDecode
+// Description  : Check and unpack a packet in one pass over its fields.  A
+//                packet with a block is unpacked with data pointing at the
+//                block where it is in the packet.
+//
+// Inputs       : packet - the packet
+//                plen - its length
+//                info - where to unpack it
+// Outputs      : SG_PACKT_OK, or what was wrong with it
+
+SG_Packet_Status sgPacketDecode( char *packet, size_t plen, SG_Packet_Info *info ) {
+    SG_Packet_Status ret;
+
+    if ( packet == NULL || info == NULL || (plen != SG_BASE_PACKET_SIZE && plen != SG_DATA_PACKET_SIZE) ){
+        return( SG_PACKT_PDATA_BAD );
+    }
+    if ( sgPacketLoad(packet + SG_PKT_MAGIC_OFF, sizeof(uint32_t)) != SG_MAGIC_VALUE ||
+         sgPacketLoad(packet + plen - sizeof(uint32_t), sizeof(uint32_t)) != SG_MAGIC_VALUE ){
+        return( SG_PACKT_PDATA_BAD );
+    }
+    if ( (ret = sgPacketGetFields(packet, info, SG_PKT_MAGIC_OFF)) != SG_PACKT_OK ){
+        return( ret );
+    }
+
+    // A block is only where the length says, but may have come separately
+    uint8_t flag = packet[SG_PKT_FLAG_OFF];
+    if ( flag > 1 || (flag == 0 && plen == SG_DATA_PACKET_SIZE) ){
+        return( SG_PACKT_BLKLN_BAD );
+    }
+    info->data = ( plen == SG_DATA_PACKET_SIZE ) ? (SGDataBlock *)(packet + SG_PKT_HEADER_SIZE) : NULL;
+    return( SG_PACKT_OK );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketDecodeBatch
+// Description  : Unpack several packets, as the responses of a batch post,
+//                stopping at the first bad one
+//
+// Inputs       : packets - the packets
+//                plens - the length of each
+//                count - how many
+//                info - where to unpack each
+//                status - where to put what was wrong with the bad one
+//                         (SG_PACKT_OK if none was)
+// Outputs      : how many decoded before the first bad one (count if none)
+
+int sgPacketDecodeBatch( char **packets, const size_t *plens, int count, SG_Packet_Info *info,
+                         SG_Packet_Status *status ) {
+    int i;
+
+    *status = SG_PACKT_OK;
+    for ( i=0; i<count; i++ ){
+        if ( (*status = sgPacketDecode(packets[i], plens[i], info+i)) != SG_PACKT_OK ){
+            break;
+        }
+    }
+    return( i );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgEnvelopeEncode
+// Description  : Check and pack several operations into one envelope.  The
+//                operations all come from the same local node, which the
+//                envelope carries once; each carries its own fields, its
+//                block or range and (in a response) whether it failed.
+//
+// Inputs       : ops - the operations
+//                count - how many
+//                env - where to pack them
+//                room - its size
+//                elen - where to put the envelope's length
+// Outputs      : SG_PACKT_OK, or what was wrong with them
+
+SG_Packet_Status sgEnvelopeEncode( const SG_Env_Op *ops, int count, char *env, size_t room, size_t *elen ) {
+    SG_Packet_Status ret;
+    size_t at = SG_ENV_HEADER_SIZE;
+
+    if ( env == NULL || ops == NULL || elen == NULL || count < 1 || count > SG_ENV_OPS_MAX ){
+        return( SG_PACKT_PDATA_BAD );
+    }
+    if ( ops[0].info.locNodeId == 0 ){
+        return( SG_PACKT_LOCID_BAD );
+    }
+    for ( int i=0; i<count; i++ ){
+        const SG_Env_Op * op = ops + i;
+        if ( op->info.locNodeId != ops[0].info.locNodeId ){
+            return( SG_PACKT_LOCID_BAD );
+        }
+        if ( op->range != NULL && !sgEnvelopeRangeOk(op) ){
+            return( SG_PACKT_BLKLN_BAD );
+        }
+        if ( at + sgEnvelopeOpSize(op) + sizeof(uint32_t) > room ){
+            return( SG_PACKT_PDATA_BAD );
+        }
+        if ( (ret = sgPacketPutFields(&op->info, env+at, SG_PKT_REM_OFF)) != SG_PACKT_OK ){
+            return( ret );
+        }
+        env[at + SG_PKT_FLAG_OFF - SG_PKT_REM_OFF] = ( op->info.data != NULL ) |
+                ( op->failed ? SG_ENV_FAILED : 0 ) | ( (op->range != NULL) ? SG_ENV_RANGE : 0 );
+        if ( op->info.data != NULL ){
+            memcpy( env + at + SG_ENV_OP_SIZE, op->info.data, SG_BLOCK_SIZE );
+        } else if ( op->range != NULL ){
+            sgPacketStore( env + at + SG_ENV_OP_SIZE, sizeof(uint16_t), op->rangeOff );
+            sgPacketStore( env + at + SG_ENV_OP_SIZE + sizeof(uint16_t), sizeof(uint16_t), op->rangeLen );
+            memcpy( env + at + SG_ENV_OP_SIZE + SG_ENV_RANGE_SIZE, op->range, op->rangeLen );
+        }
+        at += sgEnvelopeOpSize( op );
+    }
+    sgPacketStore( env + SG_PKT_MAGIC_OFF, sizeof(uint32_t), SG_ENV_MAGIC_VALUE );
+    sgPacketStore( env + SG_ENV_LOC_OFF, sizeof(SG_Node_ID), ops[0].info.locNodeId );
+    sgPacketStore( env + SG_ENV_COUNT_OFF, sizeof(uint16_t), count );
+    sgPacketStore( env + at, sizeof(uint32_t), SG_ENV_MAGIC_VALUE );
+    *elen = at + sizeof(uint32_t);
+    return( SG_PACKT_OK );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgEnvelopeDecode
+// Description  : Check and unpack an envelope's operations, each block or
+//                range is left in place in the envelope
+//
+// Inputs       : env - the envelope
+//                elen - its length
+//                ops - where to unpack the operations
+//                max - room in ops
+//                count - where to put how many there were
+// Outputs      : SG_PACKT_OK, or what was wrong with it
+
+SG_Packet_Status sgEnvelopeDecode( char *env, size_t elen, SG_Env_Op *ops, int max, int *count ) {
+    SG_Packet_Status ret;
+    size_t at = SG_ENV_HEADER_SIZE;
+
+    if ( env == NULL || ops == NULL || count == NULL || elen < SG_ENV_HEADER_SIZE + sizeof(uint32_t) ||
+         sgPacketLoad(env + SG_PKT_MAGIC_OFF, sizeof(uint32_t)) != SG_ENV_MAGIC_VALUE ||
+         sgPacketLoad(env + elen - sizeof(uint32_t), sizeof(uint32_t)) != SG_ENV_MAGIC_VALUE ){
+        return( SG_PACKT_PDATA_BAD );
+    }
+    SG_Node_ID loc = sgPacketLoad( env + SG_ENV_LOC_OFF, sizeof(SG_Node_ID) );
+    int n = (int)sgPacketLoad( env + SG_ENV_COUNT_OFF, sizeof(uint16_t) );
+    if ( loc == 0 ){
+        return( SG_PACKT_LOCID_BAD );
+    }
+    if ( n < 1 || n > max ){
+        return( SG_PACKT_PDATA_BAD );
+    }
+    for ( int i=0; i<n; i++ ){
+        SG_Env_Op * op = ops + i;
+        if ( at + SG_ENV_OP_SIZE + sizeof(uint32_t) > elen ){
+            return( SG_PACKT_PDATA_BAD );
+        }
+        if ( (ret = sgPacketGetFields(env+at, &op->info, SG_PKT_REM_OFF)) != SG_PACKT_OK ){
+            return( ret );
+        }
+
+        // The block or range must fit before the trailer, a range must fit its block
+        uint8_t flag = env[at + SG_PKT_FLAG_OFF - SG_PKT_REM_OFF];
+        char * rest = env + at + SG_ENV_OP_SIZE;
+        op->info.locNodeId = loc;
+        op->info.data = ( flag & 1 ) ? (SGDataBlock *)rest : NULL;
+        op->failed = ( flag & SG_ENV_FAILED ) ? 1 : 0;
+        op->range = NULL;
+        if ( flag > (1 | SG_ENV_FAILED | SG_ENV_RANGE) || ((flag & 1) && (flag & SG_ENV_RANGE)) ){
+            return( SG_PACKT_BLKLN_BAD );
+        }
+        if ( flag & SG_ENV_RANGE ){
+            if ( at + SG_ENV_OP_SIZE + SG_ENV_RANGE_SIZE + sizeof(uint32_t) > elen ){
+                return( SG_PACKT_BLKLN_BAD );
+            }
+            op->rangeOff = sgPacketLoad( rest, sizeof(uint16_t) );
+            op->rangeLen = sgPacketLoad( rest + sizeof(uint16_t), sizeof(uint16_t) );
+            op->range = rest + SG_ENV_RANGE_SIZE;
+            if ( !sgEnvelopeRangeOk(op) ){
+                return( SG_PACKT_BLKLN_BAD );
+            }
+        }
+        if ( at + sgEnvelopeOpSize(op) + sizeof(uint32_t) > elen ){
+            return( SG_PACKT_BLKLN_BAD );
+        }
+        at += sgEnvelopeOpSize( op );
+    }
+    if ( at + sizeof(uint32_t) != elen ){
+        return( SG_PACKT_PDATA_BAD );
+    }
+    *count = n;
+    return( SG_PACKT_OK );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serialize_sg_packet
+// Description  : Serialize a ScatterGather packet (create packet)
+//
+// Inputs       : loc - the local node identifier
+//                rem - the remote node identifier
+//                blk - the block identifier
+//                op - the operation performed/to be performed on block
+//                sseq - the sender sequence number
+//                rseq - the receiver sequence number
+//                data - the data block (of size SG_BLOCK_SIZE) or NULL
+//                packet - the buffer to place the data
+//                plen - the packet length (int bytes)
+// Outputs      : 0 if successfully created, -1 if failure
+
+SG_Packet_Status serialize_sg_packet(SG_Node_ID loc, SG_Node_ID rem, SG_Block_ID blk,
+                                     SG_System_OP op, SG_SeqNum sseq, SG_SeqNum rseq, char *data,
+                                     char *packet, size_t *plen) {
+    SG_Packet_Info info = { loc, rem, blk, op, sseq, rseq, (SGDataBlock *)data };
+
+    return( sgPacketEncode(&info, packet, plen) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : deserialize_sg_packet
+// Description  : De-serialize a ScatterGather packet (unpack packet)
+//
+// Inputs       : loc - the local node identifier
+//                rem - the remote node identifier
+//                blk - the block identifier
+//                op - the operation performed/to be performed on block
+//                sseq - the sender sequence number
+//                rseq - the receiver sequence number
+//                data - the data block (of size SG_BLOCK_SIZE) or NULL
+//                packet - the buffer to place the data
+//                plen - the packet length (int bytes)
+// Outputs      : 0 if successfully created, -1 if failure
+
+SG_Packet_Status deserialize_sg_packet(SG_Node_ID *loc, SG_Node_ID *rem, SG_Block_ID *blk,
+                                       SG_System_OP *op, SG_SeqNum *sseq, SG_SeqNum *rseq, char *data,
+                                       char *packet, size_t plen) {
+    SG_Packet_Info info;
+    SG_Packet_Status ret;
+
+    if ( (ret = sgPacketDecode(packet, plen, &info)) != SG_PACKT_OK ){
+        return( ret );
+    }
+    if ( info.data != NULL && data == NULL ){
+        return( SG_PACKT_BLKDT_BAD );
+    }
+    if ( info.data != NULL ){
+        memcpy( data, info.data, SG_BLOCK_SIZE );
+    }
+    *loc = info.locNodeId;
+    *rem = info.remNodeId;
+    *blk = info.blockID;
+    *op = info.operation;
+    *sseq = info.sendSeqNo;
+    *rseq = info.recvSeqNo;
+    return( SG_PACKT_OK );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketFuzz
+// Description  : The fuzz target: decode arbitrary bytes as an envelope and
+//                as a packet (both ways), and check that whatever decodes
+//                packs back to the same bytes (but for the block indicator
+//                of a packet sent in pieces)
+//
+// Inputs       : data - the bytes
+//                size - how many
+// Outputs      : 0 if the codec behaved, -1 if not
+
+int sgPacketFuzz( const uint8_t *data, size_t size ) {
+    char packet[SG_DATA_PACKET_SIZE], again[SG_DATA_PACKET_SIZE], block[SG_BLOCK_SIZE];
+    SG_Node_ID loc, rem;
+    SG_Block_ID blk;
+    SG_System_OP op;
+    SG_SeqNum sseq, rseq;
+    SG_Packet_Info info;
+    SG_Env_Op ops[SG_ENV_OPS_MAX];
+    int count;
+    size_t len;
+
+    // As an envelope, whatever decodes packs back to the same bytes
+    if ( size <= SG_ENV_MAX_SIZE ){
+        char env[SG_ENV_MAX_SIZE], envAgain[SG_ENV_MAX_SIZE];
+        memcpy( env, data, size );
+        if ( sgEnvelopeDecode(env, size, ops, SG_ENV_OPS_MAX, &count) == SG_PACKT_OK &&
+             (sgEnvelopeEncode(ops, count, envAgain, sizeof(envAgain), &len) != SG_PACKT_OK ||
+              len != size || memcmp(env, envAgain, size)) ){
+            return( -1 );
+        }
+    }
+
+    // As a packet, both ways
+    size_t plen = ( size < sizeof(packet) ) ? size : sizeof(packet);
+    memcpy( packet, data, plen );
+    SG_Packet_Status ret = sgPacketDecode( packet, size, &info );
+    if ( ret != deserialize_sg_packet(&loc, &rem, &blk, &op, &sseq, &rseq, block, packet, size) ){
+        return( -1 );
+    }
+    if ( ret != SG_PACKT_OK ){
+        return( 0 );
+    }
+    if ( (info.data != NULL && memcmp(block, info.data, SG_BLOCK_SIZE)) || loc != info.locNodeId ||
+         rem != info.remNodeId || blk != info.blockID || op != info.operation || sseq != info.sendSeqNo ||
+         rseq != info.recvSeqNo ){
+        return( -1 );
+    }
+    if ( sgPacketEncode(&info, again, &len) != SG_PACKT_OK || len != size ){
+        return( -1 );
+    }
+    again[SG_PKT_FLAG_OFF] = packet[SG_PKT_FLAG_OFF];
+    return( memcmp(packet, again, size) ? -1 : 0 );
+}
+
+#ifdef SG_PACKET_FUZZER
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The fuzz driver (make fuzz): mutate good packets and
+//                envelopes (bits flipped anywhere, bytes overwritten, cut
+//                short, run on or spliced) and random bytes through
+//                sgPacketFuzz, saving an input that misbehaves to
+//                sg_packet_crash
+//
+// Inputs       : argc - argument count
+//                argv - [iterations [seed]]
+// Outputs      : 0 if the codec behaved, 1 if not
+
+int main( int argc, char *argv[] ) {
+    static char seeds[16][SG_ENV_MAX_SIZE], input[SG_ENV_MAX_SIZE], block[SG_BLOCK_SIZE];
+    size_t slens[16], len;
+    long iterations = ( argc > 1 ) ? atol( argv[1] ) : 2000000;
+    unsigned seed = ( argc > 2 ) ? (unsigned)atol( argv[2] ) : (unsigned)time( NULL );
+    SG_Env_Op ops[SG_ENV_OPS_MAX];
+    int nseeds = 0;
+
+    // Seeds: packets with and without a block, and envelopes of one to many
+    // operations with blocks, ranges and failures
+    srand( seed );
+    for ( int i=0; i<SG_BLOCK_SIZE; i++ ){
+        block[i] = (char)rand();
+    }
+    for ( int op=0; op<SG_MAXVAL_OP; op++ ){
+        serialize_sg_packet( 1, 2, 3, op, 4, 5, NULL, seeds[nseeds], slens+nseeds );
+        nseeds++;
+    }
+    serialize_sg_packet( 1, 2, 3, SG_UPDATE_BLOCK, 4, 5, block, seeds[nseeds], slens+nseeds );
+    nseeds++;
+    for ( int n=1; n<=SG_ENV_OPS_MAX; n*=4 ){
+        for ( int k=0; k<n; k++ ){
+            ops[k] = (SG_Env_Op) { { 9, 100+k, 200+k, SG_CREATE_BLOCK+k%3, 10+k, 20+k,
+                                     (k%3 == 1) ? (SGDataBlock *)block : NULL }, (k%5 == 4), NULL, 0, 0 };
+            if ( k%4 == 3 ){
+                ops[k].info.operation = SG_UPDATE_BLOCK;
+                ops[k].info.data = NULL;
+                ops[k].failed = 0;
+                ops[k].range = block;
+                ops[k].rangeOff = 17*k;
+                ops[k].rangeLen = 1+k;
+            }
+        }
+        sgEnvelopeEncode( ops, n, seeds[nseeds], SG_ENV_MAX_SIZE, slens+nseeds );
+        nseeds++;
+    }
+
+    // Mutate, check, repeat
+    for ( long i=0; i<iterations; i++ ){
+        int from = rand() % nseeds;
+        len = slens[from];
+        memcpy( input, seeds[from], len );
+        for ( int k=1+rand()%4; k>0; k-- ){
+            switch ( rand() % 6 ){
+            case 0: // Flip a bit
+            case 1:
+                input[rand() % len] ^= 1 << (rand()%8);
+                break;
+            case 2: // Overwrite a byte
+                input[rand() % len] = (char)rand();
+                break;
+            case 3: // Cut short
+                len -= ( len > 1 ) ? rand() % (len < 64 ? len : 64) : 0;
+                break;
+            case 4: // Run on
+                for ( int m=1+rand()%64; m>0 && len<sizeof(input); m-- ){
+                    input[len++] = (char)rand();
+                }
+                break;
+            default: // Splice another seed's tail in
+            {
+                int other = rand() % nseeds;
+                size_t at = rand() % len, off = rand() % slens[other];
+                size_t n = slens[other] - off;
+                n = ( at + n > sizeof(input) ) ? sizeof(input) - at : n;
+                memcpy( input+at, seeds[other]+off, n );
+                len = at + n;
+            }
+            }
+        }
+        if ( i%16 == 15 ){
+            len = rand() % (SG_DATA_PACKET_SIZE+1);
+            for ( size_t k=0; k<len; k++ ){
+                input[k] = (char)rand();
+            }
+        }
+        if ( sgPacketFuzz((uint8_t *)input, len) ){
+            FILE * crash = fopen( "sg_packet_crash", "wb" );
+            if ( crash != NULL ){
+                fwrite( input, 1, len, crash );
+                fclose( crash );
+            }
+            fprintf( stderr, "sg_packet_fuzz: input [%ld] of [%lu] bytes (seed %u) misbehaved, saved to sg_packet_crash\n",
+                     i, len, seed );
+            return( 1 );
+        }
+    }
+    printf( "sg_packet_fuzz: %ld inputs (seed %u) behaved\n", iterations, seed );
+    return( 0 );
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketBench
+// Description  : Measure how many packets a second one core encodes,
+//                decodes and decodes in batches, with and without blocks
+//
+// Inputs       : none
+// Outputs      : none
+
+void sgPacketBench( void ) {
+    const char * what[] = { "encode", "decode", "batch decode" };
+    char packet[SG_DATA_PACKET_SIZE], block[SG_BLOCK_SIZE];
+    size_t plen;
+
+    memset( block, 0x5a, sizeof(block) );
+    for ( int data=0; data<2; data++ ){
+        serialize_sg_packet( 1, 2, 3, SG_OBTAIN_BLOCK, 4, 5, data ? block : NULL, packet, &plen );
+        for ( int which=0; which<3; which++ ){
+            logMessage( LOG_OUTPUT_LEVEL, "[Packet] %s, %s block: %.2f million packets a second",
+                        what[which], data ? "with a" : "without a", sgPacketRate(which, packet, plen)/1e6 );
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketUnitTest
+// Description  : Round trip packets with and without blocks and an
+//                envelope with a ranged update, check each bad field,
+//                damaged magic and bad envelope is refused with its status,
+//                then fuzz the decoders with mutated and random packets and
+//                envelopes
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int sgPacketUnitTest( void ) {
+    char packet[SG_DATA_PACKET_SIZE], block[SG_BLOCK_SIZE], out[SG_BLOCK_SIZE];
+    SG_Packet_Info info, got;
+    size_t plen;
+    int i;
+
+    srand( 311 );
+    for ( i=0; i<SG_BLOCK_SIZE; i++ ){
+        block[i] = (char)rand();
+    }
+    for ( int data=0; data<2; data++ ){
+        info = (SG_Packet_Info) { 0x1122334455667788ull, 2, 0xfedcba9876543210ull, SG_UPDATE_BLOCK, 7, 65535,
+                                  data ? (SGDataBlock *)block : NULL };
+        if ( sgPacketEncode(&info, packet, &plen) != SG_PACKT_OK ||
+             plen != (data ? SG_DATA_PACKET_SIZE : SG_BASE_PACKET_SIZE) ||
+             sgPacketDecode(packet, plen, &got) != SG_PACKT_OK || got.locNodeId != info.locNodeId ||
+             got.remNodeId != info.remNodeId || got.blockID != info.blockID || got.operation != info.operation ||
+             got.sendSeqNo != info.sendSeqNo || got.recvSeqNo != info.recvSeqNo || (got.data != NULL) != data ||
+             (data && memcmp(got.data, block, SG_BLOCK_SIZE)) ){
+            logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: packet %s a block did not round trip.", data ? "with" : "without" );
+            return( -1 );
+        }
+        if ( data && (deserialize_sg_packet(&got.locNodeId, &got.remNodeId, &got.blockID, &got.operation,
+                         &got.sendSeqNo, &got.recvSeqNo, NULL, packet, plen) != SG_PACKT_BLKDT_BAD ||
+                      deserialize_sg_packet(&got.locNodeId, &got.remNodeId, &got.blockID, &got.operation,
+                         &got.sendSeqNo, &got.recvSeqNo, out, packet, plen) != SG_PACKT_OK ||
+                      memcmp(out, block, SG_BLOCK_SIZE)) ){
+            logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: deserialize_sg_packet mishandled the block." );
+            return( -1 );
+        }
+
+        // Each field zeroed (or the operation out of range) is refused
+        for ( size_t f=0; f<SG_PACKET_FIELDS; f++ ){
+            SG_Packet_Info bad = info;
+            sgPacketStore( (char *)&bad + sgPacketFields[f].info, sgPacketFields[f].len, sgPacketFields[f].max );
+            char saved[8];
+            memcpy( saved, packet + sgPacketFields[f].off, sgPacketFields[f].len );
+            sgPacketStore( packet + sgPacketFields[f].off, sgPacketFields[f].len, sgPacketFields[f].max );
+            if ( sgPacketEncode(&bad, out, &plen) != sgPacketFields[f].bad ||
+                 sgPacketDecode(packet, plen, &got) != sgPacketFields[f].bad ){
+                logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: bad field at [%lu] not refused.", sgPacketFields[f].off );
+                return( -1 );
+            }
+            memcpy( packet + sgPacketFields[f].off, saved, sgPacketFields[f].len );
+        }
+        packet[plen-1] ^= 1;
+        if ( sgPacketDecode(packet, plen, &got) != SG_PACKT_PDATA_BAD ||
+             sgPacketDecode(packet, plen-1, &got) != SG_PACKT_PDATA_BAD ){
+            logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: bad trailer or length not refused." );
+            return( -1 );
+        }
+        packet[plen-1] ^= 1;
+    }
+
+    // A batch stops at its first bad packet
+    char batch[4][SG_BASE_PACKET_SIZE], * packets[4];
+    size_t plens[4];
+    SG_Packet_Info infos[4];
+    SG_Packet_Status status;
+    for ( i=0; i<4; i++ ){
+        serialize_sg_packet( 1, 2+i, 3, SG_CREATE_BLOCK, 4, 5, NULL, batch[i], plens+i );
+        packets[i] = batch[i];
+    }
+    batch[2][SG_PKT_OP_OFF] = SG_MAXVAL_OP;
+    if ( sgPacketDecodeBatch(packets, plens, 4, infos, &status) != 2 || status != SG_PACKT_OPERN_BAD ||
+         infos[1].remNodeId != 3 || sgPacketDecodeBatch(packets, plens, 2, infos, &status) != 2 || status != SG_PACKT_OK ){
+        logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: batch decode did not stop at the bad packet." );
+        return( -1 );
+    }
+
+    // An envelope round trips its operations, blocks, ranges and failures
+    char env[SG_ENV_MAX_SIZE];
+    SG_Env_Op ops[4], eops[SG_ENV_OPS_MAX];
+    size_t elen;
+    int count;
+    for ( i=0; i<4; i++ ){
+        ops[i] = (SG_Env_Op) { { 9, 100+i, 200+i, SG_CREATE_BLOCK+i%3, 10+i, 20+i, (i%2) ? NULL : (SGDataBlock *)block },
+                               (i == 1), NULL, 0, 0 };
+    }
+    ops[3] = (SG_Env_Op) { { 9, 103, 203, SG_UPDATE_BLOCK, 13, 23, NULL }, 0, block+100, 100, 256 };
+    if ( sgEnvelopeEncode(ops, 4, env, sizeof(env), &elen) != SG_PACKT_OK ||
+         elen != SG_ENV_HEADER_SIZE + 4*SG_ENV_OP_SIZE + 2*SG_BLOCK_SIZE + SG_ENV_RANGE_SIZE + 256 + sizeof(uint32_t) ||
+         sgEnvelopeDecode(env, elen, eops, SG_ENV_OPS_MAX, &count) != SG_PACKT_OK || count != 4 ){
+        logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: envelope did not round trip." );
+        return( -1 );
+    }
+    for ( i=0; i<4; i++ ){
+        SG_Packet_Info * e = &eops[i].info, * o = &ops[i].info;
+        if ( e->locNodeId != 9 || e->remNodeId != o->remNodeId || e->blockID != o->blockID ||
+             e->operation != o->operation || e->sendSeqNo != o->sendSeqNo || e->recvSeqNo != o->recvSeqNo ||
+             eops[i].failed != ops[i].failed || (e->data == NULL) != (o->data == NULL) ||
+             (e->data != NULL && memcmp(e->data, block, SG_BLOCK_SIZE)) || (eops[i].range == NULL) != (i != 3) ||
+             (i == 3 && (eops[i].rangeOff != 100 || eops[i].rangeLen != 256 || memcmp(eops[i].range, block+100, 256))) ){
+            logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: envelope operation [%d] did not round trip.", i );
+            return( -1 );
+        }
+    }
+
+    // A short, overfull or mixed envelope, a bad range, or a bad field is refused
+    if ( sgEnvelopeDecode(env, elen-1, eops, SG_ENV_OPS_MAX, &count) != SG_PACKT_PDATA_BAD ||
+         sgEnvelopeDecode(env, elen, eops, 3, &count) != SG_PACKT_PDATA_BAD ||
+         sgEnvelopeEncode(ops, 4, env, SG_ENV_HEADER_SIZE + SG_ENV_OP_SIZE, &elen) != SG_PACKT_PDATA_BAD ){
+        logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: bad envelope not refused." );
+        return( -1 );
+    }
+    ops[1].info.locNodeId = 8;
+    ops[3].rangeOff = SG_BLOCK_SIZE - 255;
+    SG_Packet_Status mixed = sgEnvelopeEncode( ops, 2, env, sizeof(env), &elen );
+    SG_Packet_Status over = sgEnvelopeEncode( ops+3, 1, env, sizeof(env), &elen );
+    ops[3].rangeOff = 100;
+    ops[3].info.operation = SG_OBTAIN_BLOCK;
+    SG_Packet_Status obtain = sgEnvelopeEncode( ops+3, 1, env, sizeof(env), &elen );
+    if ( mixed != SG_PACKT_LOCID_BAD || over != SG_PACKT_BLKLN_BAD || obtain != SG_PACKT_BLKLN_BAD ){
+        logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: bad envelope operation not refused." );
+        return( -1 );
+    }
+    ops[1].info.locNodeId = 9;
+    ops[3].info.operation = SG_UPDATE_BLOCK;
+    sgEnvelopeEncode( ops, 4, env, sizeof(env), &elen );
+    memset( env + SG_ENV_HEADER_SIZE + 2*SG_ENV_OP_SIZE + SG_BLOCK_SIZE + SG_PKT_BLK_OFF - SG_PKT_REM_OFF, 0,
+            sizeof(SG_Block_ID) );
+    if ( sgEnvelopeDecode(env, elen, eops, SG_ENV_OPS_MAX, &count) != SG_PACKT_BLKID_BAD ){
+        logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: bad envelope field not refused." );
+        return( -1 );
+    }
+
+    // Fuzz: good packets and envelopes with a few bytes changed, and random bytes
+    for ( i=0; i<200000; i++ ){
+        if ( i%7 == 6 ){
+            int n = 1 + rand()%4;
+            for ( int k=0; k<n; k++ ){
+                ops[k].failed = rand()%2;
+                ops[k].info.data = ( k != 3 && rand()%2 ) ? (SGDataBlock *)block : NULL;
+            }
+            ops[3].rangeOff = rand() % SG_BLOCK_SIZE;
+            ops[3].rangeLen = 1 + rand() % (SG_BLOCK_SIZE - ops[3].rangeOff);
+            ops[3].range = block + ops[3].rangeOff;
+            sgEnvelopeEncode( ops, n, env, sizeof(env), &elen );
+            for ( int k=rand()%3; k>0; k-- ){
+                env[rand() % (elen < 200 ? elen : 200)] ^= 1 << (rand()%8);
+            }
+            if ( sgPacketFuzz((uint8_t *)env, elen) ){
+                logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: fuzz envelope [%d] of [%lu] bytes misbehaved.", i, elen );
+                return( -1 );
+            }
+            continue;
+        }
+        size_t len = ( i%2 ) ? SG_DATA_PACKET_SIZE : SG_BASE_PACKET_SIZE;
+        if ( i%3 == 2 ){
+            len = rand() % (SG_DATA_PACKET_SIZE+1);
+            for ( size_t k=0; k<len; k++ ){
+                packet[k] = (char)rand();
+            }
+        } else {
+            serialize_sg_packet( 1+rand()%3, 1+rand(), 1+rand(), rand()%SG_MAXVAL_OP, 1+rand()%9, 1+rand()%9,
+                                 (len == SG_DATA_PACKET_SIZE) ? block : NULL, packet, &len );
+            for ( int k=rand()%3; k>0; k-- ){
+                packet[rand() % SG_PKT_HEADER_SIZE] ^= 1 << (rand()%8);
+            }
+        }
+        if ( sgPacketFuzz((uint8_t *)packet, len) ){
+            logMessage( LOG_ERROR_LEVEL, "sgPacketUnitTest: fuzz input [%d] of [%lu] bytes misbehaved.", i, len );
+            return( -1 );
+        }
+    }
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgPacketUnitTest: packet codec unit tests completed successfully." );
+    return( 0 );
+}
+
+//
+// Support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketLoad / sgPacketStore
+// Description  : Read or write a 2, 4 or 8 byte field (native byte order,
+//                as the service packs them) at any alignment
+//
+// Inputs       : p - where the field is
+//                len - its size
+//                v - the value to write
+// Outputs      : the value read
+
+static inline uint64_t sgPacketLoad( const char *p, size_t len ) {
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+
+    switch ( len ){
+        case 2: memcpy( &v16, p, 2 ); return( v16 );
+        case 4: memcpy( &v32, p, 4 ); return( v32 );
+        default: memcpy( &v64, p, 8 ); return( v64 );
+    }
+}
+
+static inline void sgPacketStore( char *p, size_t len, uint64_t v ) {
+    uint16_t v16 = v;
+    uint32_t v32 = v;
+
+    switch ( len ){
+        case 2: memcpy( p, &v16, 2 ); break;
+        case 4: memcpy( p, &v32, 4 ); break;
+        default: memcpy( p, &v, 8 ); break;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketCheck
+// Description  : Check a header field's value
+//
+// Inputs       : f - the field
+//                v - its value
+// Outputs      : SG_PACKT_OK, or the field's bad status
+
+static SG_Packet_Status sgPacketCheck( const SG_Packet_Field *f, uint64_t v ) {
+    if ( f->max ? (v >= f->max) : (v == 0) ){
+        return( f->bad );
+    }
+    return( SG_PACKT_OK );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketPutFields / sgPacketGetFields
+// Description  : Check and pack, or unpack and check, the header fields
+//                from packet offset from on; at is where that offset is,
+//                so an envelope operation (the header from the remote node
+//                on) is handled the same as a whole packet
+//
+// Inputs       : info - the fields
+//                at - where packet offset from is
+//                from - the first packet offset to do
+// Outputs      : SG_PACKT_OK, or the first bad field's status
+
+static SG_Packet_Status sgPacketPutFields( const SG_Packet_Info *info, char *at, size_t from ) {
+    SG_Packet_Status ret;
+
+    for ( size_t i=0; i<SG_PACKET_FIELDS; i++ ){
+        const SG_Packet_Field * f = sgPacketFields + i;
+        if ( f->off < from ){
+            continue;
+        }
+        uint64_t v = sgPacketLoad( (const char *)info + f->info, f->len );
+        if ( (ret = sgPacketCheck(f, v)) != SG_PACKT_OK ){
+            return( ret );
+        }
+        sgPacketStore( at + f->off - from, f->len, v );
+    }
+    return( SG_PACKT_OK );
+}
+
+static SG_Packet_Status sgPacketGetFields( const char *at, SG_Packet_Info *info, size_t from ) {
+    SG_Packet_Status ret;
+
+    for ( size_t i=0; i<SG_PACKET_FIELDS; i++ ){
+        const SG_Packet_Field * f = sgPacketFields + i;
+        if ( f->off < from ){
+            continue;
+        }
+        uint64_t v = sgPacketLoad( at + f->off - from, f->len );
+        if ( (ret = sgPacketCheck(f, v)) != SG_PACKT_OK ){
+            return( ret );
+        }
+        sgPacketStore( (char *)info + f->info, f->len, v );
+    }
+    return( SG_PACKT_OK );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgEnvelopeRangeOk
+// Description  : Check a ranged update: an update without a block, of some
+//                bytes that fit in a block
+//
+// Inputs       : op - the operation
+// Outputs      : true if it is a good ranged update
+
+static bool sgEnvelopeRangeOk( const SG_Env_Op *op ) {
+    return( op->info.operation == SG_UPDATE_BLOCK && op->info.data == NULL && op->rangeLen > 0 &&
+            (size_t)op->rangeOff + op->rangeLen <= SG_BLOCK_SIZE );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgEnvelopeOpSize
+// Description  : How much of an envelope an operation takes
+//
+// Inputs       : op - the operation
+// Outputs      : its size in bytes
+
+static size_t sgEnvelopeOpSize( const SG_Env_Op *op ) {
+    if ( op->info.data != NULL ){
+        return( SG_ENV_OP_SIZE + SG_BLOCK_SIZE );
+    }
+    return( SG_ENV_OP_SIZE + (( op->range != NULL ) ? SG_ENV_RANGE_SIZE + op->rangeLen : 0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPacketRate
+// Description  : Run one codec operation over and over for a while of
+//                thread CPU time
+//
+// Inputs       : which - 0 encode, 1 decode, 2 batch decode
+//                packet - a good packet
+//                plen - its length
+// Outputs      : packets a second
+
+static double sgPacketRate( int which, char *packet, size_t plen ) {
+    char out[SG_DATA_PACKET_SIZE], * packets[32];
+    size_t plens[32], len;
+    SG_Packet_Info info[32];
+    SG_Packet_Status status;
+    struct timespec start, now;
+    double secs = 0;
+    long done = 0;
+
+    sgPacketDecode( packet, plen, info );
+    for ( int i=0; i<32; i++ ){
+        packets[i] = packet;
+        plens[i] = plen;
+    }
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &start );
+    while ( secs < 0.25 ){
+        for ( int i=0; i<1000; i++ ){
+            if ( which == 0 ){
+                sgPacketEncode( info, out, &len );
+                done += 1;
+            } else if ( which == 1 ){
+                sgPacketDecode( packet, plen, info );
+                done += 1;
+            } else {
+                done += sgPacketDecodeBatch( packets, plens, 32, info, &status );
+            }
+        }
+        clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now );
+        secs = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec)/1e9;
+    }
+    return( done / secs );
+}
@@ -0,0 +1,96 @@
+#ifndef SG_PACKET_INCLUDED
+#define SG_PACKET_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_packet.h
+//  Description    : This is the declaration of the ScatterGather packet
+//                   codec, the layout of a packet and of an envelope of
+//                   several operations, and the functions packing and
+//                   unpacking them.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Includes
+#include <stdint.h>
+#include <sg_defs.h>
+
+//
+// Defines
+
+// Packet layout: magic, header fields, block indicator, (block), magic
+#define SG_PKT_MAGIC_OFF 0
+#define SG_PKT_LOC_OFF (SG_PKT_MAGIC_OFF + sizeof(uint32_t))
+#define SG_PKT_REM_OFF (SG_PKT_LOC_OFF + sizeof(SG_Node_ID))
+#define SG_PKT_BLK_OFF (SG_PKT_REM_OFF + sizeof(SG_Node_ID))
+#define SG_PKT_OP_OFF (SG_PKT_BLK_OFF + sizeof(SG_Block_ID))
+#define SG_PKT_SSEQ_OFF (SG_PKT_OP_OFF + sizeof(SG_System_OP))
+#define SG_PKT_RSEQ_OFF (SG_PKT_SSEQ_OFF + sizeof(SG_SeqNum))
+#define SG_PKT_FLAG_OFF (SG_PKT_RSEQ_OFF + sizeof(SG_SeqNum))
+#define SG_PKT_HEADER_SIZE (SG_PKT_FLAG_OFF + 1)    // where the block (or trailer) starts
+
+// Envelope layout: magic, local node, count, then each operation as a packet
+// header from the remote node on (and its block, or its range), then magic
+#define SG_ENV_MAGIC_VALUE (uint32_t)0xfefd
+#define SG_ENV_LOC_OFF sizeof(uint32_t)
+#define SG_ENV_COUNT_OFF (SG_ENV_LOC_OFF + sizeof(SG_Node_ID))
+#define SG_ENV_HEADER_SIZE (SG_ENV_COUNT_OFF + sizeof(uint16_t))
+#define SG_ENV_OP_SIZE (SG_PKT_HEADER_SIZE - SG_PKT_REM_OFF)    // an operation, less its block
+#define SG_ENV_OPS_MAX 32           // most operations in an envelope
+#define SG_ENV_MAX_SIZE (SG_ENV_HEADER_SIZE + SG_ENV_OPS_MAX*(SG_ENV_OP_SIZE+SG_ENV_RANGE_SIZE+SG_BLOCK_SIZE) + sizeof(uint32_t))
+#define SG_ENV_FAILED 2             // operation flag: the service could not carry it out
+#define SG_ENV_RANGE 4              // operation flag: a ranged update, offset, length and bytes follow
+#define SG_ENV_RANGE_SIZE (2*sizeof(uint16_t))  // a range's offset and length
+
+// Type definitions
+
+// An operation in an envelope
+typedef struct {
+    SG_Packet_Info info;    // the operation, data its block (or NULL)
+    int failed;             // in a response, the service could not carry it out
+    const char * range;     // a ranged update's bytes, NULL if it is not one
+    uint16_t rangeOff;      // where in the block they go
+    uint16_t rangeLen;      // how many
+} SG_Env_Op;
+
+//
+// Codec functions
+
+SG_Packet_Status sgPacketEncode( const SG_Packet_Info *info, char *packet, size_t *plen );
+    // Check and pack a packet, with the block if info has one
+
+SG_Packet_Status sgPacketDecode( char *packet, size_t plen, SG_Packet_Info *info );
+    // Check and unpack a packet in one pass, the block is left in place
+
+int sgPacketDecodeBatch( char **packets, const size_t *plens, int count, SG_Packet_Info *info,
+        SG_Packet_Status *status );
+    // Unpack several packets, how many decoded before the first bad one
+
+SG_Packet_Status sgEnvelopeEncode( const SG_Env_Op *ops, int count, char *env, size_t room, size_t *elen );
+    // Check and pack several operations from one local node into an envelope
+
+SG_Packet_Status sgEnvelopeDecode( char *env, size_t elen, SG_Env_Op *ops, int max, int *count );
+    // Check and unpack an envelope's operations, blocks and ranges are left in place
+
+SG_Packet_Status serialize_sg_packet( SG_Node_ID loc, SG_Node_ID rem, SG_Block_ID blk,
+        SG_System_OP op, SG_SeqNum sseq, SG_SeqNum rseq, char *data,
+        char *packet, size_t *plen );
+    // Serialize a ScatterGather packet (create packet)
+
+SG_Packet_Status deserialize_sg_packet( SG_Node_ID *loc, SG_Node_ID *rem, SG_Block_ID *blk,
+        SG_System_OP *op, SG_SeqNum *sseq, SG_SeqNum *rseq, char *data,
+        char *packet, size_t plen );
+    // De-serialize a ScatterGather packet (unpack packet)
+
+int sgPacketFuzz( const uint8_t *data, size_t size );
+    // Decode arbitrary bytes, check what decodes re-encodes the same, 0 if so
+
+void sgPacketBench( void );
+    // Log the codec's packets per second on one core
+
+int sgPacketUnitTest( void );
+    // Run the packet codec unit tests
+
+#endif
@@ -0,0 +1,391 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_post.c
+//  Description    : This file contains the batched interface to the
+//                   ScatterGather service.  Callers build every request of
+//                   a batch before any is posted and read the responses
+//                   once all are in, so a transport is free to pipeline
+//                   them; the in-process service takes them one at a time.
+//                   Requests and responses come in pieces so the driver
+//                   never copies a block into or out of a packet itself;
+//                   the in-process service wants whole packets, so the
+//                   pieces are gathered and scattered here, the one place
+//                   a transport able to send pieces would do without.
+//                   With sgPostEnvelopes set a batch goes to the service as
+//                   one envelope of all its requests; sgServiceEnvelope is a
+//                   local stand-in for a service taking envelopes, carrying
+//                   each operation out with the in-process service.  The
+//                   in-process service has no ranged update, so the
+//                   stand-in merges one into the block itself, with an
+//                   obtain and an update.  A ranged update takes one
+//                   sequence number of each kind like any other request;
+//                   the in-process service sees one more of each for the
+//                   obtain, so every packet the service gets is moved past
+//                   the numbers the stand-in has taken for itself (kept per
+//                   remote node in the node table), and its response moved
+//                   back, both patched in place.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Include Files
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_service.h>
+#include <sg_packet.h>
+#include <sg_post.h>
+#include <sg_node.h>
+
+_Static_assert( SG_POST_BATCH_MAX <= SG_ENV_OPS_MAX, "a batch fits in an envelope" );
+
+// Global data
+bool sgPostEnvelopes;           // post batches as envelopes
+uint64_t sgPostRequests;        // requests posted
+uint64_t sgPostExchanges;       // service calls they took
+static SG_SeqNum postTakenLocal;        // local sequence numbers the stand-in took
+
+// Functional Prototypes
+static size_t sgPostCopy( const struct iovec *iov, int iovcnt, char *packet, size_t len, bool in );
+static int sgServiceOp( const SG_Env_Op *op, char *rpacket, SG_Packet_Info *rinfo );
+static int sgServiceShifted( const SG_Packet_Info *info, char *rpacket, size_t *rlen, SG_Packet_Info *rinfo );
+static void sgServiceShift( char *packet, int dir );
+static int sgPostEnvelope( SG_Post *posts, int count );
+static void sgPostFail( SG_Post *posts, int count, uint64_t nsecs );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgServicePostBatch
+// Description  : Post a batch of request packets to the service.  Every
+//                post is attempted; each says whether its response came
+//                and how long it took, and gets the response's length.
+//
+// Inputs       : posts - the requests, responses are returned in place
+//                count - how many
+// Outputs      : 0 if every post succeeded, -1 if any failed
+
+int sgServicePostBatch( SG_Post *posts, int count ) {
+    char packet[SG_DATA_PACKET_SIZE], rpacket[SG_DATA_PACKET_SIZE];
+    struct timespec start, end;
+    int failed = 0;
+
+    sgPostRequests += count;
+    for ( int i=0; i<count && sgPostEnvelopes; i++ ){
+        if ( count > 1 || posts[i].range != NULL ){
+            return( sgPostEnvelope(posts, count) );
+        }
+    }
+    sgPostExchanges += count;
+    for ( int i=0; i<count; i++ ){
+        SG_Post * p = posts + i;
+        if ( p->range != NULL ){
+            logMessage( LOG_ERROR_LEVEL, "sgServicePostBatch: ranged update [%d] needs envelopes.", i );
+            p->status = -1;
+            failed += 1;
+            continue;
+        }
+        size_t len = sgPostCopy( p->iov, p->iovcnt, packet, sizeof(packet), true );
+        p->rlen = sgPostCopy( p->riov, p->riovcnt, NULL, sizeof(rpacket), false );
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        p->status = sgServicePostOne( packet, &len, rpacket, &p->rlen ) ? -1 : 0;
+        clock_gettime( CLOCK_MONOTONIC, &end );
+        if ( p->status == 0 ){
+            sgPostCopy( p->riov, p->riovcnt, rpacket, p->rlen, false );
+        }
+        p->nsecs = (uint64_t)(end.tv_sec-start.tv_sec)*1000000000 + end.tv_nsec - start.tv_nsec;
+        if ( p->status ){
+            logMessage( LOG_ERROR_LEVEL, "sgServicePostBatch: post [%d] of [%d] failed.", i, count );
+            failed += 1;
+        }
+    }
+    return( failed ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgServicePostOne
+// Description  : Post one whole packet to the in-process service, its
+//                sequence numbers (and the response's) moved past those
+//                the envelope stand-in took for itself
+//
+// Inputs       : packet - the request
+//                len - its length
+//                rpacket - where to put the response
+//                rlen - room for it, its length is returned here
+// Outputs      : 0 if successful, -1 if failure
+
+int sgServicePostOne( char *packet, size_t *len, char *rpacket, size_t *rlen ) {
+    int ret;
+
+    if ( postTakenLocal == 0 || *len < SG_PKT_HEADER_SIZE ){
+        return( sgServicePost(packet, len, rpacket, rlen) );
+    }
+    sgServiceShift( packet, 1 );
+    ret = sgServicePost( packet, len, rpacket, rlen );
+    sgServiceShift( packet, -1 );
+    if ( ret == 0 && *rlen >= SG_PKT_HEADER_SIZE ){
+        sgServiceShift( rpacket, -1 );
+    }
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgServiceEnvelope
+// Description  : A local stand-in for a service taking envelopes: unpack
+//                the operations, carry each out with the in-process service
+//                in order, and pack the responses into a response envelope,
+//                marking the operations that failed
+//
+// Inputs       : env - the request envelope
+//                elen - its length
+//                renv - where to put the response envelope
+//                rlen - room in it, its length is returned here
+// Outputs      : 0 if the envelope was answered, -1 if failure
+
+int sgServiceEnvelope( char *env, size_t *elen, char *renv, size_t *rlen ) {
+    char rpackets[SG_ENV_OPS_MAX][SG_DATA_PACKET_SIZE];
+    SG_Env_Op ops[SG_ENV_OPS_MAX], rops[SG_ENV_OPS_MAX];
+    SG_Packet_Status ret;
+    int count;
+
+    if ( (ret = sgEnvelopeDecode(env, *elen, ops, SG_ENV_OPS_MAX, &count)) != SG_PACKT_OK ){
+        logMessage( LOG_ERROR_LEVEL, "sgServiceEnvelope: bad request envelope [%d].", ret );
+        return( -1 );
+    }
+    for ( int i=0; i<count; i++ ){
+        rops[i] = (SG_Env_Op) { .failed = 0 };
+        if ( sgServiceOp(ops+i, rpackets[i], &rops[i].info) ){
+            rops[i].info = ops[i].info;
+            rops[i].info.data = NULL;
+            rops[i].failed = 1;
+        }
+    }
+    if ( (ret = sgEnvelopeEncode(rops, count, renv, *rlen, rlen)) != SG_PACKT_OK ){
+        logMessage( LOG_ERROR_LEVEL, "sgServiceEnvelope: failed packing response envelope [%d].", ret );
+        return( -1 );
+    }
+    return( 0 );
+}
+
+//
+// Support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgServiceOp
+// Description  : Carry out one envelope operation with the in-process
+//                service.  A ranged update is an obtain of the block, the
+//                new bytes merged in, and an update of the whole block;
+//                the obtain takes sequence numbers of the stand-in's own.
+//
+// Inputs       : op - the operation
+//                rpacket - where to put the response packet
+//                rinfo - where to unpack the response (its block stays in
+//                        rpacket)
+// Outputs      : 0 if successful, -1 if failure
+
+static int sgServiceOp( const SG_Env_Op *op, char *rpacket, SG_Packet_Info *rinfo ) {
+    char block[SG_BLOCK_SIZE];
+    SG_Packet_Info info = op->info;
+    size_t rlen = SG_DATA_PACKET_SIZE;
+    SG_Node_State * node;
+
+    if ( op->range != NULL ){
+        info.operation = SG_OBTAIN_BLOCK;
+        if ( (node = sgNodeAdd(info.remNodeId)) == NULL ||
+             sgServiceShifted(&info, rpacket, &rlen, rinfo) || rinfo->data == NULL ){
+            logMessage( LOG_ERROR_LEVEL, "sgServiceOp: failed to obtain block [%lu] for a ranged update.", info.blockID );
+            return( -1 );
+        }
+        postTakenLocal += 1;
+        node->taken += 1;
+        memcpy( block, rinfo->data, SG_BLOCK_SIZE );
+        memcpy( block + op->rangeOff, op->range, op->rangeLen );
+        info = op->info;
+        info.data = (SGDataBlock *)block;
+        rlen = SG_DATA_PACKET_SIZE;
+    }
+    return( sgServiceShifted(&info, rpacket, &rlen, rinfo) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgServiceShifted
+// Description  : Post a request to the in-process service with its
+//                sequence numbers moved past those the stand-in took, and
+//                move the response's back
+//
+// Inputs       : info - the request
+//                rpacket - where to put the response packet
+//                rlen - room for it, its length is returned here
+//                rinfo - where to unpack the response (its block stays in
+//                        rpacket)
+// Outputs      : 0 if successful, -1 if failure
+
+static int sgServiceShifted( const SG_Packet_Info *info, char *rpacket, size_t *rlen, SG_Packet_Info *rinfo ) {
+    char packet[SG_DATA_PACKET_SIZE];
+    size_t len;
+
+    if ( sgPacketEncode(info, packet, &len) != SG_PACKT_OK || sgServicePostOne(packet, &len, rpacket, rlen) ||
+         sgPacketDecode(rpacket, *rlen, rinfo) != SG_PACKT_OK ){
+        return( -1 );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgServiceShift
+// Description  : Move a packet's sequence numbers past those the stand-in
+//                took (dir 1), or back (dir -1), in place.  The receiver
+//                number moves by what was taken of the packet's remote
+//                node, unless it is unknown.
+//
+// Inputs       : packet - the packet, at least a header long
+//                dir - 1 to move them on, -1 to move them back
+// Outputs      : none
+
+static void sgServiceShift( char *packet, int dir ) {
+    SG_Node_State * node;
+    SG_Node_ID nde;
+    SG_SeqNum seq;
+
+    memcpy( &seq, packet + SG_PKT_SSEQ_OFF, sizeof(seq) );
+    seq += dir*postTakenLocal;
+    memcpy( packet + SG_PKT_SSEQ_OFF, &seq, sizeof(seq) );
+    memcpy( &seq, packet + SG_PKT_RSEQ_OFF, sizeof(seq) );
+    memcpy( &nde, packet + SG_PKT_REM_OFF, sizeof(nde) );
+    if ( seq != SG_SEQNO_UNKNOWN && (node = sgNodeFind(nde)) != NULL && node->taken ){
+        seq += dir*node->taken;
+        memcpy( packet + SG_PKT_RSEQ_OFF, &seq, sizeof(seq) );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgServiceReset
+// Description  : Forget the local sequence numbers the stand-in took, the
+//                node table forgets the remote ones
+//
+// Inputs       : none
+// Outputs      : none
+
+void sgServiceReset( void ) {
+    postTakenLocal = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPostEnvelope
+// Description  : Post a batch as one envelope exchange: the requests are
+//                gathered and packed together, and each response is
+//                unpacked and scattered back into its post.  Every post
+//                gets the exchange's time.
+//
+// Inputs       : posts - the requests, responses are returned in place
+//                count - how many
+// Outputs      : 0 if every post succeeded, -1 if any failed
+
+static int sgPostEnvelope( SG_Post *posts, int count ) {
+    char packets[SG_ENV_OPS_MAX][SG_DATA_PACKET_SIZE], env[SG_ENV_MAX_SIZE], renv[SG_ENV_MAX_SIZE];
+    SG_Env_Op ops[SG_ENV_OPS_MAX];
+    size_t elen, rlen = sizeof(renv);
+    struct timespec start, end;
+    SG_Packet_Status ret;
+    int n, bad = 0;
+
+    for ( int i=0; i<count; i++ ){
+        size_t len = sgPostCopy( posts[i].iov, posts[i].iovcnt, packets[i], SG_DATA_PACKET_SIZE, true );
+        ops[i] = (SG_Env_Op) { .range = posts[i].range, .rangeOff = posts[i].rangeOff, .rangeLen = posts[i].rangeLen };
+        if ( (ret = sgPacketDecode(packets[i], len, &ops[i].info)) != SG_PACKT_OK ){
+            logMessage( LOG_ERROR_LEVEL, "sgPostEnvelope: bad request [%d] of [%d], status [%d].", i, count, ret );
+            sgPostFail( posts, count, 0 );
+            return( -1 );
+        }
+    }
+    if ( (ret = sgEnvelopeEncode(ops, count, env, sizeof(env), &elen)) != SG_PACKT_OK ){
+        logMessage( LOG_ERROR_LEVEL, "sgPostEnvelope: failed packing envelope [%d].", ret );
+        sgPostFail( posts, count, 0 );
+        return( -1 );
+    }
+
+    sgPostExchanges += 1;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    int failure = sgServiceEnvelope( env, &elen, renv, &rlen );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    uint64_t nsecs = (uint64_t)(end.tv_sec-start.tv_sec)*1000000000 + end.tv_nsec - start.tv_nsec;
+    if ( failure || (ret = sgEnvelopeDecode(renv, rlen, ops, SG_ENV_OPS_MAX, &n)) != SG_PACKT_OK || n != count ){
+        logMessage( LOG_ERROR_LEVEL, "sgPostEnvelope: envelope of [%d] requests failed.", count );
+        sgPostFail( posts, count, nsecs );
+        return( -1 );
+    }
+
+    for ( int i=0; i<count; i++ ){
+        SG_Post * p = posts + i;
+        size_t len;
+        p->nsecs = nsecs;
+        p->status = ( ops[i].failed || sgPacketEncode(&ops[i].info, packets[i], &len) != SG_PACKT_OK ) ? -1 : 0;
+        if ( p->status ){
+            logMessage( LOG_ERROR_LEVEL, "sgPostEnvelope: request [%d] of [%d] failed.", i, count );
+            bad += 1;
+            continue;
+        }
+        sgPostCopy( p->riov, p->riovcnt, packets[i], len, false );
+        p->rlen = len;
+    }
+    return( bad ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPostFail
+// Description  : Mark every post of a batch failed
+//
+// Inputs       : posts - the batch
+//                count - how many
+//                nsecs - how long the attempt took
+// Outputs      : none
+
+static void sgPostFail( SG_Post *posts, int count, uint64_t nsecs ) {
+    for ( int i=0; i<count; i++ ){
+        posts[i].status = -1;
+        posts[i].nsecs = nsecs;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPostCopy
+// Description  : Gather pieces into a packet, or scatter a packet into
+//                pieces, as much as both have room for
+//
+// Inputs       : iov - the pieces
+//                iovcnt - how many
+//                packet - the packet, NULL only to add up the pieces
+//                len - its length (room in it when gathering)
+//                in - gather the pieces into the packet
+// Outputs      : bytes copied
+
+static size_t sgPostCopy( const struct iovec *iov, int iovcnt, char *packet, size_t len, bool in ) {
+    size_t at = 0;
+
+    for ( int i=0; i<iovcnt && at<len; i++ ){
+        size_t n = ( iov[i].iov_len < len-at ) ? iov[i].iov_len : len-at;
+        if ( packet != NULL && in ){
+            memcpy( packet+at, iov[i].iov_base, n );
+        } else if ( packet != NULL ){
+            memcpy( iov[i].iov_base, packet+at, n );
+        }
+        at += n;
+    }
+    return( at );
+}
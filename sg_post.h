@@ -0,0 +1,65 @@
+#ifndef SG_POST_INCLUDED
+#define SG_POST_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_post.h
+//  Description    : This is the declaration of the batched interface to the
+//                   ScatterGather service, posting several packets a call,
+//                   each sent from and received into pieces (scatter/gather),
+//                   either one exchange each or together in an envelope.
+//                   Only envelopes carry ranged updates, which send just the
+//                   changed bytes of a block.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include <sg_defs.h>
+
+//
+// Defines
+#define SG_POST_BATCH_MAX 32        // most packets the driver puts in one batch
+#define SG_POST_IOV_MAX 3           // pieces of a packet: header, block, trailer
+
+// Type definitions
+
+// One request of a batch and its response
+typedef struct {
+    struct iovec iov[SG_POST_IOV_MAX];  // the request, its pieces in order
+    int iovcnt;
+    struct iovec riov[SG_POST_IOV_MAX]; // where the pieces of the response go
+    int riovcnt;
+    size_t rlen;        // length of the response
+    int status;         // 0 once the response is in, -1 if the post failed
+    uint64_t nsecs;     // how long the response took
+    const char * range; // an update of part of a block: the new bytes (NULL for none)
+    uint16_t rangeOff;  // where in the block they go
+    uint16_t rangeLen;  // how many
+} SG_Post;
+
+// Global data
+extern bool sgPostEnvelopes;        // post batches as envelopes
+extern uint64_t sgPostRequests;     // requests posted
+extern uint64_t sgPostExchanges;    // service calls they took
+
+//
+// Batch functions
+
+int sgServicePostBatch( SG_Post *posts, int count );
+    // Post a batch of packets, the responses come back in each post
+
+int sgServicePostOne( char *packet, size_t *len, char *rpacket, size_t *rlen );
+    // Post one whole packet, as sgServicePost but through the batched interface
+
+int sgServiceEnvelope( char *env, size_t *elen, char *renv, size_t *rlen );
+    // The local stand-in service for envelopes, 0 if it was answered
+
+void sgServiceReset( void );
+    // Forget the sequence numbers the stand-in took (at shutdown)
+
+#endif
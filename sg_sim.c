@@ -20,17 +20,36 @@
 // Project Includes 
 #include <sg_defs.h>
 #include <sg_driver.h>
+#include <sg_cache.h>
+#include <sg_arena.h>
+#include <sg_mrc.h>
+#include <sg_lz.h>
+#include <sg_victim.h>
+#include <sg_node.h>
+#include <sg_packet.h>
+#include <sg_post.h>
 
 // Defines
-#define SG_ARGUMENTS "hvul:"
+#define SG_ARGUMENTS "hvuwaqepbl:c:m:d:z:r:"
 #define USAGE \
-	"USAGE: sg_sim [-h] [-v] [-l <logfile>] <workload>\n" \
+	"USAGE: sg_sim [-h] [-v] [-l <logfile>] [-c <policy>] [-m <kbytes>] [-z <kbytes>] [-r <blocks>] [-d <file>] [-w] [-a] [-q] [-p] [-e] [-b] <workload>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -u - perform the unit tests\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
+	"    -c - block cache policy: lru (default), clock, 2q or arc\n" \
+	"    -m - block cache size in kilobytes (default 128)\n" \
+	"    -z - keep evicted blocks compressed in <kbytes> of memory\n" \
+	"    -r - read up to <blocks> ahead of in-order readers (default 32, 0 for none)\n" \
+	"    -d - keep a second tier block cache in <file> (kept across runs)\n" \
+	"    -w - write-back block cache (updates sent on evict/close)\n" \
+	"    -a - cache admission control (frequency filter, streams bypass)\n" \
+	"    -q - run reads and writes through the async (queued) interface\n" \
+	"    -p - read and write at the workload offsets (sgpread/sgpwrite), no seeks\n" \
+	"    -e - post each batch of requests as one envelope, partial updates as ranges\n" \
+	"    -b - benchmark the packet codec and exit\n" \
 	"and\n" \
 	"    workload - is the name of the workload file.  Not that this\n" \
 	"               file is not needed when running the unit tests.\n" \
@@ -39,6 +58,8 @@
 //
 // Global Data
 int verbose;
+int async_ops; // Reads and writes go through the async interface
+int positional_ops; // Reads and writes give their offset instead of seeking
 unsigned long SGServiceLevel; // Service log level
 unsigned long SGDriverLevel; // Controller log level
 unsigned long SGSimulatorLevel; // Simulation log level
@@ -48,6 +69,7 @@ unsigned long SGSimulatorLevel; // Simulation log level
 
 int simulateScatterGather( char *wload ); // ScatterGather simulation
 int sg_unit_test( void ); // The program unit tests
+int simulateAsyncOp( int write, SgFHandle fh, char *buf, size_t len ); // Run an operation asynchronously
 extern int packetUnitTest( void ); // External function (packet processing)
 
 //
@@ -65,7 +87,7 @@ extern int packetUnitTest( void ); // External function (packet processing)
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0, unit_tests = 0;
+	int ch, i, verbose = 0, log_initialized = 0, unit_tests = 0, bench = 0;
 	
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, SG_ARGUMENTS)) != -1) {
@@ -88,6 +110,71 @@ int main( int argc, char *argv[] ) {
 			log_initialized = 1;
 			break;
 
+		case 'w': // Write-back cache Flag
+			sgCacheWriteBack = 1;
+			break;
+
+		case 'a': // Cache admission control Flag
+			sgCacheAdmission = 1;
+			break;
+
+		case 'q': // Async interface Flag
+			async_ops = 1;
+			break;
+
+		case 'p': // Positional reads and writes Flag
+			positional_ops = 1;
+			break;
+
+		case 'e': // Envelope batches Flag
+			sgPostEnvelopes = 1;
+			break;
+
+		case 'b': // Packet codec benchmark Flag
+			bench = 1;
+			break;
+
+		case 'm': // Set the cache size
+			if ( atol(optarg) <= 0 ) {
+				fprintf( stderr, "Bad cache size (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			sgCacheBytes = (size_t)atol(optarg) * 1024;
+			break;
+
+		case 'z': // Set the compressed victim tier size
+			if ( atol(optarg) <= 0 ) {
+				fprintf( stderr, "Bad victim tier size (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			sgCacheVictimBytes = (size_t)atol(optarg) * 1024;
+			break;
+
+		case 'r': // Set the read-ahead limit
+			if ( atol(optarg) < 0 ) {
+				fprintf( stderr, "Bad read-ahead limit (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			sgReadAheadMax = (int)atol(optarg);
+			break;
+
+		case 'd': // Set the second tier cache file
+			sgCacheL2Path = optarg;
+			break;
+
+		case 'c': // Set the cache replacement policy
+			for ( i=0; i<SG_CACHE_MAXVAL_POLICY; i++ ) {
+				if ( strcmp(optarg, sg_cache_policy_strings[i]) == 0 ) {
+					break;
+				}
+			}
+			if ( i == SG_CACHE_MAXVAL_POLICY ) {
+				fprintf( stderr, "Unknown cache policy (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			sgCachePolicy = (SG_Cache_Policy)i;
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -107,7 +194,12 @@ int main( int argc, char *argv[] ) {
 	}
 
 	// If exgtracting file from data
-	if (unit_tests) {
+	if (bench) {
+
+		// Time the packet codec
+		sgPacketBench();
+
+	} else if (unit_tests) {
 
 		// Run the unit tests
 		enableLogLevels( LOG_INFO_LEVEL );
@@ -229,7 +321,7 @@ int simulateScatterGather( char *wload ) {
 				}
 
 				/* If the position within the file is not a read location, seek */
-				if ( fdata->pos != operation.pos ) {
+				if ( (async_ops || !positional_ops) && fdata->pos != operation.pos ) {
 					if ( sgseek(fdata->fhandle, operation.pos) != operation.pos ) {
 						logMessage( LOG_ERROR_LEVEL, "SG error seek failed [%s, pos=%d], aborting", 
 							operation.objname, operation.pos );
@@ -240,7 +332,9 @@ int simulateScatterGather( char *wload ) {
 				}
 
 				/* Now do the read from the file */
-				if ( sgread(fdata->fhandle, buf, operation.size) != operation.size ) {
+				if ( (async_ops ? simulateAsyncOp(0, fdata->fhandle, buf, operation.size) :
+						positional_ops ? sgpread(fdata->fhandle, buf, operation.size, operation.pos) :
+						sgread(fdata->fhandle, buf, operation.size)) != operation.size ) {
 					logMessage( LOG_ERROR_LEVEL, "SG error read failed [%s, pos=%d, size=%d], aborting", 
 						operation.objname, operation.pos, operation.size );
 					return( -1 );
@@ -271,7 +365,7 @@ int simulateScatterGather( char *wload ) {
 				}
 
 				/* If the position within the file is not a read location, seek */
-				if ( fdata->pos != operation.pos ) {
+				if ( (async_ops || !positional_ops) && fdata->pos != operation.pos ) {
 					if ( sgseek(fdata->fhandle, operation.pos) != operation.pos ) {
 						logMessage( LOG_ERROR_LEVEL, "SG error seek failed [%s, pos=%d], aborting", 
 							operation.objname, operation.pos );
@@ -282,7 +376,9 @@ int simulateScatterGather( char *wload ) {
 				}
 
 				/* Now do the write to the file */
-				if ( sgwrite(fdata->fhandle, operation.data, operation.size) != operation.size ) {
+				if ( (async_ops ? simulateAsyncOp(1, fdata->fhandle, operation.data, operation.size) :
+						positional_ops ? sgpwrite(fdata->fhandle, operation.data, operation.size, operation.pos) :
+						sgwrite(fdata->fhandle, operation.data, operation.size)) != operation.size ) {
 					logMessage( LOG_ERROR_LEVEL, "SG error write failed [%s, pos=%d, size=%d], aborting", 
 						operation.objname, operation.pos, operation.size );
 					return( -1 );
@@ -340,6 +436,38 @@ int simulateScatterGather( char *wload ) {
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulateAsyncOp
+// Description  : Submit a read or write to the driver's async interface and
+//                wait for its completion
+//
+// Inputs       : write - a write rather than a read
+//                fh - the file handle
+//                buf - the data, or where to put it
+//                len - the length of the operation
+// Outputs      : the operation's result, -1 if failure
+
+int simulateAsyncOp( int write, SgFHandle fh, char *buf, size_t len ) {
+
+	/* Local variables */
+	static uint64_t cookie = 0;
+	SgCompletion cqe;
+	int ret;
+
+	cookie ++;
+	ret = write ? sgwrite_async( fh, buf, len, cookie ) : sgread_async( fh, buf, len, cookie );
+	if ( ret ) {
+		logMessage( LOG_ERROR_LEVEL, "SG async submission failed [fh=%d, size=%lu]", fh, len );
+		return( -1 );
+	}
+	if ( sgwait(&cqe, 1, 1) != 1 || cqe.cookie != cookie ) {
+		logMessage( LOG_ERROR_LEVEL, "SG async completion lost [cookie=%lu]", cookie );
+		return( -1 );
+	}
+	return( cqe.result );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : sg_unit_test
@@ -358,6 +486,42 @@ int sg_unit_test( void ) {
         logMessage( LOG_ERROR_LEVEL, "ScatterGather: unit tests failed." );
         return( -1 );
     }
+    if ( sgPacketUnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: packet codec unit tests failed." );
+        return( -1 );
+    }
+    if ( sgArenaUnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: arena unit tests failed." );
+        return( -1 );
+    }
+    if ( sgMrcUnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: miss ratio curve unit tests failed." );
+        return( -1 );
+    }
+    if ( sgL2UnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: second tier unit tests failed." );
+        return( -1 );
+    }
+    if ( sgLzUnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: compressor unit tests failed." );
+        return( -1 );
+    }
+    if ( sgVictimUnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: victim tier unit tests failed." );
+        return( -1 );
+    }
+    if ( sgNodeUnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: node table unit tests failed." );
+        return( -1 );
+    }
+    if ( sgCacheUnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: cache unit tests failed." );
+        return( -1 );
+    }
+    if ( sgDriverUnitTest() ) {
+        logMessage( LOG_ERROR_LEVEL, "ScatterGather: driver unit tests failed." );
+        return( -1 );
+    }
 
     // Return successfully
     logMessage( LOG_INFO_LEVEL, "ScatterGather: exiting unit tests." );
@@ -0,0 +1,462 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_victim.c
+//  Description    : This file contains the compressed victim tier.  Clean
+//                   blocks evicted from the cache are compressed into a
+//                   ring of memory in eviction order; the oldest are pushed
+//                   out (to the second tier, if there is one) to make room.
+//                   A hit takes the block out again, the cache holds it
+//                   until it is evicted once more.  Blocks that compress
+//                   poorly are not kept.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_victim.h>
+#include <sg_arena.h>
+#include <sg_lz.h>
+#include <sg_l2.h>
+
+// Defines
+#define SG_VICTIM_NIL (-1)
+
+typedef struct {    //a block in the ring, node 0 and block 0 once it is gone
+    SG_Node_ID node_ID;
+    SG_Block_ID blk_ID;
+    uint32_t off;           // where its compressed bytes start in the ring
+    uint32_t len;           // bytes it takes (rounded to the granule)
+    int32_t hnext;          // hash chain
+} SG_victim_entry;
+
+bool vtOpen;
+pthread_mutex_t vtLock = PTHREAD_MUTEX_INITIALIZER;
+SG_Arena vtArena;           // backs the ring and its index
+char * vtRing;
+uint32_t vtRingBytes;
+uint32_t vtHead;            // where the next block goes in the ring
+SG_victim_entry * vtEntries;    // in ring order, oldest at vtTail
+uint32_t vtEntryLimit;
+uint32_t vtTail;
+uint32_t vtQueued;          // entries from vtTail on, including ones gone
+int32_t * vtBuckets;
+uint32_t vtBucketMask;
+uint32_t vtLive, vtPeak;    // blocks held, most ever held
+unsigned long vtQueries, vtHits, vtKept, vtRejected, vtSpills;
+unsigned long vtKeptBytes;  // ring bytes taken by the blocks kept
+uint64_t vtCompressNs, vtDecompressNs;
+
+// Functional Prototypes
+static uint32_t sgVictimBucket( SG_Node_ID nde, SG_Block_ID blk );
+static int32_t sgVictimFind( SG_Node_ID nde, SG_Block_ID blk );
+static void sgVictimUnhash( int32_t i );
+static void sgVictimMakeRoom( uint32_t len );
+static void sgVictimPop( void );
+static uint64_t sgVictimNow( void );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openSGVictimCache
+// Description  : Set up the ring and its index, with room in the index for
+//                SG_VICTIM_MAX_RATIO times as many blocks as the ring would
+//                hold uncompressed
+//
+// Inputs       : bytes - memory for compressed blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int openSGVictimCache( size_t bytes ) {
+    if ( vtOpen || bytes < SG_BLOCK_SIZE || bytes > UINT32_MAX ){
+        logMessage( LOG_ERROR_LEVEL, "openSGVictimCache: tier already open or invalid size [%lu].", bytes );
+        return( -1 );
+    }
+    vtRingBytes = bytes - bytes%SG_VICTIM_GRANULE;
+    vtEntryLimit = (vtRingBytes/SG_BLOCK_SIZE) * SG_VICTIM_MAX_RATIO;
+    uint32_t buckets = 1;
+    while ( buckets < vtEntryLimit ){
+        buckets <<= 1;
+    }
+    vtBucketMask = buckets-1;
+
+    size_t arenaBytes = sgArenaSpan( vtRingBytes, SG_VICTIM_GRANULE ) +
+                        sgArenaSpan( sizeof(SG_victim_entry)*vtEntryLimit, 64 ) +
+                        sgArenaSpan( sizeof(int32_t)*buckets, 64 );
+    if ( initSGArena(&vtArena, arenaBytes, vtRingBytes >= SG_ARENA_HUGE_PAGE_SIZE) ){
+        logMessage( LOG_ERROR_LEVEL, "openSGVictimCache: memory allocation failed." );
+        return( -1 );
+    }
+    vtRing = allocSGArena( &vtArena, vtRingBytes, SG_VICTIM_GRANULE );
+    vtEntries = allocSGArena( &vtArena, sizeof(SG_victim_entry)*vtEntryLimit, 64 );
+    vtBuckets = allocSGArena( &vtArena, sizeof(int32_t)*buckets, 64 );
+    for ( uint32_t i=0; i<buckets; i++ ){
+        vtBuckets[i] = SG_VICTIM_NIL;
+    }
+    vtHead = vtTail = vtQueued = vtLive = vtPeak = 0;
+    vtQueries = vtHits = vtKept = vtRejected = vtSpills = vtKeptBytes = 0;
+    vtCompressNs = vtDecompressNs = 0;
+    vtOpen = true;
+
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSGVictimCache
+// Description  : Push every block held out to the second tier, log how much
+//                the tier held and gained against what it cost, and free it
+//
+// Inputs       : cacheQueries - lookups the cache above saw, for the gain
+// Outputs      : 0 if successful, -1 if failure
+
+int closeSGVictimCache( unsigned long cacheQueries ) {
+    if ( !vtOpen ){
+        return( 0 );
+    }
+    pthread_mutex_lock( &vtLock );
+    uint32_t live = vtLive;
+    while ( vtQueued > 0 ){
+        sgVictimPop();
+    }
+
+    // Effective capacity: blocks the ring holds at the average kept size
+    double ratio = vtKeptBytes ? (double)vtKept*SG_BLOCK_SIZE/vtKeptBytes : 0;
+    logMessage( LOG_INFO_LEVEL, "[Cache] Victim tier: %u bytes, held %u blocks (peak %u, %u uncompressed), "
+                "ratio %.2fx, queries: %lu, hits: %lu, hit rate gain: %.2f%%, kept: %lu, rejected: %lu, "
+                "spilled: %lu, compress: %.0f ns/block, decompress: %.0f ns/hit",
+                vtRingBytes, live, vtPeak, vtRingBytes/SG_BLOCK_SIZE, ratio, vtQueries, vtHits,
+                cacheQueries ? (double)vtHits*100/cacheQueries : 0.0, vtKept, vtRejected, vtSpills,
+                (vtKept+vtRejected) ? (double)vtCompressNs/(vtKept+vtRejected) : 0.0,
+                vtHits ? (double)vtDecompressNs/vtHits : 0.0 );
+    closeSGArena( &vtArena );
+    vtOpen = false;
+    pthread_mutex_unlock( &vtLock );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgVictimActive
+// Description  : Check whether the victim tier is open
+//
+// Inputs       : none
+// Outputs      : true if open
+
+bool sgVictimActive( void ) {
+    return( vtOpen );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getSGVictimBlock
+// Description  : Take a block out of the tier, expanding it
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+//                block - where to put it
+// Outputs      : 0 if found, -1 if not
+
+int getSGVictimBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    int ret = -1;
+
+    if ( !vtOpen ){
+        return( -1 );
+    }
+    pthread_mutex_lock( &vtLock );
+    vtQueries += 1;
+    int32_t i = sgVictimFind( nde, blk );
+    if ( i != SG_VICTIM_NIL ){
+        uint64_t start = sgVictimNow();
+        if ( sgLzDecompress(vtRing + vtEntries[i].off, vtEntries[i].len, block, SG_BLOCK_SIZE) == SG_BLOCK_SIZE ){
+            vtHits += 1;
+            ret = 0;
+        } else {
+            logMessage( LOG_ERROR_LEVEL, "getSGVictimBlock: blk [%lu] failed to expand, dropping it.", blk );
+        }
+        vtDecompressNs += sgVictimNow() - start;
+        sgVictimUnhash( i );
+    }
+    pthread_mutex_unlock( &vtLock );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : putSGVictimBlock
+// Description  : Compress a block into the tier, pushing out the oldest
+//                blocks as needed
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+//                block - the block
+// Outputs      : 0 if kept, -1 if not (it compresses too poorly)
+
+int putSGVictimBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
+    char packed[SG_VICTIM_MAX_STORED];
+
+    if ( !vtOpen ){
+        return( -1 );
+    }
+    uint64_t start = sgVictimNow();
+    int n = sgLzCompress( block, SG_BLOCK_SIZE, packed, sizeof(packed) );
+    uint64_t took = sgVictimNow() - start;
+
+    pthread_mutex_lock( &vtLock );
+    vtCompressNs += took;
+    if ( n < 0 ){
+        vtRejected += 1;
+        pthread_mutex_unlock( &vtLock );
+        return( -1 );
+    }
+    int32_t i = sgVictimFind( nde, blk );
+    if ( i != SG_VICTIM_NIL ){
+        sgVictimUnhash( i );
+    }
+
+    uint32_t len = (n + SG_VICTIM_GRANULE-1) & ~(uint32_t)(SG_VICTIM_GRANULE-1);
+    sgVictimMakeRoom( len );
+    i = (vtTail + vtQueued) % vtEntryLimit;
+    SG_victim_entry * e = vtEntries + i;
+    e->node_ID = nde;
+    e->blk_ID = blk;
+    e->off = vtHead;
+    e->len = n;
+    memcpy( vtRing + vtHead, packed, n );
+    vtHead += len;
+    vtQueued += 1;
+
+    uint32_t b = sgVictimBucket( nde, blk );
+    e->hnext = vtBuckets[b];
+    vtBuckets[b] = i;
+    vtLive += 1;
+    vtPeak = ( vtLive > vtPeak ) ? vtLive : vtPeak;
+    vtKept += 1;
+    vtKeptBytes += len;
+    pthread_mutex_unlock( &vtLock );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropSGVictimBlock
+// Description  : Forget the tier copy of a block, its bytes are reclaimed
+//                when the ring comes round to them
+//
+// Inputs       : nde - node ID of the block
+//                blk - block ID of the block
+// Outputs      : 0 if successful (or not there), -1 if failure
+
+int dropSGVictimBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+    if ( !vtOpen ){
+        return( 0 );
+    }
+    pthread_mutex_lock( &vtLock );
+    int32_t i = sgVictimFind( nde, blk );
+    if ( i != SG_VICTIM_NIL ){
+        sgVictimUnhash( i );
+    }
+    pthread_mutex_unlock( &vtLock );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgVictimUnitTest
+// Description  : Push half-text blocks through a tier the size of 16 plain
+//                blocks, with a second tier behind it, and check it holds
+//                more than 16 of them and that every block comes back from
+//                one tier or the other
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int sgVictimUnitTest( void ) {
+    char path[] = "/tmp/sg_victim_unit_XXXXXX";
+    char block[SG_BLOCK_SIZE], out[SG_BLOCK_SIZE];
+    int fd, held = 0, lost = 0, i, j;
+
+    if ( (fd = mkstemp(path)) < 0 ){
+        return( -1 );
+    }
+    close( fd );
+    if ( openSGL2Cache(path, 256) || openSGVictimCache(16*SG_BLOCK_SIZE) ){
+        closeSGL2Cache();
+        unlink( path );
+        return( -1 );
+    }
+    for ( i=1; i<=200; i++ ){
+        unsigned int seed = i;
+        memset( block, 0, SG_BLOCK_SIZE );
+        for ( j=0; j<SG_BLOCK_SIZE/2; j++ ){
+            block[j] = ' ' + rand_r(&seed)%95;
+        }
+        lost += ( putSGVictimBlock(1, i, block) != 0 );
+    }
+    for ( i=1; i<=200; i++ ){
+        unsigned int seed = i;
+        memset( block, 0, SG_BLOCK_SIZE );
+        for ( j=0; j<SG_BLOCK_SIZE/2; j++ ){
+            block[j] = ' ' + rand_r(&seed)%95;
+        }
+        if ( getSGVictimBlock(1, i, out) == 0 ){
+            held += 1;
+            lost += ( memcmp(block, out, SG_BLOCK_SIZE) != 0 || getSGVictimBlock(1, i, out) == 0 );
+        } else {
+            lost += ( getSGL2Block(1, i, out) != 0 || memcmp(block, out, SG_BLOCK_SIZE) != 0 );
+        }
+    }
+
+    // Changed blocks are forgotten, incompressible ones refused
+    memset( block, 7, SG_BLOCK_SIZE );
+    putSGVictimBlock( 1, 300, block );
+    dropSGVictimBlock( 1, 300 );
+    lost += ( getSGVictimBlock(1, 300, out) == 0 );
+    for ( j=0; j<SG_BLOCK_SIZE; j++ ){
+        block[j] = (char)rand();
+    }
+    lost += ( putSGVictimBlock(1, 301, block) == 0 );
+
+    closeSGVictimCache( 0 );
+    closeSGL2Cache();
+    unlink( path );
+    if ( held <= 16 || lost ){
+        logMessage( LOG_ERROR_LEVEL, "sgVictimUnitTest: tier held [%d] blocks, expected over 16, [%d] lost or wrong.",
+                    held, lost );
+        return( -1 );
+    }
+
+    // Return successfully
+    logMessage( LOG_INFO_LEVEL, "sgVictimUnitTest: victim tier unit tests completed successfully." );
+    return( 0 );
+}
+
+//
+// Support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgVictimBucket / sgVictimFind / sgVictimUnhash
+// Description  : Index of the blocks held by (node, block) (lock held);
+//                unhashing leaves the entry's bytes for the ring to reclaim
+//
+// Inputs       : nde, blk - the block (bucket, find)
+//                i - the entry (unhash)
+// Outputs      : the bucket, the entry or SG_VICTIM_NIL (find)
+
+static uint32_t sgVictimBucket( SG_Node_ID nde, SG_Block_ID blk ) {
+    uint64_t h = nde * 0x9e3779b97f4a7c15ULL ^ blk;
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return( (uint32_t)h & vtBucketMask );
+}
+
+static int32_t sgVictimFind( SG_Node_ID nde, SG_Block_ID blk ) {
+    for ( int32_t i=vtBuckets[sgVictimBucket(nde, blk)]; i!=SG_VICTIM_NIL; i=vtEntries[i].hnext ){
+        if ( vtEntries[i].node_ID == nde && vtEntries[i].blk_ID == blk ){
+            return( i );
+        }
+    }
+    return( SG_VICTIM_NIL );
+}
+
+static void sgVictimUnhash( int32_t i ) {
+    int32_t * link = &vtBuckets[sgVictimBucket(vtEntries[i].node_ID, vtEntries[i].blk_ID)];
+    while ( *link != i ){
+        link = &vtEntries[*link].hnext;
+    }
+    *link = vtEntries[i].hnext;
+    vtEntries[i].node_ID = 0;
+    vtEntries[i].blk_ID = 0;
+    vtLive -= 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgVictimMakeRoom
+// Description  : Pop the oldest entries until len bytes are free at the
+//                head of the ring (wrapping it to the start if the end is
+//                too short) and an index entry is free.  The entries hold
+//                the ring from the tail's offset round to the head.
+//
+// Inputs       : len - bytes needed
+// Outputs      : none
+
+static void sgVictimMakeRoom( uint32_t len ) {
+    for ( ;; ){
+        if ( vtQueued == 0 ){
+            vtHead = 0;
+            return;
+        }
+        if ( vtQueued < vtEntryLimit ){
+            uint32_t tail = vtEntries[vtTail].off;
+            if ( tail > vtHead && tail-vtHead >= len ){
+                return;
+            }
+            if ( tail < vtHead ){
+                if ( vtRingBytes-vtHead >= len ){
+                    return;
+                }
+                if ( tail >= len ){
+                    vtHead = 0;
+                    return;
+                }
+            }
+        }
+        sgVictimPop();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgVictimPop
+// Description  : Retire the oldest entry, spilling its block to the second
+//                tier if it is still held
+//
+// Inputs       : none
+// Outputs      : none
+
+static void sgVictimPop( void ) {
+    SG_victim_entry * e = vtEntries + vtTail;
+    char block[SG_BLOCK_SIZE];
+
+    if ( e->node_ID != 0 || e->blk_ID != 0 ){
+        if ( sgL2Active() && sgLzDecompress(vtRing + e->off, e->len, block, SG_BLOCK_SIZE) == SG_BLOCK_SIZE ){
+            putSGL2Block( e->node_ID, e->blk_ID, block );
+        }
+        vtSpills += 1;
+        sgVictimUnhash( vtTail );
+    }
+    vtTail = (vtTail+1) % vtEntryLimit;
+    vtQueued -= 1;
+    if ( vtQueued == 0 ){
+        vtHead = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgVictimNow
+// Description  : Monotonic time, for the compression costs
+//
+// Inputs       : none
+// Outputs      : nanoseconds
+
+static uint64_t sgVictimNow( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec );
+}
@@ -0,0 +1,48 @@
+#ifndef SG_VICTIM_INCLUDED
+#define SG_VICTIM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_victim.h
+//  Description    : This is the declaration of the compressed victim tier,
+//                   the in-memory store of blocks evicted from the cache.
+//
+//   Author        : Yao Xu
+//   Last Modified :
+//
+
+// Includes
+#include <stdbool.h>
+#include <sg_defs.h>
+
+//
+// Defines
+#define SG_VICTIM_GRANULE 32                        // stored blocks are rounded up to this
+#define SG_VICTIM_MAX_STORED (SG_BLOCK_SIZE*15/16)  // blocks compressing worse are not kept
+#define SG_VICTIM_MAX_RATIO 8                       // index room: blocks per uncompressed block
+
+//
+// Victim tier functions
+
+int openSGVictimCache( size_t bytes );
+    // Set aside bytes of memory for compressed blocks
+
+int closeSGVictimCache( unsigned long cacheQueries );
+    // Spill the blocks held to the second tier and log the stats
+
+bool sgVictimActive( void );
+    // Is the victim tier open
+
+int getSGVictimBlock( SG_Node_ID nde, SG_Block_ID blk, char *block );
+    // Take a block out of the tier, 0 if found
+
+int putSGVictimBlock( SG_Node_ID nde, SG_Block_ID blk, char *block );
+    // Compress a clean evicted block into the tier, 0 if kept
+
+int dropSGVictimBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Forget the tier copy of a block that changed
+
+int sgVictimUnitTest( void );
+    // Run the victim tier unit tests
+
+#endif